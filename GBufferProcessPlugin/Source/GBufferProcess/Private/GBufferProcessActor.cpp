@@ -1,14 +1,198 @@
 #include "GBufferProcessActor.h"
 #include "GBufferProcessSubsystem.h"
+#include "GBufferProcessRegionProxy.h"
+#include "GBufferProcessPipelineCache.h"
+#include "GBufferProcessMaterial.h"
+#include "GBufferProcessBakedRegionsActor.h"
+#include "Components/SceneComponent.h"
+#include "Engine/World.h"
+#include "Materials/MaterialInterface.h"
 #include "Engine/Classes/Components/MeshComponent.h"
 #include "CoreMinimal.h"
 #include "UObject/ConstructorHelpers.h"
 
+namespace
+{
+	UGBufferProcessSubsystem* GetRegionSubsystem(const AActor* InActor)
+	{
+		UWorld* World = InActor->GetWorld();
+		return World ? World->GetSubsystem<UGBufferProcessSubsystem>() : nullptr;
+	}
+}
+
 AGBufferProcessActor::AGBufferProcessActor(const FObjectInitializer& ObjectInitializer) : Super(ObjectInitializer)
 	, Type(EGBufferProcessType::Normal)
+	, BlendOp(EGBufferProcessBlendOp::Replace)
+	, Stage(EGBufferProcessStage::PostBasePass)
 	, Priority(0)
 	, Intensity(1.0)
+	, Material(nullptr)
+	, Shape(EGBufferProcessShape::Unbound)
+	, Extent(100.0f, 100.0f, 100.0f)
+	, LowQualityMaterial(nullptr)
+	, bStatic(false)
+	, LastReadyMaterial(nullptr)
+	, LastReadyLowQualityMaterial(nullptr)
+{
+	RootComponent = ObjectInitializer.CreateDefaultSubobject<USceneComponent>(this, TEXT("Root"));
+}
+
+void AGBufferProcessActor::SetType(EGBufferProcessType InType)
+{
+	if (Type != InType)
+	{
+		Type = InType;
+		MarkRegionDirty(EGBufferProcessRegionDirtyFlags::Kernel);
+	}
+}
+
+void AGBufferProcessActor::SetBlendOp(EGBufferProcessBlendOp InBlendOp)
+{
+	if (BlendOp != InBlendOp)
+	{
+		BlendOp = InBlendOp;
+		MarkRegionDirty(EGBufferProcessRegionDirtyFlags::Kernel);
+	}
+}
+
+void AGBufferProcessActor::SetStage(EGBufferProcessStage InStage)
+{
+	if (Stage != InStage)
+	{
+		Stage = InStage;
+		MarkRegionDirty(EGBufferProcessRegionDirtyFlags::Kernel);
+	}
+}
+
+void AGBufferProcessActor::SetPriority(int32 InPriority)
+{
+	if (Priority != InPriority)
+	{
+		Priority = InPriority;
+		MarkRegionDirty(EGBufferProcessRegionDirtyFlags::Priority);
+	}
+}
+
+void AGBufferProcessActor::SetIntensity(float InIntensity)
+{
+	if (Intensity != InIntensity)
+	{
+		Intensity = InIntensity;
+		MarkRegionDirty(EGBufferProcessRegionDirtyFlags::Intensity);
+	}
+}
+
+void AGBufferProcessActor::SetEnabled(float InEnabled)
+{
+	if (Enabled != InEnabled)
+	{
+		Enabled = InEnabled;
+		MarkRegionDirty(EGBufferProcessRegionDirtyFlags::Enabled);
+	}
+}
+
+void AGBufferProcessActor::SetShape(EGBufferProcessShape InShape)
+{
+	if (Shape != InShape)
+	{
+		Shape = InShape;
+		MarkRegionDirty(EGBufferProcessRegionDirtyFlags::Transform);
+	}
+}
+
+void AGBufferProcessActor::SetExtent(FVector InExtent)
+{
+	if (Extent != InExtent)
+	{
+		Extent = InExtent;
+		MarkRegionDirty(EGBufferProcessRegionDirtyFlags::Transform);
+	}
+}
+
+void AGBufferProcessActor::SetMaterial(UMaterialInterface* InMaterial)
+{
+	if (Material != InMaterial)
+	{
+		Material = InMaterial;
+		MarkRegionDirty(EGBufferProcessRegionDirtyFlags::Material);
+	}
+}
+
+void AGBufferProcessActor::MarkRegionDirty(EGBufferProcessRegionDirtyFlags InFlags)
+{
+	UGBufferProcessSubsystem* GBufferProcessSubsystem = GetRegionSubsystem(this);
+	if (GBufferProcessSubsystem)
+	{
+		GBufferProcessSubsystem->MarkRegionDirty(this, InFlags);
+	}
+}
+
+void AGBufferProcessActor::PostRegisterAllComponents()
+{
+	Super::PostRegisterAllComponents();
+
+	if (RootComponent)
+	{
+		RootComponent->TransformUpdated.AddUObject(this, &AGBufferProcessActor::OnRootTransformUpdated);
+	}
+}
+
+void AGBufferProcessActor::PostUnregisterAllComponents()
+{
+	if (RootComponent)
+	{
+		RootComponent->TransformUpdated.RemoveAll(this);
+	}
+
+	Super::PostUnregisterAllComponents();
+}
+
+void AGBufferProcessActor::OnRootTransformUpdated(USceneComponent* InRootComponent, EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport)
+{
+	MarkRegionDirty(EGBufferProcessRegionDirtyFlags::Transform);
+}
+
+FBox AGBufferProcessActor::GetRegionBounds() const
+{
+	switch (Shape)
+	{
+	case EGBufferProcessShape::Box:
+		return FBox(-Extent, Extent).TransformBy(GetActorTransform());
+	case EGBufferProcessShape::Sphere:
+		return FBox(FVector(-Extent.X), FVector(Extent.X)).TransformBy(GetActorTransform());
+	default:
+		return FBox(ForceInit);
+	}
+}
+
+void AGBufferProcessActor::GetRegionProxy(ERHIFeatureLevel::Type InFeatureLevel, FGBufferProcessRegionProxy& OutProxy)
 {
+	const FGBufferProcessRegionKernel& Kernel = GBufferProcess::GetRegionKernel(Type, BlendOp);
+	UMaterialInterface* RenderMaterial = FGBufferProcessPipelinePrecacher::GetReadyMaterial(Material, LastReadyMaterial, InFeatureLevel, Kernel);
+	UMaterialInterface* RenderLowQualityMaterial = FGBufferProcessPipelinePrecacher::GetReadyMaterial(LowQualityMaterial, LastReadyLowQualityMaterial, InFeatureLevel, Kernel);
+
+	OutProxy.RegionId = GetUniqueID();
+	OutProxy.LocalToWorld = GetActorTransform().ToMatrixWithScale();
+	OutProxy.WorldBounds = GetRegionBounds();
+	OutProxy.Extent = Extent;
+	OutProxy.Shape = Shape;
+	OutProxy.Type = Type;
+	OutProxy.BlendOp = BlendOp;
+	OutProxy.Stage = Stage;
+	OutProxy.Priority = Priority;
+	OutProxy.Intensity = Intensity;
+	OutProxy.MaterialProxy = RenderMaterial ? RenderMaterial->GetRenderProxy() : nullptr;
+	OutProxy.LowQualityMaterialProxy = RenderLowQualityMaterial ? RenderLowQualityMaterial->GetRenderProxy() : nullptr;
+}
+
+bool AGBufferProcessActor::IsEditorOnly() const
+{
+#if WITH_EDITORONLY_DATA
+	// Only stripped when the level has baked regions to replace them. The baked regions actor bakes the level before it is saved.
+	return Super::IsEditorOnly() || (bStatic && BakedRegionsActor.IsValid() && BakedRegionsActor->GetLevel() == GetLevel());
+#else
+	return Super::IsEditorOnly();
+#endif
 }
 
 void AGBufferProcessActor::BeginPlay()
@@ -22,6 +206,13 @@ void AGBufferProcessActor::BeginPlay()
 
 void AGBufferProcessActor::EndPlay(const EEndPlayReason::Type EndPlayReason)
 {
+	// Regions of a streamed-out level are removed in one batch by UGBufferProcessSubsystem::OnLevelRemovedFromWorld.
+	// Anything else, like a level without streaming, may destroy the actor before that, so it is removed right away.
+	if (EndPlayReason == EEndPlayReason::RemovedFromWorld && UGBufferProcessSubsystem::IsLevelPendingBatchUnregistration(GetLevel()))
+	{
+		return;
+	}
+
 	UGBufferProcessSubsystem* GBufferProcessSubsystem = static_cast<UGBufferProcessSubsystem*>(this->GetWorld()->GetSubsystemBase(UGBufferProcessSubsystem::StaticClass()));
 	if (GBufferProcessSubsystem)
 	{
@@ -35,14 +226,45 @@ void AGBufferProcessActor::PostEditChangeProperty(struct FPropertyChangedEvent&
 	Super::PostEditChangeProperty(PropertyChangedEvent);
 
 	const FName PropertyName = PropertyChangedEvent.GetPropertyName();
+	EGBufferProcessRegionDirtyFlags DirtyFlags = EGBufferProcessRegionDirtyFlags::None;
 	if (PropertyName == GET_MEMBER_NAME_CHECKED(AGBufferProcessActor, Priority))
 	{
-		UGBufferProcessSubsystem* GBufferProcessSubsystem = static_cast<UGBufferProcessSubsystem*>(this->GetWorld()->GetSubsystemBase(UGBufferProcessSubsystem::StaticClass()));
-		if (GBufferProcessSubsystem)
-		{
-			GBufferProcessSubsystem->SortRegionsByPriority();
-		}
+		DirtyFlags = EGBufferProcessRegionDirtyFlags::Priority;
+	}
+	else if (PropertyName == GET_MEMBER_NAME_CHECKED(AGBufferProcessActor, Material) || PropertyName == GET_MEMBER_NAME_CHECKED(AGBufferProcessActor, LowQualityMaterial))
+	{
+		DirtyFlags = EGBufferProcessRegionDirtyFlags::Material;
+	}
+	else if (PropertyName == GET_MEMBER_NAME_CHECKED(AGBufferProcessActor, Type) || PropertyName == GET_MEMBER_NAME_CHECKED(AGBufferProcessActor, BlendOp)
+		|| PropertyName == GET_MEMBER_NAME_CHECKED(AGBufferProcessActor, Stage))
+	{
+		DirtyFlags = EGBufferProcessRegionDirtyFlags::Kernel;
+	}
+	else if (PropertyName == GET_MEMBER_NAME_CHECKED(AGBufferProcessActor, Intensity))
+	{
+		DirtyFlags = EGBufferProcessRegionDirtyFlags::Intensity;
+	}
+	else if (PropertyName == GET_MEMBER_NAME_CHECKED(AGBufferProcessActor, Enabled))
+	{
+		DirtyFlags = EGBufferProcessRegionDirtyFlags::Enabled;
+	}
+	else if (PropertyName == GET_MEMBER_NAME_CHECKED(AGBufferProcessActor, Shape) || PropertyName == GET_MEMBER_NAME_CHECKED(AGBufferProcessActor, Extent))
+	{
+		DirtyFlags = EGBufferProcessRegionDirtyFlags::Transform;
+	}
+	else if (PropertyName == GET_MEMBER_NAME_CHECKED(AGBufferProcessActor, bStatic) && bStatic)
+	{
+		AGBufferProcessBakedRegionsActor::FindOrSpawnInLevel(GetLevel());
+	}
+	else if (PropertyName == NAME_None)
+	{
+		// Changes without a property, like resetting the actor to its defaults.
+		DirtyFlags = EGBufferProcessRegionDirtyFlags::All;
+	}
+
+	if (DirtyFlags != EGBufferProcessRegionDirtyFlags::None)
+	{
+		MarkRegionDirty(DirtyFlags);
 	}
 }
 #endif //WITH_EDITOR
-
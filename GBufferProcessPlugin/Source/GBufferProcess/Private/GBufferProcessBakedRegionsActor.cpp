@@ -0,0 +1,104 @@
+#include "GBufferProcessBakedRegionsActor.h"
+#include "GBufferProcessRegionDataAsset.h"
+#include "GBufferProcessSubsystem.h"
+#include "GBufferProcessActor.h"
+#include "Components/SceneComponent.h"
+#include "Engine/Level.h"
+#include "Engine/World.h"
+
+AGBufferProcessBakedRegionsActor::AGBufferProcessBakedRegionsActor(const FObjectInitializer& ObjectInitializer) : Super(ObjectInitializer)
+{
+	RootComponent = ObjectInitializer.CreateDefaultSubobject<USceneComponent>(this, TEXT("Root"));
+	RegionData = ObjectInitializer.CreateDefaultSubobject<UGBufferProcessRegionDataAsset>(this, TEXT("RegionData"));
+}
+
+AGBufferProcessBakedRegionsActor* AGBufferProcessBakedRegionsActor::FindInLevel(const ULevel* InLevel)
+{
+	if (!InLevel)
+	{
+		return nullptr;
+	}
+
+	for (AActor* Actor : InLevel->Actors)
+	{
+		AGBufferProcessBakedRegionsActor* AsBakedRegions = Cast<AGBufferProcessBakedRegionsActor>(Actor);
+		if (IsValid(AsBakedRegions))
+		{
+			return AsBakedRegions;
+		}
+	}
+	return nullptr;
+}
+
+bool AGBufferProcessBakedRegionsActor::UsesBakedRegions()
+{
+	// Static regions are editor only actors, they are only missing in cooked data.
+	return FPlatformProperties::RequiresCookedData();
+}
+
+#if WITH_EDITOR
+AGBufferProcessBakedRegionsActor* AGBufferProcessBakedRegionsActor::FindOrSpawnInLevel(ULevel* InLevel)
+{
+	AGBufferProcessBakedRegionsActor* BakedRegions = FindInLevel(InLevel);
+	UWorld* World = InLevel ? InLevel->GetWorld() : nullptr;
+	if (!BakedRegions && World)
+	{
+		FActorSpawnParameters SpawnParameters;
+		SpawnParameters.OverrideLevel = InLevel;
+		BakedRegions = World->SpawnActor<AGBufferProcessBakedRegionsActor>(SpawnParameters);
+	}
+	return BakedRegions;
+}
+
+void AGBufferProcessBakedRegionsActor::BakeRegions()
+{
+	ULevel* Level = GetLevel();
+	if (!Level || !RegionData)
+	{
+		return;
+	}
+
+	TArray<const AGBufferProcessActor*> StaticRegions;
+	for (AActor* Actor : Level->Actors)
+	{
+		AGBufferProcessActor* AsRegion = Cast<AGBufferProcessActor>(Actor);
+		if (IsValid(AsRegion) && AsRegion->bStatic)
+		{
+			AsRegion->BakedRegionsActor = this;
+			StaticRegions.Add(AsRegion);
+		}
+	}
+
+	RegionData->BakeRegions(StaticRegions);
+}
+
+void AGBufferProcessBakedRegionsActor::PreSave(const ITargetPlatform* TargetPlatform)
+{
+	Super::PreSave(TargetPlatform);
+
+	// Cooking saves the level too, so the cooked blob always matches the static regions that are stripped.
+	BakeRegions();
+}
+#endif
+
+void AGBufferProcessBakedRegionsActor::BeginPlay()
+{
+	Super::BeginPlay();
+
+	UGBufferProcessSubsystem* GBufferProcessSubsystem = GetWorld()->GetSubsystem<UGBufferProcessSubsystem>();
+	if (GBufferProcessSubsystem && UsesBakedRegions())
+	{
+		GBufferProcessSubsystem->RegisterBakedRegions(RegionData);
+	}
+}
+
+void AGBufferProcessBakedRegionsActor::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	UGBufferProcessSubsystem* GBufferProcessSubsystem = GetWorld()->GetSubsystem<UGBufferProcessSubsystem>();
+	if (GBufferProcessSubsystem)
+	{
+		GBufferProcessSubsystem->UnregisterBakedRegions(RegionData);
+	}
+
+	Super::EndPlay(EndPlayReason);
+}
@@ -0,0 +1,350 @@
+#include "GBufferProcessClusters.h"
+#include "GBufferProcessPlugin.h"
+#include "GBufferProcessVolumeProxy.h"
+#include "RenderGraphBuilder.h"
+#include "RenderGraphUtils.h"
+#include "SceneRendering.h"
+#include "Stats/Stats.h"
+
+IMPLEMENT_GLOBAL_SHADER_PARAMETER_STRUCT(FGBufferProcessClusterParameters, "GBufferProcessClusters");
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Clustered regions"), STAT_GBufferProcess_ClusteredRegions, STATGROUP_GBufferProcess);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Cluster region references"), STAT_GBufferProcess_ClusterRegionReferences, STATGROUP_GBufferProcess);
+DECLARE_CYCLE_STAT(TEXT("Build region clusters"), STAT_GBufferProcess_BuildRegionClusters, STATGROUP_GBufferProcess);
+
+static TAutoConsoleVariable<int32> CVarGBufferProcessClustered(
+	TEXT("r.GBufferProcess.Clustered"),
+	0,
+	TEXT("Bin regions into a grid of screen tiles and depth slices, like the forward light grid. Consecutive regions with the same\n")
+	TEXT("material and kernel are drawn at once, each pixel walks the regions of its cluster and tests its scene position against their shape.\n")
+	TEXT("Regions that decode their target, or are drawn inside the base pass render pass, are still drawn one by one.\n")
+	TEXT("GPU culling is not used while this is on.\n")
+	TEXT("0: off (default)\n")
+	TEXT("1: on, for scenes with many overlapping regions"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarGBufferProcessClusteredTileSize(
+	TEXT("r.GBufferProcess.Clustered.TileSize"),
+	64,
+	TEXT("Size of the cluster tiles in pixels."),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarGBufferProcessClusteredNumSlices(
+	TEXT("r.GBufferProcess.Clustered.NumSlices"),
+	32,
+	TEXT("Number of depth slices of the cluster grid, distributed exponentially up to the farthest bounded region."),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarGBufferProcessClusteredValidate(
+	TEXT("r.GBufferProcess.Clustered.Validate"),
+	0,
+	TEXT("Rebuild the cluster lists by testing every region against every cluster, and log the views where they differ from the binned ones. Slow."),
+	ECVF_RenderThreadSafe);
+
+namespace
+{
+	// Must match CLUSTER_REGION_STRIDE in GBufferProcessClusters.ush.
+	const int32 ClusterRegionStride = 4;
+
+	// Region depth ranges are widened by this fraction, the slices of the GPU are computed with less precise log2.
+	const float ClusterDepthPadding = 0.01f;
+
+	bool IsBinned(const FGBufferProcessClusterRegion& Region)
+	{
+		return Region.Rect.Width() > 0 && Region.Rect.Height() > 0 && Region.MinZ <= Region.MaxZ;
+	}
+
+	/** Tiles and slices a region overlaps, inclusive. */
+	void GetClusterRange(const FGBufferProcessClusterGrid& Grid, const FGBufferProcessClusterRegion& Region, FIntVector& OutMin, FIntVector& OutMax)
+	{
+		OutMin.X = FMath::Clamp(Region.Rect.Min.X / Grid.TileSize, 0, Grid.GridSize.X - 1);
+		OutMin.Y = FMath::Clamp(Region.Rect.Min.Y / Grid.TileSize, 0, Grid.GridSize.Y - 1);
+		OutMin.Z = Grid.GetSlice(Region.MinZ);
+		OutMax.X = FMath::Clamp((Region.Rect.Max.X - 1) / Grid.TileSize, 0, Grid.GridSize.X - 1);
+		OutMax.Y = FMath::Clamp((Region.Rect.Max.Y - 1) / Grid.TileSize, 0, Grid.GridSize.Y - 1);
+		OutMax.Z = Grid.GetSlice(Region.MaxZ);
+	}
+
+	/** Column-wise translated world to unit shape transform, shape and intensity of a region, see GetClusteredRegions in GBufferProcessClusters.ush. */
+	void GetClusterRegionData(const FSceneView& View, const FGBufferProcessRegionProxy& Region, FVector4 OutData[ClusterRegionStride])
+	{
+		FMatrix TranslatedWorldToUnit = FMatrix::Identity;
+		if (Region.Shape == EGBufferProcessShape::Box || Region.Shape == EGBufferProcessShape::Sphere)
+		{
+			TranslatedWorldToUnit = GBufferProcess::GetVolumeToTranslatedWorld(View, Region).Inverse();
+		}
+
+		for (int32 Column = 0; Column < 3; ++Column)
+		{
+			OutData[Column] = FVector4(TranslatedWorldToUnit.M[0][Column], TranslatedWorldToUnit.M[1][Column], TranslatedWorldToUnit.M[2][Column], TranslatedWorldToUnit.M[3][Column]);
+		}
+		OutData[3] = FVector4(Region.Intensity, (float)Region.Shape, 0.0f, 0.0f);
+	}
+}
+
+FGBufferProcessClusterGrid::FGBufferProcessClusterGrid(FIntPoint ViewSize, int32 InTileSize, int32 NumSlices, float InNearZ, float InFarZ)
+{
+	TileSize = FMath::Max(InTileSize, 1);
+	GridSize = FIntVector(
+		FMath::Max(FMath::DivideAndRoundUp(ViewSize.X, TileSize), 1),
+		FMath::Max(FMath::DivideAndRoundUp(ViewSize.Y, TileSize), 1),
+		FMath::Max(NumSlices, 1));
+	NearZ = FMath::Max(InNearZ, KINDA_SMALL_NUMBER);
+	const float FarZ = FMath::Max(InFarZ, NearZ * 2.0f);
+	SliceScale = GridSize.Z / FMath::Log2(FarZ / NearZ);
+}
+
+int32 FGBufferProcessClusterGrid::GetSlice(float ViewZ) const
+{
+	int32 Slice = FMath::Clamp(FMath::FloorToInt(FMath::Log2(FMath::Max(ViewZ / NearZ, 1.0f)) * SliceScale), 0, GridSize.Z - 1);
+
+	// Snap to the slice bounds of GetSliceMinZ, so that binning and its reference agree on depths at a boundary.
+	while (Slice + 1 < GridSize.Z && ViewZ >= GetSliceMinZ(Slice + 1))
+	{
+		++Slice;
+	}
+	while (Slice > 0 && ViewZ < GetSliceMinZ(Slice))
+	{
+		--Slice;
+	}
+	return Slice;
+}
+
+float FGBufferProcessClusterGrid::GetSliceMinZ(int32 Slice) const
+{
+	return Slice <= 0 ? 0.0f : NearZ * FMath::Pow(2.0f, Slice / SliceScale);
+}
+
+namespace GBufferProcess
+{
+	bool IsClusteredEnabled()
+	{
+		return CVarGBufferProcessClustered.GetValueOnRenderThread() != 0;
+	}
+
+	void BuildRegionClusters(const FGBufferProcessClusterGrid& Grid, TArrayView<const FGBufferProcessClusterRegion> Regions, FGBufferProcessRegionClusters& OutClusters)
+	{
+		const int32 NumClusters = Grid.GetNumClusters();
+		OutClusters.OffsetsAndCounts.Reset(NumClusters * 2);
+		OutClusters.OffsetsAndCounts.AddZeroed(NumClusters * 2);
+		OutClusters.RegionIndices.Reset();
+
+		// Step 1 : count the regions of each cluster.
+		for (const FGBufferProcessClusterRegion& Region : Regions)
+		{
+			if (!IsBinned(Region))
+			{
+				continue;
+			}
+
+			FIntVector Min, Max;
+			GetClusterRange(Grid, Region, Min, Max);
+			for (int32 Z = Min.Z; Z <= Max.Z; ++Z)
+			{
+				for (int32 Y = Min.Y; Y <= Max.Y; ++Y)
+				{
+					for (int32 X = Min.X; X <= Max.X; ++X)
+					{
+						++OutClusters.OffsetsAndCounts[Grid.GetClusterIndex(X, Y, Z) * 2 + 1];
+					}
+				}
+			}
+		}
+
+		// Step 2 : prefix sum into offsets, the counts are refilled by the next step.
+		uint32 NumReferences = 0;
+		for (int32 ClusterIndex = 0; ClusterIndex < NumClusters; ++ClusterIndex)
+		{
+			OutClusters.OffsetsAndCounts[ClusterIndex * 2] = NumReferences;
+			NumReferences += OutClusters.OffsetsAndCounts[ClusterIndex * 2 + 1];
+			OutClusters.OffsetsAndCounts[ClusterIndex * 2 + 1] = 0;
+		}
+		OutClusters.RegionIndices.SetNumUninitialized(NumReferences);
+
+		// Step 3 : regions are visited in index order, so every list comes out sorted.
+		for (int32 RegionIndex = 0; RegionIndex < Regions.Num(); ++RegionIndex)
+		{
+			const FGBufferProcessClusterRegion& Region = Regions[RegionIndex];
+			if (!IsBinned(Region))
+			{
+				continue;
+			}
+
+			FIntVector Min, Max;
+			GetClusterRange(Grid, Region, Min, Max);
+			for (int32 Z = Min.Z; Z <= Max.Z; ++Z)
+			{
+				for (int32 Y = Min.Y; Y <= Max.Y; ++Y)
+				{
+					for (int32 X = Min.X; X <= Max.X; ++X)
+					{
+						const int32 ClusterIndex = Grid.GetClusterIndex(X, Y, Z);
+						uint32& Count = OutClusters.OffsetsAndCounts[ClusterIndex * 2 + 1];
+						OutClusters.RegionIndices[OutClusters.OffsetsAndCounts[ClusterIndex * 2] + Count] = RegionIndex;
+						++Count;
+					}
+				}
+			}
+		}
+	}
+
+	void BuildRegionClustersReference(const FGBufferProcessClusterGrid& Grid, TArrayView<const FGBufferProcessClusterRegion> Regions, FGBufferProcessRegionClusters& OutClusters)
+	{
+		OutClusters.OffsetsAndCounts.Reset(Grid.GetNumClusters() * 2);
+		OutClusters.RegionIndices.Reset();
+
+		// Rects past the grid are clamped into its border tiles, like the binning does. A rect entirely past an edge keeps one pixel.
+		const FIntPoint GridExtent(Grid.GridSize.X * Grid.TileSize, Grid.GridSize.Y * Grid.TileSize);
+		TArray<FIntRect> ClampedRects;
+		ClampedRects.SetNum(Regions.Num());
+		for (int32 RegionIndex = 0; RegionIndex < Regions.Num(); ++RegionIndex)
+		{
+			const FIntRect& Rect = Regions[RegionIndex].Rect;
+			ClampedRects[RegionIndex] = FIntRect(
+				FMath::Clamp(Rect.Min.X, 0, GridExtent.X - 1),
+				FMath::Clamp(Rect.Min.Y, 0, GridExtent.Y - 1),
+				FMath::Clamp(Rect.Max.X, 1, GridExtent.X),
+				FMath::Clamp(Rect.Max.Y, 1, GridExtent.Y));
+		}
+
+		for (int32 Z = 0; Z < Grid.GridSize.Z; ++Z)
+		{
+			// The first and last slices extend to the camera and to infinity.
+			const float SliceMinZ = Z == 0 ? -MAX_flt : Grid.GetSliceMinZ(Z);
+			const float SliceMaxZ = Z == Grid.GridSize.Z - 1 ? MAX_flt : Grid.GetSliceMinZ(Z + 1);
+			for (int32 Y = 0; Y < Grid.GridSize.Y; ++Y)
+			{
+				for (int32 X = 0; X < Grid.GridSize.X; ++X)
+				{
+					const FIntRect TileRect(X * Grid.TileSize, Y * Grid.TileSize, (X + 1) * Grid.TileSize, (Y + 1) * Grid.TileSize);
+					const uint32 Offset = OutClusters.RegionIndices.Num();
+					for (int32 RegionIndex = 0; RegionIndex < Regions.Num(); ++RegionIndex)
+					{
+						const FGBufferProcessClusterRegion& Region = Regions[RegionIndex];
+						if (!IsBinned(Region))
+						{
+							continue;
+						}
+
+						const FIntRect& Rect = ClampedRects[RegionIndex];
+						const bool bOverlapsX = Rect.Min.X < TileRect.Max.X && Rect.Max.X > TileRect.Min.X;
+						const bool bOverlapsY = Rect.Min.Y < TileRect.Max.Y && Rect.Max.Y > TileRect.Min.Y;
+						const bool bOverlapsZ = Region.MinZ < SliceMaxZ && Region.MaxZ >= SliceMinZ;
+						if (bOverlapsX && bOverlapsY && bOverlapsZ)
+						{
+							OutClusters.RegionIndices.Add(RegionIndex);
+						}
+					}
+					OutClusters.OffsetsAndCounts.Add(Offset);
+					OutClusters.OffsetsAndCounts.Add(OutClusters.RegionIndices.Num() - Offset);
+				}
+			}
+		}
+	}
+
+	FGBufferProcessClusterRegion GetClusterRegion(const FSceneView& View, const FGBufferProcessRegionProxy& Region, const FIntRect& PixelRect)
+	{
+		FGBufferProcessClusterRegion ClusterRegion;
+		ClusterRegion.Rect = PixelRect - View.ViewRect.Min;
+
+		if (!Region.WorldBounds.IsValid)
+		{
+			// Unbound regions are in every slice.
+			ClusterRegion.MinZ = 0.0f;
+			ClusterRegion.MaxZ = MAX_flt;
+			return ClusterRegion;
+		}
+
+		const FMatrix& ViewMatrix = View.ViewMatrices.GetViewMatrix();
+		const FVector Center = Region.WorldBounds.GetCenter();
+		const FVector Extent = Region.WorldBounds.GetExtent();
+		ClusterRegion.MinZ = MAX_flt;
+		ClusterRegion.MaxZ = -MAX_flt;
+		for (int32 Corner = 0; Corner < 8; ++Corner)
+		{
+			const FVector CornerOffset((Corner & 1) ? Extent.X : -Extent.X, (Corner & 2) ? Extent.Y : -Extent.Y, (Corner & 4) ? Extent.Z : -Extent.Z);
+			const float ViewZ = ViewMatrix.TransformPosition(Center + CornerOffset).Z;
+			ClusterRegion.MinZ = FMath::Min(ClusterRegion.MinZ, ViewZ);
+			ClusterRegion.MaxZ = FMath::Max(ClusterRegion.MaxZ, ViewZ);
+		}
+		ClusterRegion.MinZ *= 1.0f - ClusterDepthPadding;
+		ClusterRegion.MaxZ *= 1.0f + ClusterDepthPadding;
+		return ClusterRegion;
+	}
+
+	TRDGUniformBufferRef<FGBufferProcessClusterParameters> CreateClusterUniformBuffer(
+		FRDGBuilder& GraphBuilder,
+		const FViewInfo& View,
+		TArrayView<const FGBufferProcessRegionProxy* const> Regions,
+		TArrayView<const FIntRect> Rects,
+		FRDGTextureRef SceneDepthTexture)
+	{
+		SCOPE_CYCLE_COUNTER(STAT_GBufferProcess_BuildRegionClusters);
+		check(Regions.Num() == Rects.Num());
+
+		TArray<FGBufferProcessClusterRegion> ClusterRegions;
+		TArray<FVector4> RegionData;
+		ClusterRegions.SetNum(Regions.Num());
+		RegionData.SetNumZeroed(FMath::Max(Regions.Num() * ClusterRegionStride, 1));
+
+		const float NearZ = View.NearClippingDistance;
+		float FarZ = NearZ;
+		for (int32 Slot = 0; Slot < Regions.Num(); ++Slot)
+		{
+			const FGBufferProcessRegionProxy* Region = Regions[Slot];
+			if (!Region)
+			{
+				continue;
+			}
+
+			GetClusterRegionData(View, *Region, &RegionData[Slot * ClusterRegionStride]);
+			ClusterRegions[Slot] = GetClusterRegion(View, *Region, Rects[Slot]);
+			if (Region->WorldBounds.IsValid)
+			{
+				FarZ = FMath::Max(FarZ, ClusterRegions[Slot].MaxZ);
+			}
+			INC_DWORD_STAT(STAT_GBufferProcess_ClusteredRegions);
+		}
+
+		const FGBufferProcessClusterGrid Grid(View.ViewRect.Size(), CVarGBufferProcessClusteredTileSize.GetValueOnRenderThread(), CVarGBufferProcessClusteredNumSlices.GetValueOnRenderThread(), NearZ, FarZ);
+
+		FGBufferProcessRegionClusters Clusters;
+		BuildRegionClusters(Grid, ClusterRegions, Clusters);
+		INC_DWORD_STAT_BY(STAT_GBufferProcess_ClusterRegionReferences, Clusters.RegionIndices.Num());
+
+		if (CVarGBufferProcessClusteredValidate.GetValueOnRenderThread() != 0)
+		{
+			FGBufferProcessRegionClusters ReferenceClusters;
+			BuildRegionClustersReference(Grid, ClusterRegions, ReferenceClusters);
+			if (!(Clusters == ReferenceClusters))
+			{
+				UE_LOG(GBufferProcessLog, Warning, TEXT("Binned region clusters differ from the reference: %d and %d region references for %d regions in %dx%dx%d clusters."),
+					Clusters.RegionIndices.Num(), ReferenceClusters.RegionIndices.Num(), Regions.Num(), Grid.GridSize.X, Grid.GridSize.Y, Grid.GridSize.Z);
+			}
+		}
+
+		// Buffers can't be empty.
+		if (Clusters.RegionIndices.Num() == 0)
+		{
+			Clusters.RegionIndices.Add(0);
+		}
+
+		FRDGBufferRef OffsetsAndCountsBuffer = CreateVertexBuffer(GraphBuilder, TEXT("GBufferProcessClusterOffsetsAndCounts"),
+			FRDGBufferDesc::CreateBufferDesc(sizeof(uint32), Clusters.OffsetsAndCounts.Num()), Clusters.OffsetsAndCounts.GetData(), Clusters.OffsetsAndCounts.Num() * sizeof(uint32));
+		FRDGBufferRef RegionIndicesBuffer = CreateVertexBuffer(GraphBuilder, TEXT("GBufferProcessClusterRegionIndices"),
+			FRDGBufferDesc::CreateBufferDesc(sizeof(uint32), Clusters.RegionIndices.Num()), Clusters.RegionIndices.GetData(), Clusters.RegionIndices.Num() * sizeof(uint32));
+		FRDGBufferRef RegionDataBuffer = CreateVertexBuffer(GraphBuilder, TEXT("GBufferProcessClusterRegionData"),
+			FRDGBufferDesc::CreateBufferDesc(sizeof(FVector4), RegionData.Num()), RegionData.GetData(), RegionData.Num() * sizeof(FVector4));
+
+		FGBufferProcessClusterParameters* Parameters = GraphBuilder.AllocParameters<FGBufferProcessClusterParameters>();
+		Parameters->GridSize = Grid.GridSize;
+		Parameters->TileSize = Grid.TileSize;
+		Parameters->NearZ = Grid.NearZ;
+		Parameters->SliceScale = Grid.SliceScale;
+		Parameters->ClusterOffsetsAndCounts = GraphBuilder.CreateSRV(OffsetsAndCountsBuffer, PF_R32G32_UINT);
+		Parameters->ClusterRegionIndices = GraphBuilder.CreateSRV(RegionIndicesBuffer, PF_R32_UINT);
+		Parameters->RegionData = GraphBuilder.CreateSRV(RegionDataBuffer, PF_A32B32G32R32F);
+		Parameters->SceneDepthTexture = SceneDepthTexture;
+		return GraphBuilder.CreateUniformBuffer(Parameters);
+	}
+}
@@ -0,0 +1,443 @@
+#include "GBufferProcessGPUCulling.h"
+#include "GBufferProcessMaterial.h"
+#include "GBufferProcessScheduler.h"
+#include "GBufferProcessProjection.h"
+#include "GBufferProcessRegionDataAsset.h"
+#include "Containers/DynamicRHIResourceArray.h"
+#include "RenderGraphBuilder.h"
+#include "RenderGraphUtils.h"
+#include "SceneRendering.h"
+#include "Stats/Stats.h"
+
+IMPLEMENT_GLOBAL_SHADER(FGBufferProcessInitIndirectArgsCS, "/Plugin/GBufferProcessPlugin/Private/GBufferProcessCulling.usf", "InitIndirectArgsCS", SF_Compute);
+IMPLEMENT_GLOBAL_SHADER(FGBufferProcessCullRegionsCS, "/Plugin/GBufferProcessPlugin/Private/GBufferProcessCulling.usf", "CullRegionsCS", SF_Compute);
+IMPLEMENT_GLOBAL_SHADER(FGBufferProcessRegionVS, "/Plugin/GBufferProcessPlugin/Private/GBufferProcessCulling.usf", "RegionVS", SF_Vertex);
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("GPU culled regions"), STAT_GBufferProcess_GPUCulledRegions, STATGROUP_GBufferProcess);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Indirect batches"), STAT_GBufferProcess_IndirectBatches, STATGROUP_GBufferProcess);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Region bytes uploaded"), STAT_GBufferProcess_RegionBytesUploaded, STATGROUP_GBufferProcess);
+
+static TAutoConsoleVariable<int32> CVarGBufferProcessGPUCulling(
+	TEXT("r.GBufferProcess.GPUCulling"),
+	1,
+	TEXT("Cull GBuffer process regions in a compute pass and draw them in batches with indirect draws.\n")
+	TEXT("Only used on SM5 when r.GBufferProcess.BudgetMs is 0, otherwise regions are culled and drawn one by one on the render thread.\n")
+	TEXT("Only post base pass regions are culled on the GPU, the regions of the later stages are always culled on the render thread.\n")
+	TEXT("0: off\n")
+	TEXT("1: on (default)"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarGBufferProcessHZBOcclusion(
+	TEXT("r.GBufferProcess.HZBOcclusion"),
+	1,
+	TEXT("Cull GPU culled regions that are hidden behind the previous frame HZB."),
+	ECVF_Scalability | ECVF_RenderThreadSafe);
+
+namespace
+{
+	// Must match FRHIDrawIndirectParameters and DRAW_INDIRECT_ARGS_STRIDE in GBufferProcessCulling.usf.
+	const uint32 DrawIndirectArgsStride = sizeof(FRHIDrawIndirectParameters) / sizeof(uint32);
+
+	const int32 CullingGroupSize = 64;
+
+	// Must match BAKED_REGION_STRIDE in GBufferProcessCulling.usf.
+	const int32 BakedRegionStride = sizeof(FGBufferProcessBakedRegion) / sizeof(FVector4);
+
+	// Must match NO_BATCH in GBufferProcessCulling.usf.
+	const uint32 NoBatch = ~0u;
+
+	template<typename ElementType>
+	void CreateStructuredBufferSRV(const TCHAR* Name, TResourceArray<ElementType>& Data, FStructuredBufferRHIRef& OutBuffer, FShaderResourceViewRHIRef& OutSRV)
+	{
+		FRHIResourceCreateInfo CreateInfo(Name);
+		CreateInfo.ResourceArray = &Data;
+		OutBuffer = RHICreateStructuredBuffer(sizeof(ElementType), Data.GetResourceDataSize(), BUF_Static | BUF_ShaderResource, CreateInfo);
+		OutSRV = RHICreateShaderResourceView(OutBuffer);
+	}
+
+	/** Creates a buffer that can be scatter uploaded into, with its initial data. */
+	template<typename ElementType>
+	void CreateRWStructuredBuffer(const TCHAR* Name, TResourceArray<ElementType>& Data, FRWBufferStructured& OutBuffer)
+	{
+		OutBuffer.Release();
+		OutBuffer.NumBytes = Data.GetResourceDataSize();
+
+		FRHIResourceCreateInfo CreateInfo(Name);
+		CreateInfo.ResourceArray = &Data;
+		OutBuffer.Buffer = RHICreateStructuredBuffer(sizeof(ElementType), OutBuffer.NumBytes, BUF_ShaderResource | BUF_UnorderedAccess, CreateInfo);
+		OutBuffer.UAV = RHICreateUnorderedAccessView(OutBuffer.Buffer, false, false);
+		OutBuffer.SRV = RHICreateShaderResourceView(OutBuffer.Buffer);
+	}
+
+	/** Center and extent of the region bounds, see CullRegionsCS. */
+	void GetRegionBoundsData(const FGBufferProcessRegionProxy& Region, FVector4 OutBounds[2])
+	{
+		if (Region.WorldBounds.IsValid)
+		{
+			OutBounds[0] = FVector4(Region.WorldBounds.GetCenter(), 0.0f);
+			OutBounds[1] = FVector4(Region.WorldBounds.GetExtent(), 0.0f);
+		}
+		else
+		{
+			// Unbound, see CullRegionsCS.
+			OutBounds[0] = FVector4(0.0f, 0.0f, 0.0f, 0.0f);
+			OutBounds[1] = FVector4(-1.0f, -1.0f, -1.0f, 0.0f);
+		}
+	}
+
+	bool IsSameBatch(const FGBufferProcessRegionBatch& Batch, const FGBufferProcessRegionProxy& Region)
+	{
+		// The copy of the target is made once per batch, overlapping regions of one batch would overwrite each other instead of compounding.
+		if (GBufferProcess::GetRegionKernel(Region.Type, Region.BlendOp).bDecodeEncode)
+		{
+			return false;
+		}
+		return Batch.MaterialProxy == Region.MaterialProxy && Batch.Type == Region.Type && Batch.BlendOp == Region.BlendOp;
+	}
+}
+
+bool FGBufferProcessGPUCuller::IsEnabled(const FViewInfo& View)
+{
+	return CVarGBufferProcessGPUCulling.GetValueOnRenderThread() != 0 &&
+		View.GetFeatureLevel() >= ERHIFeatureLevel::SM5 &&
+		!FGBufferProcessScheduler::IsBudgetEnabled();
+}
+
+void FGBufferProcessGPUCuller::UpdateBakedRegions(TArrayView<const FGBufferProcessBakedRegionRun> BakedRuns)
+{
+	check(IsInRenderingThread());
+
+	NumBakedRegions = 0;
+	for (const FGBufferProcessBakedRegionRun& BakedRun : BakedRuns)
+	{
+		NumBakedRegions += BakedRun.Records.Num();
+	}
+
+	// Never empty, the shaders always bind it.
+	TResourceArray<FVector4> BakedRegionsData;
+	BakedRegionsData.SetNumZeroed(FMath::Max(NumBakedRegions * BakedRegionStride, 1));
+	uint8* BakedRegionsDest = reinterpret_cast<uint8*>(BakedRegionsData.GetData());
+	for (const FGBufferProcessBakedRegionRun& BakedRun : BakedRuns)
+	{
+		FMemory::Memcpy(BakedRegionsDest, BakedRun.Records.GetData(), BakedRun.Records.Num() * sizeof(FGBufferProcessBakedRegion));
+		BakedRegionsDest += BakedRun.Records.Num() * sizeof(FGBufferProcessBakedRegion);
+	}
+
+	CreateStructuredBufferSRV(TEXT("GBufferProcessBakedRegions"), BakedRegionsData, BakedRegionsBuffer, BakedRegionsSRV);
+	INC_DWORD_STAT_BY(STAT_GBufferProcess_RegionBytesUploaded, BakedRegionsData.GetResourceDataSize());
+
+	// The slots of the other regions follow the baked ones.
+	bValid = false;
+}
+
+void FGBufferProcessGPUCuller::Update(FRHICommandList& RHICmdList, TArrayView<const FGBufferProcessRegionProxy* const> Regions, uint32 RegionsHash, const TSet<uint32>& DirtyRegionIds)
+{
+	check(IsInRenderingThread());
+
+	if (bValid && RegionsHash == CachedRegionsHash)
+	{
+		UpdateDirtyRegions(RHICmdList, Regions, DirtyRegionIds);
+		return;
+	}
+	bValid = true;
+	CachedRegionsHash = RegionsHash;
+
+	Batches.Reset();
+	RegionSlots.Reset();
+	SlotRegionIndices.Reset();
+	WeightedRegionIndices.Reset();
+	NumRegions = 0;
+
+	// Baked regions that are not drawn keep their slot without a batch.
+	TResourceArray<FVector4> RegionBoundsData;
+	TResourceArray<uint32> RegionBatches;
+	TResourceArray<float> RegionIntensitiesData;
+	RegionBatches.Init(NoBatch, NumBakedRegions);
+	RegionBatches.Reserve(NumBakedRegions + Regions.Num());
+
+	auto AddRegion = [&](int32 RegionIndex)
+	{
+		const FGBufferProcessRegionProxy& Region = *Regions[RegionIndex];
+		if (Batches.Num() == 0 || !IsSameBatch(Batches.Last(), Region))
+		{
+			FGBufferProcessRegionBatch& Batch = Batches.AddDefaulted_GetRef();
+			Batch.MaterialProxy = Region.MaterialProxy;
+			Batch.Type = Region.Type;
+			Batch.BlendOp = Region.BlendOp;
+			Batch.FirstRegion = NumRegions;
+		}
+		++Batches.Last().NumRegions;
+		++NumRegions;
+
+		// The bounds and intensity of baked regions are already in their records.
+		if (Region.BakedRegionIndex != INDEX_NONE)
+		{
+			check(Region.BakedRegionIndex < NumBakedRegions);
+			RegionBatches[Region.BakedRegionIndex] = Batches.Num() - 1;
+			return;
+		}
+
+		FVector4 Bounds[2];
+		GetRegionBoundsData(Region, Bounds);
+		RegionBoundsData.Append(Bounds, UE_ARRAY_COUNT(Bounds));
+		RegionBatches.Add(Batches.Num() - 1);
+		RegionIntensitiesData.Add(Region.Intensity);
+		RegionSlots.Add(Region.RegionId, SlotRegionIndices.Add(RegionIndex));
+	};
+
+	// Regions are sorted by ascending priority, only consecutive regions are batched to keep the draw order.
+	for (int32 RegionIndex = 0; RegionIndex < Regions.Num(); ++RegionIndex)
+	{
+		const FGBufferProcessRegionProxy& Region = *Regions[RegionIndex];
+		// Regions of the later stages are drawn on the render thread path.
+		if (!Region.MaterialProxy || Region.Stage != EGBufferProcessStage::PostBasePass || !GBufferProcess::GetRegionKernel(Region.Type, Region.BlendOp).bSupported)
+		{
+			continue;
+		}
+
+		if (Region.BlendOp == EGBufferProcessBlendOp::Weighted)
+		{
+			WeightedRegionIndices.Add(RegionIndex);
+			continue;
+		}
+		AddRegion(RegionIndex);
+	}
+
+	// Weighted regions don't depend on the draw order, they are batched by material whatever their priority, after the ordered ones.
+	// Material proxy addresses and region ids differ between sessions, so the summing order is only deterministic within a session.
+	FirstWeightedBatch = Batches.Num();
+	WeightedRegionIndices.Sort([&Regions](int32 A, int32 B)
+	{
+		const FGBufferProcessRegionProxy& RegionA = *Regions[A];
+		const FGBufferProcessRegionProxy& RegionB = *Regions[B];
+		if (RegionA.Type != RegionB.Type)
+		{
+			return RegionA.Type < RegionB.Type;
+		}
+		if (RegionA.MaterialProxy != RegionB.MaterialProxy)
+		{
+			return RegionA.MaterialProxy < RegionB.MaterialProxy;
+		}
+		return RegionA.RegionId < RegionB.RegionId;
+	});
+	for (int32 RegionIndex : WeightedRegionIndices)
+	{
+		AddRegion(RegionIndex);
+	}
+	UpdateWeightedBatchBounds(Regions);
+	NumRegionSlots = RegionBatches.Num();
+
+	if (NumRegions == 0)
+	{
+		RegionBounds.Release();
+		RegionBatchesBuffer.SafeRelease();
+		RegionBatchesSRV.SafeRelease();
+		RegionIntensities.Release();
+		BatchOffsetsBuffer.SafeRelease();
+		BatchOffsetsSRV.SafeRelease();
+		return;
+	}
+
+	// Never empty, the shaders always bind them.
+	if (SlotRegionIndices.Num() == 0)
+	{
+		RegionBoundsData.AddZeroed(2);
+		RegionIntensitiesData.AddZeroed();
+	}
+
+	TResourceArray<uint32> BatchOffsets;
+	BatchOffsets.Reserve(Batches.Num());
+	for (const FGBufferProcessRegionBatch& Batch : Batches)
+	{
+		BatchOffsets.Add(Batch.FirstRegion);
+	}
+
+	CreateRWStructuredBuffer(TEXT("GBufferProcessRegionBounds"), RegionBoundsData, RegionBounds);
+	CreateStructuredBufferSRV(TEXT("GBufferProcessRegionBatches"), RegionBatches, RegionBatchesBuffer, RegionBatchesSRV);
+	CreateRWStructuredBuffer(TEXT("GBufferProcessRegionIntensities"), RegionIntensitiesData, RegionIntensities);
+	CreateStructuredBufferSRV(TEXT("GBufferProcessBatchOffsets"), BatchOffsets, BatchOffsetsBuffer, BatchOffsetsSRV);
+
+	INC_DWORD_STAT_BY(STAT_GBufferProcess_RegionBytesUploaded, RegionBoundsData.GetResourceDataSize() + RegionBatches.GetResourceDataSize() + RegionIntensitiesData.GetResourceDataSize() + BatchOffsets.GetResourceDataSize());
+}
+
+void FGBufferProcessGPUCuller::UpdateDirtyRegions(FRHICommandList& RHICmdList, TArrayView<const FGBufferProcessRegionProxy* const> Regions, const TSet<uint32>& DirtyRegionIds)
+{
+	if (NumRegions == 0 || DirtyRegionIds.Num() == 0)
+	{
+		return;
+	}
+
+	TArray<int32, TInlineAllocator<64>> DirtySlots;
+	bool bWeightedRegionsDirty = false;
+	for (uint32 RegionId : DirtyRegionIds)
+	{
+		// Regions that are not drawn, were removed or are baked have no slot.
+		if (const int32* Slot = RegionSlots.Find(RegionId))
+		{
+			DirtySlots.Add(*Slot);
+			bWeightedRegionsDirty |= Regions[SlotRegionIndices[*Slot]]->BlendOp == EGBufferProcessBlendOp::Weighted;
+		}
+	}
+	if (DirtySlots.Num() == 0)
+	{
+		return;
+	}
+
+	if (bWeightedRegionsDirty)
+	{
+		UpdateWeightedBatchBounds(Regions);
+	}
+
+	RegionBoundsUploadBuffer.Init(DirtySlots.Num(), sizeof(FVector4) * 2, true, TEXT("GBufferProcessRegionBoundsUpload"));
+	RegionIntensitiesUploadBuffer.Init(DirtySlots.Num(), sizeof(float), false, TEXT("GBufferProcessRegionIntensitiesUpload"));
+	for (int32 Slot : DirtySlots)
+	{
+		const FGBufferProcessRegionProxy& Region = *Regions[SlotRegionIndices[Slot]];
+		FVector4 Bounds[2];
+		GetRegionBoundsData(Region, Bounds);
+		RegionBoundsUploadBuffer.Add(Slot, Bounds);
+		RegionIntensitiesUploadBuffer.Add(Slot, &Region.Intensity);
+	}
+
+	RegionBoundsUploadBuffer.ResourceUploadTo(RHICmdList, RegionBounds, false);
+	RegionIntensitiesUploadBuffer.ResourceUploadTo(RHICmdList, RegionIntensities, false);
+	RHICmdList.Transition({
+		FRHITransitionInfo(RegionBounds.UAV, ERHIAccess::UAVCompute, ERHIAccess::SRVMask),
+		FRHITransitionInfo(RegionIntensities.UAV, ERHIAccess::UAVCompute, ERHIAccess::SRVMask)
+	});
+
+	INC_DWORD_STAT_BY(STAT_GBufferProcess_RegionBytesUploaded, DirtySlots.Num() * (sizeof(FVector4) * 2 + sizeof(float)));
+}
+
+void FGBufferProcessGPUCuller::UpdateWeightedBatchBounds(TArrayView<const FGBufferProcessRegionProxy* const> Regions)
+{
+	int32 WeightedIndex = 0;
+	for (int32 BatchIndex = FirstWeightedBatch; BatchIndex < Batches.Num(); ++BatchIndex)
+	{
+		FGBufferProcessRegionBatch& Batch = Batches[BatchIndex];
+		Batch.Bounds.Init();
+
+		bool bUnbound = false;
+		for (uint32 Index = 0; Index < Batch.NumRegions; ++Index, ++WeightedIndex)
+		{
+			const FBox& WorldBounds = Regions[WeightedRegionIndices[WeightedIndex]]->WorldBounds;
+			bUnbound |= !WorldBounds.IsValid;
+			Batch.Bounds += WorldBounds;
+		}
+		if (bUnbound)
+		{
+			Batch.Bounds.Init();
+		}
+	}
+}
+
+FGBufferProcessCullingResult FGBufferProcessGPUCuller::Cull(FRDGBuilder& GraphBuilder, const FViewInfo& View, const FGBufferProcessTile* Tile) const
+{
+	check(bValid && NumRegions > 0);
+
+	INC_DWORD_STAT_BY(STAT_GBufferProcess_GPUCulledRegions, NumRegions);
+	INC_DWORD_STAT_BY(STAT_GBufferProcess_IndirectBatches, Batches.Num());
+
+	FGBufferProcessCullingResult Result;
+	Result.DrawIndirectArgs = GraphBuilder.CreateBuffer(FRDGBufferDesc::CreateIndirectDesc(Batches.Num() * DrawIndirectArgsStride), TEXT("GBufferProcessDrawIndirectArgs"));
+	Result.VisibleRegionIndices = GraphBuilder.CreateBuffer(FRDGBufferDesc::CreateStructuredDesc(sizeof(uint32), NumRegions), TEXT("GBufferProcessVisibleRegionIndices"));
+	Result.RegionRects = GraphBuilder.CreateBuffer(FRDGBufferDesc::CreateStructuredDesc(sizeof(FVector4), NumRegionSlots), TEXT("GBufferProcessRegionRects"));
+	Result.BakedRegions = BakedRegionsSRV;
+	Result.RegionIntensities = RegionIntensities.SRV;
+	Result.NumBakedRegions = NumBakedRegions;
+
+	FRDGBufferUAVRef DrawIndirectArgsUAV = GraphBuilder.CreateUAV(Result.DrawIndirectArgs, PF_R32_UINT);
+
+	FGlobalShaderMap* GlobalShaderMap = View.ShaderMap;
+
+	// Step 1 : reset the instance counts.
+	{
+		FGBufferProcessInitIndirectArgsCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FGBufferProcessInitIndirectArgsCS::FParameters>();
+		PassParameters->NumBatches = Batches.Num();
+		PassParameters->DrawIndirectArgs = DrawIndirectArgsUAV;
+
+		TShaderMapRef<FGBufferProcessInitIndirectArgsCS> ComputeShader(GlobalShaderMap);
+		FComputeShaderUtils::AddPass(
+			GraphBuilder,
+			RDG_EVENT_NAME("InitIndirectArgs Batches=%d", Batches.Num()),
+			ComputeShader,
+			PassParameters,
+			FComputeShaderUtils::GetGroupCount(Batches.Num(), CullingGroupSize));
+	}
+
+	// Step 2 : cull against the frustum and the previous frame HZB, append the visible regions to their batch.
+	{
+		const TRefCountPtr<IPooledRenderTarget>& PrevHZB = View.PrevViewInfo.HZB;
+		const bool bOcclusion = !Tile &&
+			CVarGBufferProcessHZBOcclusion.GetValueOnRenderThread() != 0 &&
+			PrevHZB.IsValid() &&
+			!View.bCameraCut &&
+			!View.bPrevTransformsReset;
+
+		FGBufferProcessCullRegionsCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FGBufferProcessCullRegionsCS::FParameters>();
+		PassParameters->WorldToClip = View.ViewMatrices.GetViewProjectionMatrix();
+		PassParameters->NumRegionSlots = NumRegionSlots;
+		PassParameters->NumBakedRegions = NumBakedRegions;
+		PassParameters->MinScreenCoverage = FGBufferProcessScheduler::GetMinScreenCoverage();
+		// NDC y goes up. A tile view renders GetTileImageRect, its coverage is measured on the final image.
+		PassParameters->NDCToCoverageUV = FVector4(0.5f, -0.5f, 0.5f, 0.5f);
+		if (Tile)
+		{
+			const FIntRect TileImageRect = GBufferProcess::GetTileImageRect(*Tile);
+			const FVector2D ImageSize(Tile->ImageSize);
+			PassParameters->NDCToCoverageUV = FVector4(
+				0.5f * TileImageRect.Width() / ImageSize.X,
+				-0.5f * TileImageRect.Height() / ImageSize.Y,
+				(TileImageRect.Min.X + 0.5f * TileImageRect.Width()) / ImageSize.X,
+				(TileImageRect.Min.Y + 0.5f * TileImageRect.Height()) / ImageSize.Y);
+		}
+		PassParameters->BakedRegions = BakedRegionsSRV;
+		PassParameters->RegionBounds = RegionBounds.SRV;
+		PassParameters->RegionBatches = RegionBatchesSRV;
+		PassParameters->BatchOffsets = BatchOffsetsSRV;
+		PassParameters->DrawIndirectArgs = DrawIndirectArgsUAV;
+		PassParameters->VisibleRegionIndices = GraphBuilder.CreateUAV(Result.VisibleRegionIndices);
+		PassParameters->RegionRects = GraphBuilder.CreateUAV(Result.RegionRects);
+
+		if (bOcclusion)
+		{
+			// The HZB mip 0 is half the view rect rounded up to a power of two, see BuildHZB.
+			const FIntPoint HZBSize = PrevHZB->GetDesc().Extent;
+			const FIntPoint PrevViewSize = View.PrevViewInfo.ViewRect.Size();
+
+			PassParameters->PrevWorldToClip = View.PrevViewInfo.ViewMatrices.GetViewProjectionMatrix();
+			PassParameters->HZBUvFactor = FVector2D(float(PrevViewSize.X) / float(2 * HZBSize.X), float(PrevViewSize.Y) / float(2 * HZBSize.Y));
+			PassParameters->HZBSize = FVector2D(HZBSize);
+			PassParameters->HZBMipCount = PrevHZB->GetDesc().NumMips;
+			PassParameters->HZBTexture = GraphBuilder.RegisterExternalTexture(PrevHZB);
+			PassParameters->HZBSampler = TStaticSamplerState<SF_Point, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+		}
+
+		FGBufferProcessCullRegionsCS::FPermutationDomain PermutationVector;
+		PermutationVector.Set<FGBufferProcessCullRegionsCS::FOcclusionDim>(bOcclusion);
+		TShaderMapRef<FGBufferProcessCullRegionsCS> ComputeShader(GlobalShaderMap, PermutationVector);
+		FComputeShaderUtils::AddPass(
+			GraphBuilder,
+			RDG_EVENT_NAME("CullRegions Regions=%d Slots=%d Occlusion=%d", NumRegions, NumRegionSlots, bOcclusion ? 1 : 0),
+			ComputeShader,
+			PassParameters,
+			FComputeShaderUtils::GetGroupCount(NumRegionSlots, CullingGroupSize));
+	}
+
+	return Result;
+}
+
+namespace GBufferProcess
+{
+	uint32 GetRegionsHash(TArrayView<const FGBufferProcessRegionProxy* const> Regions)
+	{
+		uint32 Hash = GetTypeHash(Regions.Num());
+		for (const FGBufferProcessRegionProxy* Region : Regions)
+		{
+			Hash = HashCombine(Hash, Region->RegionId);
+			Hash = HashCombine(Hash, PointerHash(Region->MaterialProxy));
+			Hash = HashCombine(Hash, ((uint32)Region->Stage << 16) | ((uint32)Region->Type << 8) | (uint32)Region->BlendOp);
+		}
+		return Hash;
+	}
+}
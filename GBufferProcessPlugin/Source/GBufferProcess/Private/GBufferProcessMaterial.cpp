@@ -15,5 +15,109 @@ IMPLEMENT_GLOBAL_SHADER(FGBufferProcessScreenPassVS, "/Plugin/GBufferProcessPlug
 IMPLEMENT_GLOBAL_SHADER(FClearRectPS, "/Plugin/GBufferProcessPlugin/Private/GBufferProcessScreenPass.usf", "ClearPS", SF_Pixel);
 IMPLEMENT_GLOBAL_SHADER(FCopyTexturePS, "/Plugin/GBufferProcessPlugin/Private/GBufferProcessScreenPass.usf", "CopyPS", SF_Pixel);
 IMPLEMENT_GLOBAL_SHADER(FRewritePS, "/Plugin/GBufferProcessPlugin/Private/GBufferProcessScreenPass.usf", "RewritePS", SF_Pixel);
+IMPLEMENT_GLOBAL_SHADER(FGBufferProcessResolveWeightedPS, "/Plugin/GBufferProcessPlugin/Private/GBufferProcessWeighted.usf", "ResolveWeightedPS", SF_Pixel);
+IMPLEMENT_GLOBAL_SHADER(FGBufferProcessVisualizeRegionPS, "/Plugin/GBufferProcessPlugin/Private/GBufferProcessVisualize.usf", "VisualizeRegionPS", SF_Pixel);
+IMPLEMENT_GLOBAL_SHADER(FGBufferProcessCompositeVisualizePS, "/Plugin/GBufferProcessPlugin/Private/GBufferProcessVisualize.usf", "CompositeVisualizePS", SF_Pixel);
 
-IMPLEMENT_MATERIAL_SHADER_TYPE(, FMaterialGraphRewriteNormalPS, TEXT("/Plugin/GBufferProcessPlugin/Private/GBufferProcessTest.usf"), TEXT("RewriteNormalPS"), SF_Pixel);
+static TAutoConsoleVariable<int32> CVarGBufferProcessSupport(
+	TEXT("r.GBufferProcess.Support"),
+	1,
+	TEXT("Compiles the region kernels of light function materials, set it per platform in the project settings.\n")
+	TEXT("Light functions get no region kernels while it is off, regions then draw with the default light function material.\n")
+	TEXT("0: off, for projects or platforms without regions\n")
+	TEXT("1: on (default)"),
+	ECVF_ReadOnly);
+
+IMPLEMENT_MATERIAL_SHADER_TYPE(, FGBufferProcessRegionPS, TEXT("/Plugin/GBufferProcessPlugin/Private/GBufferProcessRegion.usf"), TEXT("RegionPS"), SF_Pixel);
+
+namespace
+{
+	template<EGBufferProcessType TargetType>
+	void AddTargetKernels(FGBufferProcessRegionKernel* OutKernels)
+	{
+		OutKernels[(int32)EGBufferProcessBlendOp::Replace] = TGBufferProcessRegionKernel<TargetType, EGBufferProcessBlendOp::Replace>::GetKernel();
+		OutKernels[(int32)EGBufferProcessBlendOp::Lerp] = TGBufferProcessRegionKernel<TargetType, EGBufferProcessBlendOp::Lerp>::GetKernel();
+		OutKernels[(int32)EGBufferProcessBlendOp::Add] = TGBufferProcessRegionKernel<TargetType, EGBufferProcessBlendOp::Add>::GetKernel();
+		OutKernels[(int32)EGBufferProcessBlendOp::Multiply] = TGBufferProcessRegionKernel<TargetType, EGBufferProcessBlendOp::Multiply>::GetKernel();
+		OutKernels[(int32)EGBufferProcessBlendOp::Weighted] = TGBufferProcessRegionKernel<TargetType, EGBufferProcessBlendOp::Weighted>::GetKernel();
+		static_assert((int32)EGBufferProcessBlendOp::MAX == 5, "Ensure that all EGBufferProcessBlendOp values are accounted for.");
+	}
+
+	struct FRegionKernelTable
+	{
+		FGBufferProcessRegionKernel Kernels[(int32)EGBufferProcessType::MAX][(int32)EGBufferProcessBlendOp::MAX];
+
+		FRegionKernelTable()
+		{
+			AddTargetKernels<EGBufferProcessType::SceneColor>(Kernels[(int32)EGBufferProcessType::SceneColor]);
+			AddTargetKernels<EGBufferProcessType::Normal>(Kernels[(int32)EGBufferProcessType::Normal]);
+			AddTargetKernels<EGBufferProcessType::Roughness>(Kernels[(int32)EGBufferProcessType::Roughness]);
+			static_assert((int32)EGBufferProcessType::MAX == 3, "Ensure that all EGBufferProcessType values are accounted for.");
+		}
+	};
+}
+
+bool FGBufferProcessRegionPS::IsPermutationSupported(const FPermutationDomain& PermutationVector)
+{
+	const FGBufferProcessRegionKernel& Kernel = GBufferProcess::GetRegionKernel(PermutationVector.Get<FTargetTypeDim>(), PermutationVector.Get<FBlendOpDim>());
+	if (PermutationVector.Get<FInBasePassDim>() && (!Kernel.bInBasePass || PermutationVector.Get<FGPUDrivenDim>()))
+	{
+		// GPU culled regions are always drawn in their own passes.
+		return false;
+	}
+	if (PermutationVector.Get<FClusteredDim>() && (!Kernel.bClustered || PermutationVector.Get<FGPUDrivenDim>() || PermutationVector.Get<FInBasePassDim>()))
+	{
+		// Clustered regions are drawn on the render thread path, in their own passes.
+		return false;
+	}
+	return Kernel.bSupported && Kernel.bDecodeEncode == PermutationVector.Get<FDecodeEncodeDim>();
+}
+
+bool FGBufferProcessRegionPS::IsMaterialSupported(const FMaterialShaderParameters& MaterialParameters)
+{
+	if (MaterialParameters.MaterialDomain != MD_LightFunction)
+	{
+		return false;
+	}
+	return MaterialParameters.bIsDefaultMaterial || CVarGBufferProcessSupport.GetValueOnAnyThread() != 0;
+}
+
+namespace GBufferProcess
+{
+	const FGBufferProcessRegionKernel& GetRegionKernel(EGBufferProcessType InType, EGBufferProcessBlendOp InBlendOp)
+	{
+		static const FRegionKernelTable KernelTable;
+		static const FGBufferProcessRegionKernel UnsupportedKernel;
+
+		if (InType >= EGBufferProcessType::MAX || InBlendOp >= EGBufferProcessBlendOp::MAX)
+		{
+			return UnsupportedKernel;
+		}
+		return KernelTable.Kernels[(int32)InType][(int32)InBlendOp];
+	}
+
+	FRDGTextureDesc GetWeightedAccumulationDesc(FIntPoint Extent)
+	{
+		// Half floats keep sums of normals and colors above 1, alpha holds the summed weights.
+		return FRDGTextureDesc::Create2D(Extent, PF_FloatRGBA, FClearValueBinding::Transparent, TexCreate_RenderTargetable | TexCreate_ShaderResource);
+	}
+
+	bool TryGetShaders(ERHIFeatureLevel::Type InFeatureLevel, int32 InPermutationId, FMaterialRenderProxy const*& OutMaterialProxy, FMaterial const*& OutMaterial, FMaterialShaders& OutShaders)
+	{
+		while (OutMaterialProxy)
+		{
+			OutMaterial = OutMaterialProxy->GetMaterialNoFallback(InFeatureLevel);
+			if (OutMaterial && OutMaterial->IsLightFunction())
+			{
+				FMaterialShaderTypes ShaderTypes;
+				ShaderTypes.AddShaderType<FGBufferProcessRegionPS>(InPermutationId);
+				if (OutMaterial->TryGetShaders(ShaderTypes, nullptr, OutShaders))
+				{
+					return true;
+				}
+			}
+			OutMaterialProxy = OutMaterialProxy->GetFallback(InFeatureLevel);
+		}
+		return false;
+	}
+}
@@ -0,0 +1,339 @@
+#include "GBufferProcessPipelineCache.h"
+#include "GBufferProcessMaterial.h"
+#include "GBufferProcessGPUCulling.h"
+#include "GBufferProcessVolumeProxy.h"
+#include "GBufferProcessPlugin.h"
+#include "Materials/Material.h"
+#include "Materials/MaterialInterface.h"
+#include "MaterialShared.h"
+#include "GlobalShader.h"
+#include "CommonRenderResources.h"
+#include "PipelineStateCache.h"
+#include "RenderGraphResources.h"
+#include "ScreenPass.h"
+
+void FGBufferProcessPipelinePrecacher::QueueMaterial(UMaterialInterface* InMaterial, EGBufferProcessType InType, EGBufferProcessBlendOp InBlendOp)
+{
+	check(IsInGameThread());
+	if (InMaterial && GBufferProcess::GetRegionKernel(InType, InBlendOp).bSupported)
+	{
+		PendingMaterials.Add({ InMaterial, InType, InBlendOp });
+	}
+}
+
+void FGBufferProcessPipelinePrecacher::PopReadyMaterials(ERHIFeatureLevel::Type InFeatureLevel, TArray<FGBufferProcessPrecacheRequest>& OutRequests)
+{
+	check(IsInGameThread());
+
+	for (auto It = PendingMaterials.CreateIterator(); It; ++It)
+	{
+		UMaterialInterface* Material = It->Material.Get();
+		if (!Material)
+		{
+			It.RemoveCurrent();
+			continue;
+		}
+
+		const UMaterial* BaseMaterial = Material->GetMaterial();
+		if (BaseMaterial && BaseMaterial->MaterialDomain != MD_LightFunction)
+		{
+			// The region shaders are only compiled for light function materials, nothing will ever be ready.
+			UE_LOG(GBufferProcessLog, Warning, TEXT("Region material %s is not a light function material and will not be drawn."), *Material->GetPathName());
+			It.RemoveCurrent();
+			continue;
+		}
+
+		if (IsMaterialReady(Material, InFeatureLevel, GBufferProcess::GetRegionKernel(It->Type, It->BlendOp)))
+		{
+			FGBufferProcessPrecacheRequest& Request = OutRequests.AddDefaulted_GetRef();
+			Request.MaterialProxy = Material->GetRenderProxy();
+			Request.Type = It->Type;
+			Request.BlendOp = It->BlendOp;
+			It.RemoveCurrent();
+		}
+	}
+}
+
+bool FGBufferProcessPipelinePrecacher::IsMaterialReady(const UMaterialInterface* InMaterial, ERHIFeatureLevel::Type InFeatureLevel, const FGBufferProcessRegionKernel& InKernel)
+{
+	const FMaterialResource* MaterialResource = InMaterial ? InMaterial->GetMaterialResource(InFeatureLevel) : nullptr;
+	if (!MaterialResource || !MaterialResource->IsLightFunction())
+	{
+		return false;
+	}
+
+	FMaterialShaderTypes ShaderTypes;
+	ShaderTypes.AddShaderType<FGBufferProcessRegionPS>(InKernel.PermutationId);
+	if (!MaterialResource->HasShaders(ShaderTypes, nullptr))
+	{
+		return false;
+	}
+
+	// Whether a view is GPU culled is only known on the render thread, both permutations have to be ready.
+	if (InFeatureLevel >= ERHIFeatureLevel::SM5)
+	{
+		FMaterialShaderTypes GPUDrivenShaderTypes;
+		GPUDrivenShaderTypes.AddShaderType<FGBufferProcessRegionPS>(InKernel.GPUDrivenPermutationId);
+		if (!MaterialResource->HasShaders(GPUDrivenShaderTypes, nullptr))
+		{
+			return false;
+		}
+
+		// And for r.GBufferProcess.Clustered.
+		if (InKernel.bClustered)
+		{
+			FMaterialShaderTypes ClusteredShaderTypes;
+			ClusteredShaderTypes.AddShaderType<FGBufferProcessRegionPS>(InKernel.ClusteredPermutationId);
+			if (!MaterialResource->HasShaders(ClusteredShaderTypes, nullptr))
+			{
+				return false;
+			}
+		}
+	}
+
+	// Same for drawing inside the base pass render pass, which is a render thread setting.
+	if (InKernel.bInBasePass)
+	{
+		FMaterialShaderTypes InBasePassShaderTypes;
+		InBasePassShaderTypes.AddShaderType<FGBufferProcessRegionPS>(InKernel.InBasePassPermutationId);
+		return MaterialResource->HasShaders(InBasePassShaderTypes, nullptr);
+	}
+	return true;
+}
+
+UMaterialInterface* FGBufferProcessPipelinePrecacher::GetReadyMaterial(UMaterialInterface* InMaterial, UMaterialInterface*& InOutLastReadyMaterial, ERHIFeatureLevel::Type InFeatureLevel, const FGBufferProcessRegionKernel& InKernel)
+{
+	if (!InMaterial)
+	{
+		InOutLastReadyMaterial = nullptr;
+	}
+	else if (IsMaterialReady(InMaterial, InFeatureLevel, InKernel))
+	{
+		InOutLastReadyMaterial = InMaterial;
+	}
+	return InOutLastReadyMaterial;
+}
+
+FGBufferProcessReadyMaterialResolver::FGBufferProcessReadyMaterialResolver(TArrayView<UMaterialInterface* const> InMaterials, TArray<UMaterialInterface*>& InOutLastReadyMaterials, ERHIFeatureLevel::Type InFeatureLevel)
+	: Materials(InMaterials)
+	, LastReadyMaterials(InOutLastReadyMaterials)
+	, FeatureLevel(InFeatureLevel)
+{
+	check(IsInGameThread());
+	LastReadyMaterials.SetNumZeroed(Materials.Num());
+}
+
+const FMaterialRenderProxy* FGBufferProcessReadyMaterialResolver::Resolve(int32 MaterialIndex, EGBufferProcessType Type, EGBufferProcessBlendOp BlendOp)
+{
+	if (!Materials.IsValidIndex(MaterialIndex) || !Materials[MaterialIndex])
+	{
+		return nullptr;
+	}
+
+	const uint64 Key = GBufferProcess::GetMaterialKernelKey(MaterialIndex, Type, BlendOp);
+	if (const FMaterialRenderProxy** ResolvedProxy = ResolvedProxies.Find(Key))
+	{
+		return *ResolvedProxy;
+	}
+
+	UMaterialInterface* RenderMaterial = FGBufferProcessPipelinePrecacher::GetReadyMaterial(Materials[MaterialIndex], LastReadyMaterials[MaterialIndex], FeatureLevel, GBufferProcess::GetRegionKernel(Type, BlendOp));
+	const FMaterialRenderProxy* MaterialProxy = RenderMaterial ? RenderMaterial->GetRenderProxy() : nullptr;
+	ResolvedProxies.Add(Key, MaterialProxy);
+	return MaterialProxy;
+}
+
+namespace
+{
+	void InitScreenPassPipeline(const FScreenPassPipelineState& PipelineState, FGraphicsPipelineStateInitializer& GraphicsPSOInit)
+	{
+		// Has to match SetScreenPassPipelineState used by the region passes, otherwise the draw creates another pipeline.
+		GraphicsPSOInit.BlendState = PipelineState.BlendState;
+		GraphicsPSOInit.RasterizerState = TStaticRasterizerState<>::GetRHI();
+		GraphicsPSOInit.DepthStencilState = PipelineState.DepthStencilState;
+		GraphicsPSOInit.BoundShaderState.VertexDeclarationRHI = PipelineState.VertexDeclaration;
+		GraphicsPSOInit.BoundShaderState.VertexShaderRHI = PipelineState.VertexShader.GetVertexShader();
+		GraphicsPSOInit.BoundShaderState.PixelShaderRHI = PipelineState.PixelShader.GetPixelShader();
+		GraphicsPSOInit.PrimitiveType = PT_TriangleList;
+	}
+
+	void SetTargetFormats(FGraphicsPipelineStateInitializer& GraphicsPSOInit, const FRDGTextureDesc& TargetDesc, FRDGTextureRef DepthTexture)
+	{
+		GraphicsPSOInit.RenderTargetsEnabled = 1;
+		GraphicsPSOInit.RenderTargetFormats[0] = TargetDesc.Format;
+		GraphicsPSOInit.RenderTargetFlags[0] = TargetDesc.Flags;
+		GraphicsPSOInit.NumSamples = TargetDesc.NumSamples;
+
+		// Region passes bind the scene depth read only when volume proxies are on.
+		if (DepthTexture)
+		{
+			GraphicsPSOInit.DepthStencilTargetFormat = DepthTexture->Desc.Format;
+			GraphicsPSOInit.DepthStencilTargetFlag = DepthTexture->Desc.Flags;
+			GraphicsPSOInit.DepthStencilAccess = FExclusiveDepthStencil::DepthRead_StencilNop;
+		}
+	}
+
+	/** Same as SetTargetFormats for draws inside the base pass render pass, with all of its targets bound. */
+	void SetBasePassTargetFormats(FGraphicsPipelineStateInitializer& GraphicsPSOInit, const FRenderTargetBindingSlots& BasePassRenderTargets)
+	{
+		uint32 NumTargets = 0;
+		BasePassRenderTargets.Enumerate([&GraphicsPSOInit, &NumTargets](const FRenderTargetBinding& Binding)
+		{
+			const FRDGTextureDesc& TargetDesc = Binding.GetTexture()->Desc;
+			GraphicsPSOInit.RenderTargetFormats[NumTargets] = TargetDesc.Format;
+			GraphicsPSOInit.RenderTargetFlags[NumTargets] = TargetDesc.Flags;
+			GraphicsPSOInit.NumSamples = TargetDesc.NumSamples;
+			++NumTargets;
+		});
+		GraphicsPSOInit.RenderTargetsEnabled = NumTargets;
+
+		if (FRDGTextureRef DepthTexture = BasePassRenderTargets.DepthStencil.GetTexture())
+		{
+			GraphicsPSOInit.DepthStencilTargetFormat = DepthTexture->Desc.Format;
+			GraphicsPSOInit.DepthStencilTargetFlag = DepthTexture->Desc.Flags;
+			GraphicsPSOInit.DepthStencilAccess = BasePassRenderTargets.DepthStencil.GetDepthStencilAccess();
+		}
+	}
+
+	void CreatePipeline(FRHICommandList& RHICmdList, const FGraphicsPipelineStateInitializer& GraphicsPSOInit)
+	{
+		// Creating the pipeline also records it into the shader pipeline cache when PSO logging is enabled.
+		PipelineStateCache::GetAndOrCreateGraphicsPipelineState(RHICmdList, GraphicsPSOInit, EApplyRendertargetOption::DoNothing);
+	}
+
+	void PrecacheScreenPassPipeline(FRHICommandList& RHICmdList, const FScreenPassPipelineState& PipelineState, const FRDGTextureDesc& TargetDesc, FRDGTextureRef DepthTexture = nullptr)
+	{
+		FGraphicsPipelineStateInitializer GraphicsPSOInit;
+		InitScreenPassPipeline(PipelineState, GraphicsPSOInit);
+		SetTargetFormats(GraphicsPSOInit, TargetDesc, DepthTexture);
+		CreatePipeline(RHICmdList, GraphicsPSOInit);
+	}
+
+	void PrecacheBasePassPipeline(FRHICommandList& RHICmdList, const FScreenPassPipelineState& PipelineState, const FRenderTargetBindingSlots& BasePassRenderTargets)
+	{
+		FGraphicsPipelineStateInitializer GraphicsPSOInit;
+		InitScreenPassPipeline(PipelineState, GraphicsPSOInit);
+		SetBasePassTargetFormats(GraphicsPSOInit, BasePassRenderTargets);
+		CreatePipeline(RHICmdList, GraphicsPSOInit);
+	}
+
+	/** Volume proxies of views and regions that aren't mirrored, see GBufferProcess::GetVolumeRasterizerState. */
+	void InitVolumePipeline(FGraphicsPipelineStateInitializer& GraphicsPSOInit, const TShaderRef<FGBufferProcessVolumeVS>& VolumeVS, const TShaderRef<FGBufferProcessRegionPS>& PixelShader, FRHIBlendState* BlendState)
+	{
+		GBufferProcess::InitVolumePipeline(GraphicsPSOInit, VolumeVS.GetVertexShader(), PixelShader.GetPixelShader(), BlendState, TStaticRasterizerState<FM_Solid, CM_CW>::GetRHI());
+	}
+}
+
+void FGBufferProcessPipelinePrecacher::PrecachePipelines(FRHICommandList& RHICmdList, ERHIFeatureLevel::Type InFeatureLevel, TArrayView<const FGBufferProcessPrecacheRequest> Requests, TArrayView<const FRDGTextureRef> BasePassTextures, FRDGTextureRef SceneDepthTexture, const FRenderTargetBindingSlots* BasePassRenderTargets)
+{
+	check(IsInRenderingThread());
+
+	FGlobalShaderMap* GlobalShaderMap = GetGlobalShaderMap(InFeatureLevel);
+	TShaderMapRef<FGBufferProcessScreenPassVS> ScreenPassVS(GlobalShaderMap);
+	TShaderMapRef<FCopyTexturePS> CopyPixelShader(GlobalShaderMap);
+	TShaderMapRef<FGBufferProcessVolumeVS> VolumeVS(GlobalShaderMap);
+
+	for (const FGBufferProcessPrecacheRequest& Request : Requests)
+	{
+		const FGBufferProcessRegionKernel& Kernel = GBufferProcess::GetRegionKernel(Request.Type, Request.BlendOp);
+		if (!Kernel.bSupported || !BasePassTextures.IsValidIndex(Kernel.TargetIndex))
+		{
+			continue;
+		}
+
+		const FMaterialRenderProxy* MaterialProxy = Request.MaterialProxy;
+		const FMaterial* Material = nullptr;
+		FMaterialShaders MaterialShaders;
+		if (!GBufferProcess::TryGetShaders(InFeatureLevel, Kernel.PermutationId, MaterialProxy, Material, MaterialShaders))
+		{
+			continue;
+		}
+
+		TShaderRef<FGBufferProcessRegionPS> PixelShader;
+		if (!MaterialShaders.TryGetPixelShader(PixelShader))
+		{
+			continue;
+		}
+
+		const FRDGTextureDesc& BasePassDesc = BasePassTextures[Kernel.TargetIndex]->Desc;
+		// Weighted kernels draw into the accumulation texture of their target.
+		const FRDGTextureDesc TargetDesc = Kernel.bWeighted ? GBufferProcess::GetWeightedAccumulationDesc(BasePassDesc.Extent) : BasePassDesc;
+		PrecacheScreenPassPipeline(RHICmdList, FScreenPassPipelineState(ScreenPassVS, PixelShader, Kernel.GetBlendState()), TargetDesc, SceneDepthTexture);
+
+		if (SceneDepthTexture)
+		{
+			FGraphicsPipelineStateInitializer GraphicsPSOInit;
+			InitVolumePipeline(GraphicsPSOInit, VolumeVS, PixelShader, Kernel.GetBlendState());
+			SetTargetFormats(GraphicsPSOInit, TargetDesc, SceneDepthTexture);
+			CreatePipeline(RHICmdList, GraphicsPSOInit);
+		}
+
+		// Decode/encode kernels copy the target first.
+		if (Kernel.bDecodeEncode)
+		{
+			PrecacheScreenPassPipeline(RHICmdList, FScreenPassPipelineState(ScreenPassVS, CopyPixelShader), TargetDesc);
+		}
+
+		// The accumulation is resolved into the target, normals decode a copy of it.
+		if (Kernel.bWeighted)
+		{
+			FGBufferProcessResolveWeightedPS::FPermutationDomain PermutationVector;
+			PermutationVector.Set<FGBufferProcessResolveWeightedPS::FTargetTypeDim>(Request.Type);
+			TShaderMapRef<FGBufferProcessResolveWeightedPS> ResolvePixelShader(GlobalShaderMap, PermutationVector);
+			PrecacheScreenPassPipeline(RHICmdList, FScreenPassPipelineState(ScreenPassVS, ResolvePixelShader, Kernel.GetResolveBlendState()), BasePassDesc);
+
+			if (Request.Type == EGBufferProcessType::Normal)
+			{
+				PrecacheScreenPassPipeline(RHICmdList, FScreenPassPipelineState(ScreenPassVS, CopyPixelShader), BasePassDesc);
+			}
+		}
+
+		if (BasePassRenderTargets && Kernel.bInBasePass)
+		{
+			MaterialProxy = Request.MaterialProxy;
+			TShaderRef<FGBufferProcessRegionPS> InBasePassPixelShader;
+			if (GBufferProcess::TryGetShaders(InFeatureLevel, Kernel.InBasePassPermutationId, MaterialProxy, Material, MaterialShaders) &&
+				MaterialShaders.TryGetPixelShader(InBasePassPixelShader))
+			{
+				PrecacheBasePassPipeline(RHICmdList, FScreenPassPipelineState(ScreenPassVS, InBasePassPixelShader, Kernel.GetBasePassBlendState()), *BasePassRenderTargets);
+
+				if (SceneDepthTexture && BasePassRenderTargets->DepthStencil.GetTexture())
+				{
+					FGraphicsPipelineStateInitializer GraphicsPSOInit;
+					InitVolumePipeline(GraphicsPSOInit, VolumeVS, InBasePassPixelShader, Kernel.GetBasePassBlendState());
+					SetBasePassTargetFormats(GraphicsPSOInit, *BasePassRenderTargets);
+					CreatePipeline(RHICmdList, GraphicsPSOInit);
+				}
+			}
+		}
+
+		// Batches drawn by the GPU culler use their own vertex shader and no vertex buffer.
+		if (InFeatureLevel >= ERHIFeatureLevel::SM5)
+		{
+			MaterialProxy = Request.MaterialProxy;
+			TShaderRef<FGBufferProcessRegionPS> GPUDrivenPixelShader;
+			if (GBufferProcess::TryGetShaders(InFeatureLevel, Kernel.GPUDrivenPermutationId, MaterialProxy, Material, MaterialShaders) &&
+				MaterialShaders.TryGetPixelShader(GPUDrivenPixelShader))
+			{
+				TShaderMapRef<FGBufferProcessRegionVS> RegionVS(GlobalShaderMap);
+				FRHIDepthStencilState* DepthStencilState = FScreenPassPipelineState::FDefaultDepthStencilState::GetRHI();
+				FRHIVertexDeclaration* VertexDeclaration = GEmptyVertexDeclaration.VertexDeclarationRHI;
+
+				PrecacheScreenPassPipeline(RHICmdList, FScreenPassPipelineState(RegionVS, GPUDrivenPixelShader, Kernel.GetBlendState(), DepthStencilState, VertexDeclaration), TargetDesc);
+				if (Kernel.bDecodeEncode)
+				{
+					PrecacheScreenPassPipeline(RHICmdList, FScreenPassPipelineState(RegionVS, CopyPixelShader, FScreenPassPipelineState::FDefaultBlendState::GetRHI(), DepthStencilState, VertexDeclaration), TargetDesc);
+				}
+			}
+
+			// Clustered draws are always drawn as rects.
+			MaterialProxy = Request.MaterialProxy;
+			TShaderRef<FGBufferProcessRegionPS> ClusteredPixelShader;
+			if (Kernel.bClustered &&
+				GBufferProcess::TryGetShaders(InFeatureLevel, Kernel.ClusteredPermutationId, MaterialProxy, Material, MaterialShaders) &&
+				MaterialShaders.TryGetPixelShader(ClusteredPixelShader))
+			{
+				PrecacheScreenPassPipeline(RHICmdList, FScreenPassPipelineState(ScreenPassVS, ClusteredPixelShader, Kernel.GetBlendState()), TargetDesc, SceneDepthTexture);
+			}
+		}
+	}
+}
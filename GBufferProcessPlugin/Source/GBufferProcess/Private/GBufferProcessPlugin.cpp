@@ -8,6 +8,8 @@
 
 #define LOCTEXT_NAMESPACE "GBufferProcessPlugin"
 
+DEFINE_LOG_CATEGORY(GBufferProcessLog);
+
 void FGBufferProcessPlugin::StartupModule()
 {
 	// This code will execute after your module is loaded into memory; the exact timing is specified in the .uplugin file per-module
@@ -0,0 +1,229 @@
+#include "GBufferProcessProjection.h"
+#include "SceneView.h"
+
+namespace
+{
+	void GetPixelSpaceBoundingRect(const FSceneView& InView, const FVector& InBoxCenter, const FVector& InBoxExtents, FIntRect& OutViewport, float& OutMaxDepth, float& OutMinDepth)
+	{
+		OutViewport = FIntRect(INT_MAX, INT_MAX, -INT_MAX, -INT_MAX);
+		// 8 corners of the bounding box. To be multiplied by box extent and offset by the center.
+		const int NumCorners = 8;
+		const FVector Verts[NumCorners] = {
+			FVector(1, 1, 1),
+			FVector(1, 1,-1),
+			FVector(1,-1, 1),
+			FVector(1,-1,-1),
+			FVector(-1, 1, 1),
+			FVector(-1, 1,-1),
+			FVector(-1,-1, 1),
+			FVector(-1,-1,-1) };
+
+		for (int32 Index = 0; Index < NumCorners; Index++)
+		{
+			// Project bounding box vertecies into screen space.
+			const FVector WorldVert = InBoxCenter + (Verts[Index] * InBoxExtents);
+			FVector2D PixelVert;
+			FVector4 ScreenSpaceCoordinate = InView.WorldToScreen(WorldVert);
+
+			OutMaxDepth = FMath::Max<float>(ScreenSpaceCoordinate.W, OutMaxDepth);
+			OutMinDepth = FMath::Min<float>(ScreenSpaceCoordinate.W, OutMinDepth);
+
+			if (InView.ScreenToPixel(ScreenSpaceCoordinate, PixelVert))
+			{
+				// Update screen-space bounding box with with transformed vert.
+				OutViewport.Min.X = FMath::Min<int32>(OutViewport.Min.X, PixelVert.X);
+				OutViewport.Min.Y = FMath::Min<int32>(OutViewport.Min.Y, PixelVert.Y);
+
+				OutViewport.Max.X = FMath::Max<int32>(OutViewport.Max.X, PixelVert.X);
+				OutViewport.Max.Y = FMath::Max<int32>(OutViewport.Max.Y, PixelVert.Y);
+			}
+		}
+	}
+
+	// Function that calculates all points of intersection between plane and bounding box. Resulting points are unsorted.
+	void CalculatePlaneAABBIntersectionPoints(const FPlane& Plane, const FVector& BoxCenter, const FVector& BoxExtents, TArray<FVector>& OutPoints)
+	{
+		const FVector MaxCorner = BoxCenter + BoxExtents;
+
+		const FVector Verts[3][4] = {
+			{
+				// X Direction
+				FVector(-1, -1, -1),
+				FVector(-1,  1, -1),
+				FVector(-1, -1,  1),
+				FVector(-1,  1,  1),
+			},
+			{
+				// Y Direction
+				FVector(-1, -1, -1),
+				FVector( 1, -1, -1),
+				FVector( 1, -1,  1),
+				FVector(-1, -1,  1),
+			},
+			{
+				// Z Direction
+				FVector(-1, -1, -1),
+				FVector( 1, -1, -1),
+				FVector( 1,  1, -1),
+				FVector(-1,  1, -1),
+			}
+		};
+
+		FVector Intersection;
+		FVector Start;
+		FVector End;
+
+		for (int RunningAxis_Dir = 0; RunningAxis_Dir < 3; RunningAxis_Dir++)
+		{
+			const FVector *CornerLocations = Verts[RunningAxis_Dir];
+			for (int RunningCorner = 0; RunningCorner < 4; RunningCorner++)
+			{
+				Start = BoxCenter + BoxExtents * CornerLocations[RunningCorner];
+				End = FVector(Start.X, Start.Y, Start.Z);
+				End[RunningAxis_Dir] = MaxCorner[RunningAxis_Dir];
+				if (FMath::SegmentPlaneIntersection(Start, End, Plane, Intersection))
+				{
+					OutPoints.Add(Intersection);
+				}
+			}
+		}
+	}
+
+	// Takes in an existing viewport and updates it with an intersection bounding rectangle.
+	void UpdateMinMaxWithFrustrumAABBIntersection(const FSceneView& InView, const FVector& InBoxCenter, const FVector& InBoxExtents, FIntRect& OutViewportToUpdate, float& OutMaxDepthToUpdate)
+	{
+		TArray<FVector> Points;
+		Points.Reserve(6);
+		CalculatePlaneAABBIntersectionPoints(InView.ViewFrustum.Planes[4], InBoxCenter, InBoxExtents, Points);
+		if (Points.Num() == 0)
+		{
+			return;
+		}
+
+		for (FVector Point : Points)
+		{
+			// Project bounding box vertecies into screen space.
+			FVector4 ScreenSpaceCoordinate = InView.WorldToScreen(Point);
+			FVector4 ScreenSpaceCoordinateScaled = ScreenSpaceCoordinate * 1.0 / ScreenSpaceCoordinate.W;
+
+			OutMaxDepthToUpdate = FMath::Max<float>(ScreenSpaceCoordinate.W, OutMaxDepthToUpdate);
+			FVector2D PixelVert;
+
+			if (InView.ScreenToPixel(ScreenSpaceCoordinate, PixelVert))
+			{
+				// Update screen-space bounding box with with transformed vert.
+				OutViewportToUpdate.Min.X = FMath::Min<int32>(OutViewportToUpdate.Min.X, PixelVert.X);
+				OutViewportToUpdate.Min.Y = FMath::Min<int32>(OutViewportToUpdate.Min.Y, PixelVert.Y);
+
+				OutViewportToUpdate.Max.X = FMath::Max<int32>(OutViewportToUpdate.Max.X, PixelVert.X);
+				OutViewportToUpdate.Max.Y = FMath::Max<int32>(OutViewportToUpdate.Max.Y, PixelVert.Y);
+			}
+		}
+	}
+}
+
+namespace GBufferProcess
+{
+	bool GetRegionPixelRect(const FSceneView& View, const FBox& WorldBounds, FIntRect& OutRect, FIntRect* OutUnclippedRect)
+	{
+		const FIntRect& ViewRect = View.ViewRect;
+		if (OutUnclippedRect)
+		{
+			*OutUnclippedRect = FIntRect();
+		}
+
+		if (!WorldBounds.IsValid)
+		{
+			OutRect = ViewRect;
+			return true;
+		}
+
+		const FVector BoxCenter = WorldBounds.GetCenter();
+		const FVector BoxExtents = WorldBounds.GetExtent();
+		if (!View.ViewFrustum.IntersectBox(BoxCenter, BoxExtents))
+		{
+			return false;
+		}
+
+		// The camera is inside the region, every pixel of the view may be affected.
+		if (WorldBounds.IsInsideOrOn(View.ViewMatrices.GetViewOrigin()))
+		{
+			OutRect = ViewRect;
+			return true;
+		}
+
+		float MaxDepth = -BIG_NUMBER;
+		float MinDepth = BIG_NUMBER;
+		FIntRect UnscaledRect;
+		GetPixelSpaceBoundingRect(View, BoxCenter, BoxExtents, UnscaledRect, MaxDepth, MinDepth);
+		// Corners behind the camera don't project, use the near plane intersection instead.
+		UpdateMinMaxWithFrustrumAABBIntersection(View, BoxCenter, BoxExtents, UnscaledRect, MaxDepth);
+
+		// ScreenToPixel works in unscaled view space, bring the rect into the render resolution.
+		const FIntRect& UnscaledViewRect = View.UnscaledViewRect;
+		const float ScaleX = float(ViewRect.Width()) / FMath::Max(UnscaledViewRect.Width(), 1);
+		const float ScaleY = float(ViewRect.Height()) / FMath::Max(UnscaledViewRect.Height(), 1);
+		OutRect.Min.X = ViewRect.Min.X + FMath::FloorToInt((UnscaledRect.Min.X - UnscaledViewRect.Min.X) * ScaleX);
+		OutRect.Min.Y = ViewRect.Min.Y + FMath::FloorToInt((UnscaledRect.Min.Y - UnscaledViewRect.Min.Y) * ScaleY);
+		OutRect.Max.X = ViewRect.Min.X + FMath::CeilToInt((UnscaledRect.Max.X - UnscaledViewRect.Min.X) * ScaleX);
+		OutRect.Max.Y = ViewRect.Min.Y + FMath::CeilToInt((UnscaledRect.Max.Y - UnscaledViewRect.Min.Y) * ScaleY);
+		if (OutUnclippedRect)
+		{
+			*OutUnclippedRect = OutRect;
+		}
+		OutRect.Clip(ViewRect);
+
+		return OutRect.Width() > 0 && OutRect.Height() > 0;
+	}
+
+	float GetScreenCoverage(const FSceneView& View, const FIntRect& InRect)
+	{
+		const float ViewArea = float(View.ViewRect.Width()) * float(View.ViewRect.Height());
+		if (ViewArea <= 0.0f || InRect.Width() <= 0 || InRect.Height() <= 0)
+		{
+			return 0.0f;
+		}
+		return FMath::Clamp(float(InRect.Width()) * float(InRect.Height()) / ViewArea, 0.0f, 1.0f);
+	}
+
+	FIntRect GetTileImageRect(const FGBufferProcessTile& Tile)
+	{
+		check(Tile.IsValid());
+		const FIntPoint TileSize(FMath::DivideAndRoundUp(Tile.ImageSize.X, Tile.TileCount.X), FMath::DivideAndRoundUp(Tile.ImageSize.Y, Tile.TileCount.Y));
+		// The overlap is rounded up to whole pixels on each side, neighbouring tiles share at least the requested overlap.
+		const FIntPoint OverlapPad(FMath::CeilToInt(TileSize.X * Tile.OverlapRatio), FMath::CeilToInt(TileSize.Y * Tile.OverlapRatio));
+		const FIntPoint Min = Tile.TileIndex * TileSize - OverlapPad;
+		return FIntRect(Min, Min + TileSize + OverlapPad * 2);
+	}
+
+	FIntRect TileViewRectToImageRect(const FIntRect& TileImageRect, const FIntRect& ViewRect, const FIntRect& InRect)
+	{
+		const float ScaleX = float(TileImageRect.Width()) / FMath::Max(ViewRect.Width(), 1);
+		const float ScaleY = float(TileImageRect.Height()) / FMath::Max(ViewRect.Height(), 1);
+
+		FIntRect ImageRect;
+		ImageRect.Min.X = TileImageRect.Min.X + FMath::FloorToInt((InRect.Min.X - ViewRect.Min.X) * ScaleX);
+		ImageRect.Min.Y = TileImageRect.Min.Y + FMath::FloorToInt((InRect.Min.Y - ViewRect.Min.Y) * ScaleY);
+		ImageRect.Max.X = TileImageRect.Min.X + FMath::CeilToInt((InRect.Max.X - ViewRect.Min.X) * ScaleX);
+		ImageRect.Max.Y = TileImageRect.Min.Y + FMath::CeilToInt((InRect.Max.Y - ViewRect.Min.Y) * ScaleY);
+		return ImageRect;
+	}
+
+	float GetTiledScreenCoverage(const FGBufferProcessTile& Tile, const FIntRect& ViewRect, const FIntRect& UnclippedRect)
+	{
+		if (UnclippedRect.Width() <= 0 || UnclippedRect.Height() <= 0)
+		{
+			return 1.0f;
+		}
+
+		FIntRect ImageRect = TileViewRectToImageRect(GetTileImageRect(Tile), ViewRect, UnclippedRect);
+		ImageRect.Clip(FIntRect(FIntPoint::ZeroValue, Tile.ImageSize));
+		if (ImageRect.Width() <= 0 || ImageRect.Height() <= 0)
+		{
+			return 0.0f;
+		}
+
+		const float ImageArea = float(Tile.ImageSize.X) * float(Tile.ImageSize.Y);
+		return FMath::Clamp(float(ImageRect.Width()) * float(ImageRect.Height()) / ImageArea, 0.0f, 1.0f);
+	}
+}
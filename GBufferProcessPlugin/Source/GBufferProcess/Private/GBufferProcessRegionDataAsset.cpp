@@ -0,0 +1,371 @@
+#include "GBufferProcessRegionDataAsset.h"
+#include "GBufferProcessRegionProxy.h"
+#include "GBufferProcessPipelineCache.h"
+#include "GBufferProcessPlugin.h"
+#include "GBufferProcessStreaming.h"
+#include "Materials/MaterialInterface.h"
+#include "Serialization/MemoryWriter.h"
+#include "Serialization/MemoryReader.h"
+#include "HAL/IConsoleManager.h"
+#include "Math/RandomStream.h"
+
+namespace
+{
+	/** Precedes the records in the blob. 16 bytes, so the records stay 16 byte aligned. */
+	struct FGBufferProcessBakedRegionHeader
+	{
+		uint32 Magic;
+		uint32 Version;
+		uint32 RecordSize;
+		uint32 NumRegions;
+	};
+
+	static_assert(sizeof(FGBufferProcessBakedRegionHeader) == 16, "Records must stay 16 byte aligned.");
+
+	const uint32 BakedRegionMagic = 0x52504247; // GBPR
+	const uint32 BakedRegionVersion = 2;
+	/**
+	 * Version 1 records had no stage. They were zeroed before being filled in, so the stage byte of the padding
+	 * reads as PostBasePass, the stage every region was drawn at back then, and they are read as they are.
+	 */
+	const uint32 BakedRegionMinVersion = 1;
+
+	/** Float4 per record in the buffer of the GPU culler. */
+	const int32 BakedRegionStride = sizeof(FGBufferProcessBakedRegion) / sizeof(FVector4);
+
+	bool IsValidBakedRegionBlob(TArrayView<const uint8> InBlob)
+	{
+		if (InBlob.Num() < (int32)sizeof(FGBufferProcessBakedRegionHeader))
+		{
+			return false;
+		}
+
+		const FGBufferProcessBakedRegionHeader& Header = *reinterpret_cast<const FGBufferProcessBakedRegionHeader*>(InBlob.GetData());
+		return Header.Magic == BakedRegionMagic && Header.Version >= BakedRegionMinVersion && Header.Version <= BakedRegionVersion && Header.RecordSize == sizeof(FGBufferProcessBakedRegion)
+			&& InBlob.Num() == sizeof(FGBufferProcessBakedRegionHeader) + Header.NumRegions * sizeof(FGBufferProcessBakedRegion);
+	}
+
+	void GetBakedRegionProxy(const FGBufferProcessBakedRegion& InRegion, uint32 InRegionId, FGBufferProcessRegionProxy& OutProxy)
+	{
+		OutProxy.RegionId = InRegionId;
+		OutProxy.LocalToWorld = InRegion.LocalToWorld;
+		// Negative extent marks unbound regions, as in the GPU culler bounds.
+		OutProxy.WorldBounds = InRegion.BoundsExtent.X < 0.0f ? FBox(ForceInit) : FBox::BuildAABB(FVector(InRegion.BoundsCenter), FVector(InRegion.BoundsExtent));
+		OutProxy.Extent = InRegion.Extent;
+		OutProxy.Shape = InRegion.Shape;
+		OutProxy.Type = InRegion.Type;
+		OutProxy.BlendOp = InRegion.BlendOp;
+		OutProxy.Stage = InRegion.Stage;
+		OutProxy.Priority = InRegion.Priority;
+		OutProxy.Intensity = InRegion.Intensity;
+	}
+}
+
+void FGBufferProcessBakedRegionRun::Init(uint32 InAssetId, TArray<FGBufferProcessBakedRegion, TAlignedHeapAllocator<16>>&& InRecords)
+{
+	AssetId = InAssetId;
+	Records = MoveTemp(InRecords);
+
+	Proxies.SetNum(Records.Num());
+	for (int32 RegionIndex = 0; RegionIndex < Records.Num(); ++RegionIndex)
+	{
+		GetBakedRegionProxy(Records[RegionIndex], HashCombine(AssetId, (uint32)RegionIndex), Proxies[RegionIndex]);
+	}
+}
+
+bool FGBufferProcessBakedRegionRun::UpdateMaterials(FGBufferProcessBakedRegionMaterials&& InMaterials)
+{
+	if (InMaterials.MaterialProxies.OrderIndependentCompareEqual(Materials.MaterialProxies) && InMaterials.LowQualityMaterialProxies.OrderIndependentCompareEqual(Materials.LowQualityMaterialProxies))
+	{
+		return false;
+	}
+	Materials = MoveTemp(InMaterials);
+
+	for (int32 RegionIndex = 0; RegionIndex < Records.Num(); ++RegionIndex)
+	{
+		const FGBufferProcessBakedRegion& Record = Records[RegionIndex];
+		FGBufferProcessRegionProxy& Proxy = Proxies[RegionIndex];
+		Proxy.MaterialProxy = Materials.MaterialProxies.FindRef(GBufferProcess::GetMaterialKernelKey(Record.MaterialIndex, Record.Type, Record.BlendOp));
+		Proxy.LowQualityMaterialProxy = Materials.LowQualityMaterialProxies.FindRef(GBufferProcess::GetMaterialKernelKey(Record.LowQualityMaterialIndex, Record.Type, Record.BlendOp));
+	}
+	return true;
+}
+
+UGBufferProcessRegionDataAsset::UGBufferProcessRegionDataAsset(const FObjectInitializer& ObjectInitializer) : Super(ObjectInitializer)
+{
+}
+
+TArrayView<const FGBufferProcessBakedRegion> UGBufferProcessRegionDataAsset::GetRegions() const
+{
+	if (!IsValidBakedRegionBlob(RegionBlob))
+	{
+		return TArrayView<const FGBufferProcessBakedRegion>();
+	}
+
+	const FGBufferProcessBakedRegionHeader& Header = *reinterpret_cast<const FGBufferProcessBakedRegionHeader*>(RegionBlob.GetData());
+	return TArrayView<const FGBufferProcessBakedRegion>(reinterpret_cast<const FGBufferProcessBakedRegion*>(RegionBlob.GetData() + sizeof(FGBufferProcessBakedRegionHeader)), Header.NumRegions);
+}
+
+void UGBufferProcessRegionDataAsset::SetRegions(TArray<FGBufferProcessBakedRegion>& InRegions, TArray<UMaterialInterface*>&& InMaterials)
+{
+	InRegions.StableSort([](const FGBufferProcessBakedRegion& A, const FGBufferProcessBakedRegion& B)
+	{
+		return A.Priority < B.Priority;
+	});
+
+	FGBufferProcessBakedRegionHeader Header;
+	Header.Magic = BakedRegionMagic;
+	Header.Version = BakedRegionVersion;
+	Header.RecordSize = sizeof(FGBufferProcessBakedRegion);
+	Header.NumRegions = InRegions.Num();
+
+	RegionBlob.SetNumUninitialized(sizeof(FGBufferProcessBakedRegionHeader) + InRegions.Num() * sizeof(FGBufferProcessBakedRegion));
+	FMemory::Memcpy(RegionBlob.GetData(), &Header, sizeof(FGBufferProcessBakedRegionHeader));
+	FMemory::Memcpy(RegionBlob.GetData() + sizeof(FGBufferProcessBakedRegionHeader), InRegions.GetData(), InRegions.Num() * sizeof(FGBufferProcessBakedRegion));
+
+	Materials = MoveTemp(InMaterials);
+	LastReadyMaterials.Reset();
+	LastReadyLowQualityMaterials.Reset();
+	bMaterialKernelsDirty = true;
+}
+
+void UGBufferProcessRegionDataAsset::BakeRegions(TArrayView<const AGBufferProcessActor* const> InRegions)
+{
+	TArray<FGBufferProcessBakedRegion> BakedRegions;
+	TArray<UMaterialInterface*> BakedMaterials;
+	TMap<UMaterialInterface*, uint16> MaterialIndices;
+
+	auto GetMaterialIndex = [&BakedMaterials, &MaterialIndices](UMaterialInterface* InMaterial) -> uint16
+	{
+		if (!InMaterial)
+		{
+			return FGBufferProcessBakedRegion::NoMaterial;
+		}
+		if (const uint16* MaterialIndex = MaterialIndices.Find(InMaterial))
+		{
+			return *MaterialIndex;
+		}
+		return MaterialIndices.Add(InMaterial, (uint16)BakedMaterials.Add(InMaterial));
+	};
+
+	BakedRegions.Reserve(InRegions.Num());
+	for (const AGBufferProcessActor* Region : InRegions)
+	{
+		if (!Region || !Region->Enabled || !Region->Material)
+		{
+			continue;
+		}
+
+		// Leaves room for NoMaterial and the two materials of this region.
+		if (BakedMaterials.Num() + 2 >= FGBufferProcessBakedRegion::NoMaterial)
+		{
+			UE_LOG(GBufferProcessLog, Warning, TEXT("Too many region materials to bake in %s, %s is skipped."), *GetPathName(), *Region->GetPathName());
+			continue;
+		}
+
+		FGBufferProcessBakedRegion& BakedRegion = BakedRegions.AddZeroed_GetRef();
+		const FBox Bounds = Region->GetRegionBounds();
+		if (Bounds.IsValid)
+		{
+			BakedRegion.BoundsCenter = FVector4(Bounds.GetCenter(), 0.0f);
+			BakedRegion.BoundsExtent = FVector4(Bounds.GetExtent(), 0.0f);
+		}
+		else
+		{
+			BakedRegion.BoundsCenter = FVector4(0.0f, 0.0f, 0.0f, 0.0f);
+			BakedRegion.BoundsExtent = FVector4(-1.0f, -1.0f, -1.0f, 0.0f);
+		}
+		BakedRegion.LocalToWorld = Region->GetActorTransform().ToMatrixWithScale();
+		BakedRegion.Extent = Region->Extent;
+		BakedRegion.Priority = Region->Priority;
+		BakedRegion.Intensity = Region->Intensity;
+		BakedRegion.MaterialIndex = GetMaterialIndex(Region->Material);
+		BakedRegion.LowQualityMaterialIndex = GetMaterialIndex(Region->LowQualityMaterial);
+		BakedRegion.Type = Region->Type;
+		BakedRegion.BlendOp = Region->BlendOp;
+		BakedRegion.Shape = Region->Shape;
+		BakedRegion.Stage = Region->Stage;
+	}
+
+	SetRegions(BakedRegions, MoveTemp(BakedMaterials));
+}
+
+void UGBufferProcessRegionDataAsset::UpdateMaterialKernels()
+{
+	if (!bMaterialKernelsDirty)
+	{
+		return;
+	}
+	bMaterialKernelsDirty = false;
+
+	MaterialKernels.Reset();
+	LowQualityMaterialKernels.Reset();
+
+	TSet<uint64> MaterialKeys;
+	TSet<uint64> LowQualityMaterialKeys;
+	for (const FGBufferProcessBakedRegion& BakedRegion : GetRegions())
+	{
+		bool bAlreadyInSet = true;
+		MaterialKeys.Add(GBufferProcess::GetMaterialKernelKey(BakedRegion.MaterialIndex, BakedRegion.Type, BakedRegion.BlendOp), &bAlreadyInSet);
+		if (!bAlreadyInSet)
+		{
+			MaterialKernels.Add({ BakedRegion.MaterialIndex, BakedRegion.Type, BakedRegion.BlendOp });
+		}
+
+		if (BakedRegion.LowQualityMaterialIndex != FGBufferProcessBakedRegion::NoMaterial)
+		{
+			LowQualityMaterialKeys.Add(GBufferProcess::GetMaterialKernelKey(BakedRegion.LowQualityMaterialIndex, BakedRegion.Type, BakedRegion.BlendOp), &bAlreadyInSet);
+			if (!bAlreadyInSet)
+			{
+				LowQualityMaterialKernels.Add({ BakedRegion.LowQualityMaterialIndex, BakedRegion.Type, BakedRegion.BlendOp });
+			}
+		}
+	}
+}
+
+void UGBufferProcessRegionDataAsset::GatherMaterials(ERHIFeatureLevel::Type InFeatureLevel, FGBufferProcessBakedRegionMaterials& OutMaterials)
+{
+	check(IsInGameThread());
+
+	UpdateMaterialKernels();
+	OutMaterials.AssetId = GetUniqueID();
+
+	// Nothing compiled yet for a material leaves its regions without one, they are skipped until its shaders are ready.
+	FGBufferProcessReadyMaterialResolver MaterialResolver(Materials, LastReadyMaterials, InFeatureLevel);
+	for (const FMaterialKernel& Kernel : MaterialKernels)
+	{
+		OutMaterials.MaterialProxies.Add(GBufferProcess::GetMaterialKernelKey(Kernel.MaterialIndex, Kernel.Type, Kernel.BlendOp), MaterialResolver.Resolve(Kernel.MaterialIndex, Kernel.Type, Kernel.BlendOp));
+	}
+
+	FGBufferProcessReadyMaterialResolver LowQualityMaterialResolver(Materials, LastReadyLowQualityMaterials, InFeatureLevel);
+	for (const FMaterialKernel& Kernel : LowQualityMaterialKernels)
+	{
+		OutMaterials.LowQualityMaterialProxies.Add(GBufferProcess::GetMaterialKernelKey(Kernel.MaterialIndex, Kernel.Type, Kernel.BlendOp), LowQualityMaterialResolver.Resolve(Kernel.MaterialIndex, Kernel.Type, Kernel.BlendOp));
+	}
+}
+
+void UGBufferProcessRegionDataAsset::GetStreamingTextures(FGBufferProcessStreamingTextures& OutTextures) const
+{
+	for (const FGBufferProcessBakedRegion& BakedRegion : GetRegions())
+	{
+		// Negative extent marks unbound regions, as in GetBakedRegionProxy.
+		const FBox Bounds = BakedRegion.BoundsExtent.X < 0.0f ? FBox(ForceInit) : FBox::BuildAABB(FVector(BakedRegion.BoundsCenter), FVector(BakedRegion.BoundsExtent));
+		for (const uint16 MaterialIndex : { BakedRegion.MaterialIndex, BakedRegion.LowQualityMaterialIndex })
+		{
+			if (Materials.IsValidIndex(MaterialIndex))
+			{
+				OutTextures.AddRegion(Materials[MaterialIndex], Bounds);
+			}
+		}
+	}
+}
+
+void UGBufferProcessRegionDataAsset::QueuePipelinePrecache(FGBufferProcessPipelinePrecacher& InPrecacher) const
+{
+	// Many regions share a material and kernel, only queue each combination once.
+	TSet<uint64> QueuedKeys;
+	for (const FGBufferProcessBakedRegion& BakedRegion : GetRegions())
+	{
+		for (const uint16 MaterialIndex : { BakedRegion.MaterialIndex, BakedRegion.LowQualityMaterialIndex })
+		{
+			const uint64 Key = GBufferProcess::GetMaterialKernelKey(MaterialIndex, BakedRegion.Type, BakedRegion.BlendOp);
+			if (Materials.IsValidIndex(MaterialIndex) && !QueuedKeys.Contains(Key))
+			{
+				QueuedKeys.Add(Key);
+				InPrecacher.QueueMaterial(Materials[MaterialIndex], BakedRegion.Type, BakedRegion.BlendOp);
+			}
+		}
+	}
+}
+
+void UGBufferProcessRegionDataAsset::SerializeRegions(FArchive& Ar)
+{
+	// The records are raw memory. All supported platforms are little endian, so no byte swapping is done.
+	RegionBlob.BulkSerialize(Ar);
+}
+
+void UGBufferProcessRegionDataAsset::Serialize(FArchive& Ar)
+{
+	Super::Serialize(Ar);
+
+	SerializeRegions(Ar);
+
+	if (Ar.IsLoading())
+	{
+		bMaterialKernelsDirty = true;
+	}
+
+	if (Ar.IsLoading() && RegionBlob.Num() > 0 && !IsValidBakedRegionBlob(RegionBlob))
+	{
+		const uint32 Version = RegionBlob.Num() >= (int32)sizeof(FGBufferProcessBakedRegionHeader) ? reinterpret_cast<const FGBufferProcessBakedRegionHeader*>(RegionBlob.GetData())->Version : 0;
+		UE_LOG(GBufferProcessLog, Warning, TEXT("Baked regions of %s are ignored, the blob is invalid or of unsupported version %u (supported %u to %u). Re-save the level to bake them again."),
+			*GetPathName(), Version, BakedRegionMinVersion, BakedRegionVersion);
+	}
+}
+
+namespace
+{
+	/** Measures how long baked regions take from bytes on disk to the render thread and the GPU culler. */
+	void BenchmarkBakedRegions(const TArray<FString>& Args)
+	{
+		const int32 NumRegions = Args.Num() > 0 ? FMath::Max(FCString::Atoi(*Args[0]), 1) : 50000;
+
+		// Boxes scattered over 2km with a few priorities, so the bake has to sort.
+		FRandomStream RandomStream(NumRegions);
+		TArray<FGBufferProcessBakedRegion> Regions;
+		Regions.SetNumZeroed(NumRegions);
+		for (FGBufferProcessBakedRegion& Region : Regions)
+		{
+			const FVector Center = RandomStream.GetUnitVector() * RandomStream.FRandRange(0.0f, 100000.0f);
+			Region.Extent = FVector(RandomStream.FRandRange(50.0f, 500.0f));
+			Region.BoundsCenter = FVector4(Center, 0.0f);
+			Region.BoundsExtent = FVector4(Region.Extent, 0.0f);
+			Region.LocalToWorld = FTranslationMatrix(Center);
+			Region.Priority = RandomStream.RandRange(0, 7);
+			Region.Intensity = 1.0f;
+			Region.LowQualityMaterialIndex = FGBufferProcessBakedRegion::NoMaterial;
+			Region.Type = EGBufferProcessType::Normal;
+			Region.BlendOp = EGBufferProcessBlendOp::Lerp;
+			Region.Shape = EGBufferProcessShape::Box;
+			Region.Stage = EGBufferProcessStage::PostBasePass;
+		}
+
+		UGBufferProcessRegionDataAsset* SourceAsset = NewObject<UGBufferProcessRegionDataAsset>();
+		SourceAsset->SetRegions(Regions, TArray<UMaterialInterface*>());
+
+		TArray<uint8> SavedBlob;
+		FMemoryWriter Writer(SavedBlob, true);
+		SourceAsset->SerializeRegions(Writer);
+
+		UGBufferProcessRegionDataAsset* LoadedAsset = NewObject<UGBufferProcessRegionDataAsset>();
+
+		const double LoadStartTime = FPlatformTime::Seconds();
+		FMemoryReader Reader(SavedBlob, true);
+		LoadedAsset->SerializeRegions(Reader);
+		const TArrayView<const FGBufferProcessBakedRegion> LoadedRegions = LoadedAsset->GetRegions();
+		const double LoadEndTime = FPlatformTime::Seconds();
+
+		// Done once per registration: the records are copied on the game thread, their proxies are built on the render thread.
+		TArray<FGBufferProcessBakedRegion, TAlignedHeapAllocator<16>> Records;
+		Records.Append(LoadedRegions.GetData(), LoadedRegions.Num());
+		FGBufferProcessBakedRegionRun Run;
+		Run.Init(LoadedAsset->GetUniqueID(), MoveTemp(Records));
+		const double RegisterEndTime = FPlatformTime::Seconds();
+
+		// Same work as FGBufferProcessGPUCuller::UpdateBakedRegions, which uploads the records as they are.
+		TArray<FVector4> BakedRegionsData;
+		BakedRegionsData.SetNumUninitialized(Run.Records.Num() * BakedRegionStride);
+		FMemory::Memcpy(BakedRegionsData.GetData(), Run.Records.GetData(), Run.Records.Num() * sizeof(FGBufferProcessBakedRegion));
+		const double UploadEndTime = FPlatformTime::Seconds();
+
+		UE_LOG(GBufferProcessLog, Display, TEXT("Baked regions: %d of %d loaded, %.1f KB. Load %.3f ms, register %.3f ms, upload %.3f ms."),
+			LoadedRegions.Num(), NumRegions, SavedBlob.Num() / 1024.0f,
+			(LoadEndTime - LoadStartTime) * 1000.0, (RegisterEndTime - LoadEndTime) * 1000.0, (UploadEndTime - RegisterEndTime) * 1000.0);
+	}
+}
+
+static FAutoConsoleCommand GBufferProcessBenchmarkBakedRegionsCmd(
+	TEXT("r.GBufferProcess.BenchmarkBakedRegions"),
+	TEXT("Loads a blob of synthetic baked regions from memory and logs the time taken.\n")
+	TEXT("Usage: r.GBufferProcess.BenchmarkBakedRegions [NumRegions=50000]"),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&BenchmarkBakedRegions));
@@ -0,0 +1,382 @@
+#include "GBufferProcessRegionInstancesComponent.h"
+#include "GBufferProcessSubsystem.h"
+#include "GBufferProcessRegionProxy.h"
+#include "GBufferProcessPipelineCache.h"
+#include "GBufferProcessMaterial.h"
+#include "GBufferProcessStreaming.h"
+#include "Materials/MaterialInterface.h"
+#include "Engine/World.h"
+
+namespace
+{
+	// Half size of an instance shape before the instance transform, matches the default Extent of AGBufferProcessActor.
+	const float InstanceShapeExtent = 100.0f;
+
+	UGBufferProcessSubsystem* GetRegionSubsystem(const UActorComponent* InComponent)
+	{
+		UWorld* World = InComponent->GetWorld();
+		return World ? World->GetSubsystem<UGBufferProcessSubsystem>() : nullptr;
+	}
+}
+
+UGBufferProcessRegionInstancesComponent::UGBufferProcessRegionInstancesComponent(const FObjectInitializer& ObjectInitializer) : Super(ObjectInitializer)
+{
+	PrimaryComponentTick.bCanEverTick = false;
+}
+
+int32 UGBufferProcessRegionInstancesComponent::AddInstance(const FTransform& InstanceTransform, EGBufferProcessShape Shape, EGBufferProcessType Type, EGBufferProcessBlendOp BlendOp, int32 Priority, float Intensity, int32 MaterialIndex)
+{
+	const int32 InstanceIndex = InstanceTransforms.Add(InstanceTransform);
+	InstanceShapes.Add(Shape);
+	InstanceTypes.Add(Type);
+	InstanceBlendOps.Add(BlendOp);
+	InstancePriorities.Add(Priority);
+	InstanceIntensities.Add(Intensity);
+	InstanceMaterialIndices.Add(MaterialIndex);
+	bSortedInstancesDirty = true;
+
+	UGBufferProcessSubsystem* GBufferProcessSubsystem = IsRegistered() ? GetRegionSubsystem(this) : nullptr;
+	if (GBufferProcessSubsystem)
+	{
+		GBufferProcessSubsystem->MarkRegionsChanged();
+		GBufferProcessSubsystem->MarkStreamingTexturesDirty();
+		if (Materials.IsValidIndex(MaterialIndex))
+		{
+			GBufferProcessSubsystem->GetPipelinePrecacher().QueueMaterial(Materials[MaterialIndex], Type, BlendOp);
+		}
+	}
+	return InstanceIndex;
+}
+
+bool UGBufferProcessRegionInstancesComponent::RemoveInstance(int32 InstanceIndex)
+{
+	if (!IsValidInstance(InstanceIndex))
+	{
+		return false;
+	}
+
+	InstanceTransforms.RemoveAt(InstanceIndex);
+	InstanceShapes.RemoveAt(InstanceIndex);
+	InstanceTypes.RemoveAt(InstanceIndex);
+	InstanceBlendOps.RemoveAt(InstanceIndex);
+	InstancePriorities.RemoveAt(InstanceIndex);
+	InstanceIntensities.RemoveAt(InstanceIndex);
+	InstanceMaterialIndices.RemoveAt(InstanceIndex);
+	bSortedInstancesDirty = true;
+
+	UGBufferProcessSubsystem* GBufferProcessSubsystem = IsRegistered() ? GetRegionSubsystem(this) : nullptr;
+	if (GBufferProcessSubsystem)
+	{
+		GBufferProcessSubsystem->MarkRegionsChanged();
+		GBufferProcessSubsystem->MarkStreamingTexturesDirty();
+	}
+	return true;
+}
+
+bool UGBufferProcessRegionInstancesComponent::UpdateInstanceTransform(int32 InstanceIndex, const FTransform& InstanceTransform)
+{
+	if (!IsValidInstance(InstanceIndex))
+	{
+		return false;
+	}
+
+	InstanceTransforms[InstanceIndex] = InstanceTransform;
+	MarkInstanceDirty(InstanceIndex, EGBufferProcessRegionDirtyFlags::Transform);
+	return true;
+}
+
+bool UGBufferProcessRegionInstancesComponent::UpdateInstance(int32 InstanceIndex, int32 Priority, float Intensity, int32 MaterialIndex)
+{
+	if (!IsValidInstance(InstanceIndex))
+	{
+		return false;
+	}
+
+	if (InstancePriorities[InstanceIndex] != Priority)
+	{
+		InstancePriorities[InstanceIndex] = Priority;
+		bSortedInstancesDirty = true;
+		MarkInstancesChanged();
+	}
+	if (InstanceIntensities[InstanceIndex] != Intensity)
+	{
+		InstanceIntensities[InstanceIndex] = Intensity;
+		MarkInstanceDirty(InstanceIndex, EGBufferProcessRegionDirtyFlags::Intensity);
+	}
+
+	if (InstanceMaterialIndices[InstanceIndex] != MaterialIndex)
+	{
+		InstanceMaterialIndices[InstanceIndex] = MaterialIndex;
+		MarkInstanceDirty(InstanceIndex, EGBufferProcessRegionDirtyFlags::Material);
+		UGBufferProcessSubsystem* GBufferProcessSubsystem = IsRegistered() ? GetRegionSubsystem(this) : nullptr;
+		if (GBufferProcessSubsystem && Materials.IsValidIndex(MaterialIndex))
+		{
+			GBufferProcessSubsystem->GetPipelinePrecacher().QueueMaterial(Materials[MaterialIndex], InstanceTypes[InstanceIndex], InstanceBlendOps[InstanceIndex]);
+		}
+	}
+	return true;
+}
+
+void UGBufferProcessRegionInstancesComponent::ClearInstances()
+{
+	InstanceTransforms.Reset();
+	InstanceShapes.Reset();
+	InstanceTypes.Reset();
+	InstanceBlendOps.Reset();
+	InstancePriorities.Reset();
+	InstanceIntensities.Reset();
+	InstanceMaterialIndices.Reset();
+	SortedInstances.Reset();
+	bSortedInstancesDirty = false;
+
+	UGBufferProcessSubsystem* GBufferProcessSubsystem = IsRegistered() ? GetRegionSubsystem(this) : nullptr;
+	if (GBufferProcessSubsystem)
+	{
+		GBufferProcessSubsystem->MarkRegionsChanged();
+		GBufferProcessSubsystem->MarkStreamingTexturesDirty();
+	}
+}
+
+FBox UGBufferProcessRegionInstancesComponent::GetInstanceBounds(int32 InstanceIndex, const FTransform& InstanceToWorld) const
+{
+	switch (InstanceShapes[InstanceIndex])
+	{
+	case EGBufferProcessShape::Box:
+		return FBox(FVector(-InstanceShapeExtent), FVector(InstanceShapeExtent)).TransformBy(InstanceToWorld);
+	case EGBufferProcessShape::Sphere:
+		return FBox::BuildAABB(InstanceToWorld.GetLocation(), FVector(InstanceShapeExtent * InstanceToWorld.GetMaximumAxisScale()));
+	default:
+		return FBox(ForceInit);
+	}
+}
+
+void UGBufferProcessRegionInstancesComponent::UpdateSortedInstances()
+{
+	if (!bSortedInstancesDirty)
+	{
+		return;
+	}
+	bSortedInstancesDirty = false;
+
+	SortedInstances.SetNumUninitialized(InstancePriorities.Num());
+	for (int32 InstanceIndex = 0; InstanceIndex < SortedInstances.Num(); ++InstanceIndex)
+	{
+		SortedInstances[InstanceIndex] = InstanceIndex;
+	}
+
+	const TArray<int32>& Priorities = InstancePriorities;
+	SortedInstances.StableSort([&Priorities](int32 A, int32 B)
+	{
+		return Priorities[A] < Priorities[B];
+	});
+}
+
+void UGBufferProcessRegionInstancesComponent::GatherRegionProxies(ERHIFeatureLevel::Type InFeatureLevel, TArray<FGBufferProcessRegionProxy>& OutProxies)
+{
+	check(IsInGameThread());
+
+	if (!IsVisible() || InstanceTransforms.Num() == 0)
+	{
+		return;
+	}
+
+	UpdateSortedInstances();
+
+	// Materials are resolved once per slot and kernel rather than once per instance.
+	FGBufferProcessReadyMaterialResolver MaterialResolver(Materials, LastReadyMaterials, InFeatureLevel);
+
+	const FTransform& ComponentToWorld = GetComponentTransform();
+
+	OutProxies.Reserve(OutProxies.Num() + SortedInstances.Num());
+	for (int32 InstanceIndex : SortedInstances)
+	{
+		FGBufferProcessRegionProxy Proxy;
+		if (GetInstanceProxy(InstanceIndex, ComponentToWorld, MaterialResolver, Proxy))
+		{
+			OutProxies.Add(Proxy);
+		}
+	}
+}
+
+void UGBufferProcessRegionInstancesComponent::GatherInstanceProxies(ERHIFeatureLevel::Type InFeatureLevel, const TSet<int32>& InstanceIndices, TArray<FGBufferProcessRegionProxy>& OutProxies)
+{
+	check(IsInGameThread());
+
+	if (!IsVisible())
+	{
+		return;
+	}
+
+	FGBufferProcessReadyMaterialResolver MaterialResolver(Materials, LastReadyMaterials, InFeatureLevel);
+
+	const FTransform& ComponentToWorld = GetComponentTransform();
+	for (int32 InstanceIndex : InstanceIndices)
+	{
+		FGBufferProcessRegionProxy Proxy;
+		if (IsValidInstance(InstanceIndex) && GetInstanceProxy(InstanceIndex, ComponentToWorld, MaterialResolver, Proxy))
+		{
+			OutProxies.Add(Proxy);
+		}
+	}
+}
+
+bool UGBufferProcessRegionInstancesComponent::GetInstanceProxy(int32 InstanceIndex, const FTransform& ComponentToWorld, FGBufferProcessReadyMaterialResolver& MaterialResolver, FGBufferProcessRegionProxy& OutProxy) const
+{
+	const EGBufferProcessType Type = InstanceTypes[InstanceIndex];
+	const EGBufferProcessBlendOp BlendOp = InstanceBlendOps[InstanceIndex];
+
+	// Nothing compiled yet for this material, skip the instance until its shaders are ready.
+	const FMaterialRenderProxy* MaterialProxy = MaterialResolver.Resolve(InstanceMaterialIndices[InstanceIndex], Type, BlendOp);
+	if (!MaterialProxy)
+	{
+		return false;
+	}
+
+	const FTransform InstanceToWorld = InstanceTransforms[InstanceIndex] * ComponentToWorld;
+
+	OutProxy.RegionId = GetInstanceRegionId(InstanceIndex);
+	OutProxy.LocalToWorld = InstanceToWorld.ToMatrixWithScale();
+	OutProxy.WorldBounds = GetInstanceBounds(InstanceIndex, InstanceToWorld);
+	OutProxy.Extent = FVector(InstanceShapeExtent);
+	OutProxy.Shape = InstanceShapes[InstanceIndex];
+	OutProxy.Type = Type;
+	OutProxy.BlendOp = BlendOp;
+	OutProxy.Stage = Stage;
+	OutProxy.Priority = InstancePriorities[InstanceIndex];
+	OutProxy.Intensity = InstanceIntensities[InstanceIndex];
+	OutProxy.MaterialProxy = MaterialProxy;
+	return true;
+}
+
+void UGBufferProcessRegionInstancesComponent::GetStreamingTextures(FGBufferProcessStreamingTextures& OutTextures) const
+{
+	if (!IsVisible())
+	{
+		return;
+	}
+
+	const FTransform& ComponentToWorld = GetComponentTransform();
+	for (int32 InstanceIndex = 0; InstanceIndex < InstanceTransforms.Num(); ++InstanceIndex)
+	{
+		const int32 MaterialIndex = InstanceMaterialIndices[InstanceIndex];
+		if (Materials.IsValidIndex(MaterialIndex))
+		{
+			OutTextures.AddRegion(Materials[MaterialIndex], GetInstanceBounds(InstanceIndex, InstanceTransforms[InstanceIndex] * ComponentToWorld));
+		}
+	}
+}
+
+void UGBufferProcessRegionInstancesComponent::QueuePipelinePrecache() const
+{
+	UGBufferProcessSubsystem* GBufferProcessSubsystem = GetRegionSubsystem(this);
+	if (!GBufferProcessSubsystem)
+	{
+		return;
+	}
+
+	for (int32 InstanceIndex = 0; InstanceIndex < InstanceMaterialIndices.Num(); ++InstanceIndex)
+	{
+		const int32 MaterialIndex = InstanceMaterialIndices[InstanceIndex];
+		if (Materials.IsValidIndex(MaterialIndex))
+		{
+			// The precacher ignores duplicates.
+			GBufferProcessSubsystem->GetPipelinePrecacher().QueueMaterial(Materials[MaterialIndex], InstanceTypes[InstanceIndex], InstanceBlendOps[InstanceIndex]);
+		}
+	}
+}
+
+void UGBufferProcessRegionInstancesComponent::OnRegister()
+{
+	Super::OnRegister();
+
+	UGBufferProcessSubsystem* GBufferProcessSubsystem = GetRegionSubsystem(this);
+	if (GBufferProcessSubsystem)
+	{
+		GBufferProcessSubsystem->RegisterInstancesComponent(this);
+	}
+}
+
+void UGBufferProcessRegionInstancesComponent::OnUnregister()
+{
+	UGBufferProcessSubsystem* GBufferProcessSubsystem = GetRegionSubsystem(this);
+	if (GBufferProcessSubsystem)
+	{
+		GBufferProcessSubsystem->UnregisterInstancesComponent(this);
+	}
+
+	Super::OnUnregister();
+}
+
+void UGBufferProcessRegionInstancesComponent::OnUpdateTransform(EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport)
+{
+	Super::OnUpdateTransform(UpdateTransformFlags, Teleport);
+
+	// Instance transforms are relative to the component, all of them moved.
+	UGBufferProcessSubsystem* GBufferProcessSubsystem = IsRegistered() ? GetRegionSubsystem(this) : nullptr;
+	if (GBufferProcessSubsystem)
+	{
+		for (int32 InstanceIndex = 0; InstanceIndex < InstanceTransforms.Num(); ++InstanceIndex)
+		{
+			GBufferProcessSubsystem->MarkInstanceDirty(this, InstanceIndex, EGBufferProcessRegionDirtyFlags::Transform);
+		}
+	}
+}
+
+void UGBufferProcessRegionInstancesComponent::OnVisibilityChanged()
+{
+	Super::OnVisibilityChanged();
+
+	MarkInstancesChanged();
+}
+
+void UGBufferProcessRegionInstancesComponent::OnHiddenInGameChanged()
+{
+	Super::OnHiddenInGameChanged();
+
+	MarkInstancesChanged();
+}
+
+void UGBufferProcessRegionInstancesComponent::MarkInstanceDirty(int32 InstanceIndex, EGBufferProcessRegionDirtyFlags InFlags)
+{
+	UGBufferProcessSubsystem* GBufferProcessSubsystem = IsRegistered() ? GetRegionSubsystem(this) : nullptr;
+	if (GBufferProcessSubsystem)
+	{
+		GBufferProcessSubsystem->MarkInstanceDirty(this, InstanceIndex, InFlags);
+	}
+}
+
+void UGBufferProcessRegionInstancesComponent::MarkInstancesChanged()
+{
+	UGBufferProcessSubsystem* GBufferProcessSubsystem = IsRegistered() ? GetRegionSubsystem(this) : nullptr;
+	if (GBufferProcessSubsystem)
+	{
+		GBufferProcessSubsystem->MarkRegionsChanged();
+	}
+}
+
+void UGBufferProcessRegionInstancesComponent::ValidateInstanceArrays()
+{
+	int32 NumInstances = InstanceTransforms.Num();
+	NumInstances = FMath::Min(NumInstances, InstanceShapes.Num());
+	NumInstances = FMath::Min(NumInstances, InstanceTypes.Num());
+	NumInstances = FMath::Min(NumInstances, InstanceBlendOps.Num());
+	NumInstances = FMath::Min(NumInstances, InstancePriorities.Num());
+	NumInstances = FMath::Min(NumInstances, InstanceIntensities.Num());
+	NumInstances = FMath::Min(NumInstances, InstanceMaterialIndices.Num());
+
+	InstanceTransforms.SetNum(NumInstances);
+	InstanceShapes.SetNum(NumInstances);
+	InstanceTypes.SetNum(NumInstances);
+	InstanceBlendOps.SetNum(NumInstances);
+	InstancePriorities.SetNum(NumInstances);
+	InstanceIntensities.SetNum(NumInstances);
+	InstanceMaterialIndices.SetNum(NumInstances);
+	bSortedInstancesDirty = true;
+}
+
+void UGBufferProcessRegionInstancesComponent::PostLoad()
+{
+	Super::PostLoad();
+
+	ValidateInstanceArrays();
+}
@@ -2,8 +2,12 @@
 #include "GBufferProcessSceneViewExtension.h"
 #include "RHI.h"
 #include "SceneView.h"
+#include "GBufferProcessPlugin.h"
 #include "GBufferProcessSubsystem.h"
 #include "GBufferProcessMaterial.h"
+#include "GBufferProcessPipelineCache.h"
+#include "GBufferProcessGPUCulling.h"
+#include "GBufferProcessVolumeProxy.h"
 #include "CommonRenderResources.h"
 #include "Containers/DynamicRHIResourceArray.h"
 #include "Engine/World.h"
@@ -11,15 +15,68 @@
 #include "ScreenPass.h"
 #include "SceneRendering.h"
 #include "PostProcess/PostProcessing.h"
+#include "PostProcess/PostProcessMaterial.h"
 #include "RenderGraph.h"
+#include "RenderGraphUtils.h"
 #include "PixelShaderUtils.h"
 #include "DeferredShadingRenderer.h"
+#include "MeshPassProcessor.h"
+#include "Algo/AllOf.h"
 
 // Set this to 1 to clip pixels outside of bounding box.
 #define CLIP_PIXELS_OUTSIDE_AABB 1
 
-//Set this to 1 to see the clipping region.
-#define GBufferProcess_SHADER_DISPLAY_BOUNDING_RECT 0
+DECLARE_DWORD_COUNTER_STAT(TEXT("Regions in base pass render pass"), STAT_GBufferProcess_InBasePassRegions, STATGROUP_GBufferProcess);
+
+static TAutoConsoleVariable<int32> CVarGBufferProcessInBasePassRenderPass(
+	TEXT("r.GBufferProcess.InBasePassRenderPass"),
+	0,
+	TEXT("Draw regions whose kernel doesn't read its target inside the base pass render pass, so the G-buffer is not stored and reloaded for them.\n")
+	TEXT("A region that reads its target, and the regions of the same target after it, are still drawn in their own passes.\n")
+	TEXT("GPU culling is not used while this is on. Needs the PostRenderBasePassInRenderPass engine hook, see UE4EngineFileModifyLog.txt.\n")
+	TEXT("Ignored while the base pass is recorded in parallel (r.ParallelBasePass), which RDG can't merge passes into.\n")
+	TEXT("0: off (default)\n")
+	TEXT("1: on, for tile based and bandwidth limited GPUs"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarGBufferProcessParallelRecording(
+	TEXT("r.GBufferProcess.ParallelRecording"),
+	1,
+	TEXT("Record runs of region draws into command lists on task threads, submitted in priority order.\n")
+	TEXT("Under r.GBufferProcess.BudgetMs a parallel run is timed as a whole and its time split between its regions.\n")
+	TEXT("0: off\n")
+	TEXT("1: on, if the RHI supports parallel execution (default)"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarGBufferProcessParallelRecordingDrawsPerChunk(
+	TEXT("r.GBufferProcess.ParallelRecording.DrawsPerChunk"),
+	32,
+	TEXT("Minimum region draws recorded by one task, at most one task per worker thread. Runs of at most this many draws are recorded on the render thread."),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarGBufferProcessVisualize(
+	TEXT("r.GBufferProcess.Visualize"),
+	0,
+	TEXT("Overlays the region draws of each pixel after tonemapping, to find the regions that burn fill rate.\n")
+	TEXT("While this is on r.GBufferProcess.InBasePassRenderPass and r.GBufferProcess.GPUCulling are ignored: every region is culled on the\n")
+	TEXT("render thread and drawn in its own passes, so the frame being visualized can be slower than the one without it.\n")
+	TEXT("0: off (default)\n")
+	TEXT("1: overdraw, number of region draws that shaded the pixel\n")
+	TEXT("2: cost, pixel shader instructions of those draws summed. Instruction counts are editor only data, cooked builds show overdraw instead\n")
+	TEXT("3: wasted pixels, red where the draws shaded the pixel without changing it, e.g. zero intensity or outside the shapes of clustered regions"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<float> CVarGBufferProcessVisualizeMaxOverdraw(
+	TEXT("r.GBufferProcess.Visualize.MaxOverdraw"),
+	8.0f,
+	TEXT("Overdraw shown in red by r.GBufferProcess.Visualize 1."),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<float> CVarGBufferProcessVisualizeMaxCost(
+	TEXT("r.GBufferProcess.Visualize.MaxCost"),
+	2000.0f,
+	TEXT("Summed instructions shown in red by r.GBufferProcess.Visualize 2."),
+	ECVF_RenderThreadSafe);
 
 namespace
 {
@@ -79,122 +136,47 @@ namespace
 		return Parameters;
 	}
 
-	void GetPixelSpaceBoundingRect(const FSceneView& InView, const FVector& InBoxCenter, const FVector& InBoxExtents, FIntRect& OutViewport, float& OutMaxDepth, float& OutMinDepth)
+	int32 GetVisualizeMode()
 	{
-		OutViewport = FIntRect(INT_MAX, INT_MAX, -INT_MAX, -INT_MAX);
-		// 8 corners of the bounding box. To be multiplied by box extent and offset by the center.
-		const int NumCorners = 8;
-		const FVector Verts[NumCorners] = {
-			FVector(1, 1, 1),
-			FVector(1, 1,-1),
-			FVector(1,-1, 1),
-			FVector(1,-1,-1),
-			FVector(-1, 1, 1),
-			FVector(-1, 1,-1),
-			FVector(-1,-1, 1),
-			FVector(-1,-1,-1) };
-
-		for (int32 Index = 0; Index < NumCorners; Index++)
+		const int32 VisualizeMode = FMath::Clamp(CVarGBufferProcessVisualize.GetValueOnRenderThread(), 0, 3);
+#if !WITH_EDITORONLY_DATA
+		// Cooked shaders have no instruction count, the cost would be 0 everywhere.
+		if (VisualizeMode == 2)
 		{
-			// Project bounding box vertecies into screen space.
-			const FVector WorldVert = InBoxCenter + (Verts[Index] * InBoxExtents);
-			FVector2D PixelVert;
-			FVector4 ScreenSpaceCoordinate = InView.WorldToScreen(WorldVert);
-
-			OutMaxDepth = FMath::Max<float>(ScreenSpaceCoordinate.W, OutMaxDepth);
-			OutMinDepth = FMath::Min<float>(ScreenSpaceCoordinate.W, OutMinDepth);
-
-			if (InView.ScreenToPixel(ScreenSpaceCoordinate, PixelVert))
+			static bool bWarned = false;
+			if (!bWarned)
 			{
-				// Update screen-space bounding box with with transformed vert.
-				OutViewport.Min.X = FMath::Min<int32>(OutViewport.Min.X, PixelVert.X);
-				OutViewport.Min.Y = FMath::Min<int32>(OutViewport.Min.Y, PixelVert.Y);
-
-				OutViewport.Max.X = FMath::Max<int32>(OutViewport.Max.X, PixelVert.X);
-				OutViewport.Max.Y = FMath::Max<int32>(OutViewport.Max.Y, PixelVert.Y);
+				UE_LOG(GBufferProcessLog, Warning, TEXT("r.GBufferProcess.Visualize 2 needs the instruction counts of editor builds, showing overdraw instead."));
+				bWarned = true;
 			}
+			return 1;
 		}
+#endif
+		return VisualizeMode;
 	}
 
-	// Function that calculates all points of intersection between plane and bounding box. Resulting points are unsorted.
-	void CalculatePlaneAABBIntersectionPoints(const FPlane& Plane, const FVector& BoxCenter, const FVector& BoxExtents, TArray<FVector>& OutPoints)
+	/**
+	 * True if the renderer records the base pass in parallel, as it decides in RenderBasePassInternal. Its passes begin their
+	 * render pass themselves (SkipRenderPass), so RDG never merges a later pass into it.
+	 */
+	bool IsParallelBasePassEnabled()
 	{
-		const FVector MaxCorner = BoxCenter + BoxExtents;
-
-		const FVector Verts[3][4] = {
-			{
-				// X Direction
-				FVector(-1, -1, -1),
-				FVector(-1,  1, -1),
-				FVector(-1, -1,  1),
-				FVector(-1,  1,  1),
-			},
-			{
-				// Y Direction
-				FVector(-1, -1, -1),
-				FVector( 1, -1, -1),
-				FVector( 1, -1,  1),
-				FVector(-1, -1,  1),
-			},
-			{
-				// Z Direction
-				FVector(-1, -1, -1),
-				FVector( 1, -1, -1),
-				FVector( 1,  1, -1),
-				FVector(-1,  1, -1),
-			}
-		};
-
-		FVector Intersection;
-		FVector Start;
-		FVector End;
-
-		for (int RunningAxis_Dir = 0; RunningAxis_Dir < 3; RunningAxis_Dir++)
-		{
-			const FVector *CornerLocations = Verts[RunningAxis_Dir];
-			for (int RunningCorner = 0; RunningCorner < 4; RunningCorner++)
-			{
-				Start = BoxCenter + BoxExtents * CornerLocations[RunningCorner];
-				End = FVector(Start.X, Start.Y, Start.Z);
-				End[RunningAxis_Dir] = MaxCorner[RunningAxis_Dir];
-				if (FMath::SegmentPlaneIntersection(Start, End, Plane, Intersection))
-				{
-					OutPoints.Add(Intersection);
-				}
-			}
-		}
+		static const TConsoleVariableData<int32>* CVarParallelBasePass = IConsoleManager::Get().FindTConsoleVariableDataInt(TEXT("r.ParallelBasePass"));
+		return GRHICommandList.UseParallelAlgorithms() && CVarParallelBasePass && CVarParallelBasePass->GetValueOnRenderThread() != 0;
 	}
 
-	// Takes in an existing viewport and updates it with an intersection bounding rectangle.
-	void UpdateMinMaxWithFrustrumAABBIntersection(const FSceneView& InView, const FVector& InBoxCenter, const FVector& InBoxExtents, FIntRect& OutViewportToUpdate, float& OutMaxDepthToUpdate)
+	bool IsInBasePassRenderPassEnabled()
 	{
-		TArray<FVector> Points;
-		Points.Reserve(6);
-		CalculatePlaneAABBIntersectionPoints(InView.ViewFrustum.Planes[4], InBoxCenter, InBoxExtents, Points);
-		if (Points.Num() == 0)
-		{
-			return;
-		}
-
-		for (FVector Point : Points)
-		{
-			// Project bounding box vertecies into screen space.
-			FVector4 ScreenSpaceCoordinate = InView.WorldToScreen(Point);
-			FVector4 ScreenSpaceCoordinateScaled = ScreenSpaceCoordinate * 1.0 / ScreenSpaceCoordinate.W;
-
-			OutMaxDepthToUpdate = FMath::Max<float>(ScreenSpaceCoordinate.W, OutMaxDepthToUpdate);
-			FVector2D PixelVert;
-
-			if (InView.ScreenToPixel(ScreenSpaceCoordinate, PixelVert))
-			{
-				// Update screen-space bounding box with with transformed vert.
-				OutViewportToUpdate.Min.X = FMath::Min<int32>(OutViewportToUpdate.Min.X, PixelVert.X);
-				OutViewportToUpdate.Min.Y = FMath::Min<int32>(OutViewportToUpdate.Min.Y, PixelVert.Y);
+		// The visualization replays the draws of RenderScheduledRegions. With a parallel base pass the in base pass regions
+		// would get a render pass of their own anyway, PostRenderBasePass draws them like the other regions instead.
+		return CVarGBufferProcessInBasePassRenderPass.GetValueOnRenderThread() != 0 && GetVisualizeMode() == 0 && !IsParallelBasePassEnabled();
+	}
 
-				OutViewportToUpdate.Max.X = FMath::Max<int32>(OutViewportToUpdate.Max.X, PixelVert.X);
-				OutViewportToUpdate.Max.Y = FMath::Max<int32>(OutViewportToUpdate.Max.Y, PixelVert.Y);
-			}
-		}
+	const TCHAR* GetStageName(EGBufferProcessStage Stage)
+	{
+		static const TCHAR* StageNames[] = { TEXT("PostBasePass"), TEXT("PreLighting"), TEXT("PostLighting") };
+		static_assert(UE_ARRAY_COUNT(StageNames) == (int32)EGBufferProcessStage::MAX, "Ensure that all EGBufferProcessStage values are accounted for.");
+		return StageNames[(int32)Stage];
 	}
 
 	bool ViewSupportsRegions(const FSceneView& View)
@@ -203,9 +185,9 @@ namespace
 				View.Family->EngineShowFlags.PostProcessMaterial;
 	}
 
-	template<typename TSetupFunction>
+	template<typename TRHICommandList, typename TSetupFunction>
 	void DrawScreenPass(
-		FRHICommandListImmediate& RHICmdList,
+		TRHICommandList& RHICmdList,
 		const FSceneView& View,
 		const FScreenPassTextureViewport& OutputViewport,
 		const FScreenPassTextureViewport& InputViewport,
@@ -242,261 +224,1845 @@ namespace
 			DrawRectangleFlags);
 	}
 
-	FVector4 Clamp(const FVector4 & VectorToClamp, float Min, float Max)
+	/** Copy of a target read by decode/encode kernels, created on first use and shared by the regions of the view. */
+	FRDGTextureRef GetBackTexture(FRDGBuilder& GraphBuilder, TStaticArray<FRDGTextureRef, MaxSimultaneousRenderTargets>& BackTextures, int32 TargetIndex, FRDGTextureRef TargetTexture)
 	{
-		return FVector4(FMath::Clamp(VectorToClamp.X, Min, Max),
-						FMath::Clamp(VectorToClamp.Y, Min, Max),
-						FMath::Clamp(VectorToClamp.Z, Min, Max),
-						FMath::Clamp(VectorToClamp.W, Min, Max));
+		FRDGTextureRef& BackTexture = BackTextures[TargetIndex];
+		if (!BackTexture)
+		{
+			// 创建临时的RDG纹理描述
+			FRDGTextureDesc BackTextureDesc = TargetTexture->Desc;
+			BackTextureDesc.Reset();
+			BackTextureDesc.ClearValue = FClearValueBinding::Black;
+			BackTextureDesc.Flags |= (TexCreate_RenderTargetable | TexCreate_ShaderResource);
+			BackTexture = GraphBuilder.CreateTexture(BackTextureDesc, TEXT("GBufferProcessBackTexture"));
+		}
+		return BackTexture;
 	}
-}
 
-FGBufferProcessSceneViewExtension::FGBufferProcessSceneViewExtension(const FAutoRegister& AutoRegister, UGBufferProcessSubsystem* InWorldSubsystem) :
-	FSceneViewExtensionBase(AutoRegister), WorldSubsystem(InWorldSubsystem)
-{
-}
+	/** Copies the rect of a target into its back texture, pixels outside of it are left undefined. */
+	void AddCopyTargetPass(FRDGBuilder& GraphBuilder, const FViewInfo& View, FRDGTextureRef TargetTexture, FRDGTextureRef BackTexture, const FIntRect& Rect)
+	{
+		FGlobalShaderMap* GlobalShaderMap = View.ShaderMap;
+		TShaderMapRef<FGBufferProcessScreenPassVS> ScreenPassVS(GlobalShaderMap);
+		TShaderMapRef<FCopyTexturePS> CopyPixelShader(GlobalShaderMap);
+		FRHIBlendState* DefaultBlendState = FScreenPassPipelineState::FDefaultBlendState::GetRHI();
+		const FScreenPassTextureViewport RectViewport(TargetTexture->Desc.Extent, Rect);
 
-static bool TryGetShaders(ERHIFeatureLevel::Type InFeatureLevel, FMaterialRenderProxy const*& OutMaterialProxy, FMaterial const*& OutMaterial, FMaterialShaders& OutShaders)
-{
-	while (OutMaterialProxy)
+		FCopyTexturePS::FParameters* Parameters = GraphBuilder.AllocParameters<FCopyTexturePS::FParameters>();
+		Parameters->SrcTexture = TargetTexture;
+		Parameters->SrcTextureSampler = TStaticSamplerState<SF_Point>::GetRHI();
+		Parameters->RenderTargets[0] = FRenderTargetBinding(BackTexture, ERenderTargetLoadAction::ENoAction);
+
+		GraphBuilder.AddPass(
+			RDG_EVENT_NAME("CopyTarget %dx%d", Rect.Width(), Rect.Height()),
+			Parameters,
+			ERDGPassFlags::Raster,
+			[&View, ScreenPassVS, CopyPixelShader, RectViewport, Parameters, DefaultBlendState](FRHICommandListImmediate& RHICmdList)
+			{
+				DrawScreenPass(
+					RHICmdList,
+					View,
+					RectViewport,
+					RectViewport,
+					FScreenPassPipelineState(ScreenPassVS, CopyPixelShader, DefaultBlendState),
+					[&](FRHICommandListImmediate&)
+					{
+						SetShaderParameters(RHICmdList, CopyPixelShader, CopyPixelShader.GetPixelShader(), *Parameters);
+					});
+			});
+	}
+
+	/** Texture the weighted regions of a target are summed into, created and cleared on first use. */
+	FRDGTextureRef GetAccumulationTexture(FRDGBuilder& GraphBuilder, TStaticArray<FRDGTextureRef, MaxSimultaneousRenderTargets>& AccumulationTextures, int32 TargetIndex, FRDGTextureRef TargetTexture)
 	{
-		OutMaterial = OutMaterialProxy->GetMaterialNoFallback(InFeatureLevel);
-		if (OutMaterial && OutMaterial->IsLightFunction())
+		FRDGTextureRef& AccumulationTexture = AccumulationTextures[TargetIndex];
+		if (!AccumulationTexture)
 		{
-			FMaterialShaderTypes ShaderTypes;
-			ShaderTypes.AddShaderType<FMaterialGraphRewriteNormalPS>();
-			if (OutMaterial->TryGetShaders(ShaderTypes, nullptr, OutShaders))
-			{
-				return true;
-			}
+			AccumulationTexture = GraphBuilder.CreateTexture(GBufferProcess::GetWeightedAccumulationDesc(TargetTexture->Desc.Extent), TEXT("GBufferProcessWeightedAccumulation"));
+			AddClearRenderTargetPass(GraphBuilder, AccumulationTexture);
 		}
-		OutMaterialProxy = OutMaterialProxy->GetFallback(InFeatureLevel);
+		return AccumulationTexture;
 	}
-	return false;
-}
 
+	/** Blends the weighted regions summed into AccumulationTexture over the target, once all of them are drawn. Only Rect is resolved. */
+	void AddResolveWeightedPass(
+		FRDGBuilder& GraphBuilder,
+		const FViewInfo& View,
+		EGBufferProcessType Type,
+		FRDGTextureRef TargetTexture,
+		FRDGTextureRef AccumulationTexture,
+		TStaticArray<FRDGTextureRef, MaxSimultaneousRenderTargets>& BackTextures,
+		const FIntRect& Rect)
+	{
+		const FGBufferProcessRegionKernel& Kernel = GBufferProcess::GetRegionKernel(Type, EGBufferProcessBlendOp::Weighted);
 
-#ifdef MY_CHANGE_WITH_ENGINE
-void FGBufferProcessSceneViewExtension::PostRenderBasePass(FRDGBuilder& GraphBuilder, FViewInfo& InView)
-{
-	if (!WorldSubsystem){
-		return;
-	}
+		// Encoded normals are decoded from a copy of the target.
+		FRDGTextureRef BackTexture = nullptr;
+		if (Type == EGBufferProcessType::Normal)
+		{
+			BackTexture = GetBackTexture(GraphBuilder, BackTextures, Kernel.TargetIndex, TargetTexture);
+			AddCopyTargetPass(GraphBuilder, View, TargetTexture, BackTexture, Rect);
+		}
 
-	AGBufferProcessActor* ModifyActor = WorldSubsystem->GetEffectModifyActor();
-	if (!ModifyActor){
-		return;
-	}
+		FGlobalShaderMap* GlobalShaderMap = View.ShaderMap;
+		TShaderMapRef<FGBufferProcessScreenPassVS> ScreenPassVS(GlobalShaderMap);
+		FGBufferProcessResolveWeightedPS::FPermutationDomain PermutationVector;
+		PermutationVector.Set<FGBufferProcessResolveWeightedPS::FTargetTypeDim>(Type);
+		TShaderMapRef<FGBufferProcessResolveWeightedPS> ResolvePixelShader(GlobalShaderMap, PermutationVector);
 
-	UMaterialInterface* ModifyMaterial = ModifyActor->Material;
-	if (!ModifyMaterial) {
-		return;
-	}
+		FGBufferProcessResolveWeightedPS::FParameters* Parameters = GraphBuilder.AllocParameters<FGBufferProcessResolveWeightedPS::FParameters>();
+		Parameters->AccumulationTexture = AccumulationTexture;
+		Parameters->SrcTexture = BackTexture;
+		Parameters->RenderTargets[0] = FRenderTargetBinding(TargetTexture, ERenderTargetLoadAction::ELoad);
 
-	FMaterialRenderProxy* ModifyMaterialProxy = ModifyMaterial->GetRenderProxy();
-	if (!ModifyMaterialProxy) {
-		return;
+		FRHIBlendState* ResolveBlendState = Kernel.GetResolveBlendState();
+		const FScreenPassTextureViewport RectViewport(TargetTexture->Desc.Extent, Rect);
+
+		GraphBuilder.AddPass(
+			RDG_EVENT_NAME("ResolveWeighted Type=%d %dx%d", (int32)Type, Rect.Width(), Rect.Height()),
+			Parameters,
+			ERDGPassFlags::Raster,
+			[&View, ScreenPassVS, ResolvePixelShader, RectViewport, Parameters, ResolveBlendState](FRHICommandListImmediate& RHICmdList)
+			{
+				DrawScreenPass(
+					RHICmdList,
+					View,
+					RectViewport,
+					RectViewport,
+					FScreenPassPipelineState(ScreenPassVS, ResolvePixelShader, ResolveBlendState),
+					[&](FRHICommandListImmediate&)
+					{
+						SetShaderParameters(RHICmdList, ResolvePixelShader, ResolvePixelShader.GetPixelShader(), *Parameters);
+					});
+			});
 	}
 
-	FGlobalShaderMap* GlobalShaderMap = GetGlobalShaderMap(GMaxRHIFeatureLevel);
-	FSceneRenderTargets& SceneContext = FSceneRenderTargets::Get(GraphBuilder.RHICmdList);
-	FIntPoint RT_Size = SceneContext.GetBufferSizeXY();
+	/** Draws the visible regions of a batch with the arguments written by FGBufferProcessCullRegionsCS. */
+	template<typename TSetupFunction>
+	void DrawRegionBatch(
+		FRHICommandListImmediate& RHICmdList,
+		const FIntRect& ViewRect,
+		const FScreenPassPipelineState& PipelineState,
+		const TShaderRef<FGBufferProcessRegionVS>& VertexShader,
+		const FGBufferProcessRegionBatchParameters& Parameters,
+		uint32 DrawIndirectArgsOffset,
+		TSetupFunction SetupFunction)
+	{
+		PipelineState.Validate();
 
-	TStaticArray<FRDGTextureRef, MaxSimultaneousRenderTargets> BasePassTextures;
-	int32 GBufferDIndex = INDEX_NONE;
-	uint32 BasePassTextureCount = SceneContext.GetGBufferRenderTargets(GraphBuilder, BasePassTextures, GBufferDIndex);
-	TArrayView<FRDGTextureRef> BasePassTexturesView = MakeArrayView(BasePassTextures.GetData(), BasePassTextureCount);
+		// The region rects are in NDC of the view.
+		RHICmdList.SetViewport(ViewRect.Min.X, ViewRect.Min.Y, 0.0f, ViewRect.Max.X, ViewRect.Max.Y, 1.0f);
 
-	// 创建默认的混合状态
-	FRHIBlendState* DefaultBlendState = FScreenPassPipelineState::FDefaultBlendState::GetRHI();
+		SetScreenPassPipelineState(RHICmdList, PipelineState);
 
-	// 绘制的默认ViewportSize
-	const FScreenPassTextureViewport RegionViewport(SceneContext.GetBufferSizeXY());
+		SetShaderParameters(RHICmdList, VertexShader, VertexShader.GetVertexShader(), Parameters.VS);
+		SetupFunction(RHICmdList);
 
-	// Step 1 : copy normal到临时buffer
-#pragma region COPY
-		// 创建临时的RDG纹理描述
-	FRDGTextureDesc NormalTextureDesc = BasePassTexturesView[1]->Desc;
-	NormalTextureDesc.Reset();
-	NormalTextureDesc.ClearValue = FClearValueBinding::Black;
-	NormalTextureDesc.Flags |= (TexCreate_RenderTargetable | TexCreate_ShaderResource);
-	// 创建临时的RDG纹理.
-	FRDGTextureRef BackRDGNormalTexture = GraphBuilder.CreateTexture(NormalTextureDesc, TEXT("BackRDGNormalTexture"));
+		RHICmdList.DrawPrimitiveIndirect(Parameters.DrawIndirectArgs->GetIndirectRHICallBuffer(), DrawIndirectArgsOffset);
+	}
 
-	//创建Copy PS Shader的参数
-	FCopyTexturePS::FParameters* Parameters = GraphBuilder.AllocParameters<FCopyTexturePS::FParameters>();
+	bool IsParallelRecordingEnabled()
+	{
+		return CVarGBufferProcessParallelRecording.GetValueOnRenderThread() != 0 &&
+				GRHICommandList.UseParallelAlgorithms() &&
+				GRHISupportsParallelRHIExecute;
+	}
 
-	TShaderMapRef<FGBufferProcessScreenPassVS> ScreenPassVS(GlobalShaderMap);
-	TShaderMapRef<FCopyTexturePS> CopyPixelShader(GlobalShaderMap);
+	int32 GetParallelRecordingDrawsPerChunk()
+	{
+		return FMath::Max(CVarGBufferProcessParallelRecordingDrawsPerChunk.GetValueOnRenderThread(), 1);
+	}
 
-	// 设置Normal为SRV，同时设置Point Sample
-	Parameters->SrcTexture = BasePassTexturesView[1];
-	Parameters->SrcTextureSampler = TStaticSamplerState<SF_Point>::GetRHI();
+	/** Scene depth the region passes bind read only, for the depth test of volume proxies. Null if they are off. */
+	FRDGTextureRef GetVolumeProxySceneDepth(FRDGBuilder& GraphBuilder)
+	{
+		if (!GBufferProcess::IsVolumeProxyEnabled())
+		{
+			return nullptr;
+		}
+		return GraphBuilder.RegisterExternalTexture(FSceneRenderTargets::Get(GraphBuilder.RHICmdList).SceneDepthZ);
+	}
 
-	// 设置RTV
-	Parameters->RenderTargets[0] = FRenderTargetBinding(BackRDGNormalTexture, ERenderTargetLoadAction::EClear);
+	/** One region draw. Everything is resolved on the render thread, so it can be recorded on any thread. */
+	struct FRegionDraw
+	{
+		TShaderRef<FGBufferProcessRegionPS> PixelShader;
+		const FMaterial* Material = nullptr;
+		const FMaterialRenderProxy* MaterialProxy = nullptr;
+		FRHIBlendState* BlendState = nullptr;
+		FIntRect Rect;
+		float Intensity = 1.0f;
+
+		/** Copy of the target, only read by decode/encode kernels. */
+		FRDGTextureRef SrcTexture = nullptr;
+
+		/** Box and Sphere draw their proxy geometry, anything else the rect. */
+		EGBufferProcessShape VolumeShape = EGBufferProcessShape::Unbound;
+		FMatrix VolumeToTranslatedWorld;
+		FRHIRasterizerState* VolumeRasterizerState = nullptr;
+
+		/** First region slot and number of slots of a clustered draw, no slots if the draw is not clustered. */
+		FIntPoint ClusterRegionRange = FIntPoint::ZeroValue;
+	};
+
+	/** Shared by the region draws of a pass. */
+	struct FRegionDrawContext
+	{
+		const FViewInfo* View = nullptr;
+		TShaderRef<FGBufferProcessScreenPassVS> ScreenPassVS;
+		TShaderRef<FGBufferProcessVolumeVS> VolumeVS;
+		FIntPoint ViewportExtent = FIntPoint::ZeroValue;
 
-	GraphBuilder.AddPass(
-		RDG_EVENT_NAME("CopyNormal"),
-		Parameters,
-		ERDGPassFlags::Raster,
-		[&InView, ScreenPassVS, CopyPixelShader, RegionViewport, Parameters, DefaultBlendState](FRHICommandListImmediate& RHICmdList)
+		/** Cluster grid of the view, only set for passes with clustered draws. */
+		TRDGUniformBufferRef<FGBufferProcessClusterParameters> Clusters = nullptr;
+	};
+
+	FRegionDrawContext GetRegionDrawContext(const FViewInfo& View, FIntPoint ViewportExtent, TRDGUniformBufferRef<FGBufferProcessClusterParameters> Clusters = nullptr)
+	{
+		FGlobalShaderMap* GlobalShaderMap = GetGlobalShaderMap(GMaxRHIFeatureLevel);
+
+		FRegionDrawContext Context;
+		Context.View = &View;
+		Context.ScreenPassVS = TShaderMapRef<FGBufferProcessScreenPassVS>(GlobalShaderMap);
+		Context.VolumeVS = TShaderMapRef<FGBufferProcessVolumeVS>(GlobalShaderMap);
+		Context.ViewportExtent = ViewportExtent;
+		Context.Clusters = Clusters;
+		return Context;
+	}
+
+	/**
+	 * Resolves the shaders of a region. Returns false if none is compiled yet.
+	 * bVolumeProxy is only set for passes with the scene depth bound.
+	 * ClusterSlot is the slot of the region in the cluster grid for the clustered permutation, INDEX_NONE otherwise.
+	 */
+	bool InitRegionDraw(
+		const FViewInfo& View,
+		const FGBufferProcessRegionProxy& Region,
+		const FGBufferProcessScheduledRegion& ScheduledRegion,
+		int32 PermutationId,
+		FRHIBlendState* BlendState,
+		bool bVolumeProxy,
+		int32 ClusterSlot,
+		FRegionDraw& OutDraw)
+	{
+		const FMaterialRenderProxy* MaterialRenderProxy = ScheduledRegion.Quality == EGBufferProcessQuality::Low
+			? Region.LowQualityMaterialProxy
+			: Region.MaterialProxy;
+
+		FMaterialShaders MaterialShaders;
+		const FMaterial* MaterialForRendering = nullptr;
+		if (!GBufferProcess::TryGetShaders(View.GetFeatureLevel(), PermutationId, MaterialRenderProxy, MaterialForRendering, MaterialShaders))
 		{
-			DrawScreenPass(
-				RHICmdList,
-				InView,
-				RegionViewport,
-				RegionViewport,
-				FScreenPassPipelineState(ScreenPassVS, CopyPixelShader, DefaultBlendState),
-				[&](FRHICommandListImmediate&)
-				{
-					SetShaderParameters(RHICmdList, CopyPixelShader, CopyPixelShader.GetPixelShader(), *Parameters);
-				});
-		});
-#pragma endregion
+			return false;
+		}
 
-	// Step 2 : 临时Normal Buffer写回 GBuffer Normal上
-#pragma region REWRITE
-	//创建Rewrite PS Shader的参数
-	const auto FeatureLevel = InView.GetFeatureLevel();
-	const FMaterialRenderProxy* MaterialRenderProxy = nullptr;
-	const FMaterial* MaterialResource = &ModifyMaterialProxy->GetMaterialWithFallback(FeatureLevel, MaterialRenderProxy);
-	MaterialRenderProxy = MaterialRenderProxy ? MaterialRenderProxy : ModifyMaterialProxy;
+		TShaderRef<FGBufferProcessRegionPS> RegionPsShader;
+		MaterialShaders.TryGetPixelShader(RegionPsShader);
+		if (!RegionPsShader.IsValid())
+		{
+			return false;
+		}
 
-	typename FMaterialGraphRewriteNormalPS::FPermutationDomain PermutationVector;
-	PermutationVector.Set<typename FMaterialGraphRewriteNormalPS::FPermutationTest>(true);
+		OutDraw.PixelShader = RegionPsShader;
+		OutDraw.Material = MaterialForRendering;
+		OutDraw.MaterialProxy = MaterialRenderProxy;
+		OutDraw.BlendState = BlendState;
+		OutDraw.Rect = ScheduledRegion.Rect;
+		OutDraw.Intensity = Region.Intensity;
 
-	FMaterialGraphRewriteNormalPS::FParameters* RewriteParameters =
-		GraphBuilder.AllocParameters<FMaterialGraphRewriteNormalPS::FParameters>();
+		if (ClusterSlot != INDEX_NONE)
+		{
+			// The shape of clustered regions is tested per pixel against the scene position.
+			OutDraw.ClusterRegionRange = FIntPoint(ClusterSlot, 1);
+			return true;
+		}
 
-	FMaterialShaders MaterialShaders;
-	const FMaterial* MaterialForRendering = nullptr;
-	if (!TryGetShaders(FeatureLevel, MaterialRenderProxy, MaterialForRendering, MaterialShaders))
-	{
-		return;
+		if (bVolumeProxy && GBufferProcess::ShouldDrawVolumeProxy(View, Region))
+		{
+			OutDraw.VolumeShape = Region.Shape;
+			OutDraw.VolumeToTranslatedWorld = GBufferProcess::GetVolumeToTranslatedWorld(View, Region);
+			OutDraw.VolumeRasterizerState = GBufferProcess::GetVolumeRasterizerState(View, Region);
+		}
+		return true;
 	}
 
-	TShaderRef<FMaterialGraphRewriteNormalPS> RewritePsShader;
-	MaterialShaders.TryGetPixelShader(RewritePsShader);
-	if (!RewritePsShader.IsValid())
+	/**
+	 * Appends a clustered draw to the previous one if it follows its slots with the same shaders and blend.
+	 * The combined blend of the regions covering a pixel is the same as drawing them one after the other.
+	 * The merged rect is the union of the rects, so a weighted resolve over the union of the drawn rects still covers it,
+	 * and pixels of the union outside of every region are rejected by the shape test of the clustered kernel.
+	 */
+	bool TryMergeClusteredDraw(FRegionDraw& Previous, const FRegionDraw& Draw)
 	{
-		return;
+		if (Previous.ClusterRegionRange.Y == 0 || Draw.ClusterRegionRange.Y == 0 ||
+			Previous.ClusterRegionRange.X + Previous.ClusterRegionRange.Y != Draw.ClusterRegionRange.X ||
+			Previous.MaterialProxy != Draw.MaterialProxy ||
+			Previous.Material != Draw.Material ||
+			Previous.PixelShader.GetShader() != Draw.PixelShader.GetShader() ||
+			Previous.BlendState != Draw.BlendState)
+		{
+			return false;
+		}
+
+		Previous.ClusterRegionRange.Y += Draw.ClusterRegionRange.Y;
+		Previous.Rect.Union(Draw.Rect);
+		return true;
 	}
 
-	// 设置RTV为 Gbuffer normal
-	RewriteParameters->RenderTargets[0] = FRenderTargetBinding(BasePassTexturesView[1], ERenderTargetLoadAction::ELoad);
+	/** Draws the proxy geometry or the rect of a region draw with PixelShader. SetupFunction sets the parameters of the pixel shader. */
+	template<typename TRHICommandList, typename TSetupFunction>
+	void DrawRegionGeometry(
+		TRHICommandList& RHICmdList,
+		const FRegionDrawContext& Context,
+		const FRegionDraw& Draw,
+		const TShaderRef<FShader>& PixelShader,
+		FRHIBlendState* BlendState,
+		TSetupFunction SetupFunction)
+	{
+		const FViewInfo& View = *Context.View;
 
-	GraphBuilder.AddPass(
-		RDG_EVENT_NAME("RewriteNormal"),
-		RewriteParameters,
-		ERDGPassFlags::Raster,
-		[&InView, ScreenPassVS, RewritePsShader, MaterialResource, MaterialRenderProxy, RegionViewport, RewriteParameters, DefaultBlendState](FRHICommandListImmediate& RHICmdList)
+		if (Draw.VolumeShape != EGBufferProcessShape::Unbound)
+		{
+			// The proxy is projected by the view. The rect scissors it, decode/encode kernels only have a copy of the rect.
+			RHICmdList.SetViewport(View.ViewRect.Min.X, View.ViewRect.Min.Y, 0.0f, View.ViewRect.Max.X, View.ViewRect.Max.Y, 1.0f);
+			RHICmdList.SetScissorRect(true, Draw.Rect.Min.X, Draw.Rect.Min.Y, Draw.Rect.Max.X, Draw.Rect.Max.Y);
+
+			FGraphicsPipelineStateInitializer GraphicsPSOInit;
+			RHICmdList.ApplyCachedRenderTargets(GraphicsPSOInit);
+			GBufferProcess::InitVolumePipeline(GraphicsPSOInit, Context.VolumeVS.GetVertexShader(), PixelShader.GetPixelShader(), BlendState, Draw.VolumeRasterizerState);
+			SetGraphicsPipelineState(RHICmdList, GraphicsPSOInit);
+
+			FGBufferProcessVolumeVS::FParameters VolumeParameters;
+			VolumeParameters.View = View.ViewUniformBuffer;
+			VolumeParameters.VolumeToTranslatedWorld = Draw.VolumeToTranslatedWorld;
+			SetShaderParameters(RHICmdList, Context.VolumeVS, Context.VolumeVS.GetVertexShader(), VolumeParameters);
+			SetupFunction(RHICmdList);
+
+			GBufferProcess::GetVolumeGeometry().DrawShape(RHICmdList, Draw.VolumeShape);
+			RHICmdList.SetScissorRect(false, 0, 0, 0, 0);
+		}
+		else
 		{
+			const FScreenPassTextureViewport RegionRectViewport(Context.ViewportExtent, Draw.Rect);
 			DrawScreenPass(
 				RHICmdList,
-				InView,
-				RegionViewport,
-				RegionViewport,
-				FScreenPassPipelineState(ScreenPassVS, RewritePsShader, DefaultBlendState),
-				[&InView, ScreenPassVS, RewritePsShader, MaterialResource, MaterialRenderProxy](FRHICommandListImmediate& RHICmdList)
-				{
-					RewritePsShader->SetParameters(RHICmdList, InView, MaterialRenderProxy, *MaterialResource);
-				});
-		});
-#pragma endregion
-
-#if 0
-	// 取得GbufferData
-	const auto FeatureLevel = InView.GetFeatureLevel();
-	FGlobalShaderMap* GlobalShaderMap = GetGlobalShaderMap(GMaxRHIFeatureLevel);
-	FSceneRenderTargets& SceneContext = FSceneRenderTargets::Get(GraphBuilder.RHICmdList);
-	FIntPoint RT_Size = SceneContext.GetBufferSizeXY();
+				View,
+				RegionRectViewport,
+				RegionRectViewport,
+				FScreenPassPipelineState(Context.ScreenPassVS, PixelShader, BlendState),
+				SetupFunction);
+		}
+	}
 
-	TStaticArray<FRDGTextureRef, MaxSimultaneousRenderTargets> BasePassTextures;
-	int32 GBufferDIndex = INDEX_NONE;
-	uint32 BasePassTextureCount = SceneContext.GetGBufferRenderTargets(GraphBuilder, BasePassTextures, GBufferDIndex);
-	TArrayView<FRDGTextureRef> BasePassTexturesView = MakeArrayView(BasePassTextures.GetData(), BasePassTextureCount);
+	template<typename TRHICommandList>
+	void DrawRegion(TRHICommandList& RHICmdList, const FRegionDrawContext& Context, const FRegionDraw& Draw)
+	{
+		const FViewInfo& View = *Context.View;
+		FRHITexture* SrcTexture = Draw.SrcTexture ? Draw.SrcTexture->GetRHI() : nullptr;
 
-	// 创建默认的混合状态
-	FRHIBlendState* DefaultBlendState = FScreenPassPipelineState::FDefaultBlendState::GetRHI();
+		DrawRegionGeometry(RHICmdList, Context, Draw, Draw.PixelShader, Draw.BlendState,
+			[&View, &Context, &Draw, SrcTexture](TRHICommandList& InRHICmdList)
+			{
+				Draw.PixelShader->SetParameters(InRHICmdList, View, Draw.MaterialProxy, *Draw.Material, Draw.Intensity, SrcTexture);
+				if (Draw.ClusterRegionRange.Y > 0)
+				{
+					Draw.PixelShader->SetClusterParameters(InRHICmdList, Context.Clusters->GetRHI(), Draw.ClusterRegionRange);
+				}
+			});
+	}
 
-	// 绘制的默认ViewportSize
-	const FScreenPassTextureViewport RegionViewport(SceneContext.GetBufferSizeXY());
+	/**
+	 * Adds a raster pass that draws Draws in order. A timed pass begins its render pass itself, between the timing queries,
+	 * so that the queries measure the whole pass rather than draws within a render pass, see FGBufferProcessScheduler.
+	 */
+	template<typename TPassParameters>
+	void AddRegionDrawsRasterPass(FRDGBuilder& GraphBuilder, FRDGEventName&& PassName, TPassParameters* PassParameters, const FRegionDrawContext& Context, TArray<FRegionDraw>&& Draws, const FGBufferProcessPassTiming& Timing)
+	{
+		GraphBuilder.AddPass(
+			MoveTemp(PassName),
+			PassParameters,
+			Timing.IsValid() ? ERDGPassFlags::Raster | ERDGPassFlags::SkipRenderPass : ERDGPassFlags::Raster,
+			[Context, PassParameters, Timing, Draws = MoveTemp(Draws)](FRHICommandListImmediate& RHICmdList)
+			{
+				if (Timing.IsValid())
+				{
+					RHICmdList.EndRenderQuery(Timing.BeginQuery);
+					RHICmdList.BeginRenderPass(GetRenderPassInfo(PassParameters), TEXT("GBufferProcessRegionsTimed"));
+				}
 
-	// Step 1 : copy normal到临时buffer
-#pragma region COPY
-		// 创建临时的RDG纹理描述
-		FRDGTextureDesc NormalTextureDesc = BasePassTexturesView[1]->Desc;
-		NormalTextureDesc.Reset();
-		NormalTextureDesc.ClearValue = FClearValueBinding::Black;
-		NormalTextureDesc.Flags |= (TexCreate_RenderTargetable| TexCreate_ShaderResource);
-		// 创建临时的RDG纹理.
-		FRDGTextureRef BackRDGNormalTexture = GraphBuilder.CreateTexture(NormalTextureDesc, TEXT("BackRDGNormalTexture"));
+				for (const FRegionDraw& Draw : Draws)
+				{
+					DrawRegion(RHICmdList, Context, Draw);
+				}
 
-		//创建Copy PS Shader的参数
-		FCopyTexturePS::FParameters* Parameters = GraphBuilder.AllocParameters<FCopyTexturePS::FParameters>();
+				if (Timing.IsValid())
+				{
+					RHICmdList.EndRenderPass();
+					RHICmdList.EndRenderQuery(Timing.EndQuery);
+				}
+			});
+	}
 
-		TShaderMapRef<FGBufferModityScreenPassVS> ScreenPassVS(GlobalShaderMap);
-		TShaderMapRef<FCopyTexturePS> CopyPixelShader(GlobalShaderMap);
+	/**
+	 * Records one chunk of a run of region draws into its own command list and render pass.
+	 * The pixel shader bindings are gathered on the render thread, the task only reads the draws and their bindings.
+	 */
+	class FRecordRegionDrawsTask
+	{
+	public:
+		FRecordRegionDrawsTask(
+			FRHICommandList& InRHICmdList,
+			const FRHIRenderPassInfo& InRenderPassInfo,
+			const FRegionDrawContext& InContext,
+			TArray<FRegionDraw>&& InDraws,
+			TArray<FMeshDrawShaderBindings>&& InShaderBindings)
+			: RHICmdList(InRHICmdList)
+			, RenderPassInfo(InRenderPassInfo)
+			, Context(InContext)
+			, Draws(MoveTemp(InDraws))
+			, ShaderBindings(MoveTemp(InShaderBindings))
+		{
+		}
 
-		// 设置Normal为SRV，同时设置Point Sample
-		Parameters->SrcTexture = BasePassTexturesView[1];
-		Parameters->SrcTextureSampler = TStaticSamplerState<SF_Point>::GetRHI();
+		FORCEINLINE TStatId GetStatId() const
+		{
+			RETURN_QUICK_DECLARE_CYCLE_STAT(FGBufferProcessRecordRegionDrawsTask, STATGROUP_TaskGraphTasks);
+		}
 
-		// 设置RTV
-		Parameters->RenderTargets[0] = FRenderTargetBinding(BackRDGNormalTexture, ERenderTargetLoadAction::EClear);
+		static ENamedThreads::Type GetDesiredThread() { return ENamedThreads::AnyHiPriThreadNormalTask; }
+		static ESubsequentsMode::Type GetSubsequentsMode() { return ESubsequentsMode::TrackSubsequents; }
 
-		GraphBuilder.AddPass(
-			RDG_EVENT_NAME("CopyNormal"),
-			Parameters,
-			ERDGPassFlags::Raster,
-			[&InView, ScreenPassVS, CopyPixelShader, RegionViewport, Parameters, DefaultBlendState](FRHICommandListImmediate& RHICmdList)
+		void DoTask(ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent)
+		{
+			RHICmdList.BeginRenderPass(RenderPassInfo, TEXT("GBufferProcessRegionsParallel"));
+			for (int32 DrawIndex = 0; DrawIndex < Draws.Num(); ++DrawIndex)
 			{
-				DrawScreenPass(
-					RHICmdList,
-					InView,
-					RegionViewport,
-					RegionViewport,
-					FScreenPassPipelineState(ScreenPassVS, CopyPixelShader, DefaultBlendState),
-					[&](FRHICommandListImmediate&)
+				const FRegionDraw& Draw = Draws[DrawIndex];
+				const FMeshDrawShaderBindings& DrawShaderBindings = ShaderBindings[DrawIndex];
+				DrawRegionGeometry(RHICmdList, Context, Draw, Draw.PixelShader, Draw.BlendState,
+					[&Draw, &DrawShaderBindings](FRHICommandList& InRHICmdList)
 					{
-						SetShaderParameters(RHICmdList, CopyPixelShader, CopyPixelShader.GetPixelShader(), *Parameters);
+						FBoundShaderStateInput BoundShaders;
+						BoundShaders.PixelShaderRHI = Draw.PixelShader.GetPixelShader();
+						DrawShaderBindings.SetOnCommandList(InRHICmdList, BoundShaders);
 					});
-			});
-#pragma endregion
-
-	// Step 2 : 临时Normal Buffer写回 GBuffer Normal上
-#pragma region REWRITE
-		//创建Rewrite PS Shader的参数
-		FRewritePS::FParameters* RewriteParameters = GraphBuilder.AllocParameters<FRewritePS::FParameters>();
-
-		TShaderMapRef<FRewritePS> RewritePixelShader(GlobalShaderMap);
+			}
+			RHICmdList.EndRenderPass();
+			RHICmdList.HandleRTThreadTaskCompletion(MyCompletionGraphEvent);
+		}
 
-		// 设置Normal为SRV，同时设置Point Sample
-		RewriteParameters->SrcTexture = BackRDGNormalTexture;
-		RewriteParameters->SrcTextureSampler = TStaticSamplerState<SF_Point>::GetRHI();
+	private:
+		FRHICommandList& RHICmdList;
+		FRHIRenderPassInfo RenderPassInfo;
+		FRegionDrawContext Context;
+		TArray<FRegionDraw> Draws;
+		TArray<FMeshDrawShaderBindings> ShaderBindings;
+	};
+
+	/**
+	 * Records a run of region draws in chunks on task threads, like the parallel mesh draw command path.
+	 * Chunks only depend on the draw count and are submitted in chunk order, so the GPU draws in priority order whichever
+	 * task finishes first.
+	 *
+	 * Thread safety: the tasks never touch a material proxy. Its uniform expressions are evaluated and its bindings gathered
+	 * here on the render thread, see FGBufferProcessRegionPS::GetShaderBindings. A run with stale uniform expressions, e.g.
+	 * right after a shader map changed, is recorded on the render thread instead.
+	 *
+	 * Each command list has to begin its own render pass, the 4.27 RHI has no render pass shared by parallel command lists
+	 * (the parallel base pass does the same). The run is split in at most one chunk per task graph worker so the number of
+	 * render passes doesn't grow with the number of draws.
+	 */
+	void RecordRegionDrawsInParallel(
+		FRHICommandListImmediate& RHICmdList,
+		const FRHIRenderPassInfo& RenderPassInfo,
+		const FRegionDrawContext& Context,
+		TArrayView<const FRegionDraw> Draws,
+		int32 DrawsPerChunk)
+	{
+		const FViewInfo& View = *Context.View;
+		const ERHIFeatureLevel::Type FeatureLevel = View.GetFeatureLevel();
 
-		// 设置RTV为 Gbuffer normal
-		RewriteParameters->RenderTargets[0] = FRenderTargetBinding(BasePassTexturesView[1], ERenderTargetLoadAction::ELoad);
+		FMaterialRenderProxy::UpdateDeferredCachedUniformExpressions();
+		const bool bUniformExpressionsUpToDate = Algo::AllOf(Draws, [FeatureLevel](const FRegionDraw& Draw)
+		{
+			return Draw.MaterialProxy->UniformExpressionCache[FeatureLevel].bUpToDate;
+		});
+		if (!bUniformExpressionsUpToDate)
+		{
+			RHICmdList.BeginRenderPass(RenderPassInfo, TEXT("GBufferProcessRegions"));
+			for (const FRegionDraw& Draw : Draws)
+			{
+				DrawRegion(RHICmdList, Context, Draw);
+			}
+			RHICmdList.EndRenderPass();
+			return;
+		}
+
+		const FScene* Scene = View.Family->Scene ? View.Family->Scene->GetRenderScene() : nullptr;
+		FRHIUniformBuffer* Clusters = Context.Clusters ? Context.Clusters->GetRHI() : nullptr;
+
+		TArray<FMeshDrawShaderBindings> ShaderBindings;
+		ShaderBindings.SetNum(Draws.Num());
+		for (int32 DrawIndex = 0; DrawIndex < Draws.Num(); ++DrawIndex)
+		{
+			const FRegionDraw& Draw = Draws[DrawIndex];
+
+			FMeshProcessorShaders Shaders;
+			Shaders.PixelShader = Draw.PixelShader;
+			ShaderBindings[DrawIndex].Initialize(Shaders);
+
+			int32 DataOffset = 0;
+			FMeshDrawSingleShaderBindings PixelShaderBindings = ShaderBindings[DrawIndex].GetSingleShaderBindings(SF_Pixel, DataOffset);
+			Draw.PixelShader->GetShaderBindings(
+				Scene,
+				View,
+				Draw.MaterialProxy,
+				*Draw.Material,
+				Draw.Intensity,
+				Draw.SrcTexture ? Draw.SrcTexture->GetRHI() : nullptr,
+				Draw.ClusterRegionRange.Y > 0 ? Clusters : nullptr,
+				Draw.ClusterRegionRange,
+				PixelShaderBindings);
+		}
+
+		const int32 MaxChunks = FMath::Max(FTaskGraphInterface::Get().GetNumWorkerThreads(), 1);
+		const int32 NumChunks = FMath::Min(FMath::DivideAndRoundUp(Draws.Num(), DrawsPerChunk), MaxChunks);
+		const int32 DrawsPerTask = FMath::DivideAndRoundUp(Draws.Num(), NumChunks);
+
+		TArray<FRHICommandList*, TInlineAllocator<16>> CommandLists;
+		TArray<FGraphEventRef, TInlineAllocator<16>> CompletionEvents;
+		TArray<int32, TInlineAllocator<16>> NumDraws;
+		CommandLists.Reserve(NumChunks);
+		CompletionEvents.Reserve(NumChunks);
+		NumDraws.Reserve(NumChunks);
+
+		for (int32 FirstDraw = 0; FirstDraw < Draws.Num(); FirstDraw += DrawsPerTask)
+		{
+			const int32 NumChunkDraws = FMath::Min(DrawsPerTask, Draws.Num() - FirstDraw);
+
+			TArray<FMeshDrawShaderBindings> ChunkShaderBindings;
+			ChunkShaderBindings.Reserve(NumChunkDraws);
+			for (int32 DrawIndex = FirstDraw; DrawIndex < FirstDraw + NumChunkDraws; ++DrawIndex)
+			{
+				ChunkShaderBindings.Add(MoveTemp(ShaderBindings[DrawIndex]));
+			}
+
+			FRHICommandList* CommandList = new FRHICommandList(RHICmdList.GetGPUMask());
+			CompletionEvents.Add(TGraphTask<FRecordRegionDrawsTask>::CreateTask(nullptr, ENamedThreads::GetRenderThread())
+				.ConstructAndDispatchWhenReady(*CommandList, RenderPassInfo, Context, TArray<FRegionDraw>(Draws.GetData() + FirstDraw, NumChunkDraws), MoveTemp(ChunkShaderBindings)));
+			CommandLists.Add(CommandList);
+			NumDraws.Add(NumChunkDraws);
+		}
+
+		RHICmdList.QueueParallelAsyncCommandListSubmit(CompletionEvents.GetData(), false, CommandLists.GetData(), NumDraws.GetData(), CommandLists.Num(), DrawsPerChunk, false);
+	}
+
+	FVector4 Clamp(const FVector4 & VectorToClamp, float Min, float Max)
+	{
+		return FVector4(FMath::Clamp(VectorToClamp.X, Min, Max),
+						FMath::Clamp(VectorToClamp.Y, Min, Max),
+						FMath::Clamp(VectorToClamp.Z, Min, Max),
+						FMath::Clamp(VectorToClamp.W, Min, Max));
+	}
+}
+
+FGBufferProcessSceneViewExtension::FGBufferProcessSceneViewExtension(const FAutoRegister& AutoRegister, UGBufferProcessSubsystem* InWorldSubsystem) :
+	FSceneViewExtensionBase(AutoRegister), WorldSubsystem(InWorldSubsystem)
+{
+}
+
+void FGBufferProcessSceneViewExtension::BeginRenderViewFamily(FSceneViewFamily& InViewFamily)
+{
+	FGBufferProcessGatheredRegions Regions;
+	TArray<FGBufferProcessRegionProxy> DirtyRegions;
+	TArray<FGBufferProcessPrecacheRequest> PrecacheRequests;
+	TArray<uint32> DirtyRegionIds;
+	TOptional<FGBufferProcessTile> Tile;
+	bool bRegionsChanged = true;
+	if (WorldSubsystem && InViewFamily.Scene && InViewFamily.Scene->GetWorld() == WorldSubsystem->GetWorld() && InViewFamily.Views.Num() > 0)
+	{
+		WorldSubsystem->GetPipelinePrecacher().PopReadyMaterials(InViewFamily.GetFeatureLevel(), PrecacheRequests);
+		if (PrecacheRequests.Num() > 0)
+		{
+			// Regions waiting for these materials are gathered from now on.
+			WorldSubsystem->MarkRegionsChanged();
+		}
+
+		// While no region was added, removed or reordered, the render thread keeps its regions and only the dirty ones are gathered.
+		const uint32 RegionsGeneration = WorldSubsystem->GetRegionsGeneration();
+		bRegionsChanged = RegionsGeneration != GatheredRegionsGeneration || InViewFamily.GetFeatureLevel() != GatheredFeatureLevel;
+		if (bRegionsChanged)
+		{
+			WorldSubsystem->GatherRegions(InViewFamily.Views[0]->ViewLocation, Regions);
+			GatheredRegionsGeneration = RegionsGeneration;
+			GatheredFeatureLevel = InViewFamily.GetFeatureLevel();
+		}
+		else
+		{
+			WorldSubsystem->GatherDirtyRegionProxies(InViewFamily.Views[0]->ViewLocation, DirtyRegions);
+		}
+		WorldSubsystem->PopDirtyRegionIds(DirtyRegionIds);
+		Tile = WorldSubsystem->GetRenderTile();
+	}
+	else
+	{
+		// View families of other worlds draw no regions, the next one of this world has to gather them again.
+		GatheredRegionsGeneration = 0;
+	}
+
+	TSharedRef<FGBufferProcessSceneViewExtension, ESPMode::ThreadSafe> Extension = StaticCastSharedRef<FGBufferProcessSceneViewExtension>(AsShared());
+	ENQUEUE_RENDER_COMMAND(GBufferProcessSetRegions)(
+		[Extension, bRegionsChanged, Regions = MoveTemp(Regions), DirtyRegions = MoveTemp(DirtyRegions), PrecacheRequests = MoveTemp(PrecacheRequests), DirtyRegionIds = MoveTemp(DirtyRegionIds), Tile, NumViews = InViewFamily.Views.Num()](FRHICommandListImmediate&) mutable
+		{
+			if (bRegionsChanged)
+			{
+				Extension->SetRegions(MoveTemp(Regions));
+			}
+			else
+			{
+				Extension->UpdateRegionsInPlace(DirtyRegions);
+			}
+			// Kept until the GPU culler runs, other view families may not cull on the GPU.
+			Extension->RenderThreadDirtyRegionIds.Append(DirtyRegionIds);
+			Extension->RenderThreadTile = Tile;
+			Extension->RenderThreadPrecacheRequests.Append(PrecacheRequests);
+			// Entries of views that never reached post processing are dropped with the frame.
+			Extension->RenderThreadStageRegions.Reset();
+			Extension->RenderThreadStageRegions.Reserve(NumViews);
+		});
+}
+
+void FGBufferProcessSceneViewExtension::AddBakedRegions(const UGBufferProcessRegionDataAsset* InRegionData)
+{
+	check(IsInGameThread());
+
+	// Copied once, the render thread keeps the records while the asset is registered.
+	const TArrayView<const FGBufferProcessBakedRegion> Regions = InRegionData->GetRegions();
+	TArray<FGBufferProcessBakedRegion, TAlignedHeapAllocator<16>> Records;
+	Records.Append(Regions.GetData(), Regions.Num());
+
+	TSharedRef<FGBufferProcessSceneViewExtension, ESPMode::ThreadSafe> Extension = StaticCastSharedRef<FGBufferProcessSceneViewExtension>(AsShared());
+	ENQUEUE_RENDER_COMMAND(GBufferProcessAddBakedRegions)(
+		[Extension, AssetId = InRegionData->GetUniqueID(), Records = MoveTemp(Records)](FRHICommandListImmediate&) mutable
+		{
+			Extension->RenderThreadBakedRuns.AddDefaulted_GetRef().Init(AssetId, MoveTemp(Records));
+			Extension->OnBakedRunsChanged();
+		});
+}
+
+void FGBufferProcessSceneViewExtension::RemoveBakedRegions(const UGBufferProcessRegionDataAsset* InRegionData)
+{
+	check(IsInGameThread());
+
+	TSharedRef<FGBufferProcessSceneViewExtension, ESPMode::ThreadSafe> Extension = StaticCastSharedRef<FGBufferProcessSceneViewExtension>(AsShared());
+	ENQUEUE_RENDER_COMMAND(GBufferProcessRemoveBakedRegions)(
+		[Extension, AssetId = InRegionData->GetUniqueID()](FRHICommandListImmediate&)
+		{
+			Extension->RenderThreadBakedRuns.RemoveAll([AssetId](const FGBufferProcessBakedRegionRun& BakedRun)
+			{
+				return BakedRun.AssetId == AssetId;
+			});
+			Extension->OnBakedRunsChanged();
+		});
+}
+
+void FGBufferProcessSceneViewExtension::OnBakedRunsChanged()
+{
+	check(IsInRenderingThread());
+
+	int32 BakedRegionIndex = 0;
+	for (FGBufferProcessBakedRegionRun& BakedRun : RenderThreadBakedRuns)
+	{
+		for (FGBufferProcessRegionProxy& Proxy : BakedRun.Proxies)
+		{
+			Proxy.BakedRegionIndex = BakedRegionIndex++;
+		}
+	}
+	bRenderThreadBakedRunsDirty = true;
+
+	// Registering a baked region asset changes the regions generation, the next view family of the world sets them again.
+	RenderThreadRegions.Reset();
+	RenderThreadRegionsHash = 0;
+	RenderThreadStageMask = 0;
+}
+
+void FGBufferProcessSceneViewExtension::SetRegions(FGBufferProcessGatheredRegions&& InRegions)
+{
+	check(IsInRenderingThread());
+
+	RenderThreadDynamicRegions = MoveTemp(InRegions.Proxies);
+	RenderThreadRegionIndices.Reset();
+
+	// Each run is sorted by ascending priority, the next region to draw is the first one of a run.
+	struct FRunCursor
+	{
+		const FGBufferProcessRegionProxy* Next;
+		const FGBufferProcessRegionProxy* End;
+		int32 RunIndex;
+	};
+	TArray<FRunCursor, TInlineAllocator<16>> Cursors;
+	auto AddRun = [&Cursors](TArrayView<const FGBufferProcessRegionProxy> Run)
+	{
+		if (Run.Num() > 0)
+		{
+			Cursors.Add({ Run.GetData(), Run.GetData() + Run.Num(), Cursors.Num() });
+		}
+	};
+
+	for (int32 RunIndex = 0; RunIndex < InRegions.RunStarts.Num(); ++RunIndex)
+	{
+		const int32 RunStart = InRegions.RunStarts[RunIndex];
+		const int32 RunEnd = RunIndex + 1 < InRegions.RunStarts.Num() ? InRegions.RunStarts[RunIndex + 1] : RenderThreadDynamicRegions.Num();
+		AddRun(TArrayView<const FGBufferProcessRegionProxy>(RenderThreadDynamicRegions.GetData() + RunStart, RunEnd - RunStart));
+	}
+
+	// Only the materials of the baked regions were gathered, their proxies are already here.
+	for (FGBufferProcessBakedRegionRun& BakedRun : RenderThreadBakedRuns)
+	{
+		if (FGBufferProcessBakedRegionMaterials* Materials = InRegions.BakedMaterials.FindByPredicate([&BakedRun](const FGBufferProcessBakedRegionMaterials& Candidate) { return Candidate.AssetId == BakedRun.AssetId; }))
+		{
+			BakedRun.UpdateMaterials(MoveTemp(*Materials));
+		}
+		AddRun(BakedRun.Proxies);
+	}
+
+	auto CursorLess = [](const FRunCursor& A, const FRunCursor& B)
+	{
+		return A.Next->Priority != B.Next->Priority ? A.Next->Priority < B.Next->Priority : A.RunIndex < B.RunIndex;
+	};
+
+	RenderThreadRegions.Reset();
+	RenderThreadRegions.Reserve(RenderThreadDynamicRegions.Num());
+	Cursors.Heapify(CursorLess);
+	while (Cursors.Num() > 0)
+	{
+		FRunCursor Cursor;
+		Cursors.HeapPop(Cursor, CursorLess, false);
+		// Baked regions whose material isn't ready yet are skipped, the gathered ones always have one.
+		if (Cursor.Next->MaterialProxy)
+		{
+			RenderThreadRegions.Add(Cursor.Next);
+		}
+		if (++Cursor.Next != Cursor.End)
+		{
+			Cursors.HeapPush(Cursor, CursorLess);
+		}
+	}
+
+	// Lets the GPU culler skip rebuilding its buffers when only the dirty regions changed.
+	RenderThreadRegionsHash = GBufferProcess::GetRegionsHash(RenderThreadRegions);
+
+	// Lets the hooks of stages without regions return right away.
+	RenderThreadStageMask = 0;
+	for (const FGBufferProcessRegionProxy* Region : RenderThreadRegions)
+	{
+		RenderThreadStageMask |= 1u << (uint32)Region->Stage;
+	}
+}
+
+void FGBufferProcessSceneViewExtension::UpdateRegionsInPlace(TArrayView<const FGBufferProcessRegionProxy> DirtyRegions)
+{
+	check(IsInRenderingThread());
+
+	if (DirtyRegions.Num() == 0)
+	{
+		return;
+	}
+
+	// Built by the first in place update after the regions changed.
+	if (RenderThreadRegionIndices.Num() == 0)
+	{
+		RenderThreadRegionIndices.Reserve(RenderThreadDynamicRegions.Num());
+		for (int32 RegionIndex = 0; RegionIndex < RenderThreadDynamicRegions.Num(); ++RegionIndex)
+		{
+			RenderThreadRegionIndices.Add(RenderThreadDynamicRegions[RegionIndex].RegionId, RegionIndex);
+		}
+	}
+
+	// In place changes keep the priority, so the regions stay sorted and RenderThreadRegions still point at them.
+	for (const FGBufferProcessRegionProxy& DirtyRegion : DirtyRegions)
+	{
+		// Regions that are not drawn, or were removed, are not there.
+		if (const int32* RegionIndex = RenderThreadRegionIndices.Find(DirtyRegion.RegionId))
+		{
+			RenderThreadDynamicRegions[*RegionIndex] = DirtyRegion;
+		}
+	}
+}
+
+void FGBufferProcessSceneViewExtension::SubscribeToPostProcessingPass(EPostProcessingPass Pass, FAfterPassCallbackDelegateArray& InOutPassCallbacks, bool bIsPassEnabled)
+{
+	// Composited after tonemapping so the heatmap colors are not exposed or graded.
+	if (Pass == EPostProcessingPass::Tonemap && bIsPassEnabled && GetVisualizeMode() != 0)
+	{
+		InOutPassCallbacks.Add(FAfterPassCallbackDelegate::CreateRaw(this, &FGBufferProcessSceneViewExtension::PostProcessPassAfterTonemap_RenderThread));
+	}
+}
+
+FScreenPassTexture FGBufferProcessSceneViewExtension::PostProcessPassAfterTonemap_RenderThread(FRDGBuilder& GraphBuilder, const FSceneView& View, const FPostProcessMaterialInputs& Inputs)
+{
+	const FViewInfo& ViewInfo = static_cast<const FViewInfo&>(View);
+	const FScreenPassTexture SceneColor = Inputs.GetInput(EPostProcessMaterialInput::SceneColor);
+
+	// The last pass of the chain has to write the override output.
+	FScreenPassRenderTarget Output = Inputs.OverrideOutput;
+	if (Output.IsValid())
+	{
+		AddDrawTexturePass(GraphBuilder, ViewInfo, SceneColor, Output);
+		Output.LoadAction = ERenderTargetLoadAction::ELoad;
+	}
+	else
+	{
+		Output = FScreenPassRenderTarget(SceneColor, ERenderTargetLoadAction::ELoad);
+	}
+
+	// The stages and post processing of a view are recorded into the same graph builder, so the counters are bound as they are.
+	FRDGTextureRef VisualizeTexture = nullptr;
+	if (const FViewStageRegions* StageRegions = RenderThreadStageRegions.Find(&View))
+	{
+		VisualizeTexture = StageRegions->VisualizeTexture;
+	}
+	RenderThreadStageRegions.Remove(&View);
+
+	if (!VisualizeTexture)
+	{
+		return FScreenPassTexture(Output);
+	}
+
+	TShaderMapRef<FGBufferProcessScreenPassVS> ScreenPassVS(ViewInfo.ShaderMap);
+	TShaderMapRef<FGBufferProcessCompositeVisualizePS> CompositePixelShader(ViewInfo.ShaderMap);
+
+	FGBufferProcessCompositeVisualizePS::FParameters* Parameters = GraphBuilder.AllocParameters<FGBufferProcessCompositeVisualizePS::FParameters>();
+	Parameters->VisualizeTexture = VisualizeTexture;
+	Parameters->OutputViewportMin = Output.ViewRect.Min;
+	Parameters->OutputViewportSize = FVector2D(Output.ViewRect.Size());
+	Parameters->VisualizeViewportMin = ViewInfo.ViewRect.Min;
+	Parameters->VisualizeViewportSize = FVector2D(ViewInfo.ViewRect.Size());
+	Parameters->VisualizeMode = GetVisualizeMode();
+	Parameters->MaxOverdraw = FMath::Max(CVarGBufferProcessVisualizeMaxOverdraw.GetValueOnRenderThread(), 1.0f);
+	Parameters->MaxCost = FMath::Max(CVarGBufferProcessVisualizeMaxCost.GetValueOnRenderThread(), 1.0f);
+	Parameters->RenderTargets[0] = Output.GetRenderTargetBinding();
+
+	FRHIBlendState* OverlayBlendState = TStaticBlendState<CW_RGB, BO_Add, BF_SourceAlpha, BF_InverseSourceAlpha>::GetRHI();
+	const FScreenPassTextureViewport OutputViewport(Output);
+
+	GraphBuilder.AddPass(
+		RDG_EVENT_NAME("GBufferProcess CompositeVisualize %dx%d", Output.ViewRect.Width(), Output.ViewRect.Height()),
+		Parameters,
+		ERDGPassFlags::Raster,
+		[&ViewInfo, ScreenPassVS, CompositePixelShader, OutputViewport, Parameters, OverlayBlendState](FRHICommandListImmediate& RHICmdList)
+		{
+			DrawScreenPass(
+				RHICmdList,
+				ViewInfo,
+				OutputViewport,
+				OutputViewport,
+				FScreenPassPipelineState(ScreenPassVS, CompositePixelShader, OverlayBlendState),
+				[&](FRHICommandListImmediate&)
+				{
+					SetShaderParameters(RHICmdList, CompositePixelShader, CompositePixelShader.GetPixelShader(), *Parameters);
+				});
+		});
+
+	return FScreenPassTexture(Output);
+}
+
+#ifdef MY_CHANGE_WITH_ENGINE
+void FGBufferProcessSceneViewExtension::PostRenderBasePass(FRDGBuilder& GraphBuilder, FViewInfo& InView)
+{
+	if (RenderThreadRegions.Num() == 0 && RenderThreadPrecacheRequests.Num() == 0) {
+		return;
+	}
+
+	FSceneRenderTargets& SceneContext = FSceneRenderTargets::Get(GraphBuilder.RHICmdList);
+
+	TStaticArray<FRDGTextureRef, MaxSimultaneousRenderTargets> BasePassTextures;
+	int32 GBufferDIndex = INDEX_NONE;
+	uint32 BasePassTextureCount = SceneContext.GetGBufferRenderTargets(GraphBuilder, BasePassTextures, GBufferDIndex);
+	TArrayView<FRDGTextureRef> BasePassTexturesView = MakeArrayView(BasePassTextures.GetData(), BasePassTextureCount);
+
+	PrecachePendingPipelines(GraphBuilder.RHICmdList, InView, BasePassTexturesView, GetVolumeProxySceneDepth(GraphBuilder), nullptr);
+
+	if (RenderThreadRegions.Num() == 0) {
+		return;
+	}
+
+	// The GPU culler draws the post base pass regions, the regions of the later stages are scheduled on the CPU.
+	// Views that went through PostRenderBasePassInRenderPass are already scheduled.
+	const bool bGPUCulling = !RenderThreadStageRegions.Contains(&InView)
+		&& (RenderThreadStageMask & (1u << (uint32)EGBufferProcessStage::PostBasePass))
+		&& FGBufferProcessGPUCuller::IsEnabled(InView) && !IsInBasePassRenderPassEnabled() && !GBufferProcess::IsClusteredEnabled() && GetVisualizeMode() == 0;
+	if (bGPUCulling)
+	{
+		if (RenderThreadStageMask != (1u << (uint32)EGBufferProcessStage::PostBasePass))
+		{
+			FindOrScheduleStageRegions(InView, true);
+		}
+
+		RDG_EVENT_SCOPE(GraphBuilder, "GBufferProcess %s", GetStageName(EGBufferProcessStage::PostBasePass));
+		RenderGPUCulledRegions(GraphBuilder, InView, BasePassTexturesView);
+		return;
+	}
+
+	// Scheduled once for all the stages of the view, so the budget covers all of them.
+	FindOrScheduleStageRegions(InView);
+	RenderStageRegions(GraphBuilder, InView, EGBufferProcessStage::PostBasePass);
+
+#if 0
+	// 取得GbufferData
+	const auto FeatureLevel = InView.GetFeatureLevel();
+	FGlobalShaderMap* GlobalShaderMap = GetGlobalShaderMap(GMaxRHIFeatureLevel);
+	FSceneRenderTargets& SceneContext = FSceneRenderTargets::Get(GraphBuilder.RHICmdList);
+	FIntPoint RT_Size = SceneContext.GetBufferSizeXY();
+
+	TStaticArray<FRDGTextureRef, MaxSimultaneousRenderTargets> BasePassTextures;
+	int32 GBufferDIndex = INDEX_NONE;
+	uint32 BasePassTextureCount = SceneContext.GetGBufferRenderTargets(GraphBuilder, BasePassTextures, GBufferDIndex);
+	TArrayView<FRDGTextureRef> BasePassTexturesView = MakeArrayView(BasePassTextures.GetData(), BasePassTextureCount);
+
+	// 创建默认的混合状态
+	FRHIBlendState* DefaultBlendState = FScreenPassPipelineState::FDefaultBlendState::GetRHI();
+
+	// 绘制的默认ViewportSize
+	const FScreenPassTextureViewport RegionViewport(SceneContext.GetBufferSizeXY());
+
+	// Step 1 : copy normal到临时buffer
+#pragma region COPY
+		// 创建临时的RDG纹理描述
+		FRDGTextureDesc NormalTextureDesc = BasePassTexturesView[1]->Desc;
+		NormalTextureDesc.Reset();
+		NormalTextureDesc.ClearValue = FClearValueBinding::Black;
+		NormalTextureDesc.Flags |= (TexCreate_RenderTargetable| TexCreate_ShaderResource);
+		// 创建临时的RDG纹理.
+		FRDGTextureRef BackRDGNormalTexture = GraphBuilder.CreateTexture(NormalTextureDesc, TEXT("BackRDGNormalTexture"));
+
+		//创建Copy PS Shader的参数
+		FCopyTexturePS::FParameters* Parameters = GraphBuilder.AllocParameters<FCopyTexturePS::FParameters>();
+
+		TShaderMapRef<FGBufferModityScreenPassVS> ScreenPassVS(GlobalShaderMap);
+		TShaderMapRef<FCopyTexturePS> CopyPixelShader(GlobalShaderMap);
+
+		// 设置Normal为SRV，同时设置Point Sample
+		Parameters->SrcTexture = BasePassTexturesView[1];
+		Parameters->SrcTextureSampler = TStaticSamplerState<SF_Point>::GetRHI();
+
+		// 设置RTV
+		Parameters->RenderTargets[0] = FRenderTargetBinding(BackRDGNormalTexture, ERenderTargetLoadAction::EClear);
 
 		GraphBuilder.AddPass(
-			RDG_EVENT_NAME("RewriteNormal"),
-			RewriteParameters,
+			RDG_EVENT_NAME("CopyNormal"),
+			Parameters,
 			ERDGPassFlags::Raster,
-			[&InView, ScreenPassVS, RewritePixelShader, RegionViewport, RewriteParameters, DefaultBlendState](FRHICommandListImmediate& RHICmdList)
+			[&InView, ScreenPassVS, CopyPixelShader, RegionViewport, Parameters, DefaultBlendState](FRHICommandListImmediate& RHICmdList)
 			{
 				DrawScreenPass(
 					RHICmdList,
 					InView,
 					RegionViewport,
 					RegionViewport,
-					FScreenPassPipelineState(ScreenPassVS, RewritePixelShader, DefaultBlendState),
+					FScreenPassPipelineState(ScreenPassVS, CopyPixelShader, DefaultBlendState),
 					[&](FRHICommandListImmediate&)
 					{
-						SetShaderParameters(RHICmdList, RewritePixelShader, RewritePixelShader.GetPixelShader(), *RewriteParameters);
+						SetShaderParameters(RHICmdList, CopyPixelShader, CopyPixelShader.GetPixelShader(), *Parameters);
 					});
 			});
 #pragma endregion
-#endif
+
+	// Step 2 : 临时Normal Buffer写回 GBuffer Normal上
+#pragma region REWRITE
+		//创建Rewrite PS Shader的参数
+		FRewritePS::FParameters* RewriteParameters = GraphBuilder.AllocParameters<FRewritePS::FParameters>();
+
+		TShaderMapRef<FRewritePS> RewritePixelShader(GlobalShaderMap);
+
+		// 设置Normal为SRV，同时设置Point Sample
+		RewriteParameters->SrcTexture = BackRDGNormalTexture;
+		RewriteParameters->SrcTextureSampler = TStaticSamplerState<SF_Point>::GetRHI();
+
+		// 设置RTV为 Gbuffer normal
+		RewriteParameters->RenderTargets[0] = FRenderTargetBinding(BasePassTexturesView[1], ERenderTargetLoadAction::ELoad);
+
+		GraphBuilder.AddPass(
+			RDG_EVENT_NAME("RewriteNormal"),
+			RewriteParameters,
+			ERDGPassFlags::Raster,
+			[&InView, ScreenPassVS, RewritePixelShader, RegionViewport, RewriteParameters, DefaultBlendState](FRHICommandListImmediate& RHICmdList)
+			{
+				DrawScreenPass(
+					RHICmdList,
+					InView,
+					RegionViewport,
+					RegionViewport,
+					FScreenPassPipelineState(ScreenPassVS, RewritePixelShader, DefaultBlendState),
+					[&](FRHICommandListImmediate&)
+					{
+						SetShaderParameters(RHICmdList, RewritePixelShader, RewritePixelShader.GetPixelShader(), *RewriteParameters);
+					});
+			});
+#pragma endregion
+#endif
+}
+
+void FGBufferProcessSceneViewExtension::PostRenderBasePassInRenderPass(FRDGBuilder& GraphBuilder, FViewInfo& InView, const FRenderTargetBindingSlots& BasePassRenderTargets)
+{
+	if (!IsInBasePassRenderPassEnabled() || (RenderThreadRegions.Num() == 0 && RenderThreadPrecacheRequests.Num() == 0)) {
+		return;
+	}
+
+	FSceneRenderTargets& SceneContext = FSceneRenderTargets::Get(GraphBuilder.RHICmdList);
+
+	TStaticArray<FRDGTextureRef, MaxSimultaneousRenderTargets> BasePassTextures;
+	int32 GBufferDIndex = INDEX_NONE;
+	uint32 BasePassTextureCount = SceneContext.GetGBufferRenderTargets(GraphBuilder, BasePassTextures, GBufferDIndex);
+	TArrayView<FRDGTextureRef> BasePassTexturesView = MakeArrayView(BasePassTextures.GetData(), BasePassTextureCount);
+
+	PrecachePendingPipelines(GraphBuilder.RHICmdList, InView, BasePassTexturesView, GetVolumeProxySceneDepth(GraphBuilder), &BasePassRenderTargets);
+
+	if (RenderThreadRegions.Num() == 0) {
+		return;
+	}
+
+	// Only the post base pass regions are candidates, the ones left over are drawn by PostRenderBasePass.
+	TArray<FGBufferProcessScheduledRegion>& PostBasePassRegions = FindOrScheduleStageRegions(InView).Regions[(int32)EGBufferProcessStage::PostBasePass];
+	TArray<FGBufferProcessScheduledRegion> ScheduledRegions = MoveTemp(PostBasePassRegions);
+
+	// Regions of a target keep their priority order: once a region has to read the target, it and every later region
+	// of that target are drawn after the render pass ends.
+	TArray<FGBufferProcessScheduledRegion> InBasePassRegions;
+	TArray<FGBufferProcessScheduledRegion> DeferredRegions;
+	uint32 ReadTargetMask = 0;
+	for (const FGBufferProcessScheduledRegion& ScheduledRegion : ScheduledRegions)
+	{
+		const FGBufferProcessRegionProxy& Region = *RenderThreadRegions[ScheduledRegion.RegionIndex];
+		const FGBufferProcessRegionKernel& Kernel = GBufferProcess::GetRegionKernel(Region.Type, Region.BlendOp);
+		if (!Kernel.bSupported)
+		{
+			continue;
+		}
+
+		const uint32 TargetBit = 1u << Kernel.TargetIndex;
+		if (Kernel.bInBasePass && !(ReadTargetMask & TargetBit))
+		{
+			InBasePassRegions.Add(ScheduledRegion);
+		}
+		else
+		{
+			DeferredRegions.Add(ScheduledRegion);
+			// Weighted regions are resolved after every other region of their target anyway.
+			if (!Kernel.bWeighted)
+			{
+				ReadTargetMask |= TargetBit;
+			}
+		}
+	}
+
+	PostBasePassRegions = MoveTemp(DeferredRegions);
+
+	RenderInBasePassRegions(GraphBuilder, InView, BasePassRenderTargets, InBasePassRegions);
+}
+
+void FGBufferProcessSceneViewExtension::PreRenderLighting(FRDGBuilder& GraphBuilder, FViewInfo& InView)
+{
+	RenderStageRegions(GraphBuilder, InView, EGBufferProcessStage::PreLighting);
+}
+
+void FGBufferProcessSceneViewExtension::PostRenderLighting(FRDGBuilder& GraphBuilder, FViewInfo& InView)
+{
+	RenderStageRegions(GraphBuilder, InView, EGBufferProcessStage::PostLighting);
+
+	// Last stage of the view, only the counters of r.GBufferProcess.Visualize are left for post processing.
+	if (GetVisualizeMode() == 0)
+	{
+		RenderThreadStageRegions.Remove(&InView);
+	}
+}
+
+void FGBufferProcessSceneViewExtension::PrecachePendingPipelines(FRHICommandList& RHICmdList, const FViewInfo& InView, TArrayView<const FRDGTextureRef> BasePassTextures, FRDGTextureRef SceneDepthTexture, const FRenderTargetBindingSlots* BasePassRenderTargets)
+{
+	// Pipelines of newly loaded region materials are created before any of them is drawn.
+	if (RenderThreadPrecacheRequests.Num() > 0)
+	{
+		FGBufferProcessPipelinePrecacher::PrecachePipelines(RHICmdList, InView.GetFeatureLevel(), RenderThreadPrecacheRequests, BasePassTextures, SceneDepthTexture, BasePassRenderTargets);
+		RenderThreadPrecacheRequests.Reset();
+	}
+}
+
+void FGBufferProcessSceneViewExtension::ScheduleRegions(const FViewInfo& InView, TArrayView<const FGBufferProcessRegionProxy* const> Regions, TArray<FGBufferProcessScheduledRegion>& OutScheduledRegions)
+{
+	// GPU timings of previous frames feed the budget, read them once per frame.
+	if (LastCostHistoryUpdateFrame != GFrameNumberRenderThread)
+	{
+		Scheduler.UpdateCostHistory();
+		LastCostHistoryUpdateFrame = GFrameNumberRenderThread;
+	}
+
+	Scheduler.Schedule(InView, Regions, OutScheduledRegions, RenderThreadTile.GetPtrOrNull());
+}
+
+FGBufferProcessSceneViewExtension::FViewStageRegions& FGBufferProcessSceneViewExtension::FindOrScheduleStageRegions(const FViewInfo& InView, bool bPostBasePassGPUCulled)
+{
+	if (FViewStageRegions* StageRegions = RenderThreadStageRegions.Find(&InView))
+	{
+		return *StageRegions;
+	}
+
+	TArray<FGBufferProcessScheduledRegion> ScheduledRegions;
+	if (bPostBasePassGPUCulled)
+	{
+		// Only the regions of the later stages, their indices are mapped back to RenderThreadRegions.
+		TArray<const FGBufferProcessRegionProxy*> Regions;
+		TArray<int32> RegionIndices;
+		for (int32 RegionIndex = 0; RegionIndex < RenderThreadRegions.Num(); ++RegionIndex)
+		{
+			if (RenderThreadRegions[RegionIndex]->Stage != EGBufferProcessStage::PostBasePass)
+			{
+				Regions.Add(RenderThreadRegions[RegionIndex]);
+				RegionIndices.Add(RegionIndex);
+			}
+		}
+
+		ScheduleRegions(InView, Regions, ScheduledRegions);
+		for (FGBufferProcessScheduledRegion& ScheduledRegion : ScheduledRegions)
+		{
+			ScheduledRegion.RegionIndex = RegionIndices[ScheduledRegion.RegionIndex];
+		}
+	}
+	else
+	{
+		ScheduleRegions(InView, RenderThreadRegions, ScheduledRegions);
+	}
+
+	// Added even if empty, so the later hooks of the view don't schedule it again.
+	FViewStageRegions& StageRegions = RenderThreadStageRegions.Add(&InView);
+	for (const FGBufferProcessScheduledRegion& ScheduledRegion : ScheduledRegions)
+	{
+		StageRegions.Regions[(int32)RenderThreadRegions[ScheduledRegion.RegionIndex]->Stage].Add(ScheduledRegion);
+	}
+	return StageRegions;
+}
+
+void FGBufferProcessSceneViewExtension::RenderStageRegions(FRDGBuilder& GraphBuilder, FViewInfo& InView, EGBufferProcessStage Stage)
+{
+	if (!(RenderThreadStageMask & (1u << (uint32)Stage))) {
+		return;
+	}
+
+	// A view whose earlier hooks returned early is scheduled here.
+	FViewStageRegions* StageRegions = &FindOrScheduleStageRegions(InView);
+	if (StageRegions->Regions[(int32)Stage].Num() == 0) {
+		return;
+	}
+
+	// Each stage is drawn once per view.
+	TArray<FGBufferProcessScheduledRegion> ScheduledRegions = MoveTemp(StageRegions->Regions[(int32)Stage]);
+
+	FSceneRenderTargets& SceneContext = FSceneRenderTargets::Get(GraphBuilder.RHICmdList);
+
+	TStaticArray<FRDGTextureRef, MaxSimultaneousRenderTargets> BasePassTextures;
+	int32 GBufferDIndex = INDEX_NONE;
+	uint32 BasePassTextureCount = SceneContext.GetGBufferRenderTargets(GraphBuilder, BasePassTextures, GBufferDIndex);
+	TArrayView<FRDGTextureRef> BasePassTexturesView = MakeArrayView(BasePassTextures.GetData(), BasePassTextureCount);
+
+	RDG_EVENT_SCOPE(GraphBuilder, "GBufferProcess %s", GetStageName(Stage));
+	RenderScheduledRegions(GraphBuilder, InView, BasePassTexturesView, ScheduledRegions, StageRegions->VisualizeTexture);
+}
+
+void FGBufferProcessSceneViewExtension::RenderInBasePassRegions(FRDGBuilder& GraphBuilder, FViewInfo& InView, const FRenderTargetBindingSlots& BasePassRenderTargets, TArrayView<FGBufferProcessScheduledRegion> ScheduledRegions)
+{
+	const bool bVolumeProxy = GBufferProcess::IsVolumeProxyEnabled() && BasePassRenderTargets.DepthStencil.GetTexture();
+
+	TArray<FRegionDraw> Draws;
+	TArray<const FGBufferProcessScheduledRegion*> DrawnRegions;
+	Draws.Reserve(ScheduledRegions.Num());
+	DrawnRegions.Reserve(ScheduledRegions.Num());
+	for (FGBufferProcessScheduledRegion& ScheduledRegion : ScheduledRegions)
+	{
+		const FGBufferProcessRegionProxy& Region = *RenderThreadRegions[ScheduledRegion.RegionIndex];
+		const FGBufferProcessRegionKernel& Kernel = GBufferProcess::GetRegionKernel(Region.Type, Region.BlendOp);
+
+		FRegionDraw Draw;
+		if (!InitRegionDraw(InView, Region, ScheduledRegion, Kernel.InBasePassPermutationId, Kernel.GetBasePassBlendState(), bVolumeProxy, INDEX_NONE, Draw))
+		{
+			continue;
+		}
+		Draws.Add(Draw);
+		DrawnRegions.Add(&ScheduledRegion);
+	}
+
+	if (Draws.Num() == 0) {
+		return;
+	}
+	INC_DWORD_STAT_BY(STAT_GBufferProcess_InBasePassRegions, Draws.Num());
+
+	// The queries can only go inside the base pass render pass, where tile based GPUs don't give meaningful timestamps.
+	const FGBufferProcessPassTiming Timing = RHIHasTiledGPU(InView.GetShaderPlatform()) ? FGBufferProcessPassTiming() : Scheduler.AllocateTimingQueries(DrawnRegions);
+
+	FSceneRenderTargets& SceneContext = FSceneRenderTargets::Get(GraphBuilder.RHICmdList);
+	const FRegionDrawContext DrawContext = GetRegionDrawContext(InView, SceneContext.GetBufferSizeXY());
+
+	// Bound exactly like the base pass and nothing else is read, so RDG merges this pass into the base pass render pass.
+	// Always recorded on the render thread, a parallel pass would have to begin its own render pass.
+	FRenderTargetParameters* PassParameters = GraphBuilder.AllocParameters<FRenderTargetParameters>();
+	PassParameters->RenderTargets = BasePassRenderTargets;
+
+	GraphBuilder.AddPass(
+		RDG_EVENT_NAME("GBufferProcess InBasePass Regions=%d", Draws.Num()),
+		PassParameters,
+		ERDGPassFlags::Raster,
+		[DrawContext, Timing, Draws = MoveTemp(Draws)](FRHICommandListImmediate& RHICmdList)
+		{
+			if (Timing.IsValid())
+			{
+				RHICmdList.EndRenderQuery(Timing.BeginQuery);
+			}
+
+			for (const FRegionDraw& Draw : Draws)
+			{
+				DrawRegion(RHICmdList, DrawContext, Draw);
+			}
+
+			if (Timing.IsValid())
+			{
+				RHICmdList.EndRenderQuery(Timing.EndQuery);
+			}
+		});
+}
+
+void FGBufferProcessSceneViewExtension::RenderScheduledRegions(FRDGBuilder& GraphBuilder, FViewInfo& InView, TArrayView<FRDGTextureRef> BasePassTextures, TArrayView<FGBufferProcessScheduledRegion> ScheduledRegions, FRDGTextureRef& InOutVisualizeTexture)
+{
+	if (ScheduledRegions.Num() == 0) {
+		return;
+	}
+
+	FSceneRenderTargets& SceneContext = FSceneRenderTargets::Get(GraphBuilder.RHICmdList);
+	FGlobalShaderMap* GlobalShaderMap = GetGlobalShaderMap(GMaxRHIFeatureLevel);
+
+	// 创建默认的混合状态
+	FRHIBlendState* DefaultBlendState = FScreenPassPipelineState::FDefaultBlendState::GetRHI();
+
+	// 绘制的默认ViewportSize
+	const FScreenPassTextureViewport RegionViewport(SceneContext.GetBufferSizeXY());
+
+	TShaderMapRef<FGBufferProcessScreenPassVS> ScreenPassVS(GlobalShaderMap);
+	TShaderMapRef<FCopyTexturePS> CopyPixelShader(GlobalShaderMap);
+	const FRegionDrawContext DrawContext = GetRegionDrawContext(InView, RegionViewport.Extent);
+
+	FRDGTextureRef SceneDepthTexture = GetVolumeProxySceneDepth(GraphBuilder);
+
+	// Copies of the targets read by decode/encode kernels, created on first use.
+	TStaticArray<FRDGTextureRef, MaxSimultaneousRenderTargets> BackTextures;
+	for (FRDGTextureRef& BackTexture : BackTextures)
+	{
+		BackTexture = nullptr;
+	}
+
+	const bool bParallelRecording = IsParallelRecordingEnabled();
+	const int32 DrawsPerChunk = GetParallelRecordingDrawsPerChunk();
+
+	// Weighted regions don't depend on the draw order, they are drawn after the ordered ones and resolved once per target.
+	TArray<FGBufferProcessScheduledRegion> OrderedRegions;
+	TArray<FGBufferProcessScheduledRegion> WeightedRegions;
+	OrderedRegions.Reserve(ScheduledRegions.Num());
+	for (const FGBufferProcessScheduledRegion& ScheduledRegion : ScheduledRegions)
+	{
+		const FGBufferProcessRegionProxy& Region = *RenderThreadRegions[ScheduledRegion.RegionIndex];
+		if (Region.BlendOp == EGBufferProcessBlendOp::Weighted)
+		{
+			WeightedRegions.Add(ScheduledRegion);
+		}
+		else
+		{
+			OrderedRegions.Add(ScheduledRegion);
+		}
+	}
+
+	// Regions of different targets don't see each other within a stage, only the order per target is kept. Grouped by target,
+	// a scene mixing types gets a pass per target rather than a pass break at every change of type.
+	OrderedRegions.StableSort([this](const FGBufferProcessScheduledRegion& A, const FGBufferProcessScheduledRegion& B)
+	{
+		return RenderThreadRegions[A.RegionIndex]->Type < RenderThreadRegions[B.RegionIndex]->Type;
+	});
+
+	// Sums are added in region id order, so the result doesn't depend on the order regions were added in. Region ids are
+	// object unique ids, which differ between sessions: the rounding of the sums is only deterministic within a session.
+	WeightedRegions.Sort([this](const FGBufferProcessScheduledRegion& A, const FGBufferProcessScheduledRegion& B)
+	{
+		const FGBufferProcessRegionProxy& RegionA = *RenderThreadRegions[A.RegionIndex];
+		const FGBufferProcessRegionProxy& RegionB = *RenderThreadRegions[B.RegionIndex];
+		return RegionA.Type != RegionB.Type ? RegionA.Type < RegionB.Type : RegionA.RegionId < RegionB.RegionId;
+	});
+
+	// The slots of the cluster grid are the ordered regions, then the weighted ones.
+	TRDGUniformBufferRef<FGBufferProcessClusterParameters> Clusters = nullptr;
+	if (GBufferProcess::IsClusteredEnabled() && InView.GetFeatureLevel() >= ERHIFeatureLevel::SM5)
+	{
+		TArray<const FGBufferProcessRegionProxy*> ClusterRegions;
+		TArray<FIntRect> ClusterRects;
+		ClusterRegions.Reserve(ScheduledRegions.Num());
+		ClusterRects.Reserve(ScheduledRegions.Num());
+		for (const TArray<FGBufferProcessScheduledRegion>* Regions : { &OrderedRegions, &WeightedRegions })
+		{
+			for (const FGBufferProcessScheduledRegion& ScheduledRegion : *Regions)
+			{
+				const FGBufferProcessRegionProxy& Region = *RenderThreadRegions[ScheduledRegion.RegionIndex];
+				ClusterRegions.Add(GBufferProcess::GetRegionKernel(Region.Type, Region.BlendOp).bClustered ? &Region : nullptr);
+				ClusterRects.Add(ScheduledRegion.Rect);
+			}
+		}
+		Clusters = GBufferProcess::CreateClusterUniformBuffer(GraphBuilder, InView, ClusterRegions, ClusterRects, GraphBuilder.RegisterExternalTexture(SceneContext.SceneDepthZ));
+	}
+
+	for (int32 ScheduledIndex = 0; ScheduledIndex < OrderedRegions.Num(); ++ScheduledIndex)
+	{
+		FGBufferProcessScheduledRegion& ScheduledRegion = OrderedRegions[ScheduledIndex];
+		const FGBufferProcessRegionProxy& Region = *RenderThreadRegions[ScheduledRegion.RegionIndex];
+		const FGBufferProcessRegionKernel& Kernel = GBufferProcess::GetRegionKernel(Region.Type, Region.BlendOp);
+		if (!Kernel.bSupported || !BasePassTextures.IsValidIndex(Kernel.TargetIndex))
+		{
+			continue;
+		}
+
+		if (!Kernel.bDecodeEncode)
+		{
+			// Regions that don't read their target are drawn in one pass with the following ones of the same target.
+			ScheduledIndex = AddRegionDrawsPass(GraphBuilder, InView, BasePassTextures[Kernel.TargetIndex], SceneDepthTexture, Clusters, Kernel.TargetIndex, OrderedRegions, ScheduledIndex, bParallelRecording, DrawsPerChunk) - 1;
+			continue;
+		}
+
+		FRegionDraw Draw;
+		if (!InitRegionDraw(InView, Region, ScheduledRegion, Kernel.PermutationId, Kernel.GetBlendState(), SceneDepthTexture != nullptr, INDEX_NONE, Draw))
+		{
+			continue;
+		}
+
+		FRDGTextureRef TargetTexture = BasePassTextures[Kernel.TargetIndex];
+		const FScreenPassTextureViewport RegionRectViewport(RegionViewport.Extent, ScheduledRegion.Rect);
+
+		// Step 1 : copy target到临时buffer, 只复制区域的屏幕范围
+#pragma region COPY
+		FRDGTextureRef BackTexture = GetBackTexture(GraphBuilder, BackTextures, Kernel.TargetIndex, TargetTexture);
+
+		//创建Copy PS Shader的参数
+		FCopyTexturePS::FParameters* Parameters = GraphBuilder.AllocParameters<FCopyTexturePS::FParameters>();
+
+		// 设置Target为SRV，同时设置Point Sample
+		Parameters->SrcTexture = TargetTexture;
+		Parameters->SrcTextureSampler = TStaticSamplerState<SF_Point>::GetRHI();
+
+		// 设置RTV, 区域之外的像素不会被读取
+		Parameters->RenderTargets[0] = FRenderTargetBinding(BackTexture, ERenderTargetLoadAction::ENoAction);
+
+		GraphBuilder.AddPass(
+			RDG_EVENT_NAME("CopyTarget %dx%d", ScheduledRegion.Rect.Width(), ScheduledRegion.Rect.Height()),
+			Parameters,
+			ERDGPassFlags::Raster,
+			[&InView, ScreenPassVS, CopyPixelShader, RegionRectViewport, Parameters, DefaultBlendState](FRHICommandListImmediate& RHICmdList)
+			{
+				DrawScreenPass(
+					RHICmdList,
+					InView,
+					RegionRectViewport,
+					RegionRectViewport,
+					FScreenPassPipelineState(ScreenPassVS, CopyPixelShader, DefaultBlendState),
+					[&](FRHICommandListImmediate&)
+					{
+						SetShaderParameters(RHICmdList, CopyPixelShader, CopyPixelShader.GetPixelShader(), *Parameters);
+					});
+			});
+#pragma endregion
+
+		// Step 2 : 区域的kernel写回 GBuffer, 每个区域只绘制自己的屏幕范围
+#pragma region REWRITE
+		//创建Region PS Shader的参数
+		FGBufferProcessRegionPS::FParameters* RegionParameters =
+			GraphBuilder.AllocParameters<FGBufferProcessRegionPS::FParameters>();
+
+		RegionParameters->SrcTexture = BackTexture;
+		RegionParameters->RenderTargets[0] = FRenderTargetBinding(TargetTexture, ERenderTargetLoadAction::ELoad);
+		if (SceneDepthTexture)
+		{
+			RegionParameters->RenderTargets.DepthStencil = FDepthStencilBinding(SceneDepthTexture, ERenderTargetLoadAction::ELoad, ERenderTargetLoadAction::ENoAction, FExclusiveDepthStencil::DepthRead_StencilNop);
+		}
+
+		Draw.SrcTexture = BackTexture;
+		const FGBufferProcessScheduledRegion* TimedRegion = &ScheduledRegion;
+
+		AddRegionDrawsRasterPass(
+			GraphBuilder,
+			RDG_EVENT_NAME("Region=%u Type=%d BlendOp=%d %dx%d", Region.RegionId, (int32)Region.Type, (int32)Region.BlendOp, ScheduledRegion.Rect.Width(), ScheduledRegion.Rect.Height()),
+			RegionParameters,
+			DrawContext,
+			TArray<FRegionDraw>{ Draw },
+			Scheduler.AllocateTimingQueries(MakeArrayView(&TimedRegion, 1)));
+#pragma endregion
+	}
+
+	if (WeightedRegions.Num() > 0)
+	{
+		AddWeightedRegionsPasses(GraphBuilder, InView, BasePassTextures, SceneDepthTexture, Clusters, OrderedRegions.Num(), WeightedRegions, BackTextures);
+	}
+
+	if (GetVisualizeMode() != 0)
+	{
+		AddVisualizeRegionsPass(GraphBuilder, InView, SceneDepthTexture, Clusters, OrderedRegions, WeightedRegions, InOutVisualizeTexture);
+	}
+}
+
+void FGBufferProcessSceneViewExtension::AddVisualizeRegionsPass(FRDGBuilder& GraphBuilder, FViewInfo& InView, FRDGTextureRef SceneDepthTexture, TRDGUniformBufferRef<FGBufferProcessClusterParameters> Clusters, TArrayView<FGBufferProcessScheduledRegion> OrderedRegions, TArrayView<FGBufferProcessScheduledRegion> WeightedRegions, FRDGTextureRef& InOutVisualizeTexture)
+{
+	struct FVisualizeDraw
+	{
+		FRegionDraw Draw;
+		FGBufferProcessVisualizeRegionPS::FParameters Parameters;
+	};
+
+	// Step 1 : 按RenderScheduledRegions的方式重建每个draw, clustered的区域同样合并
+	TArray<FVisualizeDraw> VisualizeDraws;
+	int32 Slot = 0;
+	for (TArrayView<FGBufferProcessScheduledRegion> Regions : { OrderedRegions, WeightedRegions })
+	{
+		for (const FGBufferProcessScheduledRegion& ScheduledRegion : Regions)
+		{
+			const int32 ClusterSlot = Slot++;
+			const FGBufferProcessRegionProxy& Region = *RenderThreadRegions[ScheduledRegion.RegionIndex];
+			const FGBufferProcessRegionKernel& Kernel = GBufferProcess::GetRegionKernel(Region.Type, Region.BlendOp);
+			if (!Kernel.bSupported)
+			{
+				continue;
+			}
+
+			const bool bClustered = Clusters && Kernel.bClustered;
+			FRegionDraw Draw;
+			if (!InitRegionDraw(InView, Region, ScheduledRegion, bClustered ? Kernel.ClusteredPermutationId : Kernel.PermutationId, Kernel.GetBlendState(), SceneDepthTexture != nullptr, bClustered ? ClusterSlot : INDEX_NONE, Draw))
+			{
+				continue;
+			}
+
+			if (VisualizeDraws.Num() > 0 && TryMergeClusteredDraw(VisualizeDraws.Last().Draw, Draw))
+			{
+				VisualizeDraws.Last().Parameters.ClusterRegionRange = VisualizeDraws.Last().Draw.ClusterRegionRange;
+				continue;
+			}
+
+			FVisualizeDraw& VisualizeDraw = VisualizeDraws.AddDefaulted_GetRef();
+			VisualizeDraw.Draw = Draw;
+			VisualizeDraw.Parameters.View = InView.ViewUniformBuffer;
+			VisualizeDraw.Parameters.Clusters = Clusters;
+			VisualizeDraw.Parameters.ClusterRegionRange = Draw.ClusterRegionRange;
+#if WITH_EDITORONLY_DATA
+			VisualizeDraw.Parameters.RegionCost = (float)Draw.PixelShader->GetNumInstructions();
+#else
+			VisualizeDraw.Parameters.RegionCost = 0.0f;
+#endif
+			VisualizeDraw.Parameters.bIgnoreIntensity = Region.BlendOp == EGBufferProcessBlendOp::Replace;
+			VisualizeDraw.Parameters.RegionWeight = VisualizeDraw.Parameters.bIgnoreIntensity ? 1.0f
+				: Region.BlendOp == EGBufferProcessBlendOp::Weighted ? FMath::Max(Region.Intensity, 0.0f)
+				: Region.Intensity;
+		}
+	}
+
+	if (VisualizeDraws.Num() == 0) {
+		return;
+	}
+
+	FSceneRenderTargets& SceneContext = FSceneRenderTargets::Get(GraphBuilder.RHICmdList);
+	const FRegionDrawContext DrawContext = GetRegionDrawContext(InView, SceneContext.GetBufferSizeXY(), Clusters);
+
+	// Step 2 : 所有draw累加到可视化纹理, 后处理的tonemap之后再叠加到画面上. 同一个view的各个阶段共用一张纹理
+	if (!InOutVisualizeTexture)
+	{
+		InOutVisualizeTexture = GraphBuilder.CreateTexture(
+			FRDGTextureDesc::Create2D(SceneContext.GetBufferSizeXY(), PF_FloatRGBA, FClearValueBinding::Transparent, TexCreate_RenderTargetable | TexCreate_ShaderResource),
+			TEXT("GBufferProcessVisualize"));
+		AddClearRenderTargetPass(GraphBuilder, InOutVisualizeTexture);
+	}
+	FRDGTextureRef VisualizeTexture = InOutVisualizeTexture;
+
+	FGBufferProcessRegionPassParameters* PassParameters = GraphBuilder.AllocParameters<FGBufferProcessRegionPassParameters>();
+	PassParameters->Clusters = Clusters;
+	PassParameters->RenderTargets[0] = FRenderTargetBinding(VisualizeTexture, ERenderTargetLoadAction::ELoad);
+	if (SceneDepthTexture)
+	{
+		PassParameters->RenderTargets.DepthStencil = FDepthStencilBinding(SceneDepthTexture, ERenderTargetLoadAction::ELoad, ERenderTargetLoadAction::ENoAction, FExclusiveDepthStencil::DepthRead_StencilNop);
+	}
+
+	FGlobalShaderMap* GlobalShaderMap = InView.ShaderMap;
+	FRHIBlendState* AdditiveBlendState = TStaticBlendState<CW_RGBA, BO_Add, BF_One, BF_One, BO_Add, BF_One, BF_One>::GetRHI();
+
+	GraphBuilder.AddPass(
+		RDG_EVENT_NAME("GBufferProcess Visualize Draws=%d", VisualizeDraws.Num()),
+		PassParameters,
+		ERDGPassFlags::Raster,
+		[DrawContext, GlobalShaderMap, AdditiveBlendState, VisualizeDraws = MoveTemp(VisualizeDraws)](FRHICommandListImmediate& RHICmdList)
+		{
+			for (const FVisualizeDraw& VisualizeDraw : VisualizeDraws)
+			{
+				FGBufferProcessVisualizeRegionPS::FPermutationDomain PermutationVector;
+				PermutationVector.Set<FGBufferProcessVisualizeRegionPS::FClusteredDim>(VisualizeDraw.Draw.ClusterRegionRange.Y > 0);
+				TShaderMapRef<FGBufferProcessVisualizeRegionPS> VisualizePixelShader(GlobalShaderMap, PermutationVector);
+
+				DrawRegionGeometry(RHICmdList, DrawContext, VisualizeDraw.Draw, VisualizePixelShader, AdditiveBlendState,
+					[&VisualizePixelShader, &VisualizeDraw](FRHICommandListImmediate& InRHICmdList)
+					{
+						SetShaderParameters(InRHICmdList, VisualizePixelShader, VisualizePixelShader.GetPixelShader(), VisualizeDraw.Parameters);
+					});
+			}
+		});
+}
+
+void FGBufferProcessSceneViewExtension::AddWeightedRegionsPasses(FRDGBuilder& GraphBuilder, FViewInfo& InView, TArrayView<FRDGTextureRef> BasePassTextures, FRDGTextureRef SceneDepthTexture, TRDGUniformBufferRef<FGBufferProcessClusterParameters> Clusters, int32 FirstClusterSlot, TArrayView<FGBufferProcessScheduledRegion> WeightedRegions, TStaticArray<FRDGTextureRef, MaxSimultaneousRenderTargets>& BackTextures)
+{
+	FSceneRenderTargets& SceneContext = FSceneRenderTargets::Get(GraphBuilder.RHICmdList);
+	const FRegionDrawContext DrawContext = GetRegionDrawContext(InView, SceneContext.GetBufferSizeXY(), Clusters);
+
+	TStaticArray<FRDGTextureRef, MaxSimultaneousRenderTargets> AccumulationTextures;
+	for (FRDGTextureRef& AccumulationTexture : AccumulationTextures)
+	{
+		AccumulationTexture = nullptr;
+	}
+
+	int32 ScheduledIndex = 0;
+	while (ScheduledIndex < WeightedRegions.Num())
+	{
+		const EGBufferProcessType Type = RenderThreadRegions[WeightedRegions[ScheduledIndex].RegionIndex]->Type;
+		const FGBufferProcessRegionKernel& Kernel = GBufferProcess::GetRegionKernel(Type, EGBufferProcessBlendOp::Weighted);
+
+		// Step 1 : 同一target的所有weighted区域累加到浮点纹理, 顺序无关
+		TArray<FRegionDraw> Draws;
+		TArray<const FGBufferProcessScheduledRegion*> DrawnRegions;
+		FIntRect ResolveRect;
+		bool bHasResolveRect = false;
+		for (; ScheduledIndex < WeightedRegions.Num(); ++ScheduledIndex)
+		{
+			FGBufferProcessScheduledRegion& ScheduledRegion = WeightedRegions[ScheduledIndex];
+			const FGBufferProcessRegionProxy& Region = *RenderThreadRegions[ScheduledRegion.RegionIndex];
+			if (Region.Type != Type)
+			{
+				break;
+			}
+
+			const bool bClustered = Clusters && Kernel.bClustered;
+			FRegionDraw Draw;
+			if (!Kernel.bSupported || !InitRegionDraw(InView, Region, ScheduledRegion, bClustered ? Kernel.ClusteredPermutationId : Kernel.PermutationId, Kernel.GetBlendState(), SceneDepthTexture != nullptr, bClustered ? FirstClusterSlot + ScheduledIndex : INDEX_NONE, Draw))
+			{
+				continue;
+			}
+
+			if (!bHasResolveRect)
+			{
+				ResolveRect = ScheduledRegion.Rect;
+				bHasResolveRect = true;
+			}
+			else
+			{
+				ResolveRect.Union(ScheduledRegion.Rect);
+			}
+
+			if (Draws.Num() == 0 || !TryMergeClusteredDraw(Draws.Last(), Draw))
+			{
+				Draws.Add(Draw);
+			}
+			DrawnRegions.Add(&ScheduledRegion);
+		}
+
+		if (Draws.Num() == 0 || !BasePassTextures.IsValidIndex(Kernel.TargetIndex))
+		{
+			continue;
+		}
+
+		FRDGTextureRef TargetTexture = BasePassTextures[Kernel.TargetIndex];
+		FRDGTextureRef AccumulationTexture = GetAccumulationTexture(GraphBuilder, AccumulationTextures, Kernel.TargetIndex, TargetTexture);
+
+
+		FGBufferProcessRegionPassParameters* PassParameters = GraphBuilder.AllocParameters<FGBufferProcessRegionPassParameters>();
+		PassParameters->Clusters = Clusters;
+		PassParameters->RenderTargets[0] = FRenderTargetBinding(AccumulationTexture, ERenderTargetLoadAction::ELoad);
+		if (SceneDepthTexture)
+		{
+			PassParameters->RenderTargets.DepthStencil = FDepthStencilBinding(SceneDepthTexture, ERenderTargetLoadAction::ELoad, ERenderTargetLoadAction::ENoAction, FExclusiveDepthStencil::DepthRead_StencilNop);
+		}
+
+		AddRegionDrawsRasterPass(
+			GraphBuilder,
+			RDG_EVENT_NAME("GBufferProcess Weighted Regions=%d Target=%d", Draws.Num(), Kernel.TargetIndex),
+			PassParameters,
+			DrawContext,
+			MoveTemp(Draws),
+			Scheduler.AllocateTimingQueries(DrawnRegions));
+
+		// Step 2 : 累加结果除以权重和, 一次性混合回 GBuffer
+		AddResolveWeightedPass(GraphBuilder, InView, Type, TargetTexture, AccumulationTexture, BackTextures, ResolveRect);
+	}
+}
+
+int32 FGBufferProcessSceneViewExtension::AddRegionDrawsPass(FRDGBuilder& GraphBuilder, FViewInfo& InView, FRDGTextureRef TargetTexture, FRDGTextureRef SceneDepthTexture, TRDGUniformBufferRef<FGBufferProcessClusterParameters> Clusters, int32 TargetIndex, TArrayView<FGBufferProcessScheduledRegion> ScheduledRegions, int32 FirstScheduledIndex, bool bParallelRecording, int32 DrawsPerChunk)
+{
+	TArray<FRegionDraw> Draws;
+	TArray<const FGBufferProcessScheduledRegion*> DrawnRegions;
+
+	int32 ScheduledIndex = FirstScheduledIndex;
+	for (; ScheduledIndex < ScheduledRegions.Num(); ++ScheduledIndex)
+	{
+		FGBufferProcessScheduledRegion& ScheduledRegion = ScheduledRegions[ScheduledIndex];
+		const FGBufferProcessRegionProxy& Region = *RenderThreadRegions[ScheduledRegion.RegionIndex];
+		const FGBufferProcessRegionKernel& Kernel = GBufferProcess::GetRegionKernel(Region.Type, Region.BlendOp);
+		if (!Kernel.bSupported)
+		{
+			continue;
+		}
+		if (Kernel.bDecodeEncode || Kernel.TargetIndex != TargetIndex)
+		{
+			break;
+		}
+
+		const bool bClustered = Clusters && Kernel.bClustered;
+		FRegionDraw Draw;
+		if (!InitRegionDraw(InView, Region, ScheduledRegion, bClustered ? Kernel.ClusteredPermutationId : Kernel.PermutationId, Kernel.GetBlendState(), SceneDepthTexture != nullptr, bClustered ? ScheduledIndex : INDEX_NONE, Draw))
+		{
+			continue;
+		}
+
+		if (Draws.Num() == 0 || !TryMergeClusteredDraw(Draws.Last(), Draw))
+		{
+			Draws.Add(Draw);
+		}
+		DrawnRegions.Add(&ScheduledRegion);
+	}
+
+	if (Draws.Num() == 0) {
+		return ScheduledIndex;
+	}
+
+	FSceneRenderTargets& SceneContext = FSceneRenderTargets::Get(GraphBuilder.RHICmdList);
+	const FRegionDrawContext DrawContext = GetRegionDrawContext(InView, SceneContext.GetBufferSizeXY(), Clusters);
+
+	FGBufferProcessRegionPassParameters* PassParameters = GraphBuilder.AllocParameters<FGBufferProcessRegionPassParameters>();
+	PassParameters->Clusters = Clusters;
+	PassParameters->RenderTargets[0] = FRenderTargetBinding(TargetTexture, ERenderTargetLoadAction::ELoad);
+	if (SceneDepthTexture)
+	{
+		PassParameters->RenderTargets.DepthStencil = FDepthStencilBinding(SceneDepthTexture, ERenderTargetLoadAction::ELoad, ERenderTargetLoadAction::ENoAction, FExclusiveDepthStencil::DepthRead_StencilNop);
+	}
+
+	if (bParallelRecording && Draws.Num() > DrawsPerChunk)
+	{
+		// The queries go on the immediate command list around the parallel submit, so they time the whole run.
+		GraphBuilder.AddPass(
+			RDG_EVENT_NAME("GBufferProcess Regions=%d Target=%d (Parallel)", Draws.Num(), TargetIndex),
+			PassParameters,
+			ERDGPassFlags::Raster | ERDGPassFlags::SkipRenderPass,
+			[DrawContext, PassParameters, DrawsPerChunk, Draws = MoveTemp(Draws), Timing = Scheduler.AllocateTimingQueries(DrawnRegions)](FRHICommandListImmediate& RHICmdList)
+			{
+				if (Timing.IsValid())
+				{
+					RHICmdList.EndRenderQuery(Timing.BeginQuery);
+				}
+				RecordRegionDrawsInParallel(RHICmdList, GetRenderPassInfo(PassParameters), DrawContext, Draws, DrawsPerChunk);
+				if (Timing.IsValid())
+				{
+					RHICmdList.EndRenderQuery(Timing.EndQuery);
+				}
+			});
+		return ScheduledIndex;
+	}
+
+	AddRegionDrawsRasterPass(
+		GraphBuilder,
+		RDG_EVENT_NAME("GBufferProcess Regions=%d Target=%d", Draws.Num(), TargetIndex),
+		PassParameters,
+		DrawContext,
+		MoveTemp(Draws),
+		Scheduler.AllocateTimingQueries(DrawnRegions));
+	return ScheduledIndex;
+}
+
+void FGBufferProcessSceneViewExtension::RenderGPUCulledRegions(FRDGBuilder& GraphBuilder, FViewInfo& InView, TArrayView<FRDGTextureRef> BasePassTextures)
+{
+	if (bRenderThreadBakedRunsDirty)
+	{
+		GPUCuller.UpdateBakedRegions(RenderThreadBakedRuns);
+		bRenderThreadBakedRunsDirty = false;
+	}
+	GPUCuller.Update(GraphBuilder.RHICmdList, RenderThreadRegions, RenderThreadRegionsHash, RenderThreadDirtyRegionIds);
+	RenderThreadDirtyRegionIds.Reset();
+	if (GPUCuller.GetNumRegions() == 0) {
+		return;
+	}
+
+	// Step 1 : GPU上剔除区域, 生成每个batch的可见列表和indirect参数
+	// Consecutive frames of a tiled render are different tiles, the previous frame HZB doesn't match the view.
+	const FGBufferProcessCullingResult Culling = GPUCuller.Cull(GraphBuilder, InView, RenderThreadTile.GetPtrOrNull());
+
+	FGlobalShaderMap* GlobalShaderMap = InView.ShaderMap;
+	const auto FeatureLevel = InView.GetFeatureLevel();
+
+	// 创建默认的混合状态
+	FRHIBlendState* DefaultBlendState = FScreenPassPipelineState::FDefaultBlendState::GetRHI();
+	FRHIDepthStencilState* DefaultDepthStencilState = FScreenPassPipelineState::FDefaultDepthStencilState::GetRHI();
+
+	// RegionVS builds the rects from SV_VertexID, there is no vertex buffer.
+	FRHIVertexDeclaration* VertexDeclaration = GEmptyVertexDeclaration.VertexDeclarationRHI;
+
+	TShaderMapRef<FGBufferProcessRegionVS> RegionVS(GlobalShaderMap);
+	TShaderMapRef<FCopyTexturePS> CopyPixelShader(GlobalShaderMap);
+
+	FRDGBufferSRVRef VisibleRegionIndicesSRV = GraphBuilder.CreateSRV(Culling.VisibleRegionIndices);
+	FRDGBufferSRVRef RegionRectsSRV = GraphBuilder.CreateSRV(Culling.RegionRects);
+	const FIntRect ViewRect = InView.ViewRect;
+
+	TStaticArray<FRDGTextureRef, MaxSimultaneousRenderTargets> BackTextures;
+	for (FRDGTextureRef& BackTexture : BackTextures)
+	{
+		BackTexture = nullptr;
+	}
+
+	// Weighted batches come after the ordered ones, each target with any of them is resolved once at the end.
+	TStaticArray<FRDGTextureRef, MaxSimultaneousRenderTargets> AccumulationTextures;
+	TStaticArray<EGBufferProcessType, MaxSimultaneousRenderTargets> AccumulationTypes;
+	for (FRDGTextureRef& AccumulationTexture : AccumulationTextures)
+	{
+		AccumulationTexture = nullptr;
+	}
+
+	TArrayView<const FGBufferProcessRegionBatch> Batches = GPUCuller.GetBatches();
+	for (int32 BatchIndex = 0; BatchIndex < Batches.Num(); ++BatchIndex)
+	{
+		const FGBufferProcessRegionBatch& Batch = Batches[BatchIndex];
+		const FGBufferProcessRegionKernel& Kernel = GBufferProcess::GetRegionKernel(Batch.Type, Batch.BlendOp);
+		if (!BasePassTextures.IsValidIndex(Kernel.TargetIndex))
+		{
+			continue;
+		}
+
+		const FMaterialRenderProxy* MaterialRenderProxy = Batch.MaterialProxy;
+		FMaterialShaders MaterialShaders;
+		const FMaterial* MaterialForRendering = nullptr;
+		if (!GBufferProcess::TryGetShaders(FeatureLevel, Kernel.GPUDrivenPermutationId, MaterialRenderProxy, MaterialForRendering, MaterialShaders))
+		{
+			continue;
+		}
+
+		TShaderRef<FGBufferProcessRegionPS> RegionPsShader;
+		MaterialShaders.TryGetPixelShader(RegionPsShader);
+		if (!RegionPsShader.IsValid())
+		{
+			continue;
+		}
+
+		FRDGTextureRef TargetTexture = BasePassTextures[Kernel.TargetIndex];
+		const uint32 DrawIndirectArgsOffset = BatchIndex * sizeof(FRHIDrawIndirectParameters);
+
+		FGBufferProcessRegionVS::FParameters VSParameters;
+		VSParameters.View = InView.ViewUniformBuffer;
+		VSParameters.VisibleRegionIndices = VisibleRegionIndicesSRV;
+		VSParameters.RegionRects = RegionRectsSRV;
+		VSParameters.BakedRegions = Culling.BakedRegions;
+		VSParameters.RegionIntensities = Culling.RegionIntensities;
+		VSParameters.NumBakedRegions = Culling.NumBakedRegions;
+		VSParameters.BatchOffset = Batch.FirstRegion;
+
+		// Step 2 : copy target到临时buffer, 只有decode/encode的kernel需要, 只复制可见区域的屏幕范围
+#pragma region COPY
+		FRDGTextureRef BackTexture = nullptr;
+		if (Kernel.bDecodeEncode)
+		{
+			BackTexture = GetBackTexture(GraphBuilder, BackTextures, Kernel.TargetIndex, TargetTexture);
+
+			FGBufferProcessRegionBatchParameters* CopyParameters = GraphBuilder.AllocParameters<FGBufferProcessRegionBatchParameters>();
+			CopyParameters->VS = VSParameters;
+			CopyParameters->SrcTexture = TargetTexture;
+			CopyParameters->DrawIndirectArgs = Culling.DrawIndirectArgs;
+			CopyParameters->RenderTargets[0] = FRenderTargetBinding(BackTexture, ERenderTargetLoadAction::ENoAction);
+
+			GraphBuilder.AddPass(
+				RDG_EVENT_NAME("CopyTarget Batch=%d", BatchIndex),
+				CopyParameters,
+				ERDGPassFlags::Raster,
+				[ViewRect, RegionVS, CopyPixelShader, CopyParameters, DefaultBlendState, DefaultDepthStencilState, VertexDeclaration, DrawIndirectArgsOffset](FRHICommandListImmediate& RHICmdList)
+				{
+					DrawRegionBatch(
+						RHICmdList,
+						ViewRect,
+						FScreenPassPipelineState(RegionVS, CopyPixelShader, DefaultBlendState, DefaultDepthStencilState, VertexDeclaration),
+						RegionVS,
+						*CopyParameters,
+						DrawIndirectArgsOffset,
+						[&](FRHICommandListImmediate&)
+						{
+							FCopyTexturePS::FParameters PixelParameters;
+							PixelParameters.SrcTexture = CopyParameters->SrcTexture;
+							PixelParameters.SrcTextureSampler = TStaticSamplerState<SF_Point>::GetRHI();
+							SetShaderParameters(RHICmdList, CopyPixelShader, CopyPixelShader.GetPixelShader(), PixelParameters);
+						});
+				});
+		}
+#pragma endregion
+
+		// Step 3 : batch的kernel写回 GBuffer, 被剔除的区域instance数为0. Weighted的batch写到累加纹理
+#pragma region REWRITE
+		FRDGTextureRef OutputTexture = TargetTexture;
+		if (Kernel.bWeighted)
+		{
+			OutputTexture = GetAccumulationTexture(GraphBuilder, AccumulationTextures, Kernel.TargetIndex, TargetTexture);
+			AccumulationTypes[Kernel.TargetIndex] = Batch.Type;
+		}
+
+		FGBufferProcessRegionBatchParameters* RegionParameters = GraphBuilder.AllocParameters<FGBufferProcessRegionBatchParameters>();
+		RegionParameters->VS = VSParameters;
+		RegionParameters->SrcTexture = BackTexture;
+		RegionParameters->DrawIndirectArgs = Culling.DrawIndirectArgs;
+		RegionParameters->RenderTargets[0] = FRenderTargetBinding(OutputTexture, ERenderTargetLoadAction::ELoad);
+
+		FRHIBlendState* RegionBlendState = Kernel.GetBlendState();
+
+		GraphBuilder.AddPass(
+			RDG_EVENT_NAME("Batch=%d Regions=%u Type=%d BlendOp=%d", BatchIndex, Batch.NumRegions, (int32)Batch.Type, (int32)Batch.BlendOp),
+			RegionParameters,
+			ERDGPassFlags::Raster,
+			[&InView, ViewRect, RegionVS, RegionPsShader, MaterialForRendering, MaterialRenderProxy, RegionParameters, RegionBlendState, DefaultDepthStencilState, VertexDeclaration, BackTexture, DrawIndirectArgsOffset](FRHICommandListImmediate& RHICmdList)
+			{
+				DrawRegionBatch(
+					RHICmdList,
+					ViewRect,
+					FScreenPassPipelineState(RegionVS, RegionPsShader, RegionBlendState, DefaultDepthStencilState, VertexDeclaration),
+					RegionVS,
+					*RegionParameters,
+					DrawIndirectArgsOffset,
+					[&](FRHICommandListImmediate&)
+					{
+						// The intensity of each region comes from RegionVS.
+						RegionPsShader->SetParameters(RHICmdList, InView, MaterialRenderProxy, *MaterialForRendering, 0.0f, BackTexture ? BackTexture->GetRHI() : nullptr);
+					});
+			});
+#pragma endregion
+	}
+
+	// Step 4 : weighted累加结果混合回 GBuffer. The visible rects are only known on the GPU, the resolve covers the projected bounds
+	// of all weighted batches of the target, culled or not, and skips pixels without weight.
+	for (int32 TargetIndex = 0; TargetIndex < BasePassTextures.Num(); ++TargetIndex)
+	{
+		if (!AccumulationTextures[TargetIndex])
+		{
+			continue;
+		}
+
+		FBox ResolveBounds(ForceInit);
+		bool bUnbound = false;
+		for (const FGBufferProcessRegionBatch& Batch : Batches)
+		{
+			if (Batch.BlendOp == EGBufferProcessBlendOp::Weighted && GBufferProcess::GetRegionKernel(Batch.Type, Batch.BlendOp).TargetIndex == TargetIndex)
+			{
+				bUnbound |= !Batch.Bounds.IsValid;
+				ResolveBounds += Batch.Bounds;
+			}
+		}
+
+		FIntRect ResolveRect;
+		if (GBufferProcess::GetRegionPixelRect(InView, bUnbound ? FBox(ForceInit) : ResolveBounds, ResolveRect))
+		{
+			AddResolveWeightedPass(GraphBuilder, InView, AccumulationTypes[TargetIndex], BasePassTextures[TargetIndex], AccumulationTextures[TargetIndex], BackTextures, ResolveRect);
+		}
+	}
 }
 #endif
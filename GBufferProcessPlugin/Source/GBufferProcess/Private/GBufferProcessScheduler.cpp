@@ -0,0 +1,270 @@
+#include "GBufferProcessScheduler.h"
+#include "GBufferProcessProjection.h"
+#include "SceneView.h"
+#include "RenderCore.h"
+#include "Stats/Stats.h"
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Regions considered"), STAT_GBufferProcess_RegionsConsidered, STATGROUP_GBufferProcess);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Regions culled by frustum"), STAT_GBufferProcess_RegionsFrustumCulled, STATGROUP_GBufferProcess);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Regions culled by coverage"), STAT_GBufferProcess_RegionsCoverageCulled, STATGROUP_GBufferProcess);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Regions degraded by budget"), STAT_GBufferProcess_RegionsDegraded, STATGROUP_GBufferProcess);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Regions dropped by budget"), STAT_GBufferProcess_RegionsDropped, STATGROUP_GBufferProcess);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Regions drawn"), STAT_GBufferProcess_RegionsDrawn, STATGROUP_GBufferProcess);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Estimated cost before budget (ms)"), STAT_GBufferProcess_RequestedCostMs, STATGROUP_GBufferProcess);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Estimated cost after budget (ms)"), STAT_GBufferProcess_ScheduledCostMs, STATGROUP_GBufferProcess);
+
+static TAutoConsoleVariable<float> CVarGBufferProcessBudgetMs(
+	TEXT("r.GBufferProcess.BudgetMs"),
+	0.0f,
+	TEXT("GPU time budget per frame for all GBuffer process regions, in milliseconds. Views of the frame share it in render order.\n")
+	TEXT("Lower priority regions use their low quality material, then get dropped, until the estimate fits.\n")
+	TEXT("0 disables the budget (default)."),
+	ECVF_Scalability | ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<float> CVarGBufferProcessMinScreenCoverage(
+	TEXT("r.GBufferProcess.MinScreenCoverage"),
+	0.001f,
+	TEXT("Regions whose projected rect covers less than this fraction of the view are not drawn."),
+	ECVF_Scalability | ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<float> CVarGBufferProcessDefaultCostMs(
+	TEXT("r.GBufferProcess.DefaultRegionCostMs"),
+	0.5f,
+	TEXT("Assumed full screen GPU cost of a region that has not been measured yet, in milliseconds."),
+	ECVF_RenderThreadSafe);
+
+namespace
+{
+	// Weight of a new GPU timing sample in the smoothed per region cost.
+	const float CostHistorySmoothing = 0.2f;
+
+	// Timings that are still not available after this many frames are discarded.
+	const uint32 MaxPendingTimingFrames = 8;
+
+	// Cost history of regions that were not drawn for this many frames is discarded.
+	const uint32 MaxCostHistoryAgeFrames = 600;
+
+	// Low quality materials are assumed to cost this fraction of the full one until they are measured.
+	const float DefaultLowQualityCostScale = 0.5f;
+}
+
+FGBufferProcessScheduler::~FGBufferProcessScheduler()
+{
+	// Pooled queries return themselves to the pool, release them before it.
+	PendingTimings.Reset();
+	TimingQueryPool.SafeRelease();
+}
+
+bool FGBufferProcessScheduler::IsBudgetEnabled()
+{
+	return CVarGBufferProcessBudgetMs.GetValueOnRenderThread() > 0.0f;
+}
+
+float FGBufferProcessScheduler::GetMinScreenCoverage()
+{
+	return CVarGBufferProcessMinScreenCoverage.GetValueOnRenderThread();
+}
+
+void FGBufferProcessScheduler::UpdateCostHistory()
+{
+	check(IsInRenderingThread());
+
+	const uint32 FrameNumber = GFrameNumberRenderThread;
+
+	for (int32 Index = PendingTimings.Num() - 1; Index >= 0; --Index)
+	{
+		FPendingTiming& Timing = *PendingTimings[Index];
+
+		uint64 BeginMicroseconds = 0;
+		uint64 EndMicroseconds = 0;
+		const bool bReady =
+			RHIGetRenderQueryResult(Timing.EndQuery.GetQuery(), EndMicroseconds, false) &&
+			RHIGetRenderQueryResult(Timing.BeginQuery.GetQuery(), BeginMicroseconds, false);
+
+		if (bReady)
+		{
+			if (EndMicroseconds >= BeginMicroseconds)
+			{
+				// The time of the pass is split by the estimated cost of its regions, evenly if none has any.
+				float TotalEstimatedCostMs = 0.0f;
+				for (const FTimedRegion& Region : Timing.Regions)
+				{
+					TotalEstimatedCostMs += Region.EstimatedCostMs;
+				}
+
+				const float PassMs = float(EndMicroseconds - BeginMicroseconds) / 1000.0f;
+				for (const FTimedRegion& Region : Timing.Regions)
+				{
+					if (Region.ScreenCoverage <= 0.0f)
+					{
+						continue;
+					}
+
+					const float Share = TotalEstimatedCostMs > 0.0f ? Region.EstimatedCostMs / TotalEstimatedCostMs : 1.0f / Timing.Regions.Num();
+					const float SampleMsPerCoverage = PassMs * Share / Region.ScreenCoverage;
+					FCostHistory& History = CostHistory.FindOrAdd(Region.RegionId);
+					const int32 QualityIndex = (int32)Region.Quality;
+					History.MsPerCoverage[QualityIndex] = History.bHasSample[QualityIndex]
+						? FMath::Lerp(History.MsPerCoverage[QualityIndex], SampleMsPerCoverage, CostHistorySmoothing)
+						: SampleMsPerCoverage;
+					History.bHasSample[QualityIndex] = true;
+				}
+			}
+			PendingTimings.RemoveAtSwap(Index, 1, false);
+		}
+		else if (FrameNumber - Timing.FrameNumber > MaxPendingTimingFrames)
+		{
+			PendingTimings.RemoveAtSwap(Index, 1, false);
+		}
+	}
+
+	for (auto It = CostHistory.CreateIterator(); It; ++It)
+	{
+		if (FrameNumber - It.Value().LastUsedFrame > MaxCostHistoryAgeFrames)
+		{
+			It.RemoveCurrent();
+		}
+	}
+}
+
+float FGBufferProcessScheduler::EstimateCostMs(uint32 RegionId, EGBufferProcessQuality Quality, float ScreenCoverage) const
+{
+	const int32 QualityIndex = (int32)Quality;
+	const FCostHistory* History = CostHistory.Find(RegionId);
+	if (History && History->bHasSample[QualityIndex])
+	{
+		return History->MsPerCoverage[QualityIndex] * ScreenCoverage;
+	}
+
+	const float FullCostMs = History && History->bHasSample[(int32)EGBufferProcessQuality::Full]
+		? History->MsPerCoverage[(int32)EGBufferProcessQuality::Full]
+		: CVarGBufferProcessDefaultCostMs.GetValueOnRenderThread();
+	const float QualityScale = Quality == EGBufferProcessQuality::Low ? DefaultLowQualityCostScale : 1.0f;
+	return FullCostMs * QualityScale * ScreenCoverage;
+}
+
+FGBufferProcessPassTiming FGBufferProcessScheduler::AllocateTimingQueries(TArrayView<const FGBufferProcessScheduledRegion* const> Regions)
+{
+	// Only the budget reads the cost history.
+	if (!GSupportsTimestampRenderQueries || !IsBudgetEnabled() || Regions.Num() == 0)
+	{
+		return FGBufferProcessPassTiming();
+	}
+
+	if (!TimingQueryPool.IsValid())
+	{
+		TimingQueryPool = RHICreateRenderQueryPool(RQT_AbsoluteTime);
+	}
+
+	TUniquePtr<FPendingTiming> Timing = MakeUnique<FPendingTiming>();
+	Timing->Regions.Reserve(Regions.Num());
+	for (const FGBufferProcessScheduledRegion* ScheduledRegion : Regions)
+	{
+		FTimedRegion& Region = Timing->Regions.AddDefaulted_GetRef();
+		Region.RegionId = ScheduledRegion->RegionId;
+		Region.Quality = ScheduledRegion->Quality;
+		Region.ScreenCoverage = ScheduledRegion->ScreenCoverage;
+		Region.EstimatedCostMs = ScheduledRegion->EstimatedCostMs;
+	}
+	Timing->FrameNumber = GFrameNumberRenderThread;
+	Timing->BeginQuery = TimingQueryPool->AllocateQuery();
+	Timing->EndQuery = TimingQueryPool->AllocateQuery();
+
+	FGBufferProcessPassTiming PassTiming;
+	PassTiming.BeginQuery = Timing->BeginQuery.GetQuery();
+	PassTiming.EndQuery = Timing->EndQuery.GetQuery();
+	PendingTimings.Add(MoveTemp(Timing));
+	return PassTiming;
+}
+
+void FGBufferProcessScheduler::Schedule(const FSceneView& View, TArrayView<const FGBufferProcessRegionProxy* const> Regions, TArray<FGBufferProcessScheduledRegion>& OutScheduled, const FGBufferProcessTile* Tile)
+{
+	check(IsInRenderingThread());
+
+	OutScheduled.Reset();
+	INC_DWORD_STAT_BY(STAT_GBufferProcess_RegionsConsidered, Regions.Num());
+
+	const float MinScreenCoverage = GetMinScreenCoverage();
+	// Timings differ from tile to tile, a budget would make different decisions on both sides of a seam.
+	const float BudgetMs = Tile ? 0.0f : CVarGBufferProcessBudgetMs.GetValueOnRenderThread();
+
+	// Step 1 : cull by frustum and screen coverage. Regions are already sorted by ascending priority.
+	float TotalCostMs = 0.0f;
+	for (int32 RegionIndex = 0; RegionIndex < Regions.Num(); ++RegionIndex)
+	{
+		const FGBufferProcessRegionProxy& Region = *Regions[RegionIndex];
+
+		FGBufferProcessScheduledRegion ScheduledRegion;
+		FIntRect UnclippedRect;
+		if (!GBufferProcess::GetRegionPixelRect(View, Region.WorldBounds, ScheduledRegion.Rect, Tile ? &UnclippedRect : nullptr))
+		{
+			INC_DWORD_STAT(STAT_GBufferProcess_RegionsFrustumCulled);
+			continue;
+		}
+
+		// The coverage of the view normalizes the GPU timings of the region, a tile culls by its coverage of the whole image instead.
+		ScheduledRegion.ScreenCoverage = GBufferProcess::GetScreenCoverage(View, ScheduledRegion.Rect);
+		const float CullingCoverage = Tile ? GBufferProcess::GetTiledScreenCoverage(*Tile, View.ViewRect, UnclippedRect) : ScheduledRegion.ScreenCoverage;
+		if (CullingCoverage < MinScreenCoverage)
+		{
+			INC_DWORD_STAT(STAT_GBufferProcess_RegionsCoverageCulled);
+			continue;
+		}
+
+		ScheduledRegion.RegionIndex = RegionIndex;
+		ScheduledRegion.RegionId = Region.RegionId;
+		ScheduledRegion.EstimatedCostMs = EstimateCostMs(Region.RegionId, EGBufferProcessQuality::Full, ScheduledRegion.ScreenCoverage);
+		TotalCostMs += ScheduledRegion.EstimatedCostMs;
+		OutScheduled.Add(ScheduledRegion);
+	}
+	INC_FLOAT_STAT_BY(STAT_GBufferProcess_RequestedCostMs, TotalCostMs);
+
+	// Step 2 : over budget, fall back to low quality starting from the lowest priority.
+	if (BudgetMs > 0.0f)
+	{
+		// The budget is shared by all views of the frame, each view gets what the views before it left.
+		if (BudgetFrameNumber != GFrameNumberRenderThread)
+		{
+			BudgetFrameNumber = GFrameNumberRenderThread;
+			RemainingBudgetMs = BudgetMs;
+		}
+		const float ViewBudgetMs = RemainingBudgetMs;
+
+		for (int32 Index = 0; Index < OutScheduled.Num() && TotalCostMs > ViewBudgetMs; ++Index)
+		{
+			FGBufferProcessScheduledRegion& ScheduledRegion = OutScheduled[Index];
+			const FGBufferProcessRegionProxy& Region = *Regions[ScheduledRegion.RegionIndex];
+			if (Region.LowQualityMaterialProxy)
+			{
+				const float LowCostMs = EstimateCostMs(Region.RegionId, EGBufferProcessQuality::Low, ScheduledRegion.ScreenCoverage);
+				TotalCostMs += LowCostMs - ScheduledRegion.EstimatedCostMs;
+				ScheduledRegion.EstimatedCostMs = LowCostMs;
+				ScheduledRegion.Quality = EGBufferProcessQuality::Low;
+				INC_DWORD_STAT(STAT_GBufferProcess_RegionsDegraded);
+			}
+		}
+
+		// Step 3 : still over budget, drop regions starting from the lowest priority.
+		int32 NumDropped = 0;
+		while (NumDropped < OutScheduled.Num() && TotalCostMs > ViewBudgetMs)
+		{
+			TotalCostMs -= OutScheduled[NumDropped].EstimatedCostMs;
+			++NumDropped;
+		}
+		if (NumDropped > 0)
+		{
+			OutScheduled.RemoveAt(0, NumDropped, false);
+			INC_DWORD_STAT_BY(STAT_GBufferProcess_RegionsDropped, NumDropped);
+		}
+
+		RemainingBudgetMs = FMath::Max(RemainingBudgetMs - TotalCostMs, 0.0f);
+	}
+
+	for (const FGBufferProcessScheduledRegion& ScheduledRegion : OutScheduled)
+	{
+		CostHistory.FindOrAdd(Regions[ScheduledRegion.RegionIndex]->RegionId).LastUsedFrame = GFrameNumberRenderThread;
+	}
+
+	INC_DWORD_STAT_BY(STAT_GBufferProcess_RegionsDrawn, OutScheduled.Num());
+	INC_FLOAT_STAT_BY(STAT_GBufferProcess_ScheduledCostMs, TotalCostMs);
+}
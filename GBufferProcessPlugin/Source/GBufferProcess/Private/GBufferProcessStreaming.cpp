@@ -0,0 +1,130 @@
+#include "GBufferProcessStreaming.h"
+#include "GBufferProcessSubsystem.h"
+#include "PrimitiveSceneProxy.h"
+#include "ContentStreaming.h"
+#include "Engine/TextureStreamingTypes.h"
+#include "Engine/CollisionProfile.h"
+#include "Engine/World.h"
+#include "Engine/Texture.h"
+#include "Materials/MaterialInterface.h"
+#include "HAL/IConsoleManager.h"
+
+static TAutoConsoleVariable<int32> CVarGBufferProcessTextureStreaming(
+	TEXT("r.GBufferProcess.TextureStreaming"),
+	1,
+	TEXT("Report the textures of region materials to the texture streamer with the bounds of their regions, so their mips follow the screen size of the regions.\n")
+	TEXT("0: off, the textures keep the mips the streamer gives unreferenced textures\n")
+	TEXT("1: on (default)"),
+	ECVF_Default);
+
+namespace
+{
+	/** The texture streamer ignores registered primitives without a proxy. Draws nothing. */
+	class FGBufferProcessStreamingSceneProxy final : public FPrimitiveSceneProxy
+	{
+	public:
+		FGBufferProcessStreamingSceneProxy(const UPrimitiveComponent* InComponent)
+			: FPrimitiveSceneProxy(InComponent)
+		{
+		}
+
+		virtual SIZE_T GetTypeHash() const override
+		{
+			static size_t UniquePointer;
+			return reinterpret_cast<size_t>(&UniquePointer);
+		}
+
+		virtual FPrimitiveViewRelevance GetViewRelevance(const FSceneView* View) const override
+		{
+			return FPrimitiveViewRelevance();
+		}
+
+		virtual uint32 GetMemoryFootprint() const override { return sizeof(*this) + GetAllocatedSize(); }
+	};
+}
+
+namespace GBufferProcess
+{
+	/**
+	 * World size UV 0 to 1 is assumed to span in region materials, as reported to the texture streamer. Regions have no mesh UVs,
+	 * materials tiling their textures once per 10m get the mips they need, denser tiling gets coarser mips.
+	 */
+	static const float RegionTexelFactor = 1000.0f;
+
+	bool IsTextureStreamingEnabled()
+	{
+		return CVarGBufferProcessTextureStreaming.GetValueOnGameThread() != 0 && IStreamingManager::Get().IsTextureStreamingEnabled();
+	}
+}
+
+FGBufferProcessStreamingTextures::FGBufferProcessStreamingTextures(ERHIFeatureLevel::Type InFeatureLevel, TArray<FStreamingRenderAssetPrimitiveInfo>& InOutStreamingRenderAssets)
+	: FeatureLevel(InFeatureLevel)
+	, StreamingRenderAssets(InOutStreamingRenderAssets)
+{
+}
+
+void FGBufferProcessStreamingTextures::AddRegion(const UMaterialInterface* InMaterial, const FBox& WorldBounds)
+{
+	if (!InMaterial)
+	{
+		return;
+	}
+
+	TArray<UTexture*>* Textures = MaterialTextures.Find(InMaterial);
+	if (!Textures)
+	{
+		Textures = &MaterialTextures.Add(InMaterial);
+		InMaterial->GetUsedTextures(*Textures, EMaterialQualityLevel::Num, true, FeatureLevel, false);
+	}
+	if (Textures->Num() == 0)
+	{
+		return;
+	}
+
+	// Unbound regions cover the view wherever it is, bounds around the whole world keep every view inside them.
+	const FBoxSphereBounds Bounds = WorldBounds.IsValid ? FBoxSphereBounds(WorldBounds) : FBoxSphereBounds(FVector::ZeroVector, FVector(HALF_WORLD_MAX), HALF_WORLD_MAX);
+
+	// The region shader sets no texture coordinates, materials sample with world or screen positions, so a texel covers a fixed world size.
+	// Regions smaller than that cannot show more of the texture, unbound regions would ask for the lowest mip with their diameter.
+	const float TexelFactor = FMath::Min(GBufferProcess::RegionTexelFactor, Bounds.SphereRadius * 2.0f);
+
+	for (UTexture* Texture : *Textures)
+	{
+		if (Texture)
+		{
+			StreamingRenderAssets.Emplace(Texture, Bounds, TexelFactor);
+		}
+	}
+}
+
+UGBufferProcessStreamingComponent::UGBufferProcessStreamingComponent(const FObjectInitializer& ObjectInitializer) : Super(ObjectInitializer)
+	, Subsystem(nullptr)
+{
+	PrimaryComponentTick.bCanEverTick = false;
+	Mobility = EComponentMobility::Movable;
+	SetCollisionProfileName(UCollisionProfile::NoCollision_ProfileName);
+	SetGenerateOverlapEvents(false);
+	CastShadow = false;
+	bSelectable = false;
+}
+
+FPrimitiveSceneProxy* UGBufferProcessStreamingComponent::CreateSceneProxy()
+{
+	return new FGBufferProcessStreamingSceneProxy(this);
+}
+
+void UGBufferProcessStreamingComponent::GetStreamingRenderAssetInfo(FStreamingTextureLevelContext& LevelContext, TArray<FStreamingRenderAssetPrimitiveInfo>& OutStreamingRenderAssets) const
+{
+	UWorld* World = GetWorld();
+	if (Subsystem && World)
+	{
+		FGBufferProcessStreamingTextures StreamingTextures(World->FeatureLevel, OutStreamingRenderAssets);
+		Subsystem->GetStreamingTextures(StreamingTextures);
+	}
+}
+
+FBoxSphereBounds UGBufferProcessStreamingComponent::CalcBounds(const FTransform& LocalToWorld) const
+{
+	// The textures are reported with the bounds of their regions, the component itself is never culled.
+	return FBoxSphereBounds(FVector::ZeroVector, FVector(HALF_WORLD_MAX), HALF_WORLD_MAX);
+}
@@ -4,6 +4,12 @@
 #include "EngineUtils.h"
 #include "SceneViewExtension.h"
 #include "GBufferProcessSceneViewExtension.h"
+#include "GBufferProcessPlugin.h"
+#include "GBufferProcessStreaming.h"
+#include "ContentStreaming.h"
+#include "Engine/Level.h"
+#include "Algo/AnyOf.h"
+#include "Algo/BinarySearch.h"
 
 #if WITH_EDITOR
 #include "Editor.h"
@@ -22,6 +28,25 @@ namespace
 		return InRegion && InRegion->GetWorld() == CurrentWorld;
 #endif
 	}
+
+	bool RegionPriorityLess(const AGBufferProcessActor& A, const AGBufferProcessActor& B)
+	{
+		// Regions with the same priority could potentially cause flickering on overlap
+		return A.Priority < B.Priority;
+	}
+
+	/** Captures the proxy of an actor region if it is drawn from ViewLocation and has compiled shaders. */
+	bool GetGatheredRegionProxy(AGBufferProcessActor* InRegion, ERHIFeatureLevel::Type InFeatureLevel, const FVector& ViewLocation, FGBufferProcessRegionProxy& OutProxy)
+	{
+		if (!IsValid(InRegion) || !InRegion->Enabled || !InRegion->Material || !InRegion->IsEffect(ViewLocation))
+		{
+			return false;
+		}
+
+		InRegion->GetRegionProxy(InFeatureLevel, OutProxy);
+		// Nothing compiled yet for this region, skip it until its shaders are ready.
+		return OutProxy.MaterialProxy != nullptr;
+	}
 }
 
 void UGBufferProcessSubsystem::Initialize(FSubsystemCollectionBase& Collection)
@@ -35,6 +60,10 @@ void UGBufferProcessSubsystem::Initialize(FSubsystemCollectionBase& Collection)
 		GEditor->RegisterForUndo(this);
 	}
 #endif
+	FWorldDelegates::LevelAddedToWorld.AddUObject(this, &UGBufferProcessSubsystem::OnLevelAddedToWorld);
+	FWorldDelegates::LevelRemovedFromWorld.AddUObject(this, &UGBufferProcessSubsystem::OnLevelRemovedFromWorld);
+	FWorldDelegates::OnWorldTickStart.AddUObject(this, &UGBufferProcessSubsystem::OnWorldTickStart);
+
 	// Initializing Scene view extension responsible for rendering regions.
 	PostProcessSceneViewExtension = FSceneViewExtensions::NewExtension<FGBufferProcessSceneViewExtension>(this);
 }
@@ -50,7 +79,19 @@ void UGBufferProcessSubsystem::Deinitialize()
 		GEditor->UnregisterForUndo(this);
 	}
 #endif
+	FWorldDelegates::LevelAddedToWorld.RemoveAll(this);
+	FWorldDelegates::LevelRemovedFromWorld.RemoveAll(this);
+	FWorldDelegates::OnWorldTickStart.RemoveAll(this);
+
+	DestroyStreamingComponent();
+
 	Regions.Reset();
+	InstanceComponents.Reset();
+	BakedRegionData.Reset();
+	DirtyRegionIds.Reset();
+	DirtyRegions.Reset();
+	DirtyInstances.Reset();
+	RegisteredLevels.Reset();
 	PostProcessSceneViewExtension.Reset();
 	PostProcessSceneViewExtension = nullptr;
 }
@@ -59,11 +100,9 @@ void UGBufferProcessSubsystem::OnActorSpawned(AActor* InActor)
 {
 	AGBufferProcessActor* AsRegion = Cast<AGBufferProcessActor>(InActor);
 
-	if (IsRegionValid(AsRegion, GetWorld()))
+	if (IsRegionValid(AsRegion, GetWorld()) && !IsLevelPendingBatchRegistration(AsRegion->GetLevel()))
 	{
-		FScopeLock RegionScopeLock(&RegionAccessCriticalSection);
-		Regions.Add(AsRegion);
-		SortRegionsByPriority();
+		InsertRegionSorted(AsRegion);
 	}
 }
 
@@ -74,10 +113,309 @@ void UGBufferProcessSubsystem::OnActorDeleted(AActor* InActor)
 	{
 		FScopeLock RegionScopeLock(&RegionAccessCriticalSection);
 		Regions.Remove(AsRegion);
+		MarkRegionsChanged();
+		bStreamingTexturesDirty = true;
+	}
+}
+
+void UGBufferProcessSubsystem::OnLevelAddedToWorld(ULevel* InLevel, UWorld* InWorld)
+{
+	if (InLevel && InWorld == GetWorld())
+	{
+		AddLevelRegions(InLevel);
+	}
+}
+
+void UGBufferProcessSubsystem::OnLevelRemovedFromWorld(ULevel* InLevel, UWorld* InWorld)
+{
+	if (InWorld == GetWorld())
+	{
+		RemoveLevelRegions(InLevel);
+	}
+}
+
+bool UGBufferProcessSubsystem::IsLevelPendingBatchRegistration(const ULevel* InLevel)
+{
+	// Actors of a streaming level begin play while the level is being associated with the world.
+	// LevelAddedToWorld is broadcast right after, so they are registered there as one batch.
+	return InLevel && InLevel->bIsAssociatingLevel;
+}
+
+bool UGBufferProcessSubsystem::IsLevelPendingBatchUnregistration(const ULevel* InLevel)
+{
+	// Set by UWorld::RemoveFromWorld while it ends play for the actors of the level, right before LevelRemovedFromWorld is broadcast.
+	return InLevel && InLevel->bIsBeingRemoved;
+}
+
+void UGBufferProcessSubsystem::InsertRegionSorted(AGBufferProcessActor* InRegion, bool bNewRegion)
+{
+	FScopeLock RegionScopeLock(&RegionAccessCriticalSection);
+
+	if (Regions.Contains(InRegion))
+	{
+		return;
+	}
+
+	// Entries nulled by the garbage collector can't be compared.
+	Regions.Remove(nullptr);
+
+	// Insert after regions of equal priority so that registration order is kept stable.
+	const int32 InsertIndex = Algo::UpperBound(Regions, InRegion, [](const AGBufferProcessActor* A, const AGBufferProcessActor* B)
+	{
+		return RegionPriorityLess(*A, *B);
+	});
+	Regions.Insert(InRegion, InsertIndex);
+	MarkRegionsChanged();
+	if (bNewRegion)
+	{
+		QueuePipelinePrecache(InRegion);
+		bStreamingTexturesDirty = true;
+	}
+}
+
+void UGBufferProcessSubsystem::QueuePipelinePrecache(const AGBufferProcessActor* InRegion)
+{
+	PipelinePrecacher.QueueMaterial(InRegion->Material, InRegion->Type, InRegion->BlendOp);
+	PipelinePrecacher.QueueMaterial(InRegion->LowQualityMaterial, InRegion->Type, InRegion->BlendOp);
+}
+
+void UGBufferProcessSubsystem::MarkRegionDirty(AGBufferProcessActor* InRegion, EGBufferProcessRegionDirtyFlags InFlags)
+{
+	check(IsInGameThread());
+
+	if (EnumHasAnyFlags(InFlags, EGBufferProcessRegionDirtyFlags::Priority))
+	{
+		// Only this region moved, it is inserted again rather than sorting every region.
+		FScopeLock RegionScopeLock(&RegionAccessCriticalSection);
+		if (Regions.Remove(InRegion) > 0)
+		{
+			InsertRegionSorted(InRegion, false);
+		}
+	}
+	if (EnumHasAnyFlags(InFlags, EGBufferProcessRegionDirtyFlags::Kernel | EGBufferProcessRegionDirtyFlags::Material))
+	{
+		QueuePipelinePrecache(InRegion);
+	}
+	if (EnumHasAnyFlags(InFlags, EGBufferProcessRegionDirtyFlags::InPlace))
+	{
+		DirtyRegions.Add(InRegion);
+	}
+	MarkRegionDirty(InRegion->GetUniqueID(), InFlags);
+}
+
+void UGBufferProcessSubsystem::MarkInstanceDirty(UGBufferProcessRegionInstancesComponent* InComponent, int32 InInstanceIndex, EGBufferProcessRegionDirtyFlags InFlags)
+{
+	check(IsInGameThread());
+
+	if (EnumHasAnyFlags(InFlags, EGBufferProcessRegionDirtyFlags::InPlace))
+	{
+		DirtyInstances.FindOrAdd(InComponent).Add(InInstanceIndex);
+	}
+	MarkRegionDirty(InComponent->GetInstanceRegionId(InInstanceIndex), InFlags);
+}
+
+void UGBufferProcessSubsystem::MarkRegionDirty(uint32 InRegionId, EGBufferProcessRegionDirtyFlags InFlags)
+{
+	check(IsInGameThread());
+
+	if (EnumHasAnyFlags(InFlags, EGBufferProcessRegionDirtyFlags::InPlace))
+	{
+		DirtyRegionIds.Add(InRegionId);
+	}
+	// Other changes alter which regions are gathered or how they are batched, GetRegionsHash catches them.
+	if (EnumHasAnyFlags(InFlags, ~EGBufferProcessRegionDirtyFlags::InPlace))
+	{
+		MarkRegionsChanged();
+	}
+	if (EnumHasAnyFlags(InFlags, EGBufferProcessRegionDirtyFlags::Transform | EGBufferProcessRegionDirtyFlags::Enabled | EGBufferProcessRegionDirtyFlags::Material))
+	{
+		bStreamingTexturesDirty = true;
+	}
+}
+
+void UGBufferProcessSubsystem::PopDirtyRegionIds(TArray<uint32>& OutRegionIds)
+{
+	check(IsInGameThread());
+
+	OutRegionIds.Append(DirtyRegionIds.Array());
+	DirtyRegionIds.Reset();
+	DirtyRegions.Reset();
+	DirtyInstances.Reset();
+}
+
+void UGBufferProcessSubsystem::RegisterInstancesComponent(UGBufferProcessRegionInstancesComponent* InComponent)
+{
+	if (!InComponent || InComponent->GetWorld() != GetWorld())
+	{
+		return;
+	}
+
+	{
+		FScopeLock RegionScopeLock(&RegionAccessCriticalSection);
+		InstanceComponents.AddUnique(InComponent);
+		MarkRegionsChanged();
+		bStreamingTexturesDirty = true;
+	}
+	InComponent->QueuePipelinePrecache();
+}
+
+void UGBufferProcessSubsystem::UnregisterInstancesComponent(UGBufferProcessRegionInstancesComponent* InComponent)
+{
+	FScopeLock RegionScopeLock(&RegionAccessCriticalSection);
+	InstanceComponents.Remove(InComponent);
+	MarkRegionsChanged();
+	bStreamingTexturesDirty = true;
+}
+
+void UGBufferProcessSubsystem::RegisterBakedRegions(UGBufferProcessRegionDataAsset* InRegionData)
+{
+	if (!InRegionData)
+	{
+		return;
+	}
+
+	{
+		FScopeLock RegionScopeLock(&RegionAccessCriticalSection);
+		if (BakedRegionData.Contains(InRegionData))
+		{
+			return;
+		}
+		BakedRegionData.Add(InRegionData);
+		MarkRegionsChanged();
+		bStreamingTexturesDirty = true;
+	}
+	InRegionData->QueuePipelinePrecache(PipelinePrecacher);
+	PostProcessSceneViewExtension->AddBakedRegions(InRegionData);
+}
+
+void UGBufferProcessSubsystem::UnregisterBakedRegions(UGBufferProcessRegionDataAsset* InRegionData)
+{
+	FScopeLock RegionScopeLock(&RegionAccessCriticalSection);
+	if (BakedRegionData.Remove(InRegionData) > 0)
+	{
+		PostProcessSceneViewExtension->RemoveBakedRegions(InRegionData);
+		MarkRegionsChanged();
+		bStreamingTexturesDirty = true;
+	}
+}
+
+void UGBufferProcessSubsystem::AddLevelRegions(ULevel* InLevel)
+{
+	UWorld* World = GetWorld();
+	const bool bRequiresBegunPlay = World->IsGameWorld();
+
+	TArray<AGBufferProcessActor*> LevelRegions;
+	for (AActor* Actor : InLevel->Actors)
+	{
+		AGBufferProcessActor* AsRegion = Cast<AGBufferProcessActor>(Actor);
+		// In game worlds, actors that have not begun play yet register themselves from BeginPlay.
+		if (IsRegionValid(AsRegion, World) && (!bRequiresBegunPlay || AsRegion->HasActorBegunPlay()))
+		{
+			LevelRegions.Add(AsRegion);
+		}
+	}
+
+	FScopeLock RegionScopeLock(&RegionAccessCriticalSection);
+	RegisteredLevels.Add(InLevel);
+
+	if (LevelRegions.Num() == 0)
+	{
+		return;
+	}
+
+	Regions.Remove(nullptr);
+	if (Regions.Num() > 0)
+	{
+		// Single actors may already have been registered through the editor OnLevelActorAdded callback.
+		TSet<AGBufferProcessActor*> ExistingRegions(Regions);
+		LevelRegions.RemoveAllSwap([&ExistingRegions](AGBufferProcessActor* Region) { return ExistingRegions.Contains(Region); });
+	}
+
+	for (const AGBufferProcessActor* Region : LevelRegions)
+	{
+		QueuePipelinePrecache(Region);
+	}
+	MarkRegionsChanged();
+	bStreamingTexturesDirty = true;
+
+	// One ordering update per batch: sort the new regions, then merge them into the already sorted list.
+	LevelRegions.StableSort(RegionPriorityLess);
+
+	TArray<AGBufferProcessActor*> MergedRegions;
+	MergedRegions.Reserve(Regions.Num() + LevelRegions.Num());
+	int32 ExistingIndex = 0;
+	int32 NewIndex = 0;
+	while (ExistingIndex < Regions.Num() && NewIndex < LevelRegions.Num())
+	{
+		if (RegionPriorityLess(*LevelRegions[NewIndex], *Regions[ExistingIndex]))
+		{
+			MergedRegions.Add(LevelRegions[NewIndex++]);
+		}
+		else
+		{
+			MergedRegions.Add(Regions[ExistingIndex++]);
+		}
+	}
+	MergedRegions.Append(Regions.GetData() + ExistingIndex, Regions.Num() - ExistingIndex);
+	MergedRegions.Append(LevelRegions.GetData() + NewIndex, LevelRegions.Num() - NewIndex);
+	Regions = MoveTemp(MergedRegions);
+}
+
+void UGBufferProcessSubsystem::RemoveLevelRegions(ULevel* InLevel)
+{
+	FScopeLock RegionScopeLock(&RegionAccessCriticalSection);
+	MarkRegionsChanged();
+	bStreamingTexturesDirty = true;
+
+	if (InLevel)
+	{
+		RegisteredLevels.Remove(InLevel);
+		// RemoveAll keeps the relative order, so no re-sort is needed.
+		Regions.RemoveAll([InLevel](const AGBufferProcessActor* Region) { return !Region || Region->GetLevel() == InLevel; });
+	}
+	else
+	{
+		// A null level means the world dropped several levels at once; drop everything that lost its level.
+		UWorld* World = GetWorld();
+		for (auto It = RegisteredLevels.CreateIterator(); It; ++It)
+		{
+			if (!It->IsValid() || !World->GetLevels().Contains(It->Get()))
+			{
+				It.RemoveCurrent();
+			}
+		}
+		Regions.RemoveAll([World](const AGBufferProcessActor* Region)
+		{
+			return !IsValid(Region) || !Region->GetLevel() || !World->GetLevels().Contains(Region->GetLevel());
+		});
 	}
 }
 
 #if WITH_EDITOR
+void UGBufferProcessSubsystem::OnLevelActorListChanged()
+{
+	UWorld* World = GetWorld();
+
+	// Drop regions of levels that were unloaded since the last notification.
+	const bool bHasRemovedLevels = Algo::AnyOf(RegisteredLevels, [World](const TWeakObjectPtr<ULevel>& Level)
+	{
+		return !Level.IsValid() || !World->GetLevels().Contains(Level.Get());
+	});
+	if (bHasRemovedLevels)
+	{
+		RemoveLevelRegions(nullptr);
+	}
+
+	// Only newly loaded levels are scanned.
+	for (ULevel* Level : World->GetLevels())
+	{
+		if (Level && !RegisteredLevels.Contains(Level))
+		{
+			AddLevelRegions(Level);
+		}
+	}
+}
+
 void UGBufferProcessSubsystem::PostUndo(bool bSuccess)
 {
 	FScopeLock RegionScopeLock(&RegionAccessCriticalSection);
@@ -92,6 +430,7 @@ void UGBufferProcessSubsystem::PostUndo(bool bSuccess)
 		}
 	}
 	SortRegionsByPriority();
+	bStreamingTexturesDirty = true;
 }
 #endif
 
@@ -99,21 +438,166 @@ void UGBufferProcessSubsystem::SortRegionsByPriority()
 {
 	FScopeLock RegionScopeLock(&RegionAccessCriticalSection);
 
-	Regions.Sort([](const AGBufferProcessActor& A, const AGBufferProcessActor& B) {
-		// Regions with the same priority could potentially cause flickering on overlap
-		return A.Priority < B.Priority;
-	});
+	Regions.StableSort(RegionPriorityLess);
+	MarkRegionsChanged();
 }
 
-AGBufferProcessActor* UGBufferProcessSubsystem::GetEffectModifyActor()
+void UGBufferProcessSubsystem::GatherRegions(const FVector& ViewLocation, FGBufferProcessGatheredRegions& OutRegions)
 {
-	for (auto it : Regions)
+	check(IsInGameThread());
+	FScopeLock RegionScopeLock(&RegionAccessCriticalSection);
+
+	const ERHIFeatureLevel::Type FeatureLevel = GetWorld()->FeatureLevel;
+	OutRegions.RunStarts.Add(OutRegions.Proxies.Num());
+	OutRegions.Proxies.Reserve(OutRegions.Proxies.Num() + Regions.Num());
+	for (AGBufferProcessActor* Region : Regions)
+	{
+		FGBufferProcessRegionProxy RegionProxy;
+		if (GetGatheredRegionProxy(Region, FeatureLevel, ViewLocation, RegionProxy))
+		{
+			OutRegions.Proxies.Add(RegionProxy);
+		}
+	}
+
+	// Each component appends its instances already sorted, the render thread merges the runs.
+	for (UGBufferProcessRegionInstancesComponent* InstancesComponent : InstanceComponents)
 	{
-		if (it->IsEffect(FVector::ZeroVector))
+		if (IsValid(InstancesComponent))
 		{
-			return it;
+			OutRegions.RunStarts.Add(OutRegions.Proxies.Num());
+			InstancesComponent->GatherRegionProxies(FeatureLevel, OutRegions.Proxies);
+		}
+	}
+
+	// Baked regions are already on the render thread, only their materials can change.
+	for (UGBufferProcessRegionDataAsset* RegionData : BakedRegionData)
+	{
+		if (IsValid(RegionData))
+		{
+			RegionData->GatherMaterials(FeatureLevel, OutRegions.BakedMaterials.AddDefaulted_GetRef());
 		}
 	}
-	return nullptr;
 }
 
+void UGBufferProcessSubsystem::GatherDirtyRegionProxies(const FVector& ViewLocation, TArray<FGBufferProcessRegionProxy>& OutProxies)
+{
+	check(IsInGameThread());
+	FScopeLock RegionScopeLock(&RegionAccessCriticalSection);
+
+	const ERHIFeatureLevel::Type FeatureLevel = GetWorld()->FeatureLevel;
+	for (const TWeakObjectPtr<AGBufferProcessActor>& Region : DirtyRegions)
+	{
+		FGBufferProcessRegionProxy RegionProxy;
+		if (GetGatheredRegionProxy(Region.Get(), FeatureLevel, ViewLocation, RegionProxy))
+		{
+			OutProxies.Add(RegionProxy);
+		}
+	}
+
+	for (const TPair<TWeakObjectPtr<UGBufferProcessRegionInstancesComponent>, TSet<int32>>& Instances : DirtyInstances)
+	{
+		UGBufferProcessRegionInstancesComponent* InstancesComponent = Instances.Key.Get();
+		if (IsValid(InstancesComponent))
+		{
+			InstancesComponent->GatherInstanceProxies(FeatureLevel, Instances.Value, OutProxies);
+		}
+	}
+}
+
+void UGBufferProcessSubsystem::GetStreamingTextures(FGBufferProcessStreamingTextures& OutTextures)
+{
+	check(IsInGameThread());
+	FScopeLock RegionScopeLock(&RegionAccessCriticalSection);
+
+	// Low quality materials are reported too, the budget may switch to them any frame.
+	for (const AGBufferProcessActor* Region : Regions)
+	{
+		if (IsValid(Region) && Region->Enabled)
+		{
+			const FBox Bounds = Region->GetRegionBounds();
+			OutTextures.AddRegion(Region->Material, Bounds);
+			OutTextures.AddRegion(Region->LowQualityMaterial, Bounds);
+		}
+	}
+
+	for (const UGBufferProcessRegionInstancesComponent* InstancesComponent : InstanceComponents)
+	{
+		if (IsValid(InstancesComponent))
+		{
+			InstancesComponent->GetStreamingTextures(OutTextures);
+		}
+	}
+
+	for (const UGBufferProcessRegionDataAsset* RegionData : BakedRegionData)
+	{
+		if (IsValid(RegionData))
+		{
+			RegionData->GetStreamingTextures(OutTextures);
+		}
+	}
+}
+
+void UGBufferProcessSubsystem::OnWorldTickStart(UWorld* InWorld, ELevelTick InTickType, float InDeltaSeconds)
+{
+	if (InWorld != GetWorld())
+	{
+		return;
+	}
+
+	if (!GBufferProcess::IsTextureStreamingEnabled())
+	{
+		DestroyStreamingComponent();
+		return;
+	}
+
+	if (!StreamingComponent)
+	{
+		if (Regions.Num() == 0 && InstanceComponents.Num() == 0 && BakedRegionData.Num() == 0)
+		{
+			return;
+		}
+
+		// Outered to the world like other components without an actor, registering attaches it to the streamer as a dynamic primitive,
+		// which queries the textures then.
+		StreamingComponent = NewObject<UGBufferProcessStreamingComponent>(InWorld);
+		StreamingComponent->Subsystem = this;
+		StreamingComponent->RegisterComponentWithWorld(InWorld);
+		bStreamingTexturesDirty = false;
+	}
+	else if (bStreamingTexturesDirty)
+	{
+		// At most once per frame, the streamer queries the textures of every region again on its next update.
+		IStreamingManager::Get().NotifyPrimitiveUpdated(StreamingComponent);
+		bStreamingTexturesDirty = false;
+	}
+}
+
+void UGBufferProcessSubsystem::DestroyStreamingComponent()
+{
+	if (StreamingComponent)
+	{
+		// Detaching drops the references, the streamer lets the textures go back to their unreferenced mips.
+		StreamingComponent->DestroyComponent();
+		StreamingComponent = nullptr;
+	}
+}
+
+void UGBufferProcessSubsystem::SetRenderTile(FIntPoint ImageSize, FIntPoint TileCount, FIntPoint TileIndex, float OverlapRatio)
+{
+	FGBufferProcessTile Tile;
+	Tile.ImageSize = ImageSize;
+	Tile.TileCount = TileCount;
+	Tile.TileIndex = TileIndex;
+	Tile.OverlapRatio = OverlapRatio;
+	if (!Tile.IsValid())
+	{
+		UE_LOG(GBufferProcessLog, Warning, TEXT("Ignoring invalid render tile %s of %s for a %s image."), *TileIndex.ToString(), *TileCount.ToString(), *ImageSize.ToString());
+		return;
+	}
+	RenderTile = Tile;
+}
+
+void UGBufferProcessSubsystem::ClearRenderTile()
+{
+	RenderTile.Reset();
+}
@@ -0,0 +1,192 @@
+#include "GBufferProcessVolumeProxy.h"
+#include "Containers/DynamicRHIResourceArray.h"
+#include "RenderUtils.h"
+#include "RHIStaticStates.h"
+#include "PipelineStateCache.h"
+
+IMPLEMENT_GLOBAL_SHADER(FGBufferProcessVolumeVS, "/Plugin/GBufferProcessPlugin/Private/GBufferProcessVolume.usf", "VolumeVS", SF_Vertex);
+
+static TAutoConsoleVariable<int32> CVarGBufferProcessVolumeProxy(
+	TEXT("r.GBufferProcess.VolumeProxy"),
+	1,
+	TEXT("Rasterize box and sphere regions as proxy geometry tested against the scene depth, like deferred decals, instead of their screen rect.\n")
+	TEXT("Regions the camera is in or near are still drawn as rects, so are GPU culled regions.\n")
+	TEXT("0: off\n")
+	TEXT("1: on (default)"),
+	ECVF_RenderThreadSafe);
+
+namespace
+{
+	const int32 SphereNumRings = 8;
+	const int32 SphereNumSegments = 12;
+
+	TGlobalResource<FGBufferProcessVolumeGeometry> GVolumeGeometry;
+
+	/** Adds a triangle wound like GetUnitCubeIndexBuffer, its normal points into the shape. Degenerate triangles at the sphere poles are skipped. */
+	void AddTriangle(TArrayView<const FVector4> ShapeVertices, TResourceArray<uint16, INDEXBUFFER_ALIGNMENT>& OutIndices, uint16 A, uint16 B, uint16 C)
+	{
+		const FVector PositionA(ShapeVertices[A]);
+		const FVector PositionB(ShapeVertices[B]);
+		const FVector PositionC(ShapeVertices[C]);
+		const FVector Normal = (PositionB - PositionA) ^ (PositionC - PositionA);
+		if (Normal.IsNearlyZero())
+		{
+			return;
+		}
+
+		// The shapes are centered on the origin, the centroid points outwards.
+		const bool bOutward = (Normal | (PositionA + PositionB + PositionC)) > 0.0f;
+		OutIndices.Add(A);
+		OutIndices.Add(bOutward ? C : B);
+		OutIndices.Add(bOutward ? B : C);
+	}
+
+	void AddQuad(TArrayView<const FVector4> ShapeVertices, TResourceArray<uint16, INDEXBUFFER_ALIGNMENT>& OutIndices, uint16 A, uint16 B, uint16 C, uint16 D)
+	{
+		AddTriangle(ShapeVertices, OutIndices, A, B, C);
+		AddTriangle(ShapeVertices, OutIndices, A, C, D);
+	}
+}
+
+void FGBufferProcessVolumeGeometry::InitRHI()
+{
+	TResourceArray<FVector4, VERTEXBUFFER_ALIGNMENT> Vertices;
+	TResourceArray<uint16, INDEXBUFFER_ALIGNMENT> Indices;
+
+	// Corner i of the box is on the positive side of the axes of the bits of i.
+	Box.BaseVertexIndex = Vertices.Num();
+	Box.FirstIndex = Indices.Num();
+	for (int32 Corner = 0; Corner < 8; ++Corner)
+	{
+		Vertices.Add(FVector4((Corner & 1) ? 1.0f : -1.0f, (Corner & 2) ? 1.0f : -1.0f, (Corner & 4) ? 1.0f : -1.0f, 1.0f));
+	}
+	Box.NumVertices = Vertices.Num() - Box.BaseVertexIndex;
+
+	static const uint16 BoxFaces[6][4] =
+	{
+		{ 0, 2, 6, 4 }, { 1, 3, 7, 5 },
+		{ 0, 1, 5, 4 }, { 2, 3, 7, 6 },
+		{ 0, 1, 3, 2 }, { 4, 5, 7, 6 },
+	};
+	const TArrayView<const FVector4> BoxVertices(Vertices.GetData() + Box.BaseVertexIndex, Box.NumVertices);
+	for (const uint16* Face : BoxFaces)
+	{
+		AddQuad(BoxVertices, Indices, Face[0], Face[1], Face[2], Face[3]);
+	}
+	Box.NumPrimitives = (Indices.Num() - Box.FirstIndex) / 3;
+
+	// Latitude/longitude sphere, pushed out so that its faces enclose the unit sphere.
+	const float SphereScale = 1.0f / (FMath::Cos(PI / SphereNumSegments) * FMath::Cos(PI / (2 * SphereNumRings)));
+	Sphere.BaseVertexIndex = Vertices.Num();
+	Sphere.FirstIndex = Indices.Num();
+	for (int32 Ring = 0; Ring <= SphereNumRings; ++Ring)
+	{
+		const float Theta = PI * Ring / SphereNumRings;
+		for (int32 Segment = 0; Segment < SphereNumSegments; ++Segment)
+		{
+			const float Phi = 2.0f * PI * Segment / SphereNumSegments;
+			Vertices.Add(FVector4(FMath::Sin(Theta) * FMath::Cos(Phi) * SphereScale, FMath::Sin(Theta) * FMath::Sin(Phi) * SphereScale, FMath::Cos(Theta) * SphereScale, 1.0f));
+		}
+	}
+	Sphere.NumVertices = Vertices.Num() - Sphere.BaseVertexIndex;
+
+	const TArrayView<const FVector4> SphereVertices(Vertices.GetData() + Sphere.BaseVertexIndex, Sphere.NumVertices);
+	for (int32 Ring = 0; Ring < SphereNumRings; ++Ring)
+	{
+		for (int32 Segment = 0; Segment < SphereNumSegments; ++Segment)
+		{
+			const int32 NextSegment = (Segment + 1) % SphereNumSegments;
+			AddQuad(SphereVertices, Indices,
+				uint16(Ring * SphereNumSegments + Segment),
+				uint16(Ring * SphereNumSegments + NextSegment),
+				uint16((Ring + 1) * SphereNumSegments + NextSegment),
+				uint16((Ring + 1) * SphereNumSegments + Segment));
+		}
+	}
+	Sphere.NumPrimitives = (Indices.Num() - Sphere.FirstIndex) / 3;
+
+	FRHIResourceCreateInfo VertexCreateInfo(&Vertices);
+	VertexBufferRHI = RHICreateVertexBuffer(Vertices.GetResourceDataSize(), BUF_Static, VertexCreateInfo);
+
+	FRHIResourceCreateInfo IndexCreateInfo(&Indices);
+	IndexBufferRHI = RHICreateIndexBuffer(sizeof(uint16), Indices.GetResourceDataSize(), BUF_Static, IndexCreateInfo);
+}
+
+void FGBufferProcessVolumeGeometry::ReleaseRHI()
+{
+	VertexBufferRHI.SafeRelease();
+	IndexBufferRHI.SafeRelease();
+}
+
+void FGBufferProcessVolumeGeometry::DrawShape(FRHICommandList& RHICmdList, EGBufferProcessShape Shape) const
+{
+	check(Shape == EGBufferProcessShape::Box || Shape == EGBufferProcessShape::Sphere);
+	const FShapeRange& Range = Shape == EGBufferProcessShape::Box ? Box : Sphere;
+
+	RHICmdList.SetStreamSource(0, VertexBufferRHI, 0);
+	RHICmdList.DrawIndexedPrimitive(IndexBufferRHI, Range.BaseVertexIndex, 0, Range.NumVertices, Range.FirstIndex, Range.NumPrimitives, 1);
+}
+
+namespace GBufferProcess
+{
+	bool IsVolumeProxyEnabled()
+	{
+		return CVarGBufferProcessVolumeProxy.GetValueOnRenderThread() != 0;
+	}
+
+	bool ShouldDrawVolumeProxy(const FSceneView& View, const FGBufferProcessRegionProxy& Region)
+	{
+		if (Region.Shape != EGBufferProcessShape::Box && Region.Shape != EGBufferProcessShape::Sphere)
+		{
+			return false;
+		}
+
+		const float ConservativeRadius = Region.Shape == EGBufferProcessShape::Sphere
+			? Region.Extent.X * Region.LocalToWorld.GetMaximumAxisScale()
+			: (Region.Extent * Region.LocalToWorld.GetScaleVector()).Size();
+
+		// Same test as deferred decals. Inside it the near plane may clip the back faces, the whole rect is drawn instead.
+		const float InsideRadius = ConservativeRadius * 1.05f + View.NearClippingDistance * 2.0f;
+		return FVector::DistSquared(View.ViewMatrices.GetViewOrigin(), Region.LocalToWorld.GetOrigin()) > FMath::Square(InsideRadius);
+	}
+
+	FMatrix GetVolumeToTranslatedWorld(const FSceneView& View, const FGBufferProcessRegionProxy& Region)
+	{
+		const FVector UnitScale = Region.Shape == EGBufferProcessShape::Sphere ? FVector(Region.Extent.X) : Region.Extent;
+		return FScaleMatrix(UnitScale) * Region.LocalToWorld * FTranslationMatrix(View.ViewMatrices.GetPreViewTranslation());
+	}
+
+	FRHIRasterizerState* GetVolumeRasterizerState(const FSceneView& View, const FGBufferProcessRegionProxy& Region)
+	{
+		// Back faces are clockwise, as for deferred decals the camera is inside of.
+		bool bClockwise = true;
+		if (View.bReverseCulling)
+		{
+			bClockwise = !bClockwise;
+		}
+		if (Region.LocalToWorld.Determinant() < 0.0f)
+		{
+			bClockwise = !bClockwise;
+		}
+		return bClockwise
+			? TStaticRasterizerState<FM_Solid, CM_CW>::GetRHI()
+			: TStaticRasterizerState<FM_Solid, CM_CCW>::GetRHI();
+	}
+
+	void InitVolumePipeline(FGraphicsPipelineStateInitializer& GraphicsPSOInit, FRHIVertexShader* VertexShader, FRHIPixelShader* PixelShader, FRHIBlendState* BlendState, FRHIRasterizerState* RasterizerState)
+	{
+		GraphicsPSOInit.BlendState = BlendState;
+		GraphicsPSOInit.RasterizerState = RasterizerState;
+		// A back face passes where the scene is in front of it, pixels whose scene is behind the volume are not shaded.
+		GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<false, CF_DepthFartherOrEqual>::GetRHI();
+		GraphicsPSOInit.BoundShaderState.VertexDeclarationRHI = GetVertexDeclarationFVector4();
+		GraphicsPSOInit.BoundShaderState.VertexShaderRHI = VertexShader;
+		GraphicsPSOInit.BoundShaderState.PixelShaderRHI = PixelShader;
+		GraphicsPSOInit.PrimitiveType = PT_TriangleList;
+	}
+
+	const FGBufferProcessVolumeGeometry& GetVolumeGeometry()
+	{
+		return GVolumeGeometry;
+	}
+}
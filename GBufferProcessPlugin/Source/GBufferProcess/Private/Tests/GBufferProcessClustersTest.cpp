@@ -0,0 +1,83 @@
+#include "GBufferProcessClusters.h"
+#include "Math/RandomStream.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace
+{
+	/** Random rect and depth range, partly past the view and sometimes empty or unbound, with depths snapped to slice bounds. */
+	FGBufferProcessClusterRegion MakeRandomRegion(FRandomStream& RandomStream, const FGBufferProcessClusterGrid& Grid, FIntPoint ViewSize)
+	{
+		FGBufferProcessClusterRegion Region;
+		Region.Rect.Min = FIntPoint(RandomStream.RandRange(-64, ViewSize.X), RandomStream.RandRange(-64, ViewSize.Y));
+		Region.Rect.Max = Region.Rect.Min + FIntPoint(RandomStream.RandRange(0, ViewSize.X / 2), RandomStream.RandRange(0, ViewSize.Y / 2));
+
+		const int32 DepthKind = RandomStream.RandRange(0, 3);
+		if (DepthKind == 0)
+		{
+			Region.MinZ = 0.0f;
+			Region.MaxZ = MAX_flt;
+		}
+		else if (DepthKind == 1)
+		{
+			Region.MinZ = Grid.GetSliceMinZ(RandomStream.RandRange(0, Grid.GridSize.Z - 1));
+			Region.MaxZ = Grid.GetSliceMinZ(RandomStream.RandRange(0, Grid.GridSize.Z));
+		}
+		else
+		{
+			Region.MinZ = RandomStream.FRandRange(0.0f, 20000.0f);
+			Region.MaxZ = Region.MinZ + RandomStream.FRandRange(0.0f, 5000.0f);
+		}
+		return Region;
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FGBufferProcessClustersTest, "GBufferProcess.Clusters.BuildRegionClusters", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FGBufferProcessClustersTest::RunTest(const FString& Parameters)
+{
+	FRandomStream RandomStream(0x6B0F);
+
+	const FIntPoint ViewSizes[] = { FIntPoint(1920, 1080), FIntPoint(1001, 601), FIntPoint(37, 19) };
+	for (const FIntPoint& ViewSize : ViewSizes)
+	{
+		for (int32 Iteration = 0; Iteration < 8; ++Iteration)
+		{
+			const FGBufferProcessClusterGrid Grid(ViewSize, RandomStream.RandRange(16, 128), RandomStream.RandRange(1, 32), 10.0f, RandomStream.FRandRange(100.0f, 20000.0f));
+
+			TArray<FGBufferProcessClusterRegion> Regions;
+			Regions.SetNum(RandomStream.RandRange(0, 64));
+			for (FGBufferProcessClusterRegion& Region : Regions)
+			{
+				Region = MakeRandomRegion(RandomStream, Grid, ViewSize);
+			}
+
+			FGBufferProcessRegionClusters Clusters;
+			FGBufferProcessRegionClusters ReferenceClusters;
+			GBufferProcess::BuildRegionClusters(Grid, Regions, Clusters);
+			GBufferProcess::BuildRegionClustersReference(Grid, Regions, ReferenceClusters);
+
+			if (!TestEqual(TEXT("Number of clusters"), Clusters.OffsetsAndCounts.Num(), ReferenceClusters.OffsetsAndCounts.Num()))
+			{
+				continue;
+			}
+
+			// Compare the lists cluster by cluster, so that a failure names the cluster.
+			for (int32 ClusterIndex = 0; ClusterIndex < Grid.GetNumClusters(); ++ClusterIndex)
+			{
+				const TArray<uint32> RegionIndices(Clusters.RegionIndices.GetData() + Clusters.OffsetsAndCounts[ClusterIndex * 2], Clusters.OffsetsAndCounts[ClusterIndex * 2 + 1]);
+				const TArray<uint32> ReferenceRegionIndices(ReferenceClusters.RegionIndices.GetData() + ReferenceClusters.OffsetsAndCounts[ClusterIndex * 2], ReferenceClusters.OffsetsAndCounts[ClusterIndex * 2 + 1]);
+				if (RegionIndices != ReferenceRegionIndices)
+				{
+					AddError(FString::Printf(TEXT("Cluster %d of a %dx%dx%d grid has %d regions, the reference %d."),
+						ClusterIndex, Grid.GridSize.X, Grid.GridSize.Y, Grid.GridSize.Z, RegionIndices.Num(), ReferenceRegionIndices.Num()));
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+#endif
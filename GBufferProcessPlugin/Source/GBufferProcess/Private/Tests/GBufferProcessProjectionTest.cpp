@@ -0,0 +1,116 @@
+#include "GBufferProcessProjection.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace
+{
+	FGBufferProcessTile MakeTile(FIntPoint ImageSize, FIntPoint TileCount, FIntPoint TileIndex, float OverlapRatio)
+	{
+		FGBufferProcessTile Tile;
+		Tile.ImageSize = ImageSize;
+		Tile.TileCount = TileCount;
+		Tile.TileIndex = TileIndex;
+		Tile.OverlapRatio = OverlapRatio;
+		return Tile;
+	}
+
+	/** Rect of the tile view covered by ImageRect, for a view that renders the tile at its own resolution. */
+	FIntRect ImageRectToTileViewRect(const FIntRect& TileImageRect, const FIntRect& ImageRect)
+	{
+		return FIntRect(ImageRect.Min - TileImageRect.Min, ImageRect.Max - TileImageRect.Min);
+	}
+
+	int64 GetArea(const FIntRect& Rect)
+	{
+		return Rect.Width() > 0 && Rect.Height() > 0 ? int64(Rect.Width()) * int64(Rect.Height()) : 0;
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FGBufferProcessTileMathTest, "GBufferProcess.Projection.TileMath", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FGBufferProcessTileMathTest::RunTest(const FString& Parameters)
+{
+	// Step 1 : 边缘tile的overlap, 每边向上取整到整像素, 超出图像范围
+	{
+		const FIntPoint ImageSize(1000, 600);
+		const FIntPoint TileCount(4, 3);
+
+		TestEqual(TEXT("First tile pads past the image"), GBufferProcess::GetTileImageRect(MakeTile(ImageSize, TileCount, FIntPoint(0, 0), 0.1f)), FIntRect(-25, -20, 275, 220));
+		TestEqual(TEXT("Last tile pads past the image"), GBufferProcess::GetTileImageRect(MakeTile(ImageSize, TileCount, FIntPoint(3, 2), 0.1f)), FIntRect(725, 380, 1025, 620));
+		TestEqual(TEXT("Overlap is rounded up to whole pixels"), GBufferProcess::GetTileImageRect(MakeTile(ImageSize, TileCount, FIntPoint(1, 1), 0.05f)), FIntRect(237, 190, 513, 410));
+	}
+
+	// Step 2 : 图像尺寸不能被TileCount整除时, tile之间没有缝隙, 最后一行/列超出图像
+	{
+		const FIntPoint ImageSize(1001, 601);
+		const FIntPoint TileCount(4, 3);
+
+		for (int32 TileY = 0; TileY < TileCount.Y; ++TileY)
+		{
+			for (int32 TileX = 0; TileX < TileCount.X; ++TileX)
+			{
+				const FIntRect TileRect = GBufferProcess::GetTileImageRect(MakeTile(ImageSize, TileCount, FIntPoint(TileX, TileY), 0.0f));
+				if (TileX + 1 < TileCount.X)
+				{
+					const FIntRect RightRect = GBufferProcess::GetTileImageRect(MakeTile(ImageSize, TileCount, FIntPoint(TileX + 1, TileY), 0.0f));
+					TestEqual(TEXT("Tiles are contiguous in x"), TileRect.Max.X, RightRect.Min.X);
+				}
+				if (TileY + 1 < TileCount.Y)
+				{
+					const FIntRect BottomRect = GBufferProcess::GetTileImageRect(MakeTile(ImageSize, TileCount, FIntPoint(TileX, TileY + 1), 0.0f));
+					TestEqual(TEXT("Tiles are contiguous in y"), TileRect.Max.Y, BottomRect.Min.Y);
+				}
+			}
+		}
+
+		const FIntRect LastRect = GBufferProcess::GetTileImageRect(MakeTile(ImageSize, TileCount, TileCount - FIntPoint(1, 1), 0.0f));
+		TestTrue(TEXT("Last tile reaches the image border"), LastRect.Max.X >= ImageSize.X && LastRect.Max.Y >= ImageSize.Y);
+	}
+
+	// Step 3 : 视图分辨率与tile不同时, 映射到图像的rect是保守的
+	{
+		const FIntRect TileImageRect(-25, -20, 175, 180);
+		const FIntRect ViewRect(0, 0, 100, 100);
+		TestEqual(TEXT("Half resolution view maps to the tile"), GBufferProcess::TileViewRectToImageRect(TileImageRect, ViewRect, FIntRect(10, 10, 20, 20)), FIntRect(-5, 0, 15, 20));
+		TestEqual(TEXT("Odd view rect rounds outwards"), GBufferProcess::TileViewRectToImageRect(FIntRect(0, 0, 100, 100), FIntRect(0, 0, 30, 30), FIntRect(1, 1, 2, 2)), FIntRect(3, 3, 7, 7));
+	}
+
+	// Step 4 : 每个tile算出的覆盖率相同, 各tile不含overlap的部分加起来等于整个区域
+	{
+		const FIntPoint ImageSize(1001, 601);
+		const FIntPoint TileCount(4, 3);
+		const FIntRect ImageBounds(FIntPoint::ZeroValue, ImageSize);
+		const FIntRect RegionRect(180, 150, 720, 470);
+		const float ExpectedCoverage = float(GetArea(RegionRect)) / float(GetArea(ImageBounds));
+
+		int64 SummedArea = 0;
+		for (int32 TileY = 0; TileY < TileCount.Y; ++TileY)
+		{
+			for (int32 TileX = 0; TileX < TileCount.X; ++TileX)
+			{
+				const FGBufferProcessTile Tile = MakeTile(ImageSize, TileCount, FIntPoint(TileX, TileY), 0.1f);
+				const FIntRect TileImageRect = GBufferProcess::GetTileImageRect(Tile);
+				const FIntRect ViewRect(FIntPoint::ZeroValue, TileImageRect.Size());
+				const FIntRect UnclippedRect = ImageRectToTileViewRect(TileImageRect, RegionRect);
+
+				TestEqual(FString::Printf(TEXT("Coverage of tile %d,%d"), TileX, TileY), GBufferProcess::GetTiledScreenCoverage(Tile, ViewRect, UnclippedRect), ExpectedCoverage, KINDA_SMALL_NUMBER);
+
+				FIntRect CoreRect = GBufferProcess::GetTileImageRect(MakeTile(ImageSize, TileCount, FIntPoint(TileX, TileY), 0.0f));
+				CoreRect.Clip(ImageBounds);
+				CoreRect.Clip(RegionRect);
+				SummedArea += GetArea(CoreRect);
+			}
+		}
+		TestEqual(TEXT("Tile parts sum to the region"), SummedArea, GetArea(RegionRect));
+
+		const FGBufferProcessTile Tile = MakeTile(ImageSize, TileCount, FIntPoint(1, 1), 0.1f);
+		const FIntRect ViewRect(FIntPoint::ZeroValue, GBufferProcess::GetTileImageRect(Tile).Size());
+		TestEqual(TEXT("Empty rect covers the whole image"), GBufferProcess::GetTiledScreenCoverage(Tile, ViewRect, FIntRect()), 1.0f);
+		TestEqual(TEXT("Rect outside the image covers nothing"), GBufferProcess::GetTiledScreenCoverage(Tile, ViewRect, FIntRect(-2000, -2000, -1000, -1000)), 0.0f);
+	}
+
+	return true;
+}
+
+#endif
@@ -3,6 +3,7 @@
 #include "CoreMinimal.h"
 #include "UObject/ObjectMacros.h"
 #include "GameFramework/Actor.h"
+#include "RHIDefinitions.h"
 #include "Engine/Classes/Components/MeshComponent.h"
 #include "GBufferProcessActor.generated.h"
 
@@ -15,6 +16,71 @@ enum class EGBufferProcessType : uint8
 	MAX
 };
 
+/** Point of the frame a region is drawn at. The regions of a stage are drawn together, in priority order per target. */
+UENUM(BlueprintType)
+enum class EGBufferProcessStage : uint8
+{
+	/** Right after the base pass, before decals and ambient occlusion read the G-buffer. */
+	PostBasePass	UMETA(DisplayName = "Post Base Pass"),
+	/** Right before the lights, after everything else that writes the G-buffer. */
+	PreLighting		UMETA(DisplayName = "Pre Lighting"),
+	/** After lighting and reflections, before fog and translucency. SceneColor regions see the lit scene here. */
+	PostLighting	UMETA(DisplayName = "Post Lighting"),
+	MAX				UMETA(Hidden)
+};
+
+/** How the material output is combined with the current value of the target. */
+UENUM(BlueprintType)
+enum class EGBufferProcessBlendOp : uint8
+{
+	/** Overwrites the target. */
+	Replace			UMETA(DisplayName = "Replace"),
+	/** Interpolates from the target to the material output by Intensity. */
+	Lerp			UMETA(DisplayName = "Lerp"),
+	/** Adds the material output scaled by Intensity. Normals are re-normalized. */
+	Add				UMETA(DisplayName = "Add"),
+	/** Multiplies the target. Not supported for normals. */
+	Multiply		UMETA(DisplayName = "Multiply"),
+	/**
+	 * Order independent: overlapping weighted regions of a target are averaged by Intensity, then interpolated over the
+	 * target by the sum of their intensities, clamped to 1. Normals are averaged decoded and re-normalized.
+	 * Priority is ignored, they are applied once after the other regions of their target.
+	 */
+	Weighted		UMETA(DisplayName = "Weighted"),
+	MAX				UMETA(Hidden)
+};
+
+UENUM(BlueprintType)
+enum class EGBufferProcessShape : uint8
+{
+	/** Affects the whole view. */
+	Unbound			UMETA(DisplayName = "Unbound"),
+	Box				UMETA(DisplayName = "Box"),
+	Sphere			UMETA(DisplayName = "Sphere"),
+};
+
+/** What changed in a region since it was last gathered, see UGBufferProcessSubsystem::MarkRegionDirty. */
+enum class EGBufferProcessRegionDirtyFlags : uint8
+{
+	None		= 0,
+	/** Transform, shape or extent, anything that moves the bounds. */
+	Transform	= 1 << 0,
+	Intensity	= 1 << 1,
+	Enabled		= 1 << 2,
+	/** Type, blend op or stage. */
+	Kernel		= 1 << 3,
+	Material	= 1 << 4,
+	Priority	= 1 << 5,
+
+	/** Changes that update a region where it is, without changing which regions are drawn or in which order. */
+	InPlace		= Transform | Intensity,
+	All			= Transform | Intensity | Enabled | Kernel | Material | Priority,
+};
+ENUM_CLASS_FLAGS(EGBufferProcessRegionDirtyFlags);
+
+struct FGBufferProcessRegionProxy;
+class AGBufferProcessBakedRegionsActor;
+
 /**
  * 修改GBuffer的实例Actor
  */
@@ -22,25 +88,57 @@ UCLASS(Blueprintable)
 class AGBufferProcessActor : public AActor
 {
 	GENERATED_UCLASS_BODY()
+	friend class AGBufferProcessBakedRegionsActor;
 public:
 	/** Region type. */
-	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category="GBuffer Modify")
+	UPROPERTY(BlueprintReadWrite, BlueprintSetter = SetType, EditAnywhere, Category="GBuffer Modify")
 	EGBufferProcessType Type;
 
-	/** Render priority/order. */
-	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category="GBuffer Modify")
+	/** How the material output is combined with the target. */
+	UPROPERTY(BlueprintReadWrite, BlueprintSetter = SetBlendOp, EditAnywhere, Category="GBuffer Modify")
+	EGBufferProcessBlendOp BlendOp;
+
+	/** When in the frame the region is drawn. SceneColor regions usually want PostLighting. */
+	UPROPERTY(BlueprintReadWrite, BlueprintSetter = SetStage, EditAnywhere, Category="GBuffer Modify")
+	EGBufferProcessStage Stage;
+
+	/** Render priority/order within the stage. Weighted regions don't have one. */
+	UPROPERTY(BlueprintReadWrite, BlueprintSetter = SetPriority, EditAnywhere, Category="GBuffer Modify", meta = (EditCondition = "BlendOp != EGBufferProcessBlendOp::Weighted"))
 	int32 Priority;
 
-	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "GBuffer Modify", meta = (UIMin = 0.0, UIMax = 1.0))
+	UPROPERTY(BlueprintReadWrite, BlueprintSetter = SetIntensity, EditAnywhere, Category = "GBuffer Modify", meta = (UIMin = 0.0, UIMax = 1.0))
 	float Intensity;
 
-	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "GBuffer Modify")
+	UPROPERTY(BlueprintReadWrite, BlueprintSetter = SetEnabled, EditAnywhere, Category = "GBuffer Modify")
 	float Enabled = true;
 
 	/** The material used to change GBuffer. */
 	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "GBuffer Modify")
 	UMaterialInterface* Material;
 
+	/** Region shape. Unbound regions cover the whole screen. */
+	UPROPERTY(BlueprintReadWrite, BlueprintSetter = SetShape, EditAnywhere, Category = "GBuffer Modify")
+	EGBufferProcessShape Shape;
+
+	/** Half size of the box in local space. Spheres use X as radius. */
+	UPROPERTY(BlueprintReadWrite, BlueprintSetter = SetExtent, EditAnywhere, Category = "GBuffer Modify", meta = (EditCondition = "Shape != EGBufferProcessShape::Unbound"))
+	FVector Extent;
+
+	/** Cheaper material used when the frame is over r.GBufferProcess.BudgetMs. Regions without one are dropped instead. */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "GBuffer Modify|Budget")
+	UMaterialInterface* LowQualityMaterial;
+
+	/**
+	 * Static regions are baked into the AGBufferProcessBakedRegionsActor of their level and stripped from cooked builds.
+	 * Changes at runtime have no effect in cooked builds.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "GBuffer Modify")
+	bool bStatic;
+
+	//~ Begin UObject Interface
+	virtual bool IsEditorOnly() const override;
+	//~ End UObject Interface
+
 #if WITH_EDITOR
 	/** Called when any of the properties are changed. */
 	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
@@ -52,7 +150,77 @@ public:
 	virtual void BeginPlay() override;
 	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 
+	//~ Begin AActor Interface
+	virtual void PostRegisterAllComponents() override;
+	virtual void PostUnregisterAllComponents() override;
+	//~ End AActor Interface
+
+public:
+	/**
+	 * Setters of the region properties. Changes are tracked so that only the regions that changed are uploaded,
+	 * C++ code must go through them too rather than writing the properties.
+	 */
+	UFUNCTION(BlueprintSetter)
+	void SetType(EGBufferProcessType InType);
+
+	UFUNCTION(BlueprintSetter)
+	void SetBlendOp(EGBufferProcessBlendOp InBlendOp);
+
+	UFUNCTION(BlueprintSetter)
+	void SetStage(EGBufferProcessStage InStage);
+
+	UFUNCTION(BlueprintSetter)
+	void SetPriority(int32 InPriority);
+
+	UFUNCTION(BlueprintSetter)
+	void SetIntensity(float InIntensity);
+
+	UFUNCTION(BlueprintSetter)
+	void SetEnabled(float InEnabled);
+
+	UFUNCTION(BlueprintSetter)
+	void SetShape(EGBufferProcessShape InShape);
+
+	UFUNCTION(BlueprintSetter)
+	void SetExtent(FVector InExtent);
+
+	UFUNCTION(BlueprintCallable, Category = "GBuffer Modify")
+	void SetMaterial(UMaterialInterface* InMaterial);
+
+	/** Reports a change of the region to UGBufferProcessSubsystem. Moves of the actor are reported by the actor itself. */
+	void MarkRegionDirty(EGBufferProcessRegionDirtyFlags InFlags);
+
 public:
-	// 是否起作用
+	/**
+	 * 是否起作用
+	 * Only evaluated, with the location of the first view, when the regions are gathered again after a change, see
+	 * UGBufferProcessSubsystem::GetRegionsGeneration. Overrides whose result changes have to call MarkRegionDirty(Enabled).
+	 */
 	virtual bool IsEffect(FVector Posi) { return true; }
+
+	/** World space bounds of the region. Invalid for unbound regions. */
+	FBox GetRegionBounds() const;
+
+	/**
+	 * Snapshot of the region for the render thread. Must be called on the game thread.
+	 * While a material compiles, the proxy references the last material of the region whose shaders were ready.
+	 */
+	void GetRegionProxy(ERHIFeatureLevel::Type InFeatureLevel, FGBufferProcessRegionProxy& OutProxy);
+
+private:
+	void OnRootTransformUpdated(USceneComponent* InRootComponent, EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport);
+
+private:
+	/** Last Material that had compiled region shaders. Keeps rendering while a new material compiles. */
+	UPROPERTY(Transient)
+	UMaterialInterface* LastReadyMaterial;
+
+	/** Last LowQualityMaterial that had compiled region shaders. */
+	UPROPERTY(Transient)
+	UMaterialInterface* LastReadyLowQualityMaterial;
+
+#if WITH_EDITORONLY_DATA
+	/** Baked regions actor of the level that last baked this region, so IsEditorOnly doesn't search the level. */
+	TWeakObjectPtr<AGBufferProcessBakedRegionsActor> BakedRegionsActor;
+#endif
 };
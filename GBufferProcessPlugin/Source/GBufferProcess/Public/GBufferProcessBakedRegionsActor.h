@@ -0,0 +1,43 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/ObjectMacros.h"
+#include "GameFramework/Actor.h"
+#include "GBufferProcessBakedRegionsActor.generated.h"
+
+class UGBufferProcessRegionDataAsset;
+
+/**
+ * Holds the baked static regions of its level.
+ *
+ * Static AGBufferProcessActor regions of the level are baked into RegionData whenever the level is saved or cooked, and
+ * are stripped from cooked builds. Cooked builds register RegionData with UGBufferProcessSubsystem in one call instead.
+ * Spawned automatically when a region of the level is made static.
+ */
+UCLASS(NotBlueprintable)
+class AGBufferProcessBakedRegionsActor : public AActor
+{
+	GENERATED_UCLASS_BODY()
+public:
+	UPROPERTY(VisibleAnywhere, Category = "GBuffer Modify")
+	UGBufferProcessRegionDataAsset* RegionData;
+
+	/** Returns the first baked regions actor of the level. */
+	static AGBufferProcessBakedRegionsActor* FindInLevel(const ULevel* InLevel);
+
+	/** Returns true if RegionData is used instead of the static regions in this build. */
+	static bool UsesBakedRegions();
+
+#if WITH_EDITOR
+	static AGBufferProcessBakedRegionsActor* FindOrSpawnInLevel(ULevel* InLevel);
+
+	/** Bakes the static regions of the level into RegionData. */
+	UFUNCTION(CallInEditor, Category = "GBuffer Modify")
+	void BakeRegions();
+
+	virtual void PreSave(const class ITargetPlatform* TargetPlatform) override;
+#endif
+
+	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+};
@@ -0,0 +1,114 @@
+#pragma once
+#include "CoreMinimal.h"
+#include "ShaderParameterMacros.h"
+#include "RenderGraphResources.h"
+#include "GBufferProcessRegionProxy.h"
+
+class FRDGBuilder;
+class FSceneView;
+class FViewInfo;
+
+/**
+ * Screen tiles and exponential depth slices a view is divided into for clustered regions, like the forward light grid.
+ * The last slice ends at the farthest bounded region, pixels behind it are in the last slice.
+ */
+struct FGBufferProcessClusterGrid
+{
+	/** Tiles along X and Y, depth slices along Z. */
+	FIntVector GridSize = FIntVector(0, 0, 0);
+
+	/** Size of a tile in pixels. */
+	int32 TileSize = 1;
+
+	/** View depth where the second slice starts, everything closer is in the first one. */
+	float NearZ = 1.0f;
+
+	/** Slices per doubling of the view depth. */
+	float SliceScale = 1.0f;
+
+	FGBufferProcessClusterGrid() = default;
+	FGBufferProcessClusterGrid(FIntPoint ViewSize, int32 InTileSize, int32 NumSlices, float InNearZ, float InFarZ);
+
+	int32 GetNumClusters() const { return GridSize.X * GridSize.Y * GridSize.Z; }
+
+	int32 GetClusterIndex(int32 X, int32 Y, int32 Z) const { return (Z * GridSize.Y + Y) * GridSize.X + X; }
+
+	/** Slice of a view depth, clamped to the grid. Same as GetClusterSlice in GBufferProcessClusters.ush, up to float precision. */
+	int32 GetSlice(float ViewZ) const;
+
+	/** View depth where a slice starts. The first slice starts at 0. */
+	float GetSliceMinZ(int32 Slice) const;
+};
+
+/** What the binning knows of a region: the pixels and the view depths its bounds cover. */
+struct FGBufferProcessClusterRegion
+{
+	/** Pixel rect relative to the view rect. Regions with an empty rect are not binned. */
+	FIntRect Rect;
+
+	float MinZ = 0.0f;
+
+	float MaxZ = 0.0f;
+};
+
+/** Compact region lists of every cluster of a grid. */
+struct FGBufferProcessRegionClusters
+{
+	/** Offset into RegionIndices and number of regions, two per cluster. */
+	TArray<uint32> OffsetsAndCounts;
+
+	/** Region indices of all clusters, in ascending order inside each cluster. */
+	TArray<uint32> RegionIndices;
+
+	bool operator==(const FGBufferProcessRegionClusters& Other) const
+	{
+		return OffsetsAndCounts == Other.OffsetsAndCounts && RegionIndices == Other.RegionIndices;
+	}
+};
+
+BEGIN_GLOBAL_SHADER_PARAMETER_STRUCT(FGBufferProcessClusterParameters, )
+	SHADER_PARAMETER(FIntVector, GridSize)
+	SHADER_PARAMETER(uint32, TileSize)
+	SHADER_PARAMETER(float, NearZ)
+	SHADER_PARAMETER(float, SliceScale)
+	SHADER_PARAMETER_RDG_BUFFER_SRV(Buffer<uint2>, ClusterOffsetsAndCounts)
+	SHADER_PARAMETER_RDG_BUFFER_SRV(Buffer<uint>, ClusterRegionIndices)
+	/** Transform into the unit shape of each region, then its shape and intensity. CLUSTER_REGION_STRIDE float4 per region. */
+	SHADER_PARAMETER_RDG_BUFFER_SRV(Buffer<float4>, RegionData)
+	SHADER_PARAMETER_RDG_TEXTURE(Texture2D, SceneDepthTexture)
+END_GLOBAL_SHADER_PARAMETER_STRUCT()
+
+/** Region draw passes of the render thread path, the clusters are only bound when r.GBufferProcess.Clustered is on. */
+BEGIN_SHADER_PARAMETER_STRUCT(FGBufferProcessRegionPassParameters, )
+	SHADER_PARAMETER_RDG_UNIFORM_BUFFER(FGBufferProcessClusterParameters, Clusters)
+	RENDER_TARGET_BINDING_SLOTS()
+END_SHADER_PARAMETER_STRUCT()
+
+namespace GBufferProcess
+{
+	/** Returns true if regions drawn on the render thread look up the regions of their pixel in a cluster grid. */
+	bool IsClusteredEnabled();
+
+	/**
+	 * Bins regions into the clusters their rect and depth range overlap.
+	 * Cost is the number of clusters each region overlaps, plus one pass over the grid.
+	 */
+	void BuildRegionClusters(const FGBufferProcessClusterGrid& Grid, TArrayView<const FGBufferProcessClusterRegion> Regions, FGBufferProcessRegionClusters& OutClusters);
+
+	/** Tests every region against every cluster. Slow reference for BuildRegionClusters, both must build the same lists. */
+	void BuildRegionClustersReference(const FGBufferProcessClusterGrid& Grid, TArrayView<const FGBufferProcessClusterRegion> Regions, FGBufferProcessRegionClusters& OutClusters);
+
+	/** Rect relative to the view rect and view depth range of a region, padded so that the GPU slice math can't miss it. */
+	FGBufferProcessClusterRegion GetClusterRegion(const FSceneView& View, const FGBufferProcessRegionProxy& Region, const FIntRect& PixelRect);
+
+	/**
+	 * Bins the regions of a view and uploads the grid. Regions[i] is the region of slot i, null for slots that are not clustered.
+	 * Rects are the pixel rects the regions are drawn into. Clustered draws cover a range of slots, see FGBufferProcessRegionPS::SetClusterParameters.
+	 */
+	TRDGUniformBufferRef<FGBufferProcessClusterParameters> CreateClusterUniformBuffer(
+		FRDGBuilder& GraphBuilder,
+		const FViewInfo& View,
+		TArrayView<const FGBufferProcessRegionProxy* const> Regions,
+		TArrayView<const FIntRect> Rects,
+		FRDGTextureRef SceneDepthTexture);
+}
@@ -0,0 +1,266 @@
+#pragma once
+#include "CoreMinimal.h"
+#include "RHI.h"
+#include "GlobalShader.h"
+#include "ShaderParameterStruct.h"
+#include "RenderGraphResources.h"
+#include "UnifiedBuffer.h"
+#include "SceneView.h"
+#include "GBufferProcessRegionProxy.h"
+
+class FViewInfo;
+class FRDGBuilder;
+struct FGBufferProcessTile;
+struct FGBufferProcessBakedRegionRun;
+
+// Resets the instance counts of the batch draw arguments before culling.
+class FGBufferProcessInitIndirectArgsCS : public FGlobalShader
+{
+	DECLARE_GLOBAL_SHADER(FGBufferProcessInitIndirectArgsCS);
+	SHADER_USE_PARAMETER_STRUCT(FGBufferProcessInitIndirectArgsCS, FGlobalShader);
+
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+	}
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("INIT_INDIRECT_ARGS_CS"), 1);
+	}
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, NumBatches)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<uint>, DrawIndirectArgs)
+	END_SHADER_PARAMETER_STRUCT()
+};
+
+// Culls the regions against the view frustum and the previous frame HZB, and appends the visible ones to their batch.
+class FGBufferProcessCullRegionsCS : public FGlobalShader
+{
+	DECLARE_GLOBAL_SHADER(FGBufferProcessCullRegionsCS);
+	SHADER_USE_PARAMETER_STRUCT(FGBufferProcessCullRegionsCS, FGlobalShader);
+
+	class FOcclusionDim : SHADER_PERMUTATION_BOOL("CULL_OCCLUSION");
+	using FPermutationDomain = TShaderPermutationDomain<FOcclusionDim>;
+
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+	}
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("CULL_REGIONS_CS"), 1);
+	}
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(FMatrix, WorldToClip)
+		SHADER_PARAMETER(FMatrix, PrevWorldToClip)
+		SHADER_PARAMETER(FVector2D, HZBUvFactor)
+		SHADER_PARAMETER(FVector2D, HZBSize)
+		SHADER_PARAMETER(uint32, HZBMipCount)
+		SHADER_PARAMETER(uint32, NumRegionSlots)
+		SHADER_PARAMETER(uint32, NumBakedRegions)
+		SHADER_PARAMETER(float, MinScreenCoverage)
+		SHADER_PARAMETER(FVector4, NDCToCoverageUV)
+		SHADER_PARAMETER_RDG_TEXTURE(Texture2D, HZBTexture)
+		SHADER_PARAMETER_SAMPLER(SamplerState, HZBSampler)
+		SHADER_PARAMETER_SRV(StructuredBuffer<float4>, BakedRegions)
+		SHADER_PARAMETER_SRV(StructuredBuffer<float4>, RegionBounds)
+		SHADER_PARAMETER_SRV(StructuredBuffer<uint>, RegionBatches)
+		SHADER_PARAMETER_SRV(StructuredBuffer<uint>, BatchOffsets)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<uint>, DrawIndirectArgs)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWStructuredBuffer<uint>, VisibleRegionIndices)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWStructuredBuffer<float4>, RegionRects)
+	END_SHADER_PARAMETER_STRUCT()
+};
+
+// Draws the screen rects of the visible regions of a batch, one instance per region.
+class FGBufferProcessRegionVS : public FGlobalShader
+{
+	DECLARE_GLOBAL_SHADER(FGBufferProcessRegionVS);
+	SHADER_USE_PARAMETER_STRUCT(FGBufferProcessRegionVS, FGlobalShader);
+
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+	}
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("REGION_VS"), 1);
+	}
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER_STRUCT_REF(FViewUniformShaderParameters, View)
+		SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<uint>, VisibleRegionIndices)
+		SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<float4>, RegionRects)
+		SHADER_PARAMETER_SRV(StructuredBuffer<float4>, BakedRegions)
+		SHADER_PARAMETER_SRV(StructuredBuffer<float>, RegionIntensities)
+		SHADER_PARAMETER(uint32, NumBakedRegions)
+		SHADER_PARAMETER(uint32, BatchOffset)
+	END_SHADER_PARAMETER_STRUCT()
+};
+
+/** Parameters of a batch draw: the region vertex shader, the indirect arguments and the kernel inputs. */
+BEGIN_SHADER_PARAMETER_STRUCT(FGBufferProcessRegionBatchParameters, )
+	SHADER_PARAMETER_STRUCT_INCLUDE(FGBufferProcessRegionVS::FParameters, VS)
+	/** Copy of the target, only read by decode/encode kernels and by the copy pass itself. */
+	SHADER_PARAMETER_RDG_TEXTURE(Texture2D, SrcTexture)
+	RDG_BUFFER_ACCESS(DrawIndirectArgs, ERHIAccess::IndirectArgs)
+	RENDER_TARGET_BINDING_SLOTS()
+END_SHADER_PARAMETER_STRUCT()
+
+/**
+ * Consecutive regions, in priority order, that are drawn with the same material and kernel.
+ * Batches keep the draw order of the regions, regions inside a batch are drawn in any order.
+ * Decode/encode kernels read a copy of the target made before their batch, so each of their regions is a batch of its own.
+ * Weighted regions don't have a draw order, they are batched by material after all the other batches.
+ */
+struct FGBufferProcessRegionBatch
+{
+	const FMaterialRenderProxy* MaterialProxy = nullptr;
+
+	EGBufferProcessType Type = EGBufferProcessType::Normal;
+
+	EGBufferProcessBlendOp BlendOp = EGBufferProcessBlendOp::Replace;
+
+	/** First slot of the batch in the visible region list. Batches are contiguous. */
+	uint32 FirstRegion = 0;
+
+	uint32 NumRegions = 0;
+
+	/**
+	 * Union of the world bounds of the regions, invalid if one of them is unbound like FGBufferProcessRegionProxy::WorldBounds.
+	 * Only kept for weighted batches, their resolve is limited to its projection.
+	 */
+	FBox Bounds = FBox(ForceInit);
+};
+
+/** Per view output of FGBufferProcessGPUCuller::Cull. */
+struct FGBufferProcessCullingResult
+{
+	/** FRHIDrawIndirectParameters per batch, the instance count is the number of visible regions. */
+	FRDGBufferRef DrawIndirectArgs = nullptr;
+
+	/** Region slots, compacted per batch starting at FGBufferProcessRegionBatch::FirstRegion. */
+	FRDGBufferRef VisibleRegionIndices = nullptr;
+
+	/** NDC rect of each visible region, by slot. */
+	FRDGBufferRef RegionRects = nullptr;
+
+	/** Records of the baked regions, read by slot for the first NumBakedRegions slots. */
+	FRHIShaderResourceView* BakedRegions = nullptr;
+
+	/** Intensity of the other regions, read by slot minus NumBakedRegions. */
+	FRHIShaderResourceView* RegionIntensities = nullptr;
+
+	uint32 NumBakedRegions = 0;
+};
+
+/**
+ * Keeps the region bounds on the GPU and culls them there, so that the cost on the render thread only depends
+ * on the number of batches. The region buffers and the batches are rebuilt when regions are added, removed,
+ * reordered or change material. Regions that only moved or changed intensity are scatter uploaded into the
+ * buffers in place, so static regions cost no upload. Culling runs per view and fills the draw arguments of every batch.
+ * Baked regions take the first slots and are read from their records, uploaded as they are by UpdateBakedRegions,
+ * the other regions follow them. Slots of regions that are not drawn have no batch and are skipped by the culling.
+ * Only post base pass regions are culled, the regions of the later stages are drawn on the render thread path.
+ * The region buffers are plain RHI buffers so that they outlive the graph of any one view family.
+ * Render thread only.
+ */
+class FGBufferProcessGPUCuller
+{
+public:
+	/** True if the regions of the view should be culled on the GPU rather than by FGBufferProcessScheduler. */
+	static bool IsEnabled(const FViewInfo& View);
+
+	/**
+	 * Rebuilds the region buffers and batches if RegionsHash differs from the one they were built for.
+	 * Otherwise only uploads the bounds and intensities of DirtyRegionIds, the regions changed in place since the last update.
+	 */
+	void Update(FRHICommandList& RHICmdList, TArrayView<const FGBufferProcessRegionProxy* const> Regions, uint32 RegionsHash, const TSet<uint32>& DirtyRegionIds);
+
+	/**
+	 * Uploads the records of all baked region runs, in the order of FGBufferProcessRegionProxy::BakedRegionIndex.
+	 * Only called when a baked region asset is registered or unregistered, the next Update rebuilds the batches.
+	 */
+	void UpdateBakedRegions(TArrayView<const FGBufferProcessBakedRegionRun> BakedRuns);
+
+	/**
+	 * Culls the regions for View by frustum, r.GBufferProcess.MinScreenCoverage and the previous frame HZB.
+	 * Tile is set when View renders a tile of a larger image: coverage is then measured on the final image like
+	 * FGBufferProcessScheduler does, and occlusion is off since the previous frame HZB is of another tile.
+	 */
+	FGBufferProcessCullingResult Cull(FRDGBuilder& GraphBuilder, const FViewInfo& View, const FGBufferProcessTile* Tile = nullptr) const;
+
+	TArrayView<const FGBufferProcessRegionBatch> GetBatches() const { return Batches; }
+
+	int32 GetNumRegions() const { return NumRegions; }
+
+private:
+	/** Scatter uploads the regions of DirtyRegionIds into their slots of the region buffers. */
+	void UpdateDirtyRegions(FRHICommandList& RHICmdList, TArrayView<const FGBufferProcessRegionProxy* const> Regions, const TSet<uint32>& DirtyRegionIds);
+
+	/** Recomputes FGBufferProcessRegionBatch::Bounds of the weighted batches. */
+	void UpdateWeightedBatchBounds(TArrayView<const FGBufferProcessRegionProxy* const> Regions);
+
+private:
+	TArray<FGBufferProcessRegionBatch> Batches;
+
+	/** BakedRegionStride float4 per baked region, their records as they are. */
+	FStructuredBufferRHIRef BakedRegionsBuffer;
+	FShaderResourceViewRHIRef BakedRegionsSRV;
+
+	/** Center and extent of each region that is not baked. Written in place by scatter uploads. */
+	FRWBufferStructured RegionBounds;
+
+	FStructuredBufferRHIRef RegionBatchesBuffer;
+	FShaderResourceViewRHIRef RegionBatchesSRV;
+
+	FRWBufferStructured RegionIntensities;
+
+	FStructuredBufferRHIRef BatchOffsetsBuffer;
+	FShaderResourceViewRHIRef BatchOffsetsSRV;
+
+	FScatterUploadBuffer RegionBoundsUploadBuffer;
+	FScatterUploadBuffer RegionIntensitiesUploadBuffer;
+
+	/** Index in RegionBounds and RegionIntensities of each region that is not baked, by region id. */
+	TMap<uint32, int32> RegionSlots;
+
+	/** Index of the region proxy of each entry of RegionBounds, valid as long as the regions hash doesn't change. */
+	TArray<int32> SlotRegionIndices;
+
+	/** Index of the region proxy of each region of the weighted batches, in batch order. Same lifetime as SlotRegionIndices. */
+	TArray<int32> WeightedRegionIndices;
+
+	/** The weighted batches follow the ordered ones. */
+	int32 FirstWeightedBatch = 0;
+
+	/** Regions drawn, the capacity of the visible region list. */
+	int32 NumRegions = 0;
+
+	/** Baked regions, then the drawn regions that are not baked. */
+	int32 NumRegionSlots = 0;
+
+	int32 NumBakedRegions = 0;
+
+	uint32 CachedRegionsHash = 0;
+
+	bool bValid = false;
+};
+
+namespace GBufferProcess
+{
+	/**
+	 * Hash of the order, ids, materials, stages and kernels of the regions, everything the GPU culler batches by.
+	 * Transforms and intensities are left out, they are tracked by UGBufferProcessSubsystem::MarkRegionDirty.
+	 * Computed on the render thread, once the gathered regions are merged with the baked ones.
+	 */
+	uint32 GetRegionsHash(TArrayView<const FGBufferProcessRegionProxy* const> Regions);
+}
@@ -9,10 +9,12 @@
 #include "Runtime/RenderCore/Public/ShaderParameterUtils.h"
 #include "Runtime/RenderCore/Public/RenderResource.h"
 #include "Runtime/Renderer/Public/MaterialShader.h"
+#include "Runtime/Renderer/Public/MeshPassProcessor.h"
 #include "Runtime/RenderCore/Public/RenderGraphResources.h"
 #include "Runtime/Renderer/Private/ScreenPass.h"
 #include "Runtime/Renderer/Private/SceneTextureParameters.h"
 #include "GBufferProcessActor.h"
+#include "GBufferProcessClusters.h"
 
 // The vertex shader used by DrawScreenPass to draw a rectangle.
 class FGBufferProcessScreenPassVS : public FGlobalShader
@@ -97,15 +99,112 @@ class FRewritePS : public FGlobalShader
 	END_SHADER_PARAMETER_STRUCT()
 };
 
-// a test shader driver from material graph
-class FMaterialGraphRewriteNormalPS : public FMaterialShader
+// Divides the weighted sums of the weighted regions of a target and blends them over it, see EGBufferProcessBlendOp::Weighted.
+class FGBufferProcessResolveWeightedPS : public FGlobalShader
 {
-	DECLARE_SHADER_TYPE(FMaterialGraphRewriteNormalPS, Material);
+	DECLARE_GLOBAL_SHADER(FGBufferProcessResolveWeightedPS);
+	SHADER_USE_PARAMETER_STRUCT(FGBufferProcessResolveWeightedPS, FGlobalShader);
 
 public:
-	class FPermutationTest : SHADER_PERMUTATION_BOOL("PermutationTest");
+	class FTargetTypeDim : SHADER_PERMUTATION_ENUM_CLASS("GBUFFER_PROCESS_TARGET", EGBufferProcessType);
+	using FPermutationDomain = TShaderPermutationDomain<FTargetTypeDim>;
+
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return true;
+	}
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER_RDG_TEXTURE(Texture2D, AccumulationTexture)
+		/** Copy of the target, only read for normals. */
+		SHADER_PARAMETER_RDG_TEXTURE(Texture2D, SrcTexture)
+		RENDER_TARGET_BINDING_SLOTS()
+	END_SHADER_PARAMETER_STRUCT()
+};
+
+// Counts the region draws, material instructions and wasted pixels of each pixel for r.GBufferProcess.Visualize.
+class FGBufferProcessVisualizeRegionPS : public FGlobalShader
+{
+	DECLARE_GLOBAL_SHADER(FGBufferProcessVisualizeRegionPS);
+	SHADER_USE_PARAMETER_STRUCT(FGBufferProcessVisualizeRegionPS, FGlobalShader);
+
+public:
+	/** Visualizes a clustered draw, wasted pixels are the ones none of its regions covers. */
+	class FClusteredDim : SHADER_PERMUTATION_BOOL("GBUFFER_PROCESS_CLUSTERED");
+	using FPermutationDomain = TShaderPermutationDomain<FClusteredDim>;
+
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		const FPermutationDomain PermutationVector(Parameters.PermutationId);
+		return !PermutationVector.Get<FClusteredDim>() || IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+	}
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER_STRUCT_REF(FViewUniformShaderParameters, View)
+		SHADER_PARAMETER_RDG_UNIFORM_BUFFER(FGBufferProcessClusterParameters, Clusters)
+		SHADER_PARAMETER(FIntPoint, ClusterRegionRange)
+		SHADER_PARAMETER(float, RegionCost)
+		SHADER_PARAMETER(float, RegionWeight)
+		SHADER_PARAMETER(uint32, bIgnoreIntensity)
+	END_SHADER_PARAMETER_STRUCT()
+};
+
+// Blends the counters of FGBufferProcessVisualizeRegionPS over the tonemapped scene color as a heatmap.
+class FGBufferProcessCompositeVisualizePS : public FGlobalShader
+{
+	DECLARE_GLOBAL_SHADER(FGBufferProcessCompositeVisualizePS);
+	SHADER_USE_PARAMETER_STRUCT(FGBufferProcessCompositeVisualizePS, FGlobalShader);
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return true;
+	}
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER_RDG_TEXTURE(Texture2D, VisualizeTexture)
+		SHADER_PARAMETER(FIntPoint, OutputViewportMin)
+		SHADER_PARAMETER(FVector2D, OutputViewportSize)
+		SHADER_PARAMETER(FIntPoint, VisualizeViewportMin)
+		SHADER_PARAMETER(FVector2D, VisualizeViewportSize)
+		SHADER_PARAMETER(uint32, VisualizeMode)
+		SHADER_PARAMETER(float, MaxOverdraw)
+		SHADER_PARAMETER(float, MaxCost)
+		RENDER_TARGET_BINDING_SLOTS()
+	END_SHADER_PARAMETER_STRUCT()
+};
+
+// Region pixel shader driven by the material graph. One branch-free kernel per target type, blend op and decode/encode mode.
+class FGBufferProcessRegionPS : public FMaterialShader
+{
+	DECLARE_SHADER_TYPE(FGBufferProcessRegionPS, Material);
+
+public:
+	class FTargetTypeDim : SHADER_PERMUTATION_ENUM_CLASS("GBUFFER_PROCESS_TARGET", EGBufferProcessType);
+	class FBlendOpDim : SHADER_PERMUTATION_ENUM_CLASS("GBUFFER_PROCESS_BLEND_OP", EGBufferProcessBlendOp);
+	class FDecodeEncodeDim : SHADER_PERMUTATION_BOOL("GBUFFER_PROCESS_DECODE_ENCODE");
+	/** Drawn in batches by FGBufferProcessRegionVS, the intensity comes from the vertex shader. */
+	class FGPUDrivenDim : SHADER_PERMUTATION_BOOL("GBUFFER_PROCESS_GPU_DRIVEN");
+	/** Drawn inside the base pass render pass, the output goes to the base pass index of the target. */
+	class FInBasePassDim : SHADER_PERMUTATION_BOOL("GBUFFER_PROCESS_IN_BASE_PASS");
+	/** Draws a range of region slots at once, each pixel looks up the slots of its cluster in GBufferProcessClusters. */
+	class FClusteredDim : SHADER_PERMUTATION_BOOL("GBUFFER_PROCESS_CLUSTERED");
 	using FPermutationDomain = TShaderPermutationDomain<
-		FPermutationTest>;
+		FTargetTypeDim,
+		FBlendOpDim,
+		FDecodeEncodeDim,
+		FGPUDrivenDim,
+		FInBasePassDim,
+		FClusteredDim>;
+
+	/** Only the kernels returned by GBufferProcess::GetRegionKernel can be used, everything else is pruned. */
+	static bool IsPermutationSupported(const FPermutationDomain& PermutationVector);
+
+	/**
+	 * Region materials are light function materials. Their kernels are only compiled while the project turns on
+	 * r.GBufferProcess.Support, the default light function material always gets them as the fallback of the others.
+	 */
+	static bool IsMaterialSupported(const FMaterialShaderParameters& MaterialParameters);
 
 	static void ModifyCompilationEnvironment(const FMaterialShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
 	{
@@ -114,30 +213,293 @@ public:
 
 	static bool ShouldCompilePermutation(const FMaterialShaderPermutationParameters& Parameters)
 	{
-		return true;
+		const FPermutationDomain PermutationVector(Parameters.PermutationId);
+		if ((PermutationVector.Get<FGPUDrivenDim>() || PermutationVector.Get<FClusteredDim>()) && !IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5))
+		{
+			return false;
+		}
+		return IsMaterialSupported(Parameters.MaterialParameters) && IsPermutationSupported(PermutationVector);
 	}
 
-	FMaterialGraphRewriteNormalPS(const ShaderMetaType::CompiledShaderInitializerType& Initializer) :
+	FGBufferProcessRegionPS(const ShaderMetaType::CompiledShaderInitializerType& Initializer) :
 		FMaterialShader(Initializer)
 	{
+		RegionIntensity.Bind(Initializer.ParameterMap, TEXT("RegionIntensity"));
+		SrcTexture.Bind(Initializer.ParameterMap, TEXT("SrcTexture"));
+		SrcTextureSampler.Bind(Initializer.ParameterMap, TEXT("SrcTextureSampler"));
+		ClusterRegionRange.Bind(Initializer.ParameterMap, TEXT("ClusterRegionRange"));
 	}
 
-	FMaterialGraphRewriteNormalPS() {}
+	FGBufferProcessRegionPS() {}
 
 public:
-	void SetParameters(FRHICommandList& RHICmdList, const FViewInfo& View, const FMaterialRenderProxy* MaterialProxy, const FMaterial& Material)
+	void SetParameters(FRHICommandList& RHICmdList, const FViewInfo& View, const FMaterialRenderProxy* MaterialProxy, const FMaterial& Material, float Intensity, FRHITexture* InSrcTexture)
 	{
 		FRHIPixelShader* ShaderRHI = RHICmdList.GetBoundPixelShader();
 
 		FMaterialShader::SetViewParameters(RHICmdList, ShaderRHI, View, View.ViewUniformBuffer);
 		FMaterialShader::SetParameters(RHICmdList, ShaderRHI, MaterialProxy, Material, View);
+
+		SetShaderValue(RHICmdList, ShaderRHI, RegionIntensity, Intensity);
+		if (InSrcTexture)
+		{
+			SetTextureParameter(RHICmdList, ShaderRHI, SrcTexture, SrcTextureSampler, TStaticSamplerState<SF_Point>::GetRHI(), InSrcTexture);
+		}
+	}
+
+	/**
+	 * Gathers the bindings of SetParameters and SetClusterParameters for a draw recorded on a task thread.
+	 * FMaterialShader::SetParameters evaluates stale uniform expressions of the material, which is render thread only, so the
+	 * bindings are gathered on the render thread. The uniform expressions of MaterialProxy must be up to date.
+	 */
+	void GetShaderBindings(
+		const FScene* Scene,
+		const FViewInfo& View,
+		const FMaterialRenderProxy* MaterialProxy,
+		const FMaterial& Material,
+		float Intensity,
+		FRHITexture* InSrcTexture,
+		FRHIUniformBuffer* Clusters,
+		FIntPoint Range,
+		FMeshDrawSingleShaderBindings& ShaderBindings) const
+	{
+		FMaterialShader::GetShaderBindings(Scene, View.GetFeatureLevel(), *MaterialProxy, Material, ShaderBindings);
+		ShaderBindings.Add(GetUniformBufferParameter<FViewUniformShaderParameters>(), View.ViewUniformBuffer);
+
+		ShaderBindings.Add(RegionIntensity, Intensity);
+		if (InSrcTexture)
+		{
+			ShaderBindings.AddTexture(SrcTexture, SrcTextureSampler, TStaticSamplerState<SF_Point>::GetRHI(), InSrcTexture);
+		}
+		if (Clusters)
+		{
+			ShaderBindings.Add(GetUniformBufferParameter<FGBufferProcessClusterParameters>(), Clusters);
+			ShaderBindings.Add(ClusterRegionRange, Range);
+		}
+	}
+
+	/** Binds the cluster grid for the clustered permutation, Range is the first region slot of the draw and the number of slots. */
+	void SetClusterParameters(FRHICommandList& RHICmdList, FRHIUniformBuffer* Clusters, FIntPoint Range)
+	{
+		FRHIPixelShader* ShaderRHI = RHICmdList.GetBoundPixelShader();
+
+		SetUniformBufferParameter(RHICmdList, ShaderRHI, GetUniformBufferParameter<FGBufferProcessClusterParameters>(), Clusters);
+		SetShaderValue(RHICmdList, ShaderRHI, ClusterRegionRange, Range);
 	}
 
 public:
 	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		/** Copy of the target, only read by decode/encode kernels. */
+		SHADER_PARAMETER_RDG_TEXTURE(Texture2D, SrcTexture)
 		RENDER_TARGET_BINDING_SLOTS()
 	END_SHADER_PARAMETER_STRUCT()
 
-public:
-	//LAYOUT_FIELD(FShaderUniformBufferParameter, PassUniformBuffer);
+private:
+	LAYOUT_FIELD(FShaderParameter, RegionIntensity);
+	LAYOUT_FIELD(FShaderResourceParameter, SrcTexture);
+	LAYOUT_FIELD(FShaderResourceParameter, SrcTextureSampler);
+	LAYOUT_FIELD(FShaderParameter, ClusterRegionRange);
+};
+
+/** Runtime description of a region kernel, built from TGBufferProcessRegionKernel. */
+struct FGBufferProcessRegionKernel
+{
+	/** False for combinations that make no sense, e.g. multiplying normals. */
+	bool bSupported = false;
+
+	/** The kernel reads a copy of the target and resolves the blend itself. */
+	bool bDecodeEncode = false;
+
+	/** FGBufferProcessRegionPS permutation drawn one region at a time. */
+	int32 PermutationId = 0;
+
+	/** FGBufferProcessRegionPS permutation drawn in GPU culled batches. SM5 only. */
+	int32 GPUDrivenPermutationId = 0;
+
+	/** The kernel doesn't read the target, so it can be drawn inside the base pass render pass. */
+	bool bInBasePass = false;
+
+	/** FGBufferProcessRegionPS permutation drawn inside the base pass render pass. Only valid if bInBasePass. */
+	int32 InBasePassPermutationId = 0;
+
+	/** Consecutive regions with the same material can be drawn at once, see r.GBufferProcess.Clustered. */
+	bool bClustered = false;
+
+	/** FGBufferProcessRegionPS permutation drawn for a range of clustered regions. SM5 only, only valid if bClustered. */
+	int32 ClusteredPermutationId = 0;
+
+	/**
+	 * The kernel adds its weighted output to an accumulation texture instead of the target, so regions can be drawn in any order.
+	 * FGBufferProcessResolveWeightedPS blends the accumulation into the target once all of them are drawn.
+	 */
+	bool bWeighted = false;
+
+	/** Index of the target in the base pass render targets. */
+	int32 TargetIndex = 0;
+
+	FRHIBlendState* (*GetBlendState)() = nullptr;
+
+	/** Blend state of FGBufferProcessResolveWeightedPS into the target. Only valid if bWeighted. */
+	FRHIBlendState* (*GetResolveBlendState)() = nullptr;
+
+	/** Blend state with all base pass render targets bound. Only valid if bInBasePass. */
+	FRHIBlendState* (*GetBasePassBlendState)() = nullptr;
+};
+
+/** Output merger color factors of a blend op. */
+template<EGBufferProcessBlendOp BlendOp>
+struct TGBufferProcessRegionBlendFactors;
+
+template<>
+struct TGBufferProcessRegionBlendFactors<EGBufferProcessBlendOp::Replace>
+{
+	static constexpr EBlendFactor Src = BF_One;
+	static constexpr EBlendFactor Dest = BF_Zero;
 };
+
+// The kernels output Intensity in alpha.
+template<>
+struct TGBufferProcessRegionBlendFactors<EGBufferProcessBlendOp::Lerp>
+{
+	static constexpr EBlendFactor Src = BF_SourceAlpha;
+	static constexpr EBlendFactor Dest = BF_InverseSourceAlpha;
+};
+
+template<>
+struct TGBufferProcessRegionBlendFactors<EGBufferProcessBlendOp::Add>
+{
+	static constexpr EBlendFactor Src = BF_SourceAlpha;
+	static constexpr EBlendFactor Dest = BF_One;
+};
+
+// The kernels output lerp(1, Value, Intensity).
+template<>
+struct TGBufferProcessRegionBlendFactors<EGBufferProcessBlendOp::Multiply>
+{
+	static constexpr EBlendFactor Src = BF_DestColor;
+	static constexpr EBlendFactor Dest = BF_Zero;
+};
+
+// The kernels output (Value * Intensity, Intensity) into the accumulation texture, see TGBufferProcessRegionKernel::GetBlendState.
+template<>
+struct TGBufferProcessRegionBlendFactors<EGBufferProcessBlendOp::Weighted>
+{
+	static constexpr EBlendFactor Src = BF_One;
+	static constexpr EBlendFactor Dest = BF_One;
+};
+
+/** Output merger state for a blend op, restricted to the channels of the target. */
+template<EColorWriteMask WriteMask, EGBufferProcessBlendOp BlendOp>
+struct TGBufferProcessRegionBlendState : TStaticBlendState<WriteMask, BO_Add, TGBufferProcessRegionBlendFactors<BlendOp>::Src, TGBufferProcessRegionBlendFactors<BlendOp>::Dest> {};
+
+// Blend of render target Index in TGBufferProcessRegionBasePassBlendState, the other base pass targets are not written.
+#define GBUFFER_PROCESS_BASE_PASS_TARGET_BLEND(Index) \
+	TargetIndex == Index ? WriteMask : CW_NONE, BO_Add, TGBufferProcessRegionBlendFactors<BlendOp>::Src, TGBufferProcessRegionBlendFactors<BlendOp>::Dest, BO_Add, BF_One, BF_Zero
+
+/** TGBufferProcessRegionBlendState on render target TargetIndex, for draws with all base pass render targets bound. */
+template<int32 TargetIndex, EColorWriteMask WriteMask, EGBufferProcessBlendOp BlendOp>
+struct TGBufferProcessRegionBasePassBlendState : TStaticBlendState<
+	GBUFFER_PROCESS_BASE_PASS_TARGET_BLEND(0),
+	GBUFFER_PROCESS_BASE_PASS_TARGET_BLEND(1),
+	GBUFFER_PROCESS_BASE_PASS_TARGET_BLEND(2),
+	GBUFFER_PROCESS_BASE_PASS_TARGET_BLEND(3),
+	GBUFFER_PROCESS_BASE_PASS_TARGET_BLEND(4),
+	GBUFFER_PROCESS_BASE_PASS_TARGET_BLEND(5),
+	GBUFFER_PROCESS_BASE_PASS_TARGET_BLEND(6),
+	GBUFFER_PROCESS_BASE_PASS_TARGET_BLEND(7)> {};
+
+#undef GBUFFER_PROCESS_BASE_PASS_TARGET_BLEND
+
+/**
+ * Compile-time selection of the kernel for a target type and blend op.
+ * Encoded normals can't be interpolated or added by the output merger, those kernels decode a copy of the target instead.
+ */
+template<EGBufferProcessType TargetType, EGBufferProcessBlendOp BlendOp>
+struct TGBufferProcessRegionKernel
+{
+	static constexpr bool bSupported = !(TargetType == EGBufferProcessType::Normal && BlendOp == EGBufferProcessBlendOp::Multiply);
+
+	static constexpr bool bWeighted = BlendOp == EGBufferProcessBlendOp::Weighted;
+
+	// Weighted normals are summed decoded into their accumulation texture, ResolveWeightedPS decodes the target.
+	static constexpr bool bDecodeEncode = TargetType == EGBufferProcessType::Normal && BlendOp != EGBufferProcessBlendOp::Replace && !bWeighted;
+
+	// Kernels that read the target can't run in the render pass that writes it, weighted kernels write to their accumulation texture.
+	static constexpr bool bInBasePass = bSupported && !bDecodeEncode && !bWeighted;
+
+	// The merged blend of a range of regions only works if each of them is a plain output merger blend.
+	static constexpr bool bClustered = bSupported && !bDecodeEncode;
+
+	// SceneColor, GBufferA and GBufferB in the base pass render targets. Must match RegionPS.
+	static constexpr int32 TargetIndex =
+		TargetType == EGBufferProcessType::SceneColor ? 0 :
+		TargetType == EGBufferProcessType::Normal ? 1 : 2;
+
+	// Roughness lives in the blue channel of GBufferB, the alpha channels hold per object data.
+	static constexpr EColorWriteMask WriteMask = TargetType == EGBufferProcessType::Roughness ? CW_BLUE : CW_RGB;
+
+	static FRHIBlendState* GetBlendState()
+	{
+		if (bWeighted)
+		{
+			// The weights are summed in alpha.
+			using FWeightedFactors = TGBufferProcessRegionBlendFactors<EGBufferProcessBlendOp::Weighted>;
+			return TStaticBlendState<CW_RGBA, BO_Add, FWeightedFactors::Src, FWeightedFactors::Dest, BO_Add, FWeightedFactors::Src, FWeightedFactors::Dest>::GetRHI();
+		}
+		return TGBufferProcessRegionBlendState<WriteMask, bDecodeEncode ? EGBufferProcessBlendOp::Replace : BlendOp>::GetRHI();
+	}
+
+	// The resolve outputs the average with its coverage in alpha, normals are decoded from a copy of the target and written as is.
+	static FRHIBlendState* GetResolveBlendState()
+	{
+		return TGBufferProcessRegionBlendState<WriteMask, TargetType == EGBufferProcessType::Normal ? EGBufferProcessBlendOp::Replace : EGBufferProcessBlendOp::Lerp>::GetRHI();
+	}
+
+	static FRHIBlendState* GetBasePassBlendState()
+	{
+		return TGBufferProcessRegionBasePassBlendState<TargetIndex, WriteMask, BlendOp>::GetRHI();
+	}
+
+	static FGBufferProcessRegionPS::FPermutationDomain GetPermutationVector(bool bGPUDriven, bool bInBasePassPermutation = false, bool bClusteredPermutation = false)
+	{
+		FGBufferProcessRegionPS::FPermutationDomain PermutationVector;
+		PermutationVector.Set<FGBufferProcessRegionPS::FTargetTypeDim>(TargetType);
+		PermutationVector.Set<FGBufferProcessRegionPS::FBlendOpDim>(BlendOp);
+		PermutationVector.Set<FGBufferProcessRegionPS::FDecodeEncodeDim>(bDecodeEncode);
+		PermutationVector.Set<FGBufferProcessRegionPS::FGPUDrivenDim>(bGPUDriven);
+		PermutationVector.Set<FGBufferProcessRegionPS::FInBasePassDim>(bInBasePassPermutation);
+		PermutationVector.Set<FGBufferProcessRegionPS::FClusteredDim>(bClusteredPermutation);
+		return PermutationVector;
+	}
+
+	static FGBufferProcessRegionKernel GetKernel()
+	{
+		FGBufferProcessRegionKernel Kernel;
+		Kernel.bSupported = bSupported;
+		Kernel.bDecodeEncode = bDecodeEncode;
+		Kernel.PermutationId = GetPermutationVector(false).ToDimensionValueId();
+		Kernel.GPUDrivenPermutationId = GetPermutationVector(true).ToDimensionValueId();
+		Kernel.bInBasePass = bInBasePass;
+		Kernel.InBasePassPermutationId = GetPermutationVector(false, true).ToDimensionValueId();
+		Kernel.bClustered = bClustered;
+		Kernel.ClusteredPermutationId = GetPermutationVector(false, false, true).ToDimensionValueId();
+		Kernel.bWeighted = bWeighted;
+		Kernel.TargetIndex = TargetIndex;
+		Kernel.GetBlendState = &GetBlendState;
+		Kernel.GetResolveBlendState = &GetResolveBlendState;
+		Kernel.GetBasePassBlendState = &GetBasePassBlendState;
+		return Kernel;
+	}
+};
+
+namespace GBufferProcess
+{
+	/** Kernel for a region's type and blend op. */
+	const FGBufferProcessRegionKernel& GetRegionKernel(EGBufferProcessType InType, EGBufferProcessBlendOp InBlendOp);
+
+	/** Float texture the weighted regions of a target are accumulated into, (sum of Value * Intensity, sum of Intensity). */
+	FRDGTextureDesc GetWeightedAccumulationDesc(FIntPoint Extent);
+
+	/** Walks the material fallback chain until a light function material with the compiled region kernel is found. */
+	bool TryGetShaders(ERHIFeatureLevel::Type InFeatureLevel, int32 InPermutationId, FMaterialRenderProxy const*& OutMaterialProxy, FMaterial const*& OutMaterial, FMaterialShaders& OutShaders);
+}
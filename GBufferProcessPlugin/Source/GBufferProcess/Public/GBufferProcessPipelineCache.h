@@ -0,0 +1,102 @@
+#pragma once
+#include "CoreMinimal.h"
+#include "RHI.h"
+#include "RHIDefinitions.h"
+#include "UObject/WeakObjectPtrTemplates.h"
+#include "RenderGraphDefinitions.h"
+#include "GBufferProcessActor.h"
+
+class UMaterialInterface;
+class FMaterialRenderProxy;
+class FRHICommandList;
+struct FRenderTargetBindingSlots;
+struct FGBufferProcessRegionKernel;
+
+/** A material with the kernel it will be drawn with. */
+struct FGBufferProcessPrecacheRequest
+{
+	const FMaterialRenderProxy* MaterialProxy = nullptr;
+	EGBufferProcessType Type = EGBufferProcessType::Normal;
+	EGBufferProcessBlendOp BlendOp = EGBufferProcessBlendOp::Replace;
+};
+
+/**
+ * Precaches the graphics pipelines of region materials so the first draw of a region type doesn't hitch.
+ *
+ * Materials are queued on the game thread when their regions are registered. Once their shaders are compiled,
+ * the render thread creates the pipelines the region passes will use. New pipelines are recorded into the
+ * shader pipeline cache by PipelineStateCache when r.ShaderPipelineCache.LogPSO is enabled.
+ */
+class FGBufferProcessPipelinePrecacher
+{
+public:
+	/** Queues a region material with the kernel it is drawn with. Game thread only. */
+	void QueueMaterial(UMaterialInterface* InMaterial, EGBufferProcessType InType, EGBufferProcessBlendOp InBlendOp);
+
+	/** Moves the queued materials whose shaders are ready into OutRequests. Game thread only. */
+	void PopReadyMaterials(ERHIFeatureLevel::Type InFeatureLevel, TArray<FGBufferProcessPrecacheRequest>& OutRequests);
+
+	bool HasPendingMaterials() const { return PendingMaterials.Num() > 0; }
+
+	/** Returns true if every permutation the kernel can be drawn with is compiled for the material. Game thread only. */
+	static bool IsMaterialReady(const UMaterialInterface* InMaterial, ERHIFeatureLevel::Type InFeatureLevel, const FGBufferProcessRegionKernel& InKernel);
+
+	/** Returns InMaterial if it is ready, otherwise the last material that was. Keeps regions rendering while a new material compiles. Game thread only. */
+	static UMaterialInterface* GetReadyMaterial(UMaterialInterface* InMaterial, UMaterialInterface*& InOutLastReadyMaterial, ERHIFeatureLevel::Type InFeatureLevel, const FGBufferProcessRegionKernel& InKernel);
+
+	/**
+	 * Creates the region pipelines of the requests for the base pass render targets. Render thread only.
+	 * Pipelines of draws inside the base pass render pass are only created when its bindings are given.
+	 * SceneDepthTexture is the depth the region passes bind for volume proxies, null if they are off.
+	 */
+	static void PrecachePipelines(FRHICommandList& RHICmdList, ERHIFeatureLevel::Type InFeatureLevel, TArrayView<const FGBufferProcessPrecacheRequest> Requests, TArrayView<const FRDGTextureRef> BasePassTextures, FRDGTextureRef SceneDepthTexture, const FRenderTargetBindingSlots* BasePassRenderTargets = nullptr);
+
+private:
+	struct FPendingMaterial
+	{
+		TWeakObjectPtr<UMaterialInterface> Material;
+		EGBufferProcessType Type;
+		EGBufferProcessBlendOp BlendOp;
+
+		bool operator==(const FPendingMaterial& Other) const
+		{
+			return Material == Other.Material && Type == Other.Type && BlendOp == Other.BlendOp;
+		}
+
+		friend uint32 GetTypeHash(const FPendingMaterial& Pending)
+		{
+			return HashCombine(GetTypeHash(Pending.Material), ((uint32)Pending.Type << 8) | (uint32)Pending.BlendOp);
+		}
+	};
+
+	TSet<FPendingMaterial> PendingMaterials;
+};
+
+namespace GBufferProcess
+{
+	/** Key of a slot of a material list drawn with a kernel, see FGBufferProcessReadyMaterialResolver. */
+	inline uint64 GetMaterialKernelKey(int32 MaterialIndex, EGBufferProcessType Type, EGBufferProcessBlendOp BlendOp)
+	{
+		return ((uint64)(uint32)MaterialIndex << 16) | ((uint64)Type << 8) | (uint64)BlendOp;
+	}
+}
+
+/**
+ * Resolves the ready materials of a material list once per slot and kernel, for regions that reference their material by index.
+ * Lives for one gather. Game thread only.
+ */
+class FGBufferProcessReadyMaterialResolver
+{
+public:
+	/** InOutLastReadyMaterials holds the last ready material of each slot across gathers, it is resized to match InMaterials. */
+	FGBufferProcessReadyMaterialResolver(TArrayView<UMaterialInterface* const> InMaterials, TArray<UMaterialInterface*>& InOutLastReadyMaterials, ERHIFeatureLevel::Type InFeatureLevel);
+
+	/** Returns null if the slot is empty or nothing was compiled for it yet. */
+	const FMaterialRenderProxy* Resolve(int32 MaterialIndex, EGBufferProcessType Type, EGBufferProcessBlendOp BlendOp);
+
+private:
+	TArrayView<UMaterialInterface* const> Materials;
+	TArray<UMaterialInterface*>& LastReadyMaterials;
+	ERHIFeatureLevel::Type FeatureLevel;
+	TMap<uint64, const FMaterialRenderProxy*> ResolvedProxies;
+};
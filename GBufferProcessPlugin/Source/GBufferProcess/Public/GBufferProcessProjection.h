@@ -0,0 +1,54 @@
+#pragma once
+#include "CoreMinimal.h"
+
+class FSceneView;
+
+/**
+ * One tile of a high resolution image rendered as a grid of views, like HighResShot or Movie Render Queue tiling.
+ * Each tile renders its part of the image plus an overlap on every side, which is blended away when the tiles are stitched.
+ */
+struct FGBufferProcessTile
+{
+	/** Size of the final image in pixels. */
+	FIntPoint ImageSize = FIntPoint::ZeroValue;
+
+	FIntPoint TileCount = FIntPoint(1, 1);
+
+	FIntPoint TileIndex = FIntPoint::ZeroValue;
+
+	/** Overlap rendered past each edge of the tile, as a fraction of the tile size. */
+	float OverlapRatio = 0.0f;
+
+	bool IsValid() const
+	{
+		return ImageSize.X > 0 && ImageSize.Y > 0 && TileCount.X > 0 && TileCount.Y > 0 &&
+			TileIndex.X >= 0 && TileIndex.Y >= 0 && TileIndex.X < TileCount.X && TileIndex.Y < TileCount.Y &&
+			OverlapRatio >= 0.0f;
+	}
+};
+
+namespace GBufferProcess
+{
+	/**
+	 * Projects region bounds into the view and returns the covered pixel rect, clipped to View.ViewRect.
+	 * An invalid box stands for an unbound region and covers the whole view.
+	 * OutUnclippedRect, if given, receives the rect before it is clipped. It is left empty when the region covers the whole view.
+	 * Returns false if the bounds are outside the view frustum or don't cover any pixel.
+	 */
+	bool GetRegionPixelRect(const FSceneView& View, const FBox& WorldBounds, FIntRect& OutRect, FIntRect* OutUnclippedRect = nullptr);
+
+	/** Fraction of View.ViewRect covered by InRect, in [0, 1]. */
+	float GetScreenCoverage(const FSceneView& View, const FIntRect& InRect);
+
+	/** Pixels of the final image a tile renders, overlap included. Tiles on the border extend past the image. */
+	FIntRect GetTileImageRect(const FGBufferProcessTile& Tile);
+
+	/** Maps a pixel rect of the tile view, whose ViewRect renders TileImageRect, into the pixels of the final image. */
+	FIntRect TileViewRectToImageRect(const FIntRect& TileImageRect, const FIntRect& ViewRect, const FIntRect& InRect);
+
+	/**
+	 * Fraction of the final image covered by a rect of the tile view, in [0, 1]. Unlike GetScreenCoverage it is the same in every tile.
+	 * UnclippedRect is the rect of GetRegionPixelRect before clipping, an empty rect stands for a region covering the whole image.
+	 */
+	float GetTiledScreenCoverage(const FGBufferProcessTile& Tile, const FIntRect& ViewRect, const FIntRect& UnclippedRect);
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/ObjectMacros.h"
+#include "Engine/DataAsset.h"
+#include "RHIDefinitions.h"
+#include "GBufferProcessActor.h"
+#include "GBufferProcessRegionProxy.h"
+#include "GBufferProcessRegionDataAsset.generated.h"
+
+class UMaterialInterface;
+class FGBufferProcessPipelinePrecacher;
+class FGBufferProcessStreamingTextures;
+
+/**
+ * One baked region. Plain data, the blob of UGBufferProcessRegionDataAsset is an array of these.
+ * FGBufferProcessGPUCuller uploads the records as they are: they start with the two float4 of the region bounds
+ * in the encoding of CullRegionsCS, and RegionVS reads the intensity from the eighth float4.
+ */
+struct alignas(16) FGBufferProcessBakedRegion
+{
+	/** World bounds center, w is 0. */
+	FVector4 BoundsCenter;
+
+	/** World bounds extent, w is 0. Negative for unbound regions, see CullRegionsCS. */
+	FVector4 BoundsExtent;
+
+	FMatrix LocalToWorld;
+
+	FVector Extent;
+
+	int32 Priority;
+
+	float Intensity;
+
+	/** Index into UGBufferProcessRegionDataAsset::Materials. */
+	uint16 MaterialIndex;
+
+	/** NoMaterial if the region has no low quality material. */
+	uint16 LowQualityMaterialIndex;
+
+	EGBufferProcessType Type;
+
+	EGBufferProcessBlendOp BlendOp;
+
+	EGBufferProcessShape Shape;
+
+	EGBufferProcessStage Stage;
+
+	uint8 Padding[4];
+
+	static constexpr uint16 NoMaterial = 0xffff;
+};
+
+static_assert(sizeof(FGBufferProcessBakedRegion) == 128, "Baked region layout changed, bump the baked region version.");
+static_assert(STRUCT_OFFSET(FGBufferProcessBakedRegion, Intensity) == 7 * sizeof(FVector4), "Must match BAKED_REGION_INTENSITY in GBufferProcessCulling.usf.");
+
+/**
+ * Render thread copy of the baked regions of one UGBufferProcessRegionDataAsset, made once when the asset is registered.
+ * The proxies are built from the records then too, afterwards only their materials change, when one becomes ready.
+ */
+struct FGBufferProcessBakedRegionRun
+{
+	uint32 AssetId = 0;
+
+	/** Uploaded as they are by FGBufferProcessGPUCuller. */
+	TArray<FGBufferProcessBakedRegion, TAlignedHeapAllocator<16>> Records;
+
+	/** Proxy of each record, sorted by ascending priority. Regions whose material isn't ready have no MaterialProxy and are not drawn. */
+	TArray<FGBufferProcessRegionProxy> Proxies;
+
+	/** Takes the records and builds their proxies, without materials. */
+	void Init(uint32 InAssetId, TArray<FGBufferProcessBakedRegion, TAlignedHeapAllocator<16>>&& InRecords);
+
+	/** Sets the materials of the proxies. Returns false, without touching the proxies, if they didn't change. */
+	bool UpdateMaterials(FGBufferProcessBakedRegionMaterials&& InMaterials);
+
+private:
+	FGBufferProcessBakedRegionMaterials Materials;
+};
+
+/**
+ * Static regions of a level baked into one flat blob, sorted by ascending priority.
+ *
+ * The blob is a small header followed by FGBufferProcessBakedRegion records. It is bulk serialized, so loading it is one
+ * read and creates no per-region object. Registering the asset copies the records to the render thread once, see
+ * FGBufferProcessBakedRegionRun. From then on only the materials of the regions are gathered, by GatherMaterials.
+ * Baked by AGBufferProcessBakedRegionsActor when its level is saved or cooked.
+ */
+UCLASS()
+class UGBufferProcessRegionDataAsset : public UDataAsset
+{
+	GENERATED_UCLASS_BODY()
+public:
+	/** Materials referenced by the baked regions. */
+	UPROPERTY(VisibleAnywhere, Category = "GBuffer Modify")
+	TArray<UMaterialInterface*> Materials;
+
+	/** Baked regions sorted by ascending priority. Empty if the blob was baked with another layout. */
+	TArrayView<const FGBufferProcessBakedRegion> GetRegions() const;
+
+	/** Replaces the baked regions. Regions are stably sorted by priority here. */
+	void SetRegions(TArray<FGBufferProcessBakedRegion>& InRegions, TArray<UMaterialInterface*>&& InMaterials);
+
+	/** Bakes enabled regions with a material. Regions with dynamic effect conditions are baked as if always effective. */
+	void BakeRegions(TArrayView<const AGBufferProcessActor* const> InRegions);
+
+	/** Resolves the ready material of each material and kernel the baked regions are drawn with. Game thread only. */
+	void GatherMaterials(ERHIFeatureLevel::Type InFeatureLevel, FGBufferProcessBakedRegionMaterials& OutMaterials);
+
+	/** Adds the textures of the materials of all baked regions with the bounds of their regions. Game thread only. */
+	void GetStreamingTextures(FGBufferProcessStreamingTextures& OutTextures) const;
+
+	/** Queues the materials of all baked regions for pipeline precaching. */
+	void QueuePipelinePrecache(FGBufferProcessPipelinePrecacher& InPrecacher) const;
+
+	/** Reads or writes the blob only. */
+	void SerializeRegions(FArchive& Ar);
+
+	//~ Begin UObject Interface
+	virtual void Serialize(FArchive& Ar) override;
+	//~ End UObject Interface
+
+private:
+	/** A slot of Materials with the kernel a baked region draws it with. */
+	struct FMaterialKernel
+	{
+		uint16 MaterialIndex;
+		EGBufferProcessType Type;
+		EGBufferProcessBlendOp BlendOp;
+	};
+
+	/** Fills MaterialKernels and LowQualityMaterialKernels from the records, if the blob changed since. */
+	void UpdateMaterialKernels();
+
+private:
+	/** Header followed by the records. 16 byte aligned so the records can be read in place. */
+	TArray<uint8, TAlignedHeapAllocator<16>> RegionBlob;
+
+	/** Distinct materials and kernels of the records, so the materials are gathered without going through the records. */
+	TArray<FMaterialKernel> MaterialKernels;
+	TArray<FMaterialKernel> LowQualityMaterialKernels;
+	bool bMaterialKernelsDirty = true;
+
+	/** Last material of each slot of Materials that had compiled region shaders. */
+	UPROPERTY(Transient)
+	TArray<UMaterialInterface*> LastReadyMaterials;
+
+	UPROPERTY(Transient)
+	TArray<UMaterialInterface*> LastReadyLowQualityMaterials;
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/ObjectMacros.h"
+#include "Components/SceneComponent.h"
+#include "RHIDefinitions.h"
+#include "GBufferProcessActor.h"
+#include "GBufferProcessRegionInstancesComponent.generated.h"
+
+class UMaterialInterface;
+class FGBufferProcessStreamingTextures;
+class FGBufferProcessReadyMaterialResolver;
+struct FGBufferProcessRegionProxy;
+
+/**
+ * Many regions in one component, without an actor per region.
+ *
+ * Instances are stored as arrays of their fields and registered with UGBufferProcessSubsystem once, by the component.
+ * The shape of an instance is a box, or a sphere, of half size 100 scaled by the instance transform, which is relative
+ * to the component. Instances reference their material by index into Materials.
+ */
+UCLASS(ClassGroup = Rendering, meta = (BlueprintSpawnableComponent))
+class UGBufferProcessRegionInstancesComponent : public USceneComponent
+{
+	GENERATED_UCLASS_BODY()
+public:
+	/** Materials referenced by the instances. */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "GBuffer Modify")
+	TArray<UMaterialInterface*> Materials;
+
+	/** When in the frame the instances are drawn, see AGBufferProcessActor::Stage. */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "GBuffer Modify")
+	EGBufferProcessStage Stage = EGBufferProcessStage::PostBasePass;
+
+	/** Adds an instance and returns its index. */
+	UFUNCTION(BlueprintCallable, Category = "GBuffer Modify")
+	int32 AddInstance(const FTransform& InstanceTransform, EGBufferProcessShape Shape, EGBufferProcessType Type, EGBufferProcessBlendOp BlendOp, int32 Priority, float Intensity, int32 MaterialIndex);
+
+	/** Removes an instance. The indices of the following instances are shifted down by one. */
+	UFUNCTION(BlueprintCallable, Category = "GBuffer Modify")
+	bool RemoveInstance(int32 InstanceIndex);
+
+	UFUNCTION(BlueprintCallable, Category = "GBuffer Modify")
+	bool UpdateInstanceTransform(int32 InstanceIndex, const FTransform& InstanceTransform);
+
+	UFUNCTION(BlueprintCallable, Category = "GBuffer Modify")
+	bool UpdateInstance(int32 InstanceIndex, int32 Priority, float Intensity, int32 MaterialIndex);
+
+	UFUNCTION(BlueprintCallable, Category = "GBuffer Modify")
+	void ClearInstances();
+
+	UFUNCTION(BlueprintPure, Category = "GBuffer Modify")
+	int32 GetInstanceCount() const { return InstanceTransforms.Num(); }
+
+	/** Appends render thread copies of the instances, sorted by ascending priority. Game thread only. */
+	void GatherRegionProxies(ERHIFeatureLevel::Type InFeatureLevel, TArray<FGBufferProcessRegionProxy>& OutProxies);
+
+	/** Appends render thread copies of some of the instances, in no particular order. Game thread only. */
+	void GatherInstanceProxies(ERHIFeatureLevel::Type InFeatureLevel, const TSet<int32>& InstanceIndices, TArray<FGBufferProcessRegionProxy>& OutProxies);
+
+	/** FGBufferProcessRegionProxy::RegionId of an instance. */
+	uint32 GetInstanceRegionId(int32 InstanceIndex) const { return HashCombine(GetUniqueID(), (uint32)InstanceIndex); }
+
+	/** Adds the textures of the instance materials with the bounds of the instances. Game thread only. */
+	void GetStreamingTextures(FGBufferProcessStreamingTextures& OutTextures) const;
+
+	/** Queues the materials of all instances for pipeline precaching. Done on registration, which also follows edits in the editor. */
+	void QueuePipelinePrecache() const;
+
+	//~ Begin UActorComponent Interface
+	virtual void OnRegister() override;
+	virtual void OnUnregister() override;
+	//~ End UActorComponent Interface
+
+	//~ Begin USceneComponent Interface
+	virtual void OnUpdateTransform(EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport) override;
+	virtual void OnVisibilityChanged() override;
+	virtual void OnHiddenInGameChanged() override;
+	//~ End USceneComponent Interface
+
+	//~ Begin UObject Interface
+	virtual void PostLoad() override;
+	//~ End UObject Interface
+
+private:
+	bool IsValidInstance(int32 InstanceIndex) const { return InstanceTransforms.IsValidIndex(InstanceIndex); }
+
+	/** Reports a change of an instance to UGBufferProcessSubsystem. */
+	void MarkInstanceDirty(int32 InstanceIndex, EGBufferProcessRegionDirtyFlags InFlags);
+
+	/** Reports instances that were added, removed, reordered or hidden, which makes every region be gathered again. */
+	void MarkInstancesChanged();
+
+	/** Fills the proxy of an instance. Returns false if nothing was compiled for its material yet. */
+	bool GetInstanceProxy(int32 InstanceIndex, const FTransform& ComponentToWorld, FGBufferProcessReadyMaterialResolver& MaterialResolver, FGBufferProcessRegionProxy& OutProxy) const;
+
+	/** World space bounds of an instance. Invalid for unbound instances. */
+	FBox GetInstanceBounds(int32 InstanceIndex, const FTransform& InstanceToWorld) const;
+
+	/** Truncates the instance arrays to the shortest one, in case they were saved inconsistent. */
+	void ValidateInstanceArrays();
+
+	/** Rebuilds SortedInstances if the priorities changed. */
+	void UpdateSortedInstances();
+
+private:
+	// Structure of arrays, one element per instance in each.
+	UPROPERTY()
+	TArray<FTransform> InstanceTransforms;
+
+	UPROPERTY()
+	TArray<EGBufferProcessShape> InstanceShapes;
+
+	UPROPERTY()
+	TArray<EGBufferProcessType> InstanceTypes;
+
+	UPROPERTY()
+	TArray<EGBufferProcessBlendOp> InstanceBlendOps;
+
+	UPROPERTY()
+	TArray<int32> InstancePriorities;
+
+	UPROPERTY()
+	TArray<float> InstanceIntensities;
+
+	UPROPERTY()
+	TArray<int32> InstanceMaterialIndices;
+
+	/** Last material of each slot of Materials that had compiled region shaders. */
+	UPROPERTY(Transient)
+	TArray<UMaterialInterface*> LastReadyMaterials;
+
+	/** Instance indices sorted by ascending priority, stable in instance order. */
+	TArray<int32> SortedInstances;
+
+	bool bSortedInstancesDirty = true;
+};
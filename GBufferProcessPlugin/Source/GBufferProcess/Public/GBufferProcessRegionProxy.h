@@ -0,0 +1,67 @@
+#pragma once
+#include "CoreMinimal.h"
+#include "GBufferProcessActor.h"
+
+class FMaterialRenderProxy;
+
+/**
+ * Render thread copy of a region, captured on the game thread when the view family begins rendering.
+ */
+struct FGBufferProcessRegionProxy
+{
+	/** Stable across frames. Used to match GPU timings with regions. */
+	uint32 RegionId = 0;
+
+	FMatrix LocalToWorld = FMatrix::Identity;
+
+	/** Invalid for unbound regions. */
+	FBox WorldBounds = FBox(ForceInit);
+
+	FVector Extent = FVector::ZeroVector;
+
+	EGBufferProcessShape Shape = EGBufferProcessShape::Unbound;
+
+	EGBufferProcessType Type = EGBufferProcessType::Normal;
+
+	EGBufferProcessBlendOp BlendOp = EGBufferProcessBlendOp::Replace;
+
+	EGBufferProcessStage Stage = EGBufferProcessStage::PostBasePass;
+
+	int32 Priority = 0;
+
+	float Intensity = 1.0f;
+
+	const FMaterialRenderProxy* MaterialProxy = nullptr;
+
+	/** Optional, used by the budget scheduler when the frame is over budget. */
+	const FMaterialRenderProxy* LowQualityMaterialProxy = nullptr;
+
+	/** Index of the record among the baked regions uploaded to FGBufferProcessGPUCuller, INDEX_NONE if the region isn't baked. */
+	int32 BakedRegionIndex = INDEX_NONE;
+};
+
+/** Materials of the baked regions of one UGBufferProcessRegionDataAsset, by GBufferProcess::GetMaterialKernelKey. Null if not ready yet. */
+struct FGBufferProcessBakedRegionMaterials
+{
+	uint32 AssetId = 0;
+
+	TMap<uint64, const FMaterialRenderProxy*> MaterialProxies;
+
+	TMap<uint64, const FMaterialRenderProxy*> LowQualityMaterialProxies;
+};
+
+/**
+ * Regions captured on the game thread when the view family begins rendering.
+ * Baked regions are not copied, their records are on the render thread since they were registered, only their materials are.
+ */
+struct FGBufferProcessGatheredRegions
+{
+	/** Actor regions, then the instances of each component. Each run is sorted by ascending priority. */
+	TArray<FGBufferProcessRegionProxy> Proxies;
+
+	/** First proxy of each sorted run of Proxies. */
+	TArray<int32> RunStarts;
+
+	/** Materials of each registered baked region asset, in registration order. */
+	TArray<FGBufferProcessBakedRegionMaterials> BakedMaterials;
+};
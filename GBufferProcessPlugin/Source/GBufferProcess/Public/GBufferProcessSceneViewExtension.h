@@ -2,12 +2,21 @@
 #include "SceneViewExtension.h"
 #include "RHI.h"
 #include "RHIResources.h"
+#include "GBufferProcessRegionProxy.h"
+#include "GBufferProcessScheduler.h"
+#include "GBufferProcessPipelineCache.h"
+#include "GBufferProcessGPUCulling.h"
+#include "GBufferProcessClusters.h"
+#include "GBufferProcessRegionDataAsset.h"
+#include "RendererInterface.h"
 
 //#define MY_CHANGE_WITH_ENGINE
 
 class UGBufferProcessSubsystem;
+class UGBufferProcessRegionDataAsset;
 class UMaterialInterface;
 class FRDGTexture;
+struct FRenderTargetBindingSlots;
 
 class FGBufferProcessSceneViewExtension : public FSceneViewExtensionBase
 {
@@ -17,16 +26,165 @@ public:
 	//~ Begin FSceneViewExtensionBase Interface
 	virtual void SetupViewFamily(FSceneViewFamily& InViewFamily) override {};
 	virtual void SetupView(FSceneViewFamily& InViewFamily, FSceneView& InView) override {};
-	virtual void BeginRenderViewFamily(FSceneViewFamily& InViewFamily) override {};
+	virtual void BeginRenderViewFamily(FSceneViewFamily& InViewFamily) override;
 	virtual void PreRenderViewFamily_RenderThread(FRHICommandListImmediate& RHICmdList, FSceneViewFamily& InViewFamily) override {};
 	virtual void PreRenderView_RenderThread(FRHICommandListImmediate& RHICmdList, FSceneView& InView) override {};
 	virtual void PrePostProcessPass_RenderThread(FRDGBuilder& GraphBuilder, const FSceneView& View, const FPostProcessingInputs& Inputs) override {};
+	virtual void SubscribeToPostProcessingPass(EPostProcessingPass Pass, FAfterPassCallbackDelegateArray& InOutPassCallbacks, bool bIsPassEnabled) override;
 
 #ifdef MY_CHANGE_WITH_ENGINE
 	virtual void PostRenderBasePass(FRDGBuilder& GraphBuilder, FViewInfo& InView) override;
+	virtual void PostRenderBasePassInRenderPass(FRDGBuilder& GraphBuilder, FViewInfo& InView, const FRenderTargetBindingSlots& BasePassRenderTargets) override;
+	virtual void PreRenderLighting(FRDGBuilder& GraphBuilder, FViewInfo& InView) override;
+	virtual void PostRenderLighting(FRDGBuilder& GraphBuilder, FViewInfo& InView) override;
 #endif
 	//~ End FSceneViewExtensionBase Interface
 
+	/** Copies the records of a registered baked region asset to the render thread, where they stay until it is removed. Game thread only. */
+	void AddBakedRegions(const UGBufferProcessRegionDataAsset* InRegionData);
+
+	/** Drops the render thread copy of the records of a baked region asset. Game thread only. */
+	void RemoveBakedRegions(const UGBufferProcessRegionDataAsset* InRegionData);
+
+private:
+	/**
+	 * Scheduled regions of a view waiting for their stage, from the first hook of the view until PostRenderLighting,
+	 * or until the composite after tonemapping when r.GBufferProcess.Visualize is on.
+	 */
+	struct FViewStageRegions
+	{
+		/** Priority order is kept within each stage. */
+		TArray<FGBufferProcessScheduledRegion> Regions[(int32)EGBufferProcessStage::MAX];
+
+		/** Counters of r.GBufferProcess.Visualize shared by the stages, which the renderer adds to the same graph builder. */
+		FRDGTextureRef VisualizeTexture = nullptr;
+	};
+
+	/**
+	 * Takes the gathered regions and merges their sorted runs with the baked region runs into RenderThreadRegions, by ascending
+	 * priority. Earlier runs go first on equal priority, as they did before baking. Render thread only.
+	 */
+	void SetRegions(FGBufferProcessGatheredRegions&& InRegions);
+
+	/** Numbers the baked regions in run order for the GPU culler. RenderThreadRegions point into the runs and are dropped until the next SetRegions. Render thread only. */
+	void OnBakedRunsChanged();
+
+	/** Replaces the regions of RenderThreadDynamicRegions that changed in place with their new proxies. Render thread only. */
+	void UpdateRegionsInPlace(TArrayView<const FGBufferProcessRegionProxy> DirtyRegions);
+
+	/** Blends the counters of r.GBufferProcess.Visualize drawn for the view over the tonemapped scene color. */
+	FScreenPassTexture PostProcessPassAfterTonemap_RenderThread(FRDGBuilder& GraphBuilder, const FSceneView& View, const FPostProcessMaterialInputs& Inputs);
+
+#ifdef MY_CHANGE_WITH_ENGINE
+	/** Creates the pipelines of region materials that became ready, before any of them is drawn. */
+	void PrecachePendingPipelines(FRHICommandList& RHICmdList, const FViewInfo& InView, TArrayView<const FRDGTextureRef> BasePassTextures, FRDGTextureRef SceneDepthTexture, const FRenderTargetBindingSlots* BasePassRenderTargets);
+
+	/** Culls Regions within the budget of FGBufferProcessScheduler. The scheduled region indices are indices into Regions. */
+	void ScheduleRegions(const FViewInfo& InView, TArrayView<const FGBufferProcessRegionProxy* const> Regions, TArray<FGBufferProcessScheduledRegion>& OutScheduledRegions);
+
+	/**
+	 * Schedules the regions of a view once, at whichever of its hooks runs first, and splits them by stage.
+	 * bPostBasePassGPUCulled leaves out the post base pass regions, the GPU culler draws them.
+	 */
+	FViewStageRegions& FindOrScheduleStageRegions(const FViewInfo& InView, bool bPostBasePassGPUCulled = false);
+
+	/** Draws the scheduled regions of a stage under one event scope, scheduling the view if needed. Does nothing if there are none. */
+	void RenderStageRegions(FRDGBuilder& GraphBuilder, FViewInfo& InView, EGBufferProcessStage Stage);
+
+	/**
+	 * Draws the scheduled regions of one stage in priority order per target, the targets one after the other so that each
+	 * is drawn in as few passes as possible. Regions that read their target get their own passes.
+	 * InOutVisualizeTexture is created by the first stage that draws the counters of r.GBufferProcess.Visualize.
+	 */
+	void RenderScheduledRegions(FRDGBuilder& GraphBuilder, FViewInfo& InView, TArrayView<FRDGTextureRef> BasePassTextures, TArrayView<FGBufferProcessScheduledRegion> ScheduledRegions, FRDGTextureRef& InOutVisualizeTexture);
+
+	/**
+	 * Draws the run of scheduled regions from FirstScheduledIndex that write TargetIndex without reading it, in one pass.
+	 * Long runs are recorded in parallel. Returns the index of the first scheduled region after the run.
+	 * SceneDepthTexture is bound read only for volume proxies if not null.
+	 * If Clusters is not null, the slot of a scheduled region is its index and consecutive regions with the same material are drawn at once.
+	 */
+	int32 AddRegionDrawsPass(FRDGBuilder& GraphBuilder, FViewInfo& InView, FRDGTextureRef TargetTexture, FRDGTextureRef SceneDepthTexture, TRDGUniformBufferRef<FGBufferProcessClusterParameters> Clusters, int32 TargetIndex, TArrayView<FGBufferProcessScheduledRegion> ScheduledRegions, int32 FirstScheduledIndex, bool bParallelRecording, int32 DrawsPerChunk);
+
+	/**
+	 * Sums the weighted regions of each target into an accumulation texture and resolves it into the target.
+	 * WeightedRegions are sorted by type, then region id, so the result doesn't depend on the order regions were added in.
+	 * BackTextures are the copies of the targets shared with the other region passes of the view.
+	 * If Clusters is not null, the slot of a weighted region is FirstClusterSlot plus its index.
+	 */
+	void AddWeightedRegionsPasses(FRDGBuilder& GraphBuilder, FViewInfo& InView, TArrayView<FRDGTextureRef> BasePassTextures, FRDGTextureRef SceneDepthTexture, TRDGUniformBufferRef<FGBufferProcessClusterParameters> Clusters, int32 FirstClusterSlot, TArrayView<FGBufferProcessScheduledRegion> WeightedRegions, TStaticArray<FRDGTextureRef, MaxSimultaneousRenderTargets>& BackTextures);
+
+	/**
+	 * Replays the draws of RenderScheduledRegions into the counters of r.GBufferProcess.Visualize: draws, pixel shader instructions
+	 * and draws that didn't change the pixel. The counters are kept in RenderThreadStageRegions until post processing.
+	 * The stages of a view add to the same counters, InOutVisualizeTexture is created and cleared by the first one.
+	 */
+	void AddVisualizeRegionsPass(FRDGBuilder& GraphBuilder, FViewInfo& InView, FRDGTextureRef SceneDepthTexture, TRDGUniformBufferRef<FGBufferProcessClusterParameters> Clusters, TArrayView<FGBufferProcessScheduledRegion> OrderedRegions, TArrayView<FGBufferProcessScheduledRegion> WeightedRegions, FRDGTextureRef& InOutVisualizeTexture);
+
+	/**
+	 * Draws scheduled regions in one pass bound like the base pass, which RDG merges into the base pass render pass.
+	 * Not used while the base pass is recorded in parallel: its passes begin their own render pass and nothing merges into it.
+	 */
+	void RenderInBasePassRegions(FRDGBuilder& GraphBuilder, FViewInfo& InView, const FRenderTargetBindingSlots& BasePassRenderTargets, TArrayView<FGBufferProcessScheduledRegion> ScheduledRegions);
+
+	/** Culls the regions on the GPU and draws them in batches with indirect draws. Only used when every region is drawn after the base pass. */
+	void RenderGPUCulledRegions(FRDGBuilder& GraphBuilder, FViewInfo& InView, TArrayView<FRDGTextureRef> BasePassTextures);
+#endif
+
 private:
 	UGBufferProcessSubsystem* WorldSubsystem;
+
+	/** UGBufferProcessSubsystem::GetRegionsGeneration when RenderThreadRegions were last gathered, zero if they have to be gathered. Game thread only. */
+	uint32 GatheredRegionsGeneration = 0;
+
+	/** Feature level RenderThreadRegions were last gathered for. Game thread only. */
+	ERHIFeatureLevel::Type GatheredFeatureLevel = ERHIFeatureLevel::Num;
+
+	/**
+	 * Regions of the view family being rendered by ascending priority, pointing into RenderThreadDynamicRegions and RenderThreadBakedRuns.
+	 * Kept across view families while no region changed other than in place. Render thread only.
+	 */
+	TArray<const FGBufferProcessRegionProxy*> RenderThreadRegions;
+
+	/** Gathered actor and instance regions, in their sorted runs. Render thread only. */
+	TArray<FGBufferProcessRegionProxy> RenderThreadDynamicRegions;
+
+	/** Index of each region in RenderThreadDynamicRegions by region id, see UpdateRegionsInPlace. Render thread only. */
+	TMap<uint32, int32> RenderThreadRegionIndices;
+
+	/** Records and proxies of the registered baked region assets, in registration order. Render thread only. */
+	TArray<FGBufferProcessBakedRegionRun> RenderThreadBakedRuns;
+
+	/** Set when RenderThreadBakedRuns changed since the GPU culler last uploaded them. Render thread only. */
+	bool bRenderThreadBakedRunsDirty = true;
+
+	/** Bit per EGBufferProcessStage that RenderThreadRegions draw at. Render thread only. */
+	uint32 RenderThreadStageMask = 0;
+
+	/** GBufferProcess::GetRegionsHash of RenderThreadRegions. Render thread only. */
+	uint32 RenderThreadRegionsHash = 0;
+
+	/** Regions changed in place that the GPU culler has not uploaded yet. Render thread only. */
+	TSet<uint32> RenderThreadDirtyRegionIds;
+
+	/** Tile of a tiled render the view family draws, unset otherwise. Render thread only. */
+	TOptional<FGBufferProcessTile> RenderThreadTile;
+
+	/** Materials whose pipelines are created before the region passes of the next view. Render thread only. */
+	TArray<FGBufferProcessPrecacheRequest> RenderThreadPrecacheRequests;
+
+	/** Render thread only. */
+	FGBufferProcessScheduler Scheduler;
+
+	/** Frame in which the scheduler cost history was last updated. Render thread only. */
+	uint32 LastCostHistoryUpdateFrame = ~0u;
+
+	/** Render thread only. */
+	FGBufferProcessGPUCuller GPUCuller;
+
+	/**
+	 * Scheduled regions of the views waiting for their stage. Post base pass regions that could not be drawn inside the base pass
+	 * render pass are left here for PostRenderBasePass. Render thread only.
+	 */
+	TMap<const FSceneView*, FViewStageRegions> RenderThreadStageRegions;
 };
@@ -0,0 +1,128 @@
+#pragma once
+#include "CoreMinimal.h"
+#include "RHI.h"
+#include "RHIResources.h"
+#include "Stats/Stats.h"
+#include "GBufferProcessRegionProxy.h"
+#include "GBufferProcessProjection.h"
+
+class FSceneView;
+
+DECLARE_STATS_GROUP(TEXT("GBufferProcess"), STATGROUP_GBufferProcess, STATCAT_Advanced);
+
+enum class EGBufferProcessQuality : uint8
+{
+	Full,
+	Low,
+	MAX
+};
+
+/** A region that survived scheduling for one view, in draw order. */
+struct FGBufferProcessScheduledRegion
+{
+	/** Index into the region proxies passed to FGBufferProcessScheduler::Schedule. */
+	int32 RegionIndex = INDEX_NONE;
+
+	uint32 RegionId = 0;
+
+	/** Pixel rect the region is drawn into. */
+	FIntRect Rect;
+
+	float ScreenCoverage = 0.0f;
+
+	float EstimatedCostMs = 0.0f;
+
+	EGBufferProcessQuality Quality = EGBufferProcessQuality::Full;
+};
+
+/** Timestamp queries wrapping a pass of region draws, see FGBufferProcessScheduler::AllocateTimingQueries. */
+struct FGBufferProcessPassTiming
+{
+	FRHIRenderQuery* BeginQuery = nullptr;
+	FRHIRenderQuery* EndQuery = nullptr;
+
+	bool IsValid() const { return BeginQuery != nullptr; }
+};
+
+/**
+ * Picks the regions drawn in a view so that their estimated GPU cost stays within r.GBufferProcess.BudgetMs.
+ * The budget covers the whole frame: views are scheduled in render order and each one gets what the ones before it left.
+ *
+ * Regions covering less than r.GBufferProcess.MinScreenCoverage of the view are dropped. When over budget,
+ * the lowest priority regions fall back to their low quality material first and are dropped after that.
+ * Weighted regions are no exception: they are summed in region id order, but degraded and dropped by priority,
+ * so weighted regions that should go together need the same priority.
+ *
+ * Costs are learned per region from timestamp queries of previous frames, normalized by screen coverage.
+ * Timestamps are only taken while the budget is on, and per pass of region draws rather than per draw: tile based GPUs run
+ * the draws of a render pass together tile by tile, a timestamp between two of them means little. A pass is timed outside
+ * its render pass and its time is split across its regions by their estimated cost, so regions that are always drawn
+ * together converge to the same cost per coverage. A run recorded in parallel is one pass, timed around its parallel submit.
+ * Regions drawn inside the base pass render pass are only timed on GPUs that are not tile based.
+ * Tiles of a tiled render are culled by their coverage of the final image and ignore the budget, so every tile
+ * makes the same decisions and the stitched image has no seams.
+ * Render thread only.
+ */
+class FGBufferProcessScheduler
+{
+public:
+	~FGBufferProcessScheduler();
+
+	/** True if r.GBufferProcess.BudgetMs is set. The budget needs the per region decisions of Schedule. */
+	static bool IsBudgetEnabled();
+
+	/** r.GBufferProcess.MinScreenCoverage, also applied by FGBufferProcessGPUCuller. */
+	static float GetMinScreenCoverage();
+
+	/** Reads back finished GPU timings. Never waits on the GPU. Call once per frame before Schedule. */
+	void UpdateCostHistory();
+
+	/** Fills OutScheduled with the regions to draw in View, sorted by ascending priority. Tile is set when View renders a tile of a larger image. */
+	void Schedule(const FSceneView& View, TArrayView<const FGBufferProcessRegionProxy* const> Regions, TArray<FGBufferProcessScheduledRegion>& OutScheduled, const FGBufferProcessTile* Tile = nullptr);
+
+	/**
+	 * Sets up the timestamp queries of a pass of region draws that is about to be added. Both queries must be issued.
+	 * No queries while the budget is off, or if GPU timing isn't available.
+	 */
+	FGBufferProcessPassTiming AllocateTimingQueries(TArrayView<const FGBufferProcessScheduledRegion* const> Regions);
+
+private:
+	float EstimateCostMs(uint32 RegionId, EGBufferProcessQuality Quality, float ScreenCoverage) const;
+
+private:
+	struct FCostHistory
+	{
+		/** Smoothed GPU time of the region if it covered the whole view. */
+		float MsPerCoverage[(int32)EGBufferProcessQuality::MAX] = { 0.0f, 0.0f };
+		bool bHasSample[(int32)EGBufferProcessQuality::MAX] = { false, false };
+		uint32 LastUsedFrame = 0;
+	};
+
+	struct FTimedRegion
+	{
+		uint32 RegionId = 0;
+		EGBufferProcessQuality Quality = EGBufferProcessQuality::Full;
+		float ScreenCoverage = 0.0f;
+		float EstimatedCostMs = 0.0f;
+	};
+
+	struct FPendingTiming
+	{
+		TArray<FTimedRegion, TInlineAllocator<1>> Regions;
+		uint32 FrameNumber = 0;
+		FRHIPooledRenderQuery BeginQuery;
+		FRHIPooledRenderQuery EndQuery;
+	};
+
+	TMap<uint32, FCostHistory> CostHistory;
+
+	/** Frame RemainingBudgetMs was reset for. */
+	uint32 BudgetFrameNumber = ~0u;
+
+	/** Budget left to the views of the frame that are not scheduled yet. */
+	float RemainingBudgetMs = 0.0f;
+
+	TArray<TUniquePtr<FPendingTiming>> PendingTimings;
+
+	FRenderQueryPoolRHIRef TimingQueryPool;
+};
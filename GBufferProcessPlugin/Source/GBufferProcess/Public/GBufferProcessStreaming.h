@@ -0,0 +1,61 @@
+#pragma once
+#include "CoreMinimal.h"
+#include "UObject/ObjectMacros.h"
+#include "Components/PrimitiveComponent.h"
+#include "RHIDefinitions.h"
+#include "GBufferProcessStreaming.generated.h"
+
+class UMaterialInterface;
+class UTexture;
+class UGBufferProcessSubsystem;
+struct FStreamingRenderAssetPrimitiveInfo;
+
+namespace GBufferProcess
+{
+	/** Returns true if the textures of region materials are reported to the texture streamer. Game thread only. */
+	bool IsTextureStreamingEnabled();
+}
+
+/**
+ * Collects the textures of region materials with the bounds they are drawn in, for the texture streamer.
+ * Lives for one collection. Game thread only.
+ */
+class FGBufferProcessStreamingTextures
+{
+public:
+	FGBufferProcessStreamingTextures(ERHIFeatureLevel::Type InFeatureLevel, TArray<FStreamingRenderAssetPrimitiveInfo>& InOutStreamingRenderAssets);
+
+	/** Adds the textures of a material drawn inside WorldBounds, invalid for unbound regions. Null materials are ignored. */
+	void AddRegion(const UMaterialInterface* InMaterial, const FBox& WorldBounds);
+
+private:
+	ERHIFeatureLevel::Type FeatureLevel;
+
+	TArray<FStreamingRenderAssetPrimitiveInfo>& StreamingRenderAssets;
+
+	/** Textures of each material, gathered once per collection. */
+	TMap<const UMaterialInterface*, TArray<UTexture*>> MaterialTextures;
+};
+
+/**
+ * Invisible primitive reporting the textures of all regions of a world to the texture streamer, which then computes their
+ * wanted mips from the screen size and distance of each region as it does for meshes. Regions have no primitive of their own,
+ * FGBufferProcessSceneViewExtension draws them. Owned by UGBufferProcessSubsystem.
+ */
+UCLASS(Transient)
+class UGBufferProcessStreamingComponent : public UPrimitiveComponent
+{
+	GENERATED_UCLASS_BODY()
+public:
+	UPROPERTY(Transient)
+	UGBufferProcessSubsystem* Subsystem;
+
+	//~ Begin UPrimitiveComponent Interface
+	virtual FPrimitiveSceneProxy* CreateSceneProxy() override;
+	virtual void GetStreamingRenderAssetInfo(FStreamingTextureLevelContext& LevelContext, TArray<FStreamingRenderAssetPrimitiveInfo>& OutStreamingRenderAssets) const override;
+	//~ End UPrimitiveComponent Interface
+
+	//~ Begin USceneComponent Interface
+	virtual FBoxSphereBounds CalcBounds(const FTransform& LocalToWorld) const override;
+	//~ End USceneComponent Interface
+};
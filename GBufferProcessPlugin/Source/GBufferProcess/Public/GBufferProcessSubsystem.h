@@ -7,6 +7,11 @@
 #include "Engine/EngineBaseTypes.h"
 #include "GBufferProcessActor.h"
 #include "GBufferProcessSceneViewExtension.h"
+#include "GBufferProcessRegionProxy.h"
+#include "GBufferProcessPipelineCache.h"
+#include "GBufferProcessRegionInstancesComponent.h"
+#include "GBufferProcessRegionDataAsset.h"
+#include "GBufferProcessProjection.h"
 
 #if WITH_EDITOR
 #include "EditorUndoClient.h"
@@ -14,6 +19,9 @@
 
 #include "GBufferProcessSubsystem.generated.h"
 
+class UGBufferProcessStreamingComponent;
+class FGBufferProcessStreamingTextures;
+
 /**
  * Conditional inheritance to allow UGBufferProcessSubsystem to inherit/avoid Editor's Undo/Redo in Editor/Game modes.
  */ 
@@ -55,22 +63,140 @@ public:
 	void OnActorDeleted(AActor* InActor);
 
 #if WITH_EDITOR
-	/** A callback for when the level is loaded. */
+	/** A callback for when the level is loaded. Only levels that were added or removed since the last call are processed. */
 	UFUNCTION()
-	void OnLevelActorListChanged() { PostUndo(true); };
+	void OnLevelActorListChanged();
 #endif
 
+	/** Registers all regions of a streamed-in level in one batch. */
+	void OnLevelAddedToWorld(ULevel* InLevel, UWorld* InWorld);
+
+	/** Unregisters all regions of a streamed-out level in one batch. */
+	void OnLevelRemovedFromWorld(ULevel* InLevel, UWorld* InWorld);
+
+	/**
+	 * Returns true while the level is being streamed out and its regions will be unregistered by OnLevelRemovedFromWorld.
+	 * Regions ending play for any other reason have to unregister themselves.
+	 */
+	static bool IsLevelPendingBatchUnregistration(const ULevel* InLevel);
+
 	/** Sorts regions based on priority. */
 	void SortRegionsByPriority();
 
-	//
-	AGBufferProcessActor* GetEffectModifyActor();
+	/**
+	 * Captures render thread copies of all enabled actor and instance regions, in runs sorted by priority,
+	 * and the materials of the baked regions. Game thread only.
+	 */
+	void GatherRegions(const FVector& ViewLocation, FGBufferProcessGatheredRegions& OutRegions);
+
+	/**
+	 * Captures render thread copies of the regions changed in place since the last PopDirtyRegionIds, in no particular order.
+	 * Lets a view family update the regions it already has while GetRegionsGeneration is unchanged. Game thread only.
+	 */
+	void GatherDirtyRegionProxies(const FVector& ViewLocation, TArray<FGBufferProcessRegionProxy>& OutProxies);
+
+	/**
+	 * Changes whenever the gathered regions could differ other than in place: a region was registered or unregistered,
+	 * enabled, moved in the priority order, or got another kernel or material, or a material became ready. Game thread only.
+	 */
+	uint32 GetRegionsGeneration() const { return RegionsGeneration; }
+
+	/** Makes the next view family gather every region again. Game thread only. */
+	void MarkRegionsChanged() { ++RegionsGeneration; }
+
+	/** Materials of registered regions whose pipelines still have to be precached. Game thread only. */
+	FGBufferProcessPipelinePrecacher& GetPipelinePrecacher() { return PipelinePrecacher; }
+
+	/** Queues the materials of a newly registered or edited region for pipeline precaching. */
+	void QueuePipelinePrecache(const AGBufferProcessActor* InRegion);
+
+	/**
+	 * Applies a change of a region: priority changes re-sort the regions, material and kernel changes are precached,
+	 * in place changes are queued so that only the changed regions are gathered and uploaded. Game thread only.
+	 */
+	void MarkRegionDirty(AGBufferProcessActor* InRegion, EGBufferProcessRegionDirtyFlags InFlags);
+
+	/** Applies a change of an instance of a component, like MarkRegionDirty. Game thread only. */
+	void MarkInstanceDirty(UGBufferProcessRegionInstancesComponent* InComponent, int32 InInstanceIndex, EGBufferProcessRegionDirtyFlags InFlags);
+
+	/** Moves the ids of the regions changed in place since the last call into OutRegionIds, and forgets their changes. Game thread only. */
+	void PopDirtyRegionIds(TArray<uint32>& OutRegionIds);
+
+	/** Registers all instances of the component at once. Called by the component when it is registered. */
+	void RegisterInstancesComponent(UGBufferProcessRegionInstancesComponent* InComponent);
+
+	void UnregisterInstancesComponent(UGBufferProcessRegionInstancesComponent* InComponent);
+
+	/** Registers all baked regions of a level at once. Their records are copied to the render thread once, here. */
+	void RegisterBakedRegions(UGBufferProcessRegionDataAsset* InRegionData);
+
+	void UnregisterBakedRegions(UGBufferProcessRegionDataAsset* InRegionData);
+
+	/**
+	 * Marks the next frames as a tile of a tiled high resolution render, until ClearRenderTile.
+	 * Regions are then culled by their coverage of the whole image, so all tiles draw the same regions.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "GBuffer Modify|Tiled Render")
+	void SetRenderTile(FIntPoint ImageSize, FIntPoint TileCount, FIntPoint TileIndex, float OverlapRatio);
+
+	UFUNCTION(BlueprintCallable, Category = "GBuffer Modify|Tiled Render")
+	void ClearRenderTile();
+
+	/** The tile rendered by the next frame, unset outside of tiled renders. Game thread only. */
+	const TOptional<FGBufferProcessTile>& GetRenderTile() const { return RenderTile; }
+
+	/** Makes the texture streamer query the region textures again at the start of the next frame. Game thread only. */
+	void MarkStreamingTexturesDirty() { bStreamingTexturesDirty = true; }
+
+	/** Adds the textures of the materials of all enabled regions with the bounds of their regions. Game thread only. */
+	void GetStreamingTextures(FGBufferProcessStreamingTextures& OutTextures);
 
 public:
-	/** Stores pointers to all GBufferProcessActor Actors. */
+	/** Stores pointers to all GBufferProcessActor Actors. Entries of actors destroyed without unregistering are nulled by the garbage collector. */
+	UPROPERTY(Transient)
 	TArray<AGBufferProcessActor*> Regions;
 
+	/**
+	 * Components holding region instances. Their instances are merged with Regions by priority when gathered.
+	 * Referenced so that a component destroyed without unregistering is nulled by the garbage collector rather than left dangling.
+	 */
+	UPROPERTY(Transient)
+	TArray<UGBufferProcessRegionInstancesComponent*> InstanceComponents;
+
+	/** Baked static regions of cooked levels. Merged with Regions by priority when gathered. Kept alive until unregistered. */
+	UPROPERTY(Transient)
+	TArray<UGBufferProcessRegionDataAsset*> BakedRegionData;
+
+private:
+	/**
+	 * Inserts a single region after all regions with a lower or equal priority. Keeps Regions sorted without a full sort.
+	 * bNewRegion is false when a registered region is only moved, its pipelines and textures are already known.
+	 */
+	void InsertRegionSorted(AGBufferProcessActor* InRegion, bool bNewRegion = true);
+
+	/** Adds the valid regions of a level that are not registered yet. Regions are merged into Regions with one sort of the batch. */
+	void AddLevelRegions(ULevel* InLevel);
+
+	/** Removes all regions owned by a level, or by levels that are no longer part of the world when InLevel is null. */
+	void RemoveLevelRegions(ULevel* InLevel);
+
+	/** Returns true while the level is being streamed in and its actors will be registered by OnLevelAddedToWorld. */
+	static bool IsLevelPendingBatchRegistration(const ULevel* InLevel);
+
+	/** Queues an in place change of a region by its FGBufferProcessRegionProxy::RegionId. */
+	void MarkRegionDirty(uint32 InRegionId, EGBufferProcessRegionDirtyFlags InFlags);
+
+	/** Creates StreamingComponent once there are regions, and tells the texture streamer about the regions that changed. */
+	void OnWorldTickStart(UWorld* InWorld, ELevelTick InTickType, float InDeltaSeconds);
+
+	void DestroyStreamingComponent();
+
 private:
+	FGBufferProcessPipelinePrecacher PipelinePrecacher;
+
+	/** Levels whose regions were registered as a batch. */
+	TSet<TWeakObjectPtr<ULevel>> RegisteredLevels;
+
 	/** Region class. Used for getting all region actors in level. */
 	TSubclassOf<AGBufferProcessActor> RegionClass;
 	
@@ -78,6 +204,27 @@ private:
 
 	FCriticalSection RegionAccessCriticalSection;
 
+	TOptional<FGBufferProcessTile> RenderTile;
+
+	/** Regions changed in place since the last gather, see MarkRegionDirty. */
+	TSet<uint32> DirtyRegionIds;
+
+	/** Actors of DirtyRegionIds, gathered again by GatherDirtyRegionProxies. */
+	TSet<TWeakObjectPtr<AGBufferProcessActor>> DirtyRegions;
+
+	/** Instances of DirtyRegionIds by component, gathered again by GatherDirtyRegionProxies. */
+	TMap<TWeakObjectPtr<UGBufferProcessRegionInstancesComponent>, TSet<int32>> DirtyInstances;
+
+	/** See GetRegionsGeneration. Starts above zero so that it never matches a view family that gathered nothing yet. */
+	uint32 RegionsGeneration = 1;
+
+	/** Reports the region textures to the texture streamer while r.GBufferProcess.TextureStreaming is on. */
+	UPROPERTY(Transient)
+	UGBufferProcessStreamingComponent* StreamingComponent = nullptr;
+
+	/** Regions were added, removed, moved or changed material since the texture streamer last queried them. */
+	bool bStreamingTexturesDirty = false;
+
 public:
 	friend class FGBufferProcessSceneViewExtension;
 };
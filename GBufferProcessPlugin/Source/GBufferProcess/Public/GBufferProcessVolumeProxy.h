@@ -0,0 +1,74 @@
+#pragma once
+#include "CoreMinimal.h"
+#include "RHI.h"
+#include "RenderResource.h"
+#include "GlobalShader.h"
+#include "ShaderParameterStruct.h"
+#include "SceneView.h"
+#include "GBufferProcessRegionProxy.h"
+
+// Rasterizes the proxy geometry of a region volume, see FGBufferProcessVolumeGeometry.
+class FGBufferProcessVolumeVS : public FGlobalShader
+{
+	DECLARE_GLOBAL_SHADER(FGBufferProcessVolumeVS);
+	SHADER_USE_PARAMETER_STRUCT(FGBufferProcessVolumeVS, FGlobalShader);
+
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return true;
+	}
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER_STRUCT_REF(FViewUniformShaderParameters, View)
+		SHADER_PARAMETER(FMatrix, VolumeToTranslatedWorld)
+	END_SHADER_PARAMETER_STRUCT()
+};
+
+/**
+ * Unit proxy geometry of the bounded region shapes: a cube and a low poly sphere enclosing the unit sphere.
+ * Triangles wind like the engine's unit cube, so back faces are drawn with the rasterizer states of deferred decals.
+ */
+class FGBufferProcessVolumeGeometry : public FRenderResource
+{
+public:
+	virtual void InitRHI() override;
+	virtual void ReleaseRHI() override;
+
+	/** Draws the proxy of a bounded shape with the vertex buffer bound to stream 0. */
+	void DrawShape(FRHICommandList& RHICmdList, EGBufferProcessShape Shape) const;
+
+private:
+	struct FShapeRange
+	{
+		uint32 BaseVertexIndex = 0;
+		uint32 NumVertices = 0;
+		uint32 FirstIndex = 0;
+		uint32 NumPrimitives = 0;
+	};
+
+	FVertexBufferRHIRef VertexBufferRHI;
+	FIndexBufferRHIRef IndexBufferRHI;
+
+	FShapeRange Box;
+	FShapeRange Sphere;
+};
+
+namespace GBufferProcess
+{
+	/** Returns true if bounded regions are rasterized as proxy geometry, tested against the scene depth. */
+	bool IsVolumeProxyEnabled();
+
+	/** Returns true if the region is drawn with its proxy geometry, false if it is drawn as a rect because the camera is in or near it. */
+	bool ShouldDrawVolumeProxy(const FSceneView& View, const FGBufferProcessRegionProxy& Region);
+
+	/** Transform of the unit proxy geometry of the region into the translated world space of the view. */
+	FMatrix GetVolumeToTranslatedWorld(const FSceneView& View, const FGBufferProcessRegionProxy& Region);
+
+	/** Culls the front faces of the proxy geometry, whatever the handedness of the view and the region. */
+	FRHIRasterizerState* GetVolumeRasterizerState(const FSceneView& View, const FGBufferProcessRegionProxy& Region);
+
+	/** Pipeline of a volume draw without render targets. Shared with pipeline precaching, so both create the same pipeline. */
+	void InitVolumePipeline(FGraphicsPipelineStateInitializer& GraphicsPSOInit, FRHIVertexShader* VertexShader, FRHIPixelShader* PixelShader, FRHIBlendState* BlendState, FRHIRasterizerState* RasterizerState);
+
+	const FGBufferProcessVolumeGeometry& GetVolumeGeometry();
+}